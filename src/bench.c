@@ -0,0 +1,563 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * bench.c
+ * =======
+ *
+ * This file only serves benchmarking purposes.
+ * It defines functions measuring the performance of some operations on
+ * freshly formatted disk images.
+ *
+ */
+
+#include "ssfs_internal.h"
+#include "fs.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+
+/**
+ * @brief Returns a monotonic timestamp in seconds.
+ */
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Throughput of one large read() and write() for several degrees of parallelism
+void bench_parallel_io() {
+    print_warning("Starting bench_parallel_io...", NULL);
+
+    char *disk_name = "bench_parallel.img";
+    int file_size = 16 * 1024 * 1024;
+    int threads[] = {1, 2, 4, 8};
+    int num_threads = sizeof(threads) / sizeof(threads[0]);
+
+    uint8_t *data = malloc(file_size);
+    if (data == NULL) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+    for (int i = 0; i < file_size; i++)
+        data[i] = (uint8_t)(i % 251);
+
+    if (ssfs_format_new(disk_name, 2 * file_size / VDISK_SECTOR_SIZE, 32) != 0) {
+        print_error("Failed to create image", "%s", disk_name);
+        free(data);
+        return;
+    }
+    mount(disk_name);
+
+    int inode = create();
+    write(inode, data, file_size, 0);
+
+    for (int t = 0; t < num_threads; t++) {
+        ssfs_set_parallelism(threads[t], 0);
+
+        double start = now_seconds();
+        int written = write(inode, data, file_size, 0);
+        double write_time = now_seconds() - start;
+
+        start = now_seconds();
+        int bytes = read(inode, data, file_size, 0);
+        double read_time = now_seconds() - start;
+
+        if (written != file_size || bytes != file_size) {
+            print_error("Transfer failed", "threads: %d, written: %d, read: %d", threads[t], written, bytes);
+            continue;
+        }
+        print_info("Parallel I/O", "threads: %d, write: %.1f MiB/s, read: %.1f MiB/s",
+            threads[t],
+            file_size / write_time / (1024 * 1024),
+            file_size / read_time / (1024 * 1024));
+    }
+
+    ssfs_set_parallelism(1, 0);
+    unmount();
+    free(data);
+    remove(disk_name);
+}
+
+// format() against zeroing every sector of the image, as it used to
+void bench_format() {
+    print_warning("Starting bench_format...", NULL);
+
+    char *disk_name = "bench_format.img";
+    int sizes_mib[] = {16, 64, 256};
+    int num_sizes = sizeof(sizes_mib) / sizeof(sizes_mib[0]);
+    uint8_t zeros[VDISK_SECTOR_SIZE];
+    memset(zeros, 0, VDISK_SECTOR_SIZE);
+
+    for (int i = 0; i < num_sizes; i++) {
+        uint32_t blocks = sizes_mib[i] * (1024 * 1024 / VDISK_SECTOR_SIZE);
+
+        // Previous path: one write per sector
+        DISK disk;
+        if (vdisk_create(disk_name, blocks) != 0 || vdisk_on(disk_name, &disk) != 0) {
+            print_error("Failed to create image", "%s", disk_name);
+            return;
+        }
+        double start = now_seconds();
+        for (uint32_t sector = 0; sector < blocks; sector++)
+            vdisk_write(&disk, sector, zeros);
+        vdisk_sync(&disk);
+        double write_time = now_seconds() - start;
+        vdisk_off(&disk);
+
+        start = now_seconds();
+        int ret = ssfs_format_new(disk_name, blocks, 1024);
+        double format_time = now_seconds() - start;
+        if (ret != 0) {
+            print_error("Format failed", "size: %d MiB, code: %d", sizes_mib[i], ret);
+            continue;
+        }
+
+        print_info("Format", "size: %d MiB, writing every sector: %.3f s, format: %.3f s",
+            sizes_mib[i], write_time, format_time);
+    }
+
+    remove(disk_name);
+}
+
+/**
+ * @brief Counts the blocks marked as used in the bitmap of the mounted volume.
+ */
+static uint32_t bench_used_blocks() {
+    uint32_t used = 0;
+    for (uint32_t b = 0; b < disk_handle->size_in_sectors; b++)
+        used += allocated_blocks_handle[b];
+    return used;
+}
+
+// Sequential write and read of a large file with block pointer and extent inodes
+void bench_inode_versions() {
+    print_warning("Starting bench_inode_versions...", NULL);
+
+    char *disk_name = "bench_inodes.img";
+    int file_size = 48 * 1024 * 1024;
+    uint32_t file_blocks = file_size / VDISK_SECTOR_SIZE;
+
+    uint8_t *data = malloc(file_size);
+    if (data == NULL) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+    for (int i = 0; i < file_size; i++)
+        data[i] = (uint8_t)(i % 251);
+
+    for (uint32_t version = INODE_V1; version <= INODE_V2; version++) {
+        ssfs_format_options_t options = {.inode_version = version};
+        if (vdisk_create(disk_name, 2 * file_blocks) != 0 ||
+            ssfs_format_opts(disk_name, 32, &options) != 0 ||
+            mount(disk_name) != 0) {
+            print_error("Failed to create image", "%s", disk_name);
+            break;
+        }
+
+        int inode = create();
+        uint32_t used_before = bench_used_blocks();
+
+        double start = now_seconds();
+        int written = write(inode, data, file_size, 0);
+        ssfs_sync();
+        double write_time = now_seconds() - start;
+        uint32_t map_blocks = bench_used_blocks() - used_before - file_blocks;
+
+        start = now_seconds();
+        int bytes = read(inode, data, file_size, 0);
+        double read_time = now_seconds() - start;
+
+        if (written != file_size || bytes != file_size)
+            print_error("Transfer failed", "version: %u, written: %d, read: %d", version, written, bytes);
+        else
+            print_info("Inode version", "%u, write: %.1f MiB/s, read: %.1f MiB/s, block map: %u blocks",
+                version,
+                file_size / write_time / (1024 * 1024),
+                file_size / read_time / (1024 * 1024),
+                map_blocks);
+        unmount();
+    }
+
+    free(data);
+    remove(disk_name);
+}
+
+// Sequential and random transfers on volumes of different block sizes
+void bench_block_sizes() {
+    print_warning("Starting bench_block_sizes...", NULL);
+
+    char *disk_name = "bench_blocks.img";
+    int file_size = 32 * 1024 * 1024;
+    int io_size = 4096;
+    int random_ops = 2000;
+    uint32_t block_sizes[] = {1024, 4096, 16384, 65536};
+    int num_sizes = sizeof(block_sizes) / sizeof(block_sizes[0]);
+
+    uint8_t *data = malloc(file_size);
+    if (data == NULL) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+    for (int i = 0; i < file_size; i++)
+        data[i] = (uint8_t)(i % 251);
+
+    for (int s = 0; s < num_sizes; s++) {
+        ssfs_format_options_t options = {.block_size = block_sizes[s]};
+        if (vdisk_create(disk_name, 2 * file_size / VDISK_SECTOR_SIZE) != 0 ||
+            ssfs_format_opts(disk_name, 32, &options) != 0 ||
+            mount(disk_name) != 0) {
+            print_error("Failed to create image", "%s", disk_name);
+            break;
+        }
+
+        int inode = create();
+        double start = now_seconds();
+        int written = write(inode, data, file_size, 0);
+        ssfs_sync();
+        double write_time = now_seconds() - start;
+
+        start = now_seconds();
+        int bytes = read(inode, data, file_size, 0);
+        double read_time = now_seconds() - start;
+
+        // Same offsets for every block size
+        srand(42);
+        int random_failed = 0;
+        start = now_seconds();
+        for (int op = 0; op < random_ops; op++) {
+            int offset = (rand() % (file_size / io_size)) * io_size;
+            if (read(inode, data + offset, io_size, offset) != io_size)
+                random_failed++;
+        }
+        double random_read_time = now_seconds() - start;
+
+        start = now_seconds();
+        for (int op = 0; op < random_ops; op++) {
+            int offset = (rand() % (file_size / io_size)) * io_size;
+            if (write(inode, data + offset, io_size, offset) != io_size)
+                random_failed++;
+        }
+        ssfs_sync();
+        double random_write_time = now_seconds() - start;
+
+        if (written != file_size || bytes != file_size || random_failed != 0)
+            print_error("Transfer failed", "block size: %u, written: %d, read: %d, random failures: %d",
+                block_sizes[s], written, bytes, random_failed);
+        else
+            print_info("Block size", "%5u, seq write: %.1f MiB/s, seq read: %.1f MiB/s, "
+                "random %d B read: %.0f op/s, write: %.0f op/s",
+                block_sizes[s],
+                file_size / write_time / (1024 * 1024),
+                file_size / read_time / (1024 * 1024),
+                io_size,
+                random_ops / random_read_time,
+                random_ops / random_write_time);
+        unmount();
+    }
+
+    free(data);
+    remove(disk_name);
+}
+
+// Many tiny files, with and without inline data
+void bench_inline_data() {
+    print_warning("Starting bench_inline_data...", NULL);
+
+    char *disk_name = "bench_inline.img";
+    int files_num = 4096;
+    int file_size = 20;
+    uint8_t data[20];
+    uint8_t verify[20];
+    for (int i = 0; i < file_size; i++)
+        data[i] = (uint8_t)(i + 1);
+
+    for (int with_inline = 0; with_inline <= 1; with_inline++) {
+        ssfs_format_options_t options = {.features = with_inline ? SSFS_FEATURE_INLINE_DATA : 0};
+        if (vdisk_create(disk_name, 16 * 1024) != 0 ||
+            ssfs_format_opts(disk_name, files_num, &options) != 0 ||
+            mount(disk_name) != 0) {
+            print_error("Failed to create image", "%s", disk_name);
+            break;
+        }
+
+        uint32_t used_before = bench_used_blocks();
+        int failed = 0;
+        double start = now_seconds();
+        for (int f = 0; f < files_num; f++) {
+            int inode = create();
+            if (inode < 0 || write(inode, data, file_size, 0) != file_size)
+                failed++;
+        }
+        ssfs_sync();
+        double write_time = now_seconds() - start;
+        uint32_t data_blocks = bench_used_blocks() - used_before;
+
+        start = now_seconds();
+        for (int f = 0; f < files_num; f++)
+            if (read(f, verify, file_size, 0) != file_size || memcmp(data, verify, file_size) != 0)
+                failed++;
+        double read_time = now_seconds() - start;
+
+        if (failed != 0)
+            print_error("Transfer failed", "inline: %d, failures: %d", with_inline, failed);
+        else
+            print_info("Tiny files", "inline: %s, %d files of %d B, data blocks: %u, "
+                "create+write: %.1f us/file, read: %.1f us/file",
+                with_inline ? "yes" : "no", files_num, file_size, data_blocks,
+                write_time / files_num * 1e6, read_time / files_num * 1e6);
+        unmount();
+    }
+
+    remove(disk_name);
+}
+
+// Small-file corpus of 1 to 3 KiB, with and without tail packing
+void bench_tail_packing() {
+    print_warning("Starting bench_tail_packing...", NULL);
+
+    char *disk_name = "bench_tails.img";
+    int files_num = 2048;
+    int max_size = 3 * 1024;
+    uint32_t block_sizes[] = {1024, 4096};
+    int num_sizes = sizeof(block_sizes) / sizeof(block_sizes[0]);
+
+    int *sizes = malloc(files_num * sizeof(int));
+    uint8_t *data = malloc(max_size);
+    uint8_t *verify = malloc(max_size);
+    if (!sizes || !data || !verify) {
+        print_error("Memory allocation failed", NULL);
+        free(sizes);
+        free(data);
+        free(verify);
+        return;
+    }
+    srand(42);
+    uint64_t corpus_bytes = 0;
+    for (int f = 0; f < files_num; f++) {
+        sizes[f] = 1024 + rand() % (max_size - 1024 + 1);
+        corpus_bytes += sizes[f];
+    }
+    for (int i = 0; i < max_size; i++)
+        data[i] = (uint8_t)(i % 251);
+
+    for (int s = 0; s < num_sizes; s++) {
+        for (int packed = 0; packed <= 1; packed++) {
+            ssfs_format_options_t options = {
+                .inode_version = INODE_V2,
+                .block_size = block_sizes[s],
+                .features = packed ? SSFS_FEATURE_TAIL_PACKING : 0
+            };
+            if (vdisk_create(disk_name, 32 * 1024) != 0 ||
+                ssfs_format_opts(disk_name, files_num, &options) != 0 ||
+                mount(disk_name) != 0) {
+                print_error("Failed to create image", "%s", disk_name);
+                goto cleanup;
+            }
+
+            uint32_t used_before = bench_used_blocks();
+            int failed = 0;
+            for (int f = 0; f < files_num; f++) {
+                int inode = create();
+                if (inode < 0 || write(inode, data, sizes[f], 0) != sizes[f])
+                    failed++;
+            }
+            ssfs_sync();
+            uint32_t data_blocks = bench_used_blocks() - used_before;
+
+            double start = now_seconds();
+            for (int f = 0; f < files_num; f++)
+                if (read(f, verify, sizes[f], 0) != sizes[f] || memcmp(data, verify, sizes[f]) != 0)
+                    failed++;
+            double read_time = now_seconds() - start;
+
+            if (failed != 0)
+                print_error("Transfer failed", "block size: %u, packed: %d, failures: %d",
+                    block_sizes[s], packed, failed);
+            else
+                print_info("Small files", "block size: %5u, tails packed: %s, data blocks: %u, "
+                    "space efficiency: %.1f%%, read: %.1f us/file",
+                    block_sizes[s], packed ? "yes" : "no ", data_blocks,
+                    100.0 * corpus_bytes / ((double)data_blocks * block_sizes[s]),
+                    read_time / files_num * 1e6);
+            unmount();
+        }
+    }
+
+cleanup:
+    free(sizes);
+    free(data);
+    free(verify);
+    remove(disk_name);
+}
+
+// Link and lookup throughput of a directory, from 1 K to 1 M names
+void bench_dir_lookup() {
+    print_warning("Starting bench_dir_lookup...", NULL);
+
+    char *disk_name = "bench_dir.img";
+    int sizes[] = {1000, 10000, 100000, 1000000};
+    int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    int lookups_num = 100000;
+    char name[32];
+
+    // Version 2 inodes, so that the largest directory is one extent tree
+    ssfs_format_options_t options = {.inode_version = INODE_V2, .block_size = 4096};
+
+    for (int s = 0; s < num_sizes; s++) {
+        if (vdisk_create(disk_name, 256 * 1024) != 0 ||
+            ssfs_format_opts(disk_name, 64, &options) != 0 ||
+            mount(disk_name) != 0) {
+            print_error("Failed to create image", "%s", disk_name);
+            break;
+        }
+
+        int dir_inode = ssfs_mkdir();
+        int file_inode = create();
+
+        int failed = 0;
+        double start = now_seconds();
+        for (int i = 0; i < sizes[s]; i++) {
+            snprintf(name, sizeof(name), "entry-%07d", i);
+            if (ssfs_link(dir_inode, name, file_inode) != 0)
+                failed++;
+        }
+        double link_time = now_seconds() - start;
+
+        srand(42);
+        start = now_seconds();
+        for (int l = 0; l < lookups_num; l++) {
+            snprintf(name, sizeof(name), "entry-%07d", rand() % sizes[s]);
+            if (ssfs_lookup(dir_inode, name) != file_inode)
+                failed++;
+        }
+        double lookup_time = now_seconds() - start;
+
+        if (failed != 0)
+            print_error("Directory operations failed", "names: %d, failures: %d", sizes[s], failed);
+        else
+            print_info("Directory", "names: %7d, size: %6d KiB, link: %8.0f ops/s, lookup: %8.0f ops/s",
+                sizes[s], stat(dir_inode) / 1024,
+                sizes[s] / link_time, lookups_num / lookup_time);
+        unmount();
+    }
+
+    remove(disk_name);
+}
+
+// Creating, stating and deleting files one by one or in batches
+void bench_batch_ops() {
+    print_warning("Starting bench_batch_ops...", NULL);
+
+    char *disk_name = "bench_batch.img";
+    int files_num = 10000;
+
+    int *inode_nums = malloc(files_num * sizeof(int));
+    int *sizes = malloc(files_num * sizeof(int));
+    if (inode_nums == NULL || sizes == NULL) {
+        print_error("Memory allocation failed", NULL);
+        free(inode_nums);
+        free(sizes);
+        return;
+    }
+
+    for (int batched = 0; batched <= 1; batched++) {
+        if (ssfs_format_new(disk_name, 16 * 1024, files_num) != 0 || mount(disk_name) != 0) {
+            print_error("Failed to create image", "%s", disk_name);
+            break;
+        }
+
+        double start = now_seconds();
+        if (batched)
+            ssfs_create_many(inode_nums, files_num);
+        else
+            for (int f = 0; f < files_num; f++)
+                inode_nums[f] = create();
+        double create_time = now_seconds() - start;
+
+        start = now_seconds();
+        if (batched)
+            ssfs_stat_range(0, files_num, sizes);
+        else
+            for (int f = 0; f < files_num; f++)
+                sizes[f] = stat(f);
+        double stat_time = now_seconds() - start;
+
+        start = now_seconds();
+        if (batched)
+            ssfs_delete_many(inode_nums, files_num);
+        else
+            for (int f = 0; f < files_num; f++)
+                delete(inode_nums[f]);
+        double delete_time = now_seconds() - start;
+
+        print_info(batched ? "Batched" : "One by one", "%d files, create: %7.1f ms, stat: %6.1f ms, delete: %7.1f ms",
+            files_num, create_time * 1e3, stat_time * 1e3, delete_time * 1e3);
+        unmount();
+    }
+
+    free(inode_nums);
+    free(sizes);
+    remove(disk_name);
+}
+
+// Enumerating the files of a sparse inode table, with stat() or the iterator
+void bench_inode_scan() {
+    print_warning("Starting bench_inode_scan...", NULL);
+
+    char *disk_name = "bench_scan.img";
+    int inodes = 100000;
+    int files_num = 10000;
+
+    if (ssfs_format_new(disk_name, 16 * 1024, inodes) != 0 || mount(disk_name) != 0) {
+        print_error("Failed to create image", "%s", disk_name);
+        return;
+    }
+
+    // One inode out of ten is used
+    int *inode_nums = malloc(inodes * sizeof(int));
+    if (inode_nums == NULL) {
+        print_error("Memory allocation failed", NULL);
+        unmount();
+        return;
+    }
+    ssfs_create_many(inode_nums, inodes);
+    int deleted = 0;
+    for (int i = 0; i < inodes; i++)
+        if (i % (inodes / files_num) != 0)
+            inode_nums[deleted++] = i;
+    ssfs_delete_many(inode_nums, deleted);
+    free(inode_nums);
+
+    // stat() prints an error for every unused inode
+    FILE *saved = stderr;
+    stderr = fopen("/dev/null", "w");
+    double start = now_seconds();
+    int found_stat = 0;
+    for (int i = 0; i < inodes; i++)
+        if (stat(i) >= 0)
+            found_stat++;
+    double stat_time = now_seconds() - start;
+    fclose(stderr);
+    stderr = saved;
+
+    start = now_seconds();
+    int found_iter = 0;
+    ssfs_inode_iter_t iter;
+    ssfs_inode_info_t info;
+    ssfs_inode_iter_begin(&iter, 0);
+    while (ssfs_inode_iter_next(&iter, &info) == 1)
+        found_iter++;
+    ssfs_inode_iter_end(&iter);
+    double iter_time = now_seconds() - start;
+
+    print_info("Scan", "%d inodes, %d files, stat(): %.1f ms, iterator: %.1f ms",
+        inodes, found_iter, stat_time * 1e3, iter_time * 1e3);
+    if (found_stat != found_iter)
+        print_error("Different results", "stat(): %d, iterator: %d", found_stat, found_iter);
+
+    unmount();
+    remove(disk_name);
+}
@@ -13,4 +13,8 @@ const int ssfs_EALLOC       = -11;
 const int ssfs_EINODE       = -12;
 const int ssfs_E3RDPARTY    = -13;
 const int ssfs_EREAD        = -14;
-const int ssfs_EINVAL       = -15;
\ No newline at end of file
+const int ssfs_EINVAL       = -15;
+const int ssfs_EJOURNAL     = -16;
+const int ssfs_ENOENT      = -17;
+const int ssfs_EEXIST      = -18;
+const int ssfs_ENOTDIR     = -19;
\ No newline at end of file
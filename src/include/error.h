@@ -17,5 +17,9 @@ extern const int ssfs_EINODE;
 extern const int ssfs_E3RDPARTY;
 extern const int ssfs_EREAD;
 extern const int ssfs_EINVAL;
+extern const int ssfs_EJOURNAL;
+extern const int ssfs_ENOENT;
+extern const int ssfs_EEXIST;
+extern const int ssfs_ENOTDIR;
 
 #endif
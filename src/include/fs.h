@@ -3,6 +3,190 @@
 
 #include <stdint.h>
 
+// Optional on-disk features, see ssfs_format_options_t
+#define SSFS_FEATURE_INLINE_DATA 0x1  // Tiny files are stored inside their inode
+#define SSFS_FEATURE_TAIL_PACKING 0x2 // Last partial blocks share fragment blocks (version 2 inodes)
+
+// Volume parameters chosen by ssfs_format_opts(), 0 for the default
+typedef struct {
+    uint32_t inode_version;  // 1: block pointers (default), 2: extents
+    uint32_t block_size;     // Bytes per block, a power of two from 1024 (default) to 65536
+    uint32_t features;       // SSFS_FEATURE_* flags, none by default
+} ssfs_format_options_t;
+
+// Usage of the mounted volume, see ssfs_statfs()
+typedef struct {
+    uint32_t block_size;
+    uint32_t total_blocks;
+    uint32_t free_blocks;
+    uint32_t total_inodes;
+    uint32_t free_inodes;
+    uint32_t largest_free_extent;  // Longest run of free blocks
+} ssfs_statfs_t;
+
+// Calls timed by ssfs_get_stats() and recorded by ssfs_trace_start()
+typedef enum {
+    SSFS_OP_FORMAT,
+    SSFS_OP_MOUNT,
+    SSFS_OP_UNMOUNT,
+    SSFS_OP_CREATE,
+    SSFS_OP_DELETE,
+    SSFS_OP_STAT,
+    SSFS_OP_READ,
+    SSFS_OP_WRITE,
+    SSFS_OP_FSYNC,
+    SSFS_OP_FDATASYNC,
+    SSFS_OP_SYNC,
+    SSFS_OP_LOOKUP,
+    SSFS_OP_LINK,
+    SSFS_OP_UNLINK,
+    SSFS_OP_MKDIR,
+    SSFS_OP_CREATE_MANY,
+    SSFS_OP_DELETE_MANY,
+    SSFS_OP_STAT_MANY,
+    SSFS_OP_STAT_RANGE,
+    SSFS_OP_STATFS,
+    SSFS_OP_GROW,
+    SSFS_OP_READDIR,
+    SSFS_OP_ITER_BEGIN,
+    SSFS_OP_ITER_NEXT,
+    SSFS_OP_FORMAT_NEW,
+    SSFS_OP_NUM
+} ssfs_op_t;
+
+// Latency histogram buckets: 4 per power of two of nanoseconds, up to 2^40 ns
+#define SSFS_HISTOGRAM_BUCKETS 156
+
+// Calls of one operation, see ssfs_stats_percentile()
+typedef struct {
+    uint64_t calls;
+    uint64_t errors;    // Calls that returned a negative error code
+    uint64_t total_ns;
+    uint64_t histogram[SSFS_HISTOGRAM_BUCKETS];
+} ssfs_op_stats_t;
+
+// What the file system did since the last ssfs_reset_stats(), in every thread.
+// Write amplification is device_bytes_written / user_bytes_written, read
+// amplification device_bytes_read / user_bytes_read.
+typedef struct {
+    uint64_t device_reads;          // Disk transfers, whatever their length
+    uint64_t device_writes;
+    uint64_t device_bytes_read;
+    uint64_t device_bytes_written;
+    uint64_t device_syncs;
+    uint64_t device_discards;
+    uint64_t device_simulated_ns;   // Time of the disk I/O on the device of vdisk_set_model()
+    uint64_t device_batched;        // Requests of batches, served in device_batch_transfers
+    uint64_t device_batch_transfers;
+    uint64_t device_batch_wait_ns;  // Time the requests of batches waited for their transfer
+    uint64_t user_bytes_read;       // Returned by read()
+    uint64_t user_bytes_written;    // Accepted by write()
+    uint64_t allocator_calls;       // Requests for a free block
+    uint64_t allocator_scanned;     // Bitmap entries looked at to serve them
+    uint64_t blocks_allocated;
+    uint64_t blocks_freed;
+    ssfs_op_stats_t ops[SSFS_OP_NUM];
+} ssfs_stats_t;
+
+// A file found by ssfs_inode_iter_next()
+typedef struct {
+    int inode_num;
+    uint64_t size;
+    uint32_t blocks;  // Data blocks holding the contents
+} ssfs_inode_info_t;
+
+// Scan of the inode table, see ssfs_inode_iter_begin()
+typedef struct {
+    uint32_t cursor;       // Next inode to look at, saved to resume a scan
+    uint32_t block_index;  // Table block held in `block`, UINT32_MAX if none
+    uint8_t *block;
+} ssfs_inode_iter_t;
+
+// Longest name of a directory entry, in bytes
+#define SSFS_NAME_MAX 255
+
+// Directory entry, see ssfs_readdir()
+typedef struct {
+    int inode_num;
+    char name[SSFS_NAME_MAX + 1];  // NUL-terminated
+} ssfs_dirent_t;
+
+// Problems found by ssfs_check()
+typedef enum {
+    SSFS_CHECK_RANGE,      // Block referenced out of the data region
+    SSFS_CHECK_DUPLICATE,  // Block referenced twice
+    SSFS_CHECK_SIZE,       // Size beyond the blocks referenced, or bad block map
+    SSFS_CHECK_TAIL,       // Packed tail out of its fragment block or overlapping another one
+    SSFS_CHECK_FREE_INODE, // Free inode holding data
+    SSFS_CHECK_LEAK,       // Free block holding data
+    SSFS_CHECK_COUNTERS,   // Free counts of the superblock
+    SSFS_CHECK_NUM
+} ssfs_check_problem_t;
+
+// How ssfs_check() runs, 0 for the default
+typedef struct {
+    int repair;   // Repair the image, else only read it
+    int threads;  // Worker threads, 8 by default
+    int verbose;  // Print every problem, else the first 10 of each kind
+} ssfs_check_options_t;
+
+// What ssfs_check() found
+typedef struct {
+    uint64_t found[SSFS_CHECK_NUM];      // Problems of each kind
+    uint64_t remaining[SSFS_CHECK_NUM];  // Those left after the repair, all of them without
+    uint32_t journal_blocks;             // Blocks with an image in the committed journal records
+    uint32_t inodes;
+    uint32_t used_inodes;
+    uint32_t orphans;                    // Deleted files whose blocks weren't reclaimed yet
+    uint32_t blocks;
+    uint32_t used_blocks;
+    uint64_t elapsed_ns;
+} ssfs_check_report_t;
+
+// Layout of a file, see ssfs_frag_file()
+typedef struct {
+    uint32_t blocks;         // Data blocks, the packed tail aside
+    uint32_t runs;           // Runs of physically contiguous data blocks, in logical order
+    uint32_t ideal_runs;     // Runs of the file once contiguous: 1, 0 without data blocks
+    uint32_t meta_blocks;    // Indirect or extent blocks
+    uint64_t meta_distance;  // Sum of their distances to the first block each maps, in blocks
+} ssfs_frag_file_t;
+
+// Lengths of the runs of free blocks: bucket i counts those of 2^i to 2^(i+1) - 1 blocks
+#define SSFS_FRAG_BUCKETS 32
+
+// Layout of the mounted volume, see ssfs_frag_report()
+typedef struct {
+    uint32_t files;                // Files with data blocks
+    uint32_t fragmented_files;     // Files in more runs than ideal
+    uint64_t data_blocks;
+    uint64_t data_runs;
+    uint64_t ideal_runs;
+    uint64_t meta_blocks;          // Indirect or extent blocks of the files
+    uint64_t meta_distance;        // Sum of their distances to the first block each maps
+    uint32_t itable_runs;          // Runs of the inode table, 1 until it grows
+    uint32_t free_blocks;
+    uint32_t free_extents;         // Runs of free blocks
+    uint32_t largest_free_extent;
+    uint32_t free_histogram[SSFS_FRAG_BUCKETS];
+} ssfs_frag_report_t;
+
+// Options of ssfs_defrag_volume()
+typedef struct {
+    uint64_t bytes_per_second;  // Copy rate, 0 for no limit
+} ssfs_defrag_options_t;
+
+// What ssfs_defrag_volume() did
+typedef struct {
+    uint32_t files;          // Files in more than one run
+    uint32_t defragmented;   // Those moved into a single run
+    uint32_t skipped;        // Those left for lack of a run of free blocks long enough
+    uint64_t blocks_moved;
+    uint64_t runs_before;    // Runs of the files moved, before and after
+    uint64_t runs_after;
+    uint64_t elapsed_ns;
+} ssfs_defrag_report_t;
+
 int format(char *disk_name, int inodes);
 int stat(int inode_num);
 int mount(char *disk_name);
@@ -11,4 +195,38 @@ int create();
 int delete(int inode_num);
 int read(int inode_num, uint8_t *data, int len, int offset);
 int write(int inode_num, uint8_t *data, int len, int offset);
+
+int ssfs_set_parallelism(int threads, int threshold);
+int ssfs_sync();
+int ssfs_set_commit_batch(int transactions);
+int ssfs_fsync(int inode_num);
+int ssfs_fdatasync(int inode_num);
+int ssfs_format_opts(char *disk_name, int inodes, const ssfs_format_options_t *options);
+int ssfs_format_new(char *disk_name, uint32_t size_in_blocks, int inodes);
+int ssfs_statfs(ssfs_statfs_t *stats);
+int ssfs_grow(uint32_t new_size);
+int ssfs_create_many(int *inode_nums, int count);
+int ssfs_delete_many(const int *inode_nums, int count);
+int ssfs_stat_many(const int *inode_nums, int count, int *sizes);
+int ssfs_stat_range(int first_inode, int count, int *sizes);
+int ssfs_inode_iter_begin(ssfs_inode_iter_t *iter, int start_inode);
+int ssfs_inode_iter_next(ssfs_inode_iter_t *iter, ssfs_inode_info_t *info);
+void ssfs_inode_iter_end(ssfs_inode_iter_t *iter);
+int ssfs_get_stats(ssfs_stats_t *stats);
+void ssfs_reset_stats();
+uint64_t ssfs_stats_percentile(const ssfs_op_stats_t *op, double percent);
+const char *ssfs_op_name(ssfs_op_t op);
+int ssfs_trace_start(const char *path);
+int ssfs_trace_stop();
+int ssfs_mkdir();
+int ssfs_lookup(int dir_inode, const char *name);
+int ssfs_link(int dir_inode, const char *name, int inode_num);
+int ssfs_unlink(int dir_inode, const char *name);
+int ssfs_readdir(int dir_inode, uint32_t *cursor, ssfs_dirent_t *entry);
+int ssfs_check(char *disk_name, const ssfs_check_options_t *options, ssfs_check_report_t *report);
+const char *ssfs_check_problem_name(ssfs_check_problem_t problem);
+int ssfs_frag_file(int inode_num, ssfs_frag_file_t *file);
+int ssfs_frag_report(ssfs_frag_report_t *report);
+int ssfs_defrag(int inode_num);
+int ssfs_defrag_volume(const ssfs_defrag_options_t *options, ssfs_defrag_report_t *report);
 #endif
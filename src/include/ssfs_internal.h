@@ -1,115 +1,470 @@
-/*
- * Author: Valérian Wislez
- *
- * ssfs_internal.h
- * ===============
- * 
- * This file defines the data structures of the filesystem. It also declares
- * the global variables used by the program as well as some common constants.
- * All the prototypes of the functions written to perform operations are
- * also written here.
- *
- */
-
-#ifndef SSFS_INTERNAL_H
-#define SSFS_INTERNAL_H
-
-#include <stdint.h>
-#include <stdbool.h>
-#include <stdarg.h>
-
-#include "vdisk.h"
-
-// #########################
-// # Structure definitions #
-// #########################
-
-struct superblock {
-    uint8_t magic[16];
-    uint32_t num_blocks;
-    uint32_t num_inode_blocks;
-    uint32_t block_size;
-} __attribute__((packed));
-
-typedef struct superblock superblock_t;
-
-struct inode {
-    uint32_t valid;      // 0 for unused, 1 for used
-    uint32_t size;       // File size in bytes
-    uint32_t direct[4];  // Direct block "pointers"
-    uint32_t indirect1;  // First indirect "pointer"
-    uint32_t indirect2;  // Second indirect "pointer"
-} __attribute__((packed));
-
-typedef struct inode inode_t;
-
-typedef inode_t inodes_block_t[32];
-
-// ####################
-// # Global variables #
-// ####################
-
-extern DISK *disk_handle;
-extern bool *allocated_blocks_handle;
-
-// #############
-// # Constants #
-// #############
-
-extern const int VDISK_SECTOR_SIZE;  // from vdisk.c, defaults to 1024
-extern const int SUPERBLOCK_SECTOR;
-extern const unsigned char MAGIC_NUMBER[];
-
-// ##########################
-// # Prototypes declaration #
-// ##########################
-
-// # test
-
-void test1();
-void test2();
-void test3();
-void test4();
-void test5();
-
-// # ssfs_core
-
-int _initialize_allocated_blocks();
-
-// # ssfs_file_io
-
-int get_file_block_addresses(inode_t *inode, uint32_t *address_buffer, uint32_t max_addresses);
-int write_in_file(inode_t *inode, uint8_t *data, uint32_t len, uint32_t offset);
-int extend_file(inode_t *inode, uint32_t new_size);
-int set_data_block_pointer(inode_t *inode, uint32_t logical);
-int get_free_block(uint32_t *block);
-
-// # ssfs_utils 
-
-int is_mounted();
-int is_inode_positive(int inodes_num);
-int is_inode_valid(int inodes_num, int max_inodes_num);
-int erase_block_content(uint32_t block_num);
-int is_magic_ok(uint8_t * number);
-
-int set_block_status(uint32_t block, bool status);
-int allocate_block(uint32_t block);
-int deallocate_block(uint32_t block);
-int _update_indirect_block_status(uint32_t indirect_block, bool status);
-int allocate_indirect_block(uint32_t indirect_block);
-int deallocate_indirect_block(uint32_t indirect_block);
-int _update_double_indirect_block_status(uint32_t double_indirect_block, bool status);
-int allocate_double_indirect_block(uint32_t double_indirect_block);
-int deallocate_double_indirect_block(uint32_t double_indirect_block);
-
-void pretty_print(const char* color, const char *label, const char *format, va_list args);
-void print_info(const char *label, const char *format, ...);
-void print_error(const char *label, const char *format, ...);
-void print_success(const char *label, const char *format, ...);
-void print_warning(const char *label, const char *format, ...);
-
-int print_inode_num_info(int inode_num);
-int print_inode_info(inode_t *inode);
-
-
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_internal.h
+ * ===============
+ * 
+ * This file defines the data structures of the filesystem. It also declares
+ * the global variables used by the program as well as some common constants.
+ * All the prototypes of the functions written to perform operations are
+ * also written here.
+ *
+ */
+
+#ifndef SSFS_INTERNAL_H
+#define SSFS_INTERNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#include "vdisk.h"
+#include "fs.h"
+
+// #########################
+// # Structure definitions #
+// #########################
+
+struct superblock {
+    uint8_t magic[16];
+    uint32_t num_blocks;
+    uint32_t num_inode_blocks;
+    uint32_t block_size;
+    uint32_t journal_start;   // First block of the journal region
+    uint32_t journal_blocks;  // 0 when the volume has no journal
+    uint32_t orphan_start;    // First block of the orphan list
+    uint32_t orphan_blocks;   // 0 when deletes are synchronous
+    uint32_t inode_version;   // INODE_V1 (or 0, older volumes) or INODE_V2
+    uint32_t inode_size;      // Size of an on-disk inode, in bytes
+    uint32_t features;        // SSFS_FEATURE_* flags chosen at format time
+    uint32_t free_blocks;     // As of the last sync or unmount
+    uint32_t free_inodes;     // As of the last sync or unmount
+    uint32_t inode_table_next; // First extent block of the grown inode table, 0 if none
+    uint32_t unclean;         // 1 while mounted, 0 once cleanly unmounted
+} __attribute__((packed));
+
+typedef struct superblock superblock_t;
+
+struct inode {
+    uint32_t valid;      // 0 for unused, 1 for used, | INODE_V1_INLINE
+    uint32_t size;       // File size in bytes
+    uint32_t direct[4];  // Direct block "pointers"
+    uint32_t indirect1;  // First indirect "pointer"
+    uint32_t indirect2;  // Second indirect "pointer"
+} __attribute__((packed));
+
+typedef struct inode inode_t;
+
+typedef inode_t inodes_block_t[32];
+
+#define INODE_V1 1
+#define INODE_V2 2
+
+// The contents of the file are stored in place of its block map
+#define INODE_V1_INLINE   0x2  // In `valid`, as version 1 inodes have no flags
+#define INODE_FLAG_INLINE 0x1
+#define INODE_FLAG_TAIL   0x2  // The last partial block is in a fragment block
+
+struct extent {
+    uint32_t logical;   // First logical block of the file
+    uint32_t physical;  // First physical block on disk
+    uint32_t length;    // Number of contiguous blocks
+};
+
+typedef struct extent extent_t;
+
+#define INODE_V2_EXTENTS 7
+
+// Extent-based inode, 128 bytes, fields naturally aligned
+struct inode_v2 {
+    uint32_t valid;         // 0 for unused, 1 for used
+    uint32_t flags;
+    uint64_t size;          // File size in bytes
+    uint32_t extents_num;   // Used entries of `extents`
+    uint32_t extent_block;  // First overflow extent block, 0 if none
+    uint32_t extent_tail;   // Last overflow extent block, 0 if none
+    extent_t extents[INODE_V2_EXTENTS];
+    uint32_t tail_block;    // Fragment block holding the tail, with INODE_FLAG_TAIL
+    uint16_t tail_offset;   // Offset of the tail in the fragment block
+    uint16_t tail_length;   // Bytes of the tail, size % block size
+    uint32_t reserved[2];
+};
+
+typedef struct inode_v2 inode_v2_t;
+
+// Overflow extent block, chained to the next one
+struct extent_block {
+    uint32_t count;  // Used entries of `extents`
+    uint32_t next;   // Next extent block, 0 for the last one
+    extent_t extents[];
+};
+
+typedef struct extent_block extent_block_t;
+
+// An inode of either version, as found in an inode block
+typedef union {
+    inode_t v1;
+    inode_v2_t v2;
+} any_inode_t;
+
+// Layout of the mounted volume, derived from its superblock
+typedef struct {
+    uint32_t block_size;
+    uint32_t pointers_per_block;  // Fan-out of indirect blocks
+    uint32_t inode_version;
+    uint32_t inode_size;
+    uint32_t inodes_per_block;
+    uint32_t features;
+} geometry_t;
+
+// Header of a trace file, see ssfs_trace_start()
+struct trace_header {
+    uint32_t magic;          // TRACE_MAGIC
+    uint32_t version;        // TRACE_VERSION
+    uint64_t start_time_ns;  // Wall clock time of the start of the trace
+} __attribute__((packed));
+
+typedef struct trace_header trace_header_t;
+
+// A traced call, followed by `name_len` bytes of name, or for the batch
+// operations by `arg2` inode numbers (int32_t). The arguments of each
+// operation:
+//   format: inode = inode version, arg1 = inodes, arg2 = block size, flags = features
+//   format_new: arg1 = inodes, arg2 = size in blocks
+//   read, write: inode, arg1 = offset, arg2 = length
+//   delete, stat, fsync, fdatasync: inode
+//   lookup, unlink: inode = directory, name
+//   link: inode = directory, arg1 = inode linked, name
+//   create_many, delete_many, stat_many: arg1 = count, arg2 = inode numbers
+//     listed, those created or those given
+//   stat_range: inode = first inode, arg1 = count
+//   grow: arg1 = new size in blocks
+//   readdir: inode = directory, arg1 = cursor given
+//   inode_iter_begin: arg1 = start inode
+//   inode_iter_next: inode = file found
+struct trace_record {
+    uint64_t start_ns;     // Since the start of the trace
+    uint32_t duration_ns;  // UINT32_MAX for longer calls
+    uint8_t op;            // ssfs_op_t
+    uint8_t flags;
+    uint16_t name_len;
+    int32_t inode;
+    int32_t arg1;
+    int32_t arg2;
+    int32_t result;
+} __attribute__((packed));
+
+typedef struct trace_record trace_record_t;
+
+// Block of the journal region, see ssfs_journal.c
+typedef struct {
+    uint32_t magic;      // JOURNAL_MAGIC
+    uint32_t type;       // JOURNAL_HEADER, JOURNAL_DESCRIPTOR or JOURNAL_COMMIT
+    uint32_t seq;
+    uint32_t count;      // Descriptor: entries in this block. Commit: blocks in the record.
+    uint32_t checksum;   // Commit only
+    uint32_t entries[];  // Descriptor only
+} journal_block_t;
+
+// A block image, or a revoke, of a committed journal record
+typedef struct {
+    uint32_t sector;    // Home sector, with JOURNAL_REVOKE for a revoke
+    uint32_t seq;       // Sequence number of the record
+    uint32_t position;  // Block of the image, relative to the journal start
+} journal_entry_t;
+
+// Reads a block of a volume into `buffer`, returning 0 or an error code
+typedef int (*block_reader_t)(uint32_t block, uint8_t *buffer, void *arg);
+
+// ####################
+// # Global variables #
+// ####################
+
+extern DISK *disk_handle;
+extern bool *allocated_blocks_handle;
+extern geometry_t geometry_handle;
+extern pthread_mutex_t fs_mutex;  // Serializes the operations on the mounted volume
+
+// #############
+// # Constants #
+// #############
+
+extern const int VDISK_SECTOR_SIZE;  // from vdisk.c, defaults to 1024
+#define MIN_BLOCK_SIZE 1024
+#define MAX_BLOCK_SIZE 65536
+
+// Block size and indirect fan-out of the mounted volume
+#define BLOCK_SIZE ((int)geometry_handle.block_size)
+#define POINTERS_PER_BLOCK (geometry_handle.pointers_per_block)
+extern const int SUPERBLOCK_SECTOR;
+extern const unsigned char MAGIC_NUMBER[];
+#define TRACE_MAGIC 0x43525453  // "STRC"
+#define TRACE_VERSION 2
+#define JOURNAL_MAGIC       0x4a534653  // "SFSJ"
+#define JOURNAL_HEADER      1
+#define JOURNAL_DESCRIPTOR  2
+#define JOURNAL_COMMIT      3
+#define JOURNAL_REVOKE      0x80000000u
+
+// ##########################
+// # Prototypes declaration #
+// ##########################
+
+// # test
+
+void test1();
+void test2();
+void test3();
+void test4();
+void test5();
+void test6();
+void test7();
+void test8();
+void test9();
+void test10();
+void test11();
+void test12();
+void test13();
+void test14();
+void test15();
+void test16();
+void test17();
+void test18();
+void test19();
+void test20();
+void test21();
+void test22();
+void test23();
+void test24();
+void test25();
+void test26();
+void test27();
+void test28();
+void test29();
+
+// # bench
+
+void bench_parallel_io();
+void bench_format();
+void bench_inode_versions();
+void bench_block_sizes();
+void bench_inline_data();
+void bench_tail_packing();
+void bench_dir_lookup();
+void bench_batch_ops();
+void bench_inode_scan();
+
+// # ssfs_core
+
+int _initialize_allocated_blocks();
+int _compute_geometry(uint32_t block_size, uint32_t inode_version, geometry_t *geometry);
+int _zero_blocks(DISK *disk, uint32_t first_block, uint32_t count);
+int _write_superblock(DISK *disk, superblock_t *sb);
+int _set_unclean(bool unclean);
+int _zero_free_blocks();
+int _ssfs_format_opts(char *disk_name, int inodes, const ssfs_format_options_t *options);
+int _ssfs_format_new(char *disk_name, uint32_t size_in_blocks, int inodes);
+int _mount(char *disk_name);
+int _unmount();
+
+// # ssfs_inode
+
+int _stat(int inode_num);
+int _create();
+int _delete(int inode_num);
+any_inode_t *inode_at(uint8_t *block_buffer, uint32_t index);
+int inode_in_use(any_inode_t *inode);
+uint64_t inode_get_size(any_inode_t *inode);
+uint32_t inode_data_blocks(any_inode_t *inode);
+int inode_block_addresses(any_inode_t *inode, uint32_t *address_buffer, uint32_t max_addresses);
+int inode_extend(any_inode_t *inode, uint64_t new_size);
+int inode_set_blocks_status(any_inode_t *inode, bool status);
+int inode_release(int inode_num, any_inode_t *old_inode);
+
+// # ssfs_extent
+
+int extent_block_addresses(inode_v2_t *inode, uint32_t *address_buffer, uint32_t max_addresses);
+int extent_extend_file(inode_v2_t *inode, uint64_t new_size);
+int extent_for_each(inode_v2_t *inode, int (*visit)(uint32_t first, uint32_t count, void *arg), void *arg);
+int extent_set_blocks_status(inode_v2_t *inode, bool status);
+int print_extents_info(inode_v2_t *inode);
+
+// # ssfs_inline
+
+uint32_t inline_capacity();
+int inode_is_inline(any_inode_t *inode);
+int inline_fits(any_inode_t *inode, uint64_t new_size);
+int inline_read(any_inode_t *inode, uint8_t *data, uint32_t len, uint32_t offset);
+int inline_write(any_inode_t *inode, uint8_t *data, uint32_t len, uint32_t offset);
+int inline_migrate(int inode_num, any_inode_t *inode, uint64_t new_size);
+
+// # ssfs_tail
+
+int tail_packing_enabled();
+int tail_is_packed(any_inode_t *inode);
+uint64_t tail_start(any_inode_t *inode);
+int tail_read(any_inode_t *inode, uint8_t *data, uint32_t len, uint32_t offset);
+int tail_pack(int inode_num, any_inode_t *inode);
+int tail_unpack(int inode_num, any_inode_t *inode);
+int tail_free(any_inode_t *inode);
+int fragment_mark(uint32_t block, uint32_t offset, uint32_t length);
+int fragments_committed();
+void fragments_begun();
+int fragments_aborted();
+void fragments_release();
+
+// # ssfs_statfs
+
+int _ssfs_statfs(ssfs_statfs_t *stats);
+void counters_reset(uint32_t inodes);
+void bitmap_set(uint32_t block, bool status);
+void counters_inodes_used(int count);
+void counters_inodes_added(uint32_t count);
+uint32_t counters_free_inodes();
+void counters_blocks_added();
+void counters_begun();
+void counters_aborted();
+int counters_save();
+
+// # ssfs_stats
+
+uint64_t stats_clock();
+void stats_op(ssfs_op_t op, uint64_t start, int ret);
+void stats_allocation(uint32_t scanned, bool found);
+void stats_block_freed();
+
+// # ssfs_trace
+
+void trace_record(ssfs_op_t op, uint64_t start, int ret, int inode, int arg1, int arg2, const char *name);
+void trace_record_format(uint64_t start, int ret, int inodes, const ssfs_format_options_t *options);
+void trace_record_inodes(ssfs_op_t op, uint64_t start, int ret, int count, const int *inode_nums, int listed);
+void trace_start_from_env();
+
+// # ssfs_itable
+
+int itable_load();
+void itable_release();
+uint32_t itable_inodes();
+uint32_t itable_blocks();
+uint32_t itable_block(uint32_t index);
+void itable_mark_blocks();
+int itable_grow(uint32_t *first_inode);
+void itable_begun();
+void itable_aborted();
+
+// # ssfs_batch
+
+int _ssfs_create_many(int *inode_nums, int count);
+int _ssfs_delete_many(const int *inode_nums, int count);
+int _ssfs_stat_many(const int *inode_nums, int count, int *sizes);
+int _ssfs_stat_range(int first_inode, int count, int *sizes);
+
+// # ssfs_grow
+
+int _ssfs_grow(uint32_t new_size);
+
+// # ssfs_iter
+
+int _ssfs_inode_iter_begin(ssfs_inode_iter_t *iter, int start_inode);
+int _ssfs_inode_iter_next(ssfs_inode_iter_t *iter, ssfs_inode_info_t *info);
+
+// # ssfs_dir
+
+int _ssfs_mkdir();
+int _ssfs_lookup(int dir_inode, const char *name);
+int _ssfs_link(int dir_inode, const char *name, int inode_num);
+int _ssfs_unlink(int dir_inode, const char *name);
+int _ssfs_readdir(int dir_inode, uint32_t *cursor, ssfs_dirent_t *entry);
+
+// # ssfs_file_io
+
+int _read(int inode_num, uint8_t *data, int _len, int _offset);
+int _write(int inode_num, uint8_t *data, int _len, int _offset);
+int get_file_block_addresses(inode_t *inode, uint32_t *address_buffer, uint32_t max_addresses);
+int write_in_file(int inode_num, any_inode_t *inode, uint8_t *data, uint32_t len, uint32_t offset);
+int extend_file(inode_t *inode, uint32_t new_size);
+int set_data_block_pointer(inode_t *inode, uint32_t logical);
+int get_free_block(uint32_t *block);
+int get_free_block_near(uint32_t goal, uint32_t *block);
+bool release_blocks();
+
+// # ssfs_fsync
+
+int dirty_load(uint32_t inodes_num);
+int dirty_grow(uint32_t inodes_num);
+void dirty_release();
+void dirty_mark_data(int inode_num, uint32_t sector, uint32_t count);
+void dirty_mark_metadata(int inode_num, bool allocation);
+void dirty_forget(int inode_num);
+int dirty_flush_data(int inode_num);
+int dirty_flush_committing();
+void dirty_committed();
+
+// # ssfs_journal
+
+int _ssfs_sync();
+int journal_scan(uint32_t start, uint32_t blocks, block_reader_t read_block, void *arg,
+                 journal_entry_t **entries, uint32_t *count, uint32_t *next_seq);
+int journal_entry_applies(const journal_entry_t *entries, uint32_t count, uint32_t e);
+int journal_load(superblock_t *sb);
+void journal_release();
+int journal_grow(uint32_t old_size, uint32_t new_size);
+int journal_is_active();
+void journal_begin();
+int journal_end();
+int journal_abort();
+int journal_in_transaction();
+int journal_commit();
+int journal_defer_free(uint32_t block, bool zeroed);
+int journal_allocated(uint32_t block);
+int meta_read(uint32_t sector, uint8_t *buffer);
+int meta_write(uint32_t sector, uint8_t *buffer);
+
+// # ssfs_parallel
+
+int parallel_eligible(uint32_t len);
+int parallel_transfer(uint32_t *addresses, uint8_t *data, uint32_t len, uint32_t offset, bool is_write);
+void parallel_shutdown();
+
+// # ssfs_reclaim
+
+int reclaim_start(superblock_t *sb);
+void reclaim_stop();
+void reclaim_wakeup();
+int reclaim_pending();
+int reclaim_all();
+int orphan_add(any_inode_t *inode);
+void orphans_begun();
+void orphans_aborted();
+
+// # ssfs_utils 
+
+int is_mounted();
+int is_inode_positive(int inodes_num);
+int is_inode_valid(int inodes_num, int max_inodes_num);
+int erase_block_content(uint32_t block_num);
+int erase_block_range(uint32_t first_block, uint32_t count);
+int is_magic_ok(uint8_t * number);
+
+int set_block_status(uint32_t block, bool status);
+int allocate_block(uint32_t block);
+int deallocate_block(uint32_t block);
+int _update_indirect_block_status(uint32_t indirect_block, bool status);
+int allocate_indirect_block(uint32_t indirect_block);
+int deallocate_indirect_block(uint32_t indirect_block);
+int _update_double_indirect_block_status(uint32_t double_indirect_block, bool status);
+int allocate_double_indirect_block(uint32_t double_indirect_block);
+int deallocate_double_indirect_block(uint32_t double_indirect_block);
+
+void pretty_print(const char* color, const char *label, const char *format, va_list args);
+void print_info(const char *label, const char *format, ...);
+void print_error(const char *label, const char *format, ...);
+void print_success(const char *label, const char *format, ...);
+void print_warning(const char *label, const char *format, ...);
+
+int print_inode_num_info(int inode_num);
+int print_inode_info(inode_t *inode);
+
+
 #endif
\ No newline at end of file
@@ -3,18 +3,109 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdbool.h>
+
+// Images named with this prefix live in memory instead of a file, see
+// vdisk_create(), vdisk_load() and vdisk_save()
+#define VDISK_MEMORY_PREFIX "mem:"
+
+struct vdisk_memory;
 
 typedef struct {
     uint32_t sector_size;
     uint32_t size_in_sectors;
     char *name;
     FILE *fp;
+    uint64_t discarded_bytes;  // Zeroed by vdisk_discard() without data I/O
+    struct vdisk_memory *memory;  // In-memory image, NULL for an image file
 } DISK;
 
+// I/O done on the disks, see vdisk_get_stats(). Every field is a uint64_t.
+typedef struct {
+    uint64_t reads;              // Transfers, whatever their number of sectors
+    uint64_t writes;
+    uint64_t sectors_read;
+    uint64_t sectors_written;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t syncs;              // vdisk_sync() and vdisk_sync_range()
+    uint64_t discards;
+    uint64_t sectors_discarded;
+    uint64_t prefetches;
+    uint64_t simulated_ns;       // Time waited on the simulated device, see vdisk_set_model()
+    uint64_t batched_requests;   // Requests given to vdisk_submit()
+    uint64_t batched_transfers;  // Transfers made for them, fewer once merged
+    uint64_t batch_wait_ns;      // Time the requests waited in their batch
+} vdisk_stats_t;
+
+typedef enum {
+    VDISK_READ,
+    VDISK_WRITE,
+    VDISK_DISCARD,
+} vdisk_op_t;
+
+// A request of a batch, see vdisk_submit()
+typedef struct {
+    vdisk_op_t op;
+    uint32_t sector;
+    uint32_t count;
+    uint8_t *buffer;             // `count` sectors, unused by a discard
+} vdisk_request_t;
+
+// Orders in which vdisk_submit() serves a batch
+typedef enum {
+    VDISK_SCHED_NONE,            // As given, one transfer per request
+    VDISK_SCHED_ELEVATOR,        // One sweep by sector, adjacent requests merged
+    VDISK_SCHED_DEADLINE,        // As elevator, reads swept before writes, and
+                                 // background batches wait for other reads, up to a deadline
+} vdisk_scheduler_t;
+
+// Costs of a simulated device, see vdisk_set_model(). Times are in ns.
+typedef struct {
+    uint64_t read_ns;            // Fixed cost of a read
+    uint64_t write_ns;           // Fixed cost of a write or a discard
+    uint64_t seek_min_ns;        // Added to a transfer that doesn't follow the previous one,
+    uint64_t seek_max_ns;        // growing with the square root of the distance up to this
+    uint64_t bytes_per_second;   // Transfer rate of a request, 0 for no limit
+    uint64_t sync_ns;            // Cost of a sync, once the requests before it are done
+    uint32_t queue_depth;        // Requests served at once, 0 for 1
+    bool inject;                 // Also sleep for the time, so that it adds to the wall time
+} vdisk_model_t;
+
+// An image mapped in memory, see vdisk_map()
+typedef struct {
+    uint8_t *data;
+    uint64_t size;                // Bytes of the image
+    int fd;                       // Image file, -1 for an in-memory image
+    struct vdisk_memory *memory;  // In-memory image, NULL for an image file
+} vdisk_mapping_t;
+
+int vdisk_create(char *filename, uint32_t size_in_sectors);
 int vdisk_on(char *filename, DISK *diskp);
+int vdisk_set_sector_size(DISK *diskp, uint32_t sector_size);
+int vdisk_resize(DISK *diskp, uint32_t size_in_sectors);
 int vdisk_read(DISK *diskp, uint32_t sector, uint8_t *buffer);
 int vdisk_write(DISK *diskp, uint32_t sector, uint8_t *buffer);
+int vdisk_read_range(DISK *diskp, uint32_t sector, uint32_t count, uint8_t *buffer);
+int vdisk_write_range(DISK *diskp, uint32_t sector, uint32_t count, uint8_t *buffer);
+int vdisk_submit(DISK *diskp, vdisk_request_t *requests, uint32_t count, bool background);
+void vdisk_set_scheduler(vdisk_scheduler_t policy);
 int vdisk_sync(DISK *diskp);
+int vdisk_sync_range(DISK *diskp, uint32_t sector, uint32_t count);
+int vdisk_discard(DISK *diskp, uint32_t sector, uint32_t count);
+void vdisk_prefetch(DISK *diskp, uint32_t sector, uint32_t count);
 void vdisk_off(DISK *diskp);
+int vdisk_load(char *name, char *filename);
+int vdisk_save(char *name, char *filename);
+int vdisk_delete(char *name);
+int vdisk_map(char *filename, bool writable, vdisk_mapping_t *mapping);
+uint64_t vdisk_map_next_data(vdisk_mapping_t *mapping, uint64_t position);
+void vdisk_map_zero(vdisk_mapping_t *mapping, uint64_t position, uint64_t length);
+int vdisk_map_sync(vdisk_mapping_t *mapping);
+void vdisk_unmap(vdisk_mapping_t *mapping);
+void vdisk_get_stats(vdisk_stats_t *stats);
+void vdisk_reset_stats();
+int vdisk_set_model(const vdisk_model_t *model);
+int vdisk_model_profile(const char *name, vdisk_model_t *model);
 
 #endif
@@ -4,7 +4,7 @@
  * main.c
  * ======
  * 
- * This file only calls test suites for now.
+ * This file only calls test suites and benchmarks for now.
  *
  *  
  */
@@ -18,5 +18,38 @@ int main(void) {
     //test3();
     //test4();
     //test5();
+    //test6();
+    //test7();
+    //test8();
+    //test9();
+    //test10();
+    //test11();
+    //test12();
+    //test13();
+    //test14();
+    //test15();
+    //test16();
+    //test17();
+    //test18();
+    //test19();
+    //test20();
+    //test21();
+    //test22();
+    //test23();
+    //test24();
+    //test25();
+    //test26();
+    //test27();
+    //test28();
+    //test29();
+    //bench_parallel_io();
+    //bench_format();
+    //bench_inode_versions();
+    //bench_block_sizes();
+    //bench_inline_data();
+    //bench_tail_packing();
+    //bench_dir_lookup();
+    //bench_batch_ops();
+    //bench_inode_scan();
     return 0;
 }
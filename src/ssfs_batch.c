@@ -0,0 +1,381 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_batch.c
+ * ============
+ *
+ * Batched inode operations.
+ * `create()`, `delete()` and `stat()` lock the volume and read an inode
+ * block for every file, and each creation or deletion is a transaction.
+ * The batched versions lock the volume once, read and write each inode
+ * block they touch once, and run as a single transaction.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+/**
+ * @brief Creates `count` files in one transaction, see `ssfs_create_many()`.
+ * @return `count` on success, negative error code on failure.
+ * @note The caller holds `fs_mutex`. On failure, the transaction is aborted.
+ */
+static int create_many_transaction(int *inode_nums, int count) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    journal_begin();
+
+    // Room for every file is made before any is created
+    while (counters_free_inodes() < (uint32_t)count) {
+        uint32_t first_inode;
+        ret = itable_grow(&first_inode);
+        if (ret != 0)
+            goto error_management_abort_transaction;
+    }
+
+    uint32_t inodes_per_block = geometry_handle.inodes_per_block;
+    int created = 0;
+    for (uint32_t index = 0; index < itable_blocks() && created < count; index++) {
+        ret = meta_read(itable_block(index), buffer);
+        if (ret != 0)
+            goto error_management_abort_transaction;
+
+        int block_created = 0;
+        for (uint32_t i = 0; i < inodes_per_block && created < count; i++) {
+            any_inode_t *inode = inode_at(buffer, i);
+            if (inode_in_use(inode))
+                continue;
+
+            // The valid field comes first in every inode version
+            inode->v1.valid = 1;
+            inode_nums[created++] = index * inodes_per_block + i;
+            block_created++;
+        }
+        if (block_created == 0)
+            continue;
+
+        ret = meta_write(itable_block(index), buffer);
+        if (ret != 0)
+            goto error_management_abort_transaction;
+        for (int c = created - block_created; c < created; c++)
+            dirty_mark_metadata(inode_nums[c], false);
+        counters_inodes_used(block_created);
+    }
+
+    ret = journal_end();
+    return ret != 0 ? ret : created;
+
+error_management_abort_transaction:
+    journal_abort();
+    return ret;
+}
+
+/**
+ * @brief Creates `count` files at once.
+ *
+ * The inode table is grown first if needed, then scanned once, each inode
+ * block holding new files being written once.
+ *
+ * @param inode_nums Filled with the inode numbers of the new files.
+ * @param count The number of files to create.
+ *
+ * @return `count` on success.
+ * @return Negative integer (error codes) on failure. When inodes run out,
+ * no file is created.
+ */
+int _ssfs_create_many(int *inode_nums, int count) {
+    int ret = 0;
+
+    if (inode_nums == NULL || count <= 0) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+
+    // Retried once the blocks waiting for a commit or for the reclaimer are
+    // released, outside of the transaction
+    ret = create_many_transaction(inode_nums, count);
+    if (ret == ssfs_ENOSPACE && release_blocks())
+        ret = create_many_transaction(inode_nums, count);
+    if (ret < 0)
+        goto error_management_unlock;
+
+    pthread_mutex_unlock(&fs_mutex);
+    return ret;
+
+error_management_unlock:
+    pthread_mutex_unlock(&fs_mutex);
+
+error_management:
+    fprintf(stderr, "Error when creating files (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_create_many()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_create_many(int *inode_nums, int count) {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_create_many(inode_nums, count);
+    stats_op(SSFS_OP_CREATE_MANY, start, ret);
+    trace_record_inodes(SSFS_OP_CREATE_MANY, start, ret, count, inode_nums, ret > 0 ? ret : 0);
+    return ret;
+}
+
+/**
+ * @brief Compares two inode numbers, for `qsort()`.
+ */
+static int compare_inodes(const void *a, const void *b) {
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Deletes several files at once, as a single transaction.
+ *
+ * The files are processed in inode order, so that each inode block is read
+ * and written once. Their blocks are released as by `delete()`.
+ *
+ * @param inode_nums The inode numbers of the files. Unused inodes and
+ * duplicates are skipped.
+ * @param count The number of inode numbers.
+ *
+ * @return The number of files deleted on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int _ssfs_delete_many(const int *inode_nums, int count) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    int *sorted = NULL;
+
+    if (inode_nums == NULL || count <= 0) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    sorted = malloc(count * sizeof(int));
+    if (sorted == NULL) {
+        ret = ssfs_EALLOC;
+        goto error_management;
+    }
+    memcpy(sorted, inode_nums, count * sizeof(int));
+    qsort(sorted, count, sizeof(int), compare_inodes);
+
+    pthread_mutex_lock(&fs_mutex);
+
+    // Every number is checked before anything is deleted
+    uint32_t total_inodes = itable_inodes();
+    if (!is_inode_valid(sorted[0], total_inodes) || !is_inode_valid(sorted[count - 1], total_inodes)) {
+        ret = ssfs_EALLOC;
+        goto error_management_unlock;
+    }
+
+    uint32_t inodes_per_block = geometry_handle.inodes_per_block;
+    int deleted = 0;
+    journal_begin();
+
+    for (int f = 0; f < count;) {
+        uint32_t block_index = sorted[f] / inodes_per_block;
+        ret = meta_read(itable_block(block_index), buffer);
+        if (ret != 0)
+            goto error_management_abort_transaction;
+
+        // Every listed inode of the block is cleared before it is written
+        int block_deleted = 0;
+        for (; f < count && sorted[f] / inodes_per_block == block_index; f++) {
+            any_inode_t *inode = inode_at(buffer, sorted[f] % inodes_per_block);
+            if (!inode_in_use(inode))
+                continue;
+
+            any_inode_t old_inode;
+            memcpy(&old_inode, inode, geometry_handle.inode_size);
+            memset(inode, 0, geometry_handle.inode_size);
+            ret = inode_release(sorted[f], &old_inode);
+            if (ret != 0)
+                goto error_management_abort_transaction;
+            block_deleted++;
+        }
+        if (block_deleted == 0)
+            continue;
+
+        ret = meta_write(itable_block(block_index), buffer);
+        if (ret != 0)
+            goto error_management_abort_transaction;
+        deleted += block_deleted;
+    }
+
+    ret = journal_end();
+    if (ret != 0)
+        goto error_management_unlock;
+
+    reclaim_wakeup();
+    pthread_mutex_unlock(&fs_mutex);
+    free(sorted);
+    return deleted;
+
+error_management_abort_transaction:
+    journal_abort();
+
+error_management_unlock:
+    pthread_mutex_unlock(&fs_mutex);
+
+error_management:
+    free(sorted);
+    fprintf(stderr, "Error when deleting files (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_delete_many()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_delete_many(const int *inode_nums, int count) {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_delete_many(inode_nums, count);
+    stats_op(SSFS_OP_DELETE_MANY, start, ret);
+    trace_record_inodes(SSFS_OP_DELETE_MANY, start, ret, count, inode_nums, inode_nums != NULL ? count : 0);
+    return ret;
+}
+
+/**
+ * @brief Fills `sizes` with the sizes of the inodes `inode_nums`, or
+ * `first_inode` onwards when it is NULL. An inode block is read once for
+ * consecutive inodes in it.
+ * @return 0 on success, negative error code on failure.
+ * @note The caller holds `fs_mutex`.
+ */
+static int stat_inodes(const int *inode_nums, int first_inode, int count, int *sizes) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    uint32_t inodes_per_block = geometry_handle.inodes_per_block;
+    uint32_t total_inodes = itable_inodes();
+    uint32_t cached_block = UINT32_MAX;
+
+    for (int f = 0; f < count; f++) {
+        int inode_num = inode_nums != NULL ? inode_nums[f] : first_inode + f;
+        if (!is_inode_valid(inode_num, total_inodes)) {
+            sizes[f] = ssfs_EALLOC;
+            continue;
+        }
+
+        uint32_t block_index = inode_num / inodes_per_block;
+        if (block_index != cached_block) {
+            ret = meta_read(itable_block(block_index), buffer);
+            if (ret != 0)
+                return ret;
+            cached_block = block_index;
+        }
+
+        any_inode_t *inode = inode_at(buffer, inode_num % inodes_per_block);
+        sizes[f] = inode_in_use(inode) ? (int)inode_get_size(inode) : ssfs_EINODE;
+    }
+    return ret;
+}
+
+/**
+ * @brief Retrieves the sizes of several files at once.
+ *
+ * @param inode_nums The inode numbers of the files.
+ * @param count The number of inode numbers.
+ * @param sizes Filled with the size of each file in bytes, or ssfs_EINODE
+ * for an unused inode and ssfs_EALLOC for a number out of the table.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int _ssfs_stat_many(const int *inode_nums, int count, int *sizes) {
+    int ret = 0;
+
+    if (inode_nums == NULL || sizes == NULL || count < 0) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+    ret = stat_inodes(inode_nums, 0, count, sizes);
+    pthread_mutex_unlock(&fs_mutex);
+    if (ret != 0)
+        goto error_management;
+    return ret;
+
+error_management:
+    fprintf(stderr, "Error when retrieving stats of files (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_stat_many()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_stat_many(const int *inode_nums, int count, int *sizes) {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_stat_many(inode_nums, count, sizes);
+    stats_op(SSFS_OP_STAT_MANY, start, ret);
+    trace_record_inodes(SSFS_OP_STAT_MANY, start, ret, count, inode_nums, inode_nums != NULL ? count : 0);
+    return ret;
+}
+
+/**
+ * @brief Retrieves the sizes of the files [first_inode, first_inode + count).
+ *
+ * @param sizes Filled as by `ssfs_stat_many()`.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int _ssfs_stat_range(int first_inode, int count, int *sizes) {
+    int ret = 0;
+
+    if (sizes == NULL || first_inode < 0 || count < 0) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+    ret = stat_inodes(NULL, first_inode, count, sizes);
+    pthread_mutex_unlock(&fs_mutex);
+    if (ret != 0)
+        goto error_management;
+    return ret;
+
+error_management:
+    fprintf(stderr, "Error when retrieving stats of files (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_stat_range()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_stat_range(int first_inode, int count, int *sizes) {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_stat_range(first_inode, count, sizes);
+    stats_op(SSFS_OP_STAT_RANGE, start, ret);
+    trace_record(SSFS_OP_STAT_RANGE, start, ret, first_inode, count, 0, NULL);
+    return ret;
+}
@@ -0,0 +1,1253 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_check.c
+ * ============
+ *
+ * Offline consistency check of an image, run by the `ssfs_fsck` tool.
+ * The image is mapped whole with `vdisk_map()` and its metadata read in
+ * place, the images of the committed journal records standing in for their
+ * home blocks, as after the replay of the next `mount()`. Worker threads
+ * share out the inode table and walk the block map of each file, claiming
+ * every block it references in an array of owners with an atomic minimum:
+ * a block referenced twice is seen by its second claim, and ends up owned
+ * by the lowest claimant. The free blocks are then scanned in parallel,
+ * skipping the holes of the image. Every free block of SSFS is zero, so a
+ * free block holding data was leaked by an operation that allocated it and
+ * failed before referencing it.
+ *
+ * The repair replays the journal, then cuts each damaged file at its first
+ * bad reference: out of range, owned by another file, already referenced
+ * by the file, out of logical order, or past the size.
+ * The size is lowered to the blocks left, a bad tail dropped, and a second
+ * scan zeroes the leaked blocks, those just cut included, and rewrites the
+ * counters of the superblock. The contents of directories aren't checked.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+// Owners of the blocks, in the order a doubly-referenced block is given to
+#define OWNER_FREE     0
+#define OWNER_SYSTEM   1  // Superblock, inode table, journal and orphan list
+#define OWNER_FRAGMENT 2  // Fragment block, shared by the packed tails
+#define OWNER_FIRST    3  // The file of the i-th inode slot, orphans after the table
+#define OWNER_PAST_SIZE 0x80000000u  // With a file, mapped past its size: yields to the others
+
+#define CHECK_THREADS 8          // Worker threads by default
+#define CHECK_MAX_THREADS 64
+#define INODE_WORK_BLOCKS 16     // Inode blocks taken at once by a worker
+#define FREE_WORK_BLOCKS 4096    // Blocks scanned at once for leaks
+#define REPORT_LIMIT 10          // Problems of each kind printed, unless verbose
+
+#define LEAF_EXTENTS ((BLOCK_SIZE - sizeof(extent_block_t)) / sizeof(extent_t))
+
+// Names of the problems, in ssfs_check_problem_t order
+static const char *problem_names[SSFS_CHECK_NUM] = {
+    "out-of-range blocks", "doubly-referenced blocks", "inconsistent files",
+    "bad tails", "dirty free inodes", "leaked blocks", "wrong counters",
+};
+
+typedef enum {
+    REF_DATA,  // Data block of the file, at its logical index
+    REF_META,  // Indirect or extent block, at the first logical index it maps
+    REF_TAIL,  // Fragment block of the packed tail
+} ref_kind_t;
+
+// What a visit tells the walk of a block map
+#define WALK_CONTINUE 0
+#define WALK_SKIP     1  // Don't descend into this block
+#define WALK_STOP     2  // Stop the walk, the file is cut here
+
+typedef struct {
+    uint32_t *items;
+    uint32_t num;
+    uint32_t capacity;
+} id_list_t;
+
+typedef struct {
+    uint32_t block;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t owner;
+} tail_ref_t;
+
+typedef struct {
+    tail_ref_t *items;
+    uint32_t num;
+    uint32_t capacity;
+} tail_list_t;
+
+typedef struct {
+    vdisk_mapping_t mapping;
+    superblock_t sb;         // Latest superblock, journal included
+    uint32_t blocks;         // Blocks of the volume
+    uint32_t first_data;     // First block after the system blocks
+    bool repairing;
+    bool verbose;
+    int threads;
+
+    // Committed journal images, sorted by home sector
+    uint32_t *overlay_sectors;
+    uint32_t *overlay_positions;
+    uint32_t overlay_num;
+    uint32_t journal_next_seq;
+
+    // Inode table, as in ssfs_itable.c
+    extent_t *table;
+    uint32_t table_num;
+    uint32_t table_blocks;
+
+    uint32_t *owners;        // Owner of each block, OWNER_FREE if none
+    uint32_t *visited;       // Owner that last visited each block, for the repair
+    uint32_t cursor;         // Next work item, shared by the workers
+    uint64_t found[SSFS_CHECK_NUM];
+    uint64_t reported[SSFS_CHECK_NUM];
+    uint32_t used_inodes;
+    uint32_t orphans;
+    uint32_t used_blocks;
+    id_list_t suspects;      // Owners of the files to repair
+    id_list_t bad_tails;     // Owners whose tail overlaps another one, sorted
+    tail_list_t tails;
+    pthread_mutex_t mutex;   // Merges of the workers and printing
+} check_t;
+
+typedef struct {
+    check_t *check;
+    uint32_t used_inodes;
+    uint32_t orphans;
+    uint32_t used_blocks;
+    id_list_t suspects;
+    tail_list_t tails;
+    int ret;
+} worker_t;
+
+typedef struct {
+    check_t *check;
+    worker_t *worker;        // NULL for a repair walk
+    any_inode_t *inode;
+    uint32_t owner;
+    bool orphan;             // Orphans may be partly reclaimed, their sizes aren't checked
+    uint32_t data_seen;      // Data blocks referenced so far
+    uint32_t expected;       // Data blocks of the size, the tail following
+    bool bad_map;            // Out of logical order, or not as the file system leaves it
+    bool damaged;
+    bool keep_tail;          // Repair: the walk reached the tail, and it is good
+} walk_t;
+
+/**
+ * @brief Appends an owner to a list.
+ * @return 0 on success, negative error code on failure.
+ */
+static int id_append(id_list_t *list, uint32_t id) {
+    if (list->num == list->capacity) {
+        uint32_t capacity = list->capacity ? 2 * list->capacity : 64;
+        uint32_t *items = realloc(list->items, capacity * sizeof(uint32_t));
+        if (items == NULL)
+            return ssfs_EALLOC;
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->num++] = id;
+    return 0;
+}
+
+/**
+ * @brief Appends a tail to a list.
+ * @return 0 on success, negative error code on failure.
+ */
+static int tail_append(tail_list_t *list, tail_ref_t tail) {
+    if (list->num == list->capacity) {
+        uint32_t capacity = list->capacity ? 2 * list->capacity : 64;
+        tail_ref_t *items = realloc(list->items, capacity * sizeof(tail_ref_t));
+        if (items == NULL)
+            return ssfs_EALLOC;
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->num++] = tail;
+    return 0;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_tails(const void *a, const void *b) {
+    const tail_ref_t *x = a, *y = b;
+    if (x->block != y->block)
+        return (x->block > y->block) - (x->block < y->block);
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/**
+ * @brief Sorts a list and removes its duplicates.
+ */
+static void id_sort_unique(id_list_t *list) {
+    if (list->num == 0)
+        return;
+    qsort(list->items, list->num, sizeof(uint32_t), compare_ids);
+    uint32_t unique = 1;
+    for (uint32_t i = 1; i < list->num; i++)
+        if (list->items[i] != list->items[unique - 1])
+            list->items[unique++] = list->items[i];
+    list->num = unique;
+}
+
+static bool id_contains(const id_list_t *list, uint32_t id) {
+    return list->num > 0 && bsearch(&id, list->items, list->num, sizeof(uint32_t), compare_ids) != NULL;
+}
+
+/**
+ * @brief Counts a problem, and prints it unless enough of its kind were.
+ */
+static void report(check_t *check, ssfs_check_problem_t problem, const char *format, ...) {
+    __atomic_fetch_add(&check->found[problem], 1, __ATOMIC_RELAXED);
+    uint64_t rank = __atomic_fetch_add(&check->reported[problem], 1, __ATOMIC_RELAXED);
+    if (!check->verbose && rank > REPORT_LIMIT)
+        return;
+
+    char message[256];
+    if (!check->verbose && rank == REPORT_LIMIT) {
+        snprintf(message, sizeof(message), "more not shown");
+    } else {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(message, sizeof(message), format, args);
+        va_end(args);
+    }
+    pthread_mutex_lock(&check->mutex);
+    print_warning(problem_names[problem], "%s", message);
+    pthread_mutex_unlock(&check->mutex);
+}
+
+/**
+ * @brief Describes the owner of a block, as "inode 12".
+ */
+static const char *describe_owner(check_t *check, uint32_t owner, char *buffer, size_t size) {
+    uint32_t inodes = check->table_blocks * geometry_handle.inodes_per_block;
+    owner &= ~OWNER_PAST_SIZE;
+    if (owner == OWNER_SYSTEM)
+        snprintf(buffer, size, "the system blocks");
+    else if (owner == OWNER_FRAGMENT)
+        snprintf(buffer, size, "a fragment block");
+    else if (owner - OWNER_FIRST < inodes)
+        snprintf(buffer, size, "inode %u", owner - OWNER_FIRST);
+    else
+        snprintf(buffer, size, "orphan %u", owner - OWNER_FIRST - inodes);
+    return buffer;
+}
+
+/**
+ * @brief Returns a block as the next `mount()` will see it: its image in
+ * the journal if a committed record holds one, else its home block.
+ * @note `block` must be lower than `check->blocks`.
+ */
+static uint8_t *meta_block(check_t *check, uint32_t block) {
+    if (check->overlay_num > 0) {
+        uint32_t *found = bsearch(&block, check->overlay_sectors, check->overlay_num, sizeof(uint32_t), compare_ids);
+        if (found != NULL) {
+            uint32_t position = check->overlay_positions[found - check->overlay_sectors];
+            return check->mapping.data + (uint64_t)(check->sb.journal_start + position) * BLOCK_SIZE;
+        }
+    }
+    return check->mapping.data + (uint64_t)block * BLOCK_SIZE;
+}
+
+/**
+ * @brief Returns the physical block of the `index`-th block of the inode table.
+ */
+static uint32_t table_block(check_t *check, uint32_t index) {
+    for (uint32_t e = 0; e < check->table_num; e++)
+        if (index < check->table[e].logical + check->table[e].length)
+            return check->table[e].physical + (index - check->table[e].logical);
+    return 0;
+}
+
+/**
+ * @brief Claims a block for `owner`, keeping the lowest claimant.
+ * @return The owner the block had, OWNER_FREE if none.
+ */
+static uint32_t claim(check_t *check, uint32_t block, uint32_t owner) {
+    uint32_t *slot = &check->owners[block];
+    uint32_t previous = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    while ((previous == OWNER_FREE || owner < previous) &&
+           !__atomic_compare_exchange_n(slot, &previous, owner, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    return previous;
+}
+
+/**
+ * @brief Tells whether the packed tail of a file fits in its fragment block
+ * and holds the end of the file.
+ */
+static bool tail_fields_valid(check_t *check, any_inode_t *inode) {
+    inode_v2_t *v2 = &inode->v2;
+    return v2->tail_block >= check->first_data && v2->tail_block < check->blocks &&
+        v2->tail_length > 0 && v2->tail_length == v2->size % BLOCK_SIZE &&
+        (uint32_t)v2->tail_offset + v2->tail_length <= (uint32_t)BLOCK_SIZE;
+}
+
+/**
+ * @brief Visits a block referenced by a file during the check: claims it
+ * and reports what is wrong with the reference.
+ */
+static int check_visit(walk_t *walk, uint32_t block, ref_kind_t kind, uint32_t logical) {
+    check_t *check = walk->check;
+    worker_t *worker = walk->worker;
+    char owner_name[64], other_name[64];
+    describe_owner(check, walk->owner, owner_name, sizeof(owner_name));
+
+    if (kind == REF_TAIL) {
+        if (!tail_fields_valid(check, walk->inode)) {
+            report(check, SSFS_CHECK_TAIL, "tail of %s at block %u, offset %u, %u bytes",
+                owner_name, block, walk->inode->v2.tail_offset, walk->inode->v2.tail_length);
+            walk->damaged = true;
+            return WALK_SKIP;
+        }
+        uint32_t previous = claim(check, block, OWNER_FRAGMENT);
+        if (previous != OWNER_FREE && previous != OWNER_FRAGMENT) {
+            report(check, SSFS_CHECK_DUPLICATE, "fragment block %u of %s, also used by %s",
+                block, owner_name, describe_owner(check, previous, other_name, sizeof(other_name)));
+            walk->damaged = true;
+            if (previous >= OWNER_FIRST && id_append(&worker->suspects, previous & ~OWNER_PAST_SIZE) != 0)
+                worker->ret = ssfs_EALLOC;
+        }
+        tail_ref_t tail = {block, walk->inode->v2.tail_offset, walk->inode->v2.tail_length, walk->owner};
+        if (tail_append(&worker->tails, tail) != 0)
+            worker->ret = ssfs_EALLOC;
+        return WALK_CONTINUE;
+    }
+
+    if (kind == REF_DATA) {
+        if (logical != walk->data_seen)
+            walk->bad_map = true;
+        walk->data_seen++;
+    }
+
+    if (block < check->first_data || block >= check->blocks) {
+        report(check, SSFS_CHECK_RANGE, "block %u of %s, at logical block %u", block, owner_name, logical);
+        walk->damaged = true;
+        return WALK_SKIP;
+    }
+
+    // A block past the size may be one of a failed extension, or a pointer
+    // gone wrong: any block in the size of a file is kept before it
+    uint32_t claimant = walk->owner | (logical >= walk->expected ? OWNER_PAST_SIZE : 0);
+    uint32_t previous = claim(check, block, claimant);
+    if ((previous & ~OWNER_PAST_SIZE) == walk->owner) {
+        report(check, SSFS_CHECK_DUPLICATE, "block %u referenced twice by %s", block, owner_name);
+        walk->damaged = true;
+        return WALK_SKIP;
+    }
+    if (previous != OWNER_FREE) {
+        report(check, SSFS_CHECK_DUPLICATE, "block %u of %s, also used by %s",
+            block, owner_name, describe_owner(check, previous, other_name, sizeof(other_name)));
+        walk->damaged = true;
+        if (previous >= OWNER_FIRST && id_append(&worker->suspects, previous & ~OWNER_PAST_SIZE) != 0)
+            worker->ret = ssfs_EALLOC;
+    }
+    return WALK_CONTINUE;
+}
+
+/**
+ * @brief Visits a block referenced by a damaged file during the repair, in
+ * logical order: the walk stops at the first reference that isn't the
+ * file's to keep.
+ */
+static int repair_visit(walk_t *walk, uint32_t block, ref_kind_t kind, uint32_t logical) {
+    check_t *check = walk->check;
+
+    if (kind == REF_TAIL) {
+        walk->keep_tail = tail_fields_valid(check, walk->inode) && check->owners[block] == OWNER_FRAGMENT &&
+            !id_contains(&check->bad_tails, walk->owner) && walk->data_seen == walk->expected;
+        return WALK_CONTINUE;
+    }
+
+    bool bad = block < check->first_data || block >= check->blocks ||
+        (check->owners[block] & ~OWNER_PAST_SIZE) != walk->owner || check->visited[block] == walk->owner ||
+        logical != walk->data_seen || (!walk->orphan && logical >= walk->expected);
+    if (bad)
+        return WALK_STOP;
+
+    check->visited[block] = walk->owner;
+    if (kind == REF_DATA)
+        walk->data_seen++;
+    return WALK_CONTINUE;
+}
+
+static int visit(walk_t *walk, uint32_t block, ref_kind_t kind, uint32_t logical) {
+    if (walk->worker == NULL)
+        return repair_visit(walk, block, kind, logical);
+    return check_visit(walk, block, kind, logical);
+}
+
+/**
+ * @brief Walks the block map of a version 1 inode: direct blocks, then the
+ * indirect block, then the double indirect block.
+ * @return WALK_STOP if the walk was stopped, else WALK_CONTINUE.
+ */
+static int walk_v1(walk_t *walk, inode_t *inode) {
+    uint32_t pointers = POINTERS_PER_BLOCK;
+
+    for (uint32_t d = 0; d < 4; d++)
+        if (inode->direct[d] != 0 && visit(walk, inode->direct[d], REF_DATA, d) == WALK_STOP)
+            return WALK_STOP;
+
+    if (inode->indirect1 != 0) {
+        int ret = visit(walk, inode->indirect1, REF_META, 4);
+        if (ret == WALK_STOP)
+            return ret;
+        if (ret == WALK_CONTINUE) {
+            uint32_t *data = (uint32_t *)meta_block(walk->check, inode->indirect1);
+            for (uint32_t i = 0; i < pointers; i++)
+                if (data[i] != 0 && visit(walk, data[i], REF_DATA, 4 + i) == WALK_STOP)
+                    return WALK_STOP;
+        }
+    }
+
+    if (inode->indirect2 != 0) {
+        int ret = visit(walk, inode->indirect2, REF_META, 4 + pointers);
+        if (ret != WALK_CONTINUE)
+            return ret;
+        uint32_t *indirect = (uint32_t *)meta_block(walk->check, inode->indirect2);
+        for (uint32_t i = 0; i < pointers; i++) {
+            if (indirect[i] == 0)
+                continue;
+            uint32_t first = 4 + pointers + i * pointers;
+            ret = visit(walk, indirect[i], REF_META, first);
+            if (ret == WALK_STOP)
+                return ret;
+            if (ret != WALK_CONTINUE)
+                continue;
+            uint32_t *data = (uint32_t *)meta_block(walk->check, indirect[i]);
+            for (uint32_t j = 0; j < pointers; j++)
+                if (data[j] != 0 && visit(walk, data[j], REF_DATA, first + j) == WALK_STOP)
+                    return WALK_STOP;
+        }
+    }
+    return WALK_CONTINUE;
+}
+
+/**
+ * @brief Walks the blocks of an extent. Past the end of the volume, only
+ * the first block is visited and the others are counted.
+ * @return WALK_STOP if the walk was stopped, else WALK_CONTINUE.
+ */
+static int walk_extent(walk_t *walk, extent_t *extent) {
+    uint32_t length = extent->length;
+    if (length == 0)
+        walk->bad_map = true;
+    uint32_t in_range = 0;
+    if (extent->physical < walk->check->blocks)
+        in_range = walk->check->blocks - extent->physical < length ? walk->check->blocks - extent->physical : length;
+
+    for (uint32_t b = 0; b < in_range; b++)
+        if (visit(walk, extent->physical + b, REF_DATA, extent->logical + b) == WALK_STOP)
+            return WALK_STOP;
+    if (in_range < length) {
+        if (visit(walk, extent->physical + in_range, REF_DATA, extent->logical + in_range) == WALK_STOP)
+            return WALK_STOP;
+        walk->data_seen += length - in_range - 1;
+    }
+    return WALK_CONTINUE;
+}
+
+/**
+ * @brief Walks the block map of a version 2 inode: its extents, then each
+ * overflow extent block and its extents, then the packed tail.
+ * @return WALK_STOP if the walk was stopped, else WALK_CONTINUE.
+ */
+static int walk_v2(walk_t *walk, inode_v2_t *inode) {
+    check_t *check = walk->check;
+
+    uint32_t extents_num = inode->extents_num;
+    if (extents_num > INODE_V2_EXTENTS) {
+        extents_num = INODE_V2_EXTENTS;
+        walk->bad_map = true;
+    }
+    for (uint32_t e = 0; e < extents_num; e++)
+        if (walk_extent(walk, &inode->extents[e]) == WALK_STOP)
+            return WALK_STOP;
+
+    // A chain longer than the volume loops. Extensions start from the last
+    // extent of the last extent block, which must be the tail of the chain.
+    uint32_t steps = 0, last = 0;
+    uint32_t next = inode->extent_block;
+    for (; next != 0 && steps < check->blocks; steps++) {
+        int ret = visit(walk, next, REF_META, walk->data_seen);
+        if (ret == WALK_STOP)
+            return ret;
+        if (ret != WALK_CONTINUE)
+            break;
+
+        extent_block_t *leaf = (extent_block_t *)meta_block(check, next);
+        uint32_t count = leaf->count;
+        if (count == 0 || count > LEAF_EXTENTS) {
+            if (walk->worker == NULL)
+                return WALK_STOP;
+            count = count < LEAF_EXTENTS ? count : LEAF_EXTENTS;
+            walk->bad_map = true;
+        }
+        for (uint32_t e = 0; e < count; e++)
+            if (walk_extent(walk, &leaf->extents[e]) == WALK_STOP)
+                return WALK_STOP;
+        last = next;
+        next = leaf->next;
+    }
+    if (next == 0 && inode->extent_tail != last)
+        walk->bad_map = true;
+
+    if (tail_is_packed(walk->inode))
+        return visit(walk, inode->tail_block, REF_TAIL, (uint32_t)(inode->size / BLOCK_SIZE));
+    return WALK_CONTINUE;
+}
+
+static int walk_file(walk_t *walk) {
+    if (geometry_handle.inode_version == INODE_V2)
+        return walk_v2(walk, &walk->inode->v2);
+    return walk_v1(walk, &walk->inode->v1);
+}
+
+/**
+ * @brief Tells whether the flags of an inode are some the file system sets:
+ * a file is either inline or has a packed tail.
+ */
+static bool flags_valid(any_inode_t *inode) {
+    if (geometry_handle.inode_version == INODE_V2)
+        return inode->v2.valid == 1 && (inode->v2.flags & ~(INODE_FLAG_INLINE | INODE_FLAG_TAIL)) == 0 &&
+            (inode->v2.flags & (INODE_FLAG_INLINE | INODE_FLAG_TAIL)) != (INODE_FLAG_INLINE | INODE_FLAG_TAIL);
+    return inode->v1.valid == 1 || inode->v1.valid == (1 | INODE_V1_INLINE);
+}
+
+/**
+ * @brief Keeps the flags of an inode the file system sets, the inline flag
+ * before the tail flag, as the fields of the tail would be inline data.
+ */
+static void repair_flags(any_inode_t *inode) {
+    if (geometry_handle.inode_version == INODE_V2) {
+        inode->v2.valid = 1;
+        inode->v2.flags &= inode->v2.flags & INODE_FLAG_INLINE ? INODE_FLAG_INLINE : INODE_FLAG_TAIL;
+    } else {
+        inode->v1.valid = 1 | (inode->v1.valid & INODE_V1_INLINE);
+    }
+}
+
+/**
+ * @brief Checks a file: claims its blocks, then compares its size with them.
+ */
+static void check_file(worker_t *worker, any_inode_t *inode, uint32_t owner, bool orphan) {
+    check_t *check = worker->check;
+    char owner_name[64];
+    uint64_t size = inode_get_size(inode);
+
+    if (!flags_valid(inode)) {
+        report(check, SSFS_CHECK_SIZE, "%s has bad flags",
+            describe_owner(check, owner, owner_name, sizeof(owner_name)));
+        if (id_append(&worker->suspects, owner) != 0)
+            worker->ret = ssfs_EALLOC;
+    }
+
+    if (inode_is_inline(inode)) {
+        if (size > inline_capacity()) {
+            report(check, SSFS_CHECK_SIZE, "%s holds %llu bytes inline, at most %u fit",
+                describe_owner(check, owner, owner_name, sizeof(owner_name)),
+                (unsigned long long)size, inline_capacity());
+            if (id_append(&worker->suspects, owner) != 0)
+                worker->ret = ssfs_EALLOC;
+        }
+        return;
+    }
+
+    uint32_t expected = inode_data_blocks(inode);
+    walk_t walk = {.check = check, .worker = worker, .inode = inode, .owner = owner, .orphan = orphan};
+    walk.expected = orphan ? UINT32_MAX : expected;
+    walk_file(&walk);
+
+    // A failed extension of a version 2 inode leaves blocks mapped past the
+    // size, used by the next one, where version 1 inodes would lose them
+    bool past_size = walk.data_seen > expected && geometry_handle.inode_version == INODE_V2;
+    if (!orphan && (walk.bad_map || (walk.data_seen != expected && !past_size))) {
+        report(check, SSFS_CHECK_SIZE, "%s of %llu bytes, %u blocks expected, %u referenced%s",
+            describe_owner(check, owner, owner_name, sizeof(owner_name)), (unsigned long long)size,
+            expected, walk.data_seen, walk.bad_map ? ", with a bad block map" : "");
+        walk.damaged = true;
+    }
+    if (walk.damaged && id_append(&worker->suspects, owner) != 0)
+        worker->ret = ssfs_EALLOC;
+}
+
+/**
+ * @brief Tells whether an inode holds only zeros.
+ */
+static bool inode_is_zero(any_inode_t *inode) {
+    const uint8_t *bytes = (const uint8_t *)inode;
+    for (uint32_t b = 0; b < geometry_handle.inode_size; b++)
+        if (bytes[b] != 0)
+            return false;
+    return true;
+}
+
+/**
+ * @brief Worker checking the files of the inode blocks it takes, those of
+ * the table then those of the orphan list.
+ */
+static void *inode_worker(void *arg) {
+    worker_t *worker = arg;
+    check_t *check = worker->check;
+    uint32_t items = check->table_blocks + check->sb.orphan_blocks;
+
+    for (;;) {
+        uint32_t first = __atomic_fetch_add(&check->cursor, INODE_WORK_BLOCKS, __ATOMIC_RELAXED);
+        if (first >= items)
+            break;
+        uint32_t end = items - first < INODE_WORK_BLOCKS ? items : first + INODE_WORK_BLOCKS;
+
+        for (uint32_t item = first; item < end; item++) {
+            bool orphan = item >= check->table_blocks;
+            uint32_t block = orphan ? check->sb.orphan_start + (item - check->table_blocks) : table_block(check, item);
+            uint8_t *inodes = meta_block(check, block);
+
+            for (uint32_t i = 0; i < geometry_handle.inodes_per_block; i++) {
+                any_inode_t *inode = inode_at(inodes, i);
+                if (!inode_in_use(inode)) {
+                    // create() takes a free inode as it is
+                    if (!inode_is_zero(inode)) {
+                        report(check, SSFS_CHECK_FREE_INODE, "%s %u", orphan ? "orphan slot" : "inode",
+                            orphan ? (item - check->table_blocks) * geometry_handle.inodes_per_block + i
+                                   : item * geometry_handle.inodes_per_block + i);
+                        if (check->repairing)
+                            memset(inode, 0, geometry_handle.inode_size);
+                    }
+                    continue;
+                }
+                if (orphan)
+                    worker->orphans++;
+                else
+                    worker->used_inodes++;
+                check_file(worker, inode, OWNER_FIRST + item * geometry_handle.inodes_per_block + i, orphan);
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Tells whether a block holds only zeros.
+ */
+static bool block_is_zero(const uint8_t *data) {
+    const uint64_t *words = (const uint64_t *)data;
+    for (uint32_t w = 0; w < (uint32_t)BLOCK_SIZE / sizeof(uint64_t); w++)
+        if (words[w] != 0)
+            return false;
+    return true;
+}
+
+/**
+ * @brief Worker counting the used blocks of the ranges it takes and looking
+ * for data in their free blocks. Those are zeroed by a repair.
+ */
+static void *free_worker(void *arg) {
+    worker_t *worker = arg;
+    check_t *check = worker->check;
+
+    for (;;) {
+        uint32_t first = __atomic_fetch_add(&check->cursor, FREE_WORK_BLOCKS, __ATOMIC_RELAXED);
+        if (first >= check->blocks)
+            break;
+        uint32_t end = check->blocks - first < FREE_WORK_BLOCKS ? check->blocks : first + FREE_WORK_BLOCKS;
+
+        for (uint32_t block = first; block < end; block++)
+            if (check->owners[block] != OWNER_FREE)
+                worker->used_blocks++;
+
+        // Holes of the image read as zeros, they are skipped
+        uint64_t position = (uint64_t)first * BLOCK_SIZE;
+        uint32_t block = first;
+        while (block < end) {
+            uint64_t data = vdisk_map_next_data(&check->mapping, position);
+            if (data > position)
+                block = (uint32_t)(data / BLOCK_SIZE);
+            if (block >= end)
+                break;
+
+            // Up to the end of the range, at most, as the data may stop anywhere
+            for (; block < end; block++) {
+                if (check->owners[block] != OWNER_FREE || block < check->first_data)
+                    continue;
+                uint8_t *content = check->mapping.data + (uint64_t)block * BLOCK_SIZE;
+                if (block_is_zero(content))
+                    continue;
+                report(check, SSFS_CHECK_LEAK, "free block %u holds data", block);
+                if (check->repairing)
+                    vdisk_map_zero(&check->mapping, (uint64_t)block * BLOCK_SIZE, BLOCK_SIZE);
+            }
+            position = (uint64_t)block * BLOCK_SIZE;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Runs `work` on the workers, and merges what they found.
+ * @return 0 on success, negative error code on failure.
+ */
+static int run_workers(check_t *check, void *(*work)(void *)) {
+    int ret = 0;
+    pthread_t threads[CHECK_MAX_THREADS];
+    worker_t workers[CHECK_MAX_THREADS];
+    int started = 0;
+
+    check->cursor = 0;
+    memset(workers, 0, sizeof(workers));
+    for (int t = 0; t < check->threads; t++) {
+        workers[t].check = check;
+        if (t > 0 && pthread_create(&threads[t], NULL, work, &workers[t]) != 0)
+            break;
+        started = t + 1;
+    }
+    work(&workers[0]);  // The calling thread works as well
+    for (int t = 1; t < started; t++)
+        pthread_join(threads[t], NULL);
+
+    for (int t = 0; t < check->threads; t++) {
+        worker_t *worker = &workers[t];
+        check->used_inodes += worker->used_inodes;
+        check->orphans += worker->orphans;
+        check->used_blocks += worker->used_blocks;
+        for (uint32_t i = 0; i < worker->suspects.num && ret == 0; i++)
+            ret = id_append(&check->suspects, worker->suspects.items[i]);
+        for (uint32_t i = 0; i < worker->tails.num && ret == 0; i++)
+            ret = tail_append(&check->tails, worker->tails.items[i]);
+        if (worker->ret != 0)
+            ret = worker->ret;
+        free(worker->suspects.items);
+        free(worker->tails.items);
+    }
+    return ret;
+}
+
+/**
+ * @brief Finds the packed tails overlapping a tail of a lower offset in the
+ * same fragment block.
+ * @return 0 on success, negative error code on failure.
+ */
+static int check_tail_overlaps(check_t *check) {
+    int ret = 0;
+    tail_list_t *tails = &check->tails;
+    if (tails->num > 0)
+        qsort(tails->items, tails->num, sizeof(tail_ref_t), compare_tails);
+
+    uint32_t end = 0;
+    for (uint32_t t = 0; t < tails->num && ret == 0; t++) {
+        tail_ref_t *tail = &tails->items[t];
+        if (t > 0 && tail->block == tails->items[t - 1].block && tail->offset < end) {
+            char owner_name[64];
+            report(check, SSFS_CHECK_TAIL, "tail of %s overlaps another one in fragment block %u",
+                describe_owner(check, tail->owner, owner_name, sizeof(owner_name)), tail->block);
+            ret = id_append(&check->bad_tails, tail->owner);
+            if (ret == 0)
+                ret = id_append(&check->suspects, tail->owner);
+        }
+        if (t == 0 || tail->block != tails->items[t - 1].block || tail->offset + tail->length > end)
+            end = tail->offset + tail->length;
+    }
+    id_sort_unique(&check->bad_tails);
+    return ret;
+}
+
+/**
+ * @brief Claims the blocks of the system for OWNER_SYSTEM: the superblock,
+ * the reserved inode table, the journal, the orphan list, and the blocks
+ * the inode table grew into with its chain.
+ * @return 0 on success, negative error code on failure.
+ */
+static int claim_system_blocks(check_t *check) {
+    for (uint32_t block = 0; block < check->first_data; block++)
+        check->owners[block] = OWNER_SYSTEM;
+
+    for (uint32_t e = 1; e < check->table_num; e++)
+        for (uint32_t b = 0; b < check->table[e].length; b++)
+            if (claim(check, check->table[e].physical + b, OWNER_SYSTEM) != OWNER_FREE)
+                report(check, SSFS_CHECK_DUPLICATE, "block %u of the inode table used twice", check->table[e].physical + b);
+
+    for (uint32_t next = check->sb.inode_table_next; next != 0;) {
+        if (claim(check, next, OWNER_SYSTEM) != OWNER_FREE) {
+            report(check, SSFS_CHECK_DUPLICATE, "block %u of the inode table used twice", next);
+            break;
+        }
+        next = ((extent_block_t *)meta_block(check, next))->next;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks every file, then the free blocks and the counters of the
+ * superblock.
+ * @return 0 on success, negative error code on failure.
+ */
+static int check_volume(check_t *check) {
+    int ret = 0;
+
+    memset(check->owners, 0, (size_t)check->blocks * sizeof(uint32_t));
+    memset(check->found, 0, sizeof(check->found));
+    memset(check->reported, 0, sizeof(check->reported));
+    check->used_inodes = 0;
+    check->orphans = 0;
+    check->used_blocks = 0;
+    check->suspects.num = 0;
+    check->bad_tails.num = 0;
+    check->tails.num = 0;
+
+    ret = claim_system_blocks(check);
+    if (ret != 0)
+        return ret;
+    ret = run_workers(check, inode_worker);
+    if (ret != 0)
+        return ret;
+    ret = check_tail_overlaps(check);
+    if (ret != 0)
+        return ret;
+    id_sort_unique(&check->suspects);
+    ret = run_workers(check, free_worker);
+    if (ret != 0)
+        return ret;
+
+    // The counters are written in the home superblock by unmount()
+    superblock_t *home = (superblock_t *)check->mapping.data;
+    uint32_t free_blocks = check->blocks - check->used_blocks;
+    uint32_t free_inodes = check->table_blocks * geometry_handle.inodes_per_block - check->used_inodes;
+    if (home->free_blocks != free_blocks || home->free_inodes != free_inodes) {
+        report(check, SSFS_CHECK_COUNTERS, "%u free blocks and %u free inodes recorded, %u and %u found",
+            home->free_blocks, home->free_inodes, free_blocks, free_inodes);
+        if (check->repairing) {
+            home->free_blocks = free_blocks;
+            home->free_inodes = free_inodes;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Keeps the extents of `extents` covering the logical blocks below
+ * `kept`, the last one shortened if needed.
+ * @return The number of extents kept.
+ */
+static uint32_t trim_extents(extent_t *extents, uint32_t num, uint32_t kept, uint32_t *covered) {
+    uint32_t trimmed = 0;
+    for (uint32_t e = 0; e < num && *covered < kept; e++) {
+        if (extents[e].length == 0)
+            continue;
+        extents[trimmed] = extents[e];
+        if (extents[trimmed].length > kept - *covered)
+            extents[trimmed].length = kept - *covered;
+        *covered += extents[trimmed].length;
+        trimmed++;
+    }
+    return trimmed;
+}
+
+/**
+ * @brief Cuts the block map of a version 1 inode after its first `kept`
+ * data blocks.
+ */
+static void truncate_v1(check_t *check, inode_t *inode, uint32_t kept) {
+    uint32_t pointers = POINTERS_PER_BLOCK;
+
+    for (uint32_t d = kept < 4 ? kept : 4; d < 4; d++)
+        inode->direct[d] = 0;
+
+    if (kept <= 4)
+        inode->indirect1 = 0;
+    else if (inode->indirect1 != 0 && kept < 4 + pointers)
+        memset((uint32_t *)meta_block(check, inode->indirect1) + (kept - 4), 0, (pointers - (kept - 4)) * sizeof(uint32_t));
+
+    if (kept <= 4 + pointers) {
+        inode->indirect2 = 0;
+        return;
+    }
+    uint32_t rest = kept - 4 - pointers;
+    uint32_t full = rest / pointers;
+    if (inode->indirect2 == 0 || full >= pointers)
+        return;
+
+    uint32_t *indirect = (uint32_t *)meta_block(check, inode->indirect2);
+    uint32_t first_cleared = full;
+    if (rest % pointers != 0) {
+        if (indirect[full] != 0)
+            memset((uint32_t *)meta_block(check, indirect[full]) + rest % pointers, 0,
+                (pointers - rest % pointers) * sizeof(uint32_t));
+        first_cleared++;
+    }
+    memset(indirect + first_cleared, 0, (pointers - first_cleared) * sizeof(uint32_t));
+}
+
+/**
+ * @brief Cuts the block map of a version 2 inode after its first `kept`
+ * data blocks, unlinking the extent blocks left empty.
+ */
+static void truncate_v2(check_t *check, inode_v2_t *inode, uint32_t kept) {
+    uint32_t covered = 0;
+    uint32_t extents_num = inode->extents_num < INODE_V2_EXTENTS ? inode->extents_num : INODE_V2_EXTENTS;
+    inode->extents_num = trim_extents(inode->extents, extents_num, kept, &covered);
+
+    uint32_t previous = 0;
+    for (uint32_t next = inode->extent_block; next != 0 && covered < kept;) {
+        extent_block_t *leaf = (extent_block_t *)meta_block(check, next);
+        uint32_t count = leaf->count < LEAF_EXTENTS ? leaf->count : LEAF_EXTENTS;
+        leaf->count = trim_extents(leaf->extents, count, kept, &covered);
+        if (leaf->count == 0)
+            break;
+        previous = next;
+        next = leaf->next;
+    }
+
+    if (previous == 0)
+        inode->extent_block = 0;
+    else
+        ((extent_block_t *)meta_block(check, previous))->next = 0;
+    inode->extent_tail = previous;
+}
+
+/**
+ * @brief Repairs a damaged file: cuts it at its first bad reference and
+ * lowers its size to the blocks left.
+ */
+static void repair_file(check_t *check, uint32_t owner) {
+    uint32_t slot = owner - OWNER_FIRST;
+    uint32_t item = slot / geometry_handle.inodes_per_block;
+    bool orphan = item >= check->table_blocks;
+    uint32_t block = orphan ? check->sb.orphan_start + (item - check->table_blocks) : table_block(check, item);
+    any_inode_t *inode = inode_at(meta_block(check, block), slot % geometry_handle.inodes_per_block);
+    uint64_t size = inode_get_size(inode);
+
+    repair_flags(inode);
+    if (inode_is_inline(inode)) {
+        if (size > inline_capacity())
+            size = inline_capacity();
+    } else {
+        walk_t walk = {.check = check, .inode = inode, .owner = owner, .orphan = orphan};
+        walk.expected = inode_data_blocks(inode);
+        walk_file(&walk);
+
+        uint32_t kept = walk.data_seen;
+        if (geometry_handle.inode_version == INODE_V2)
+            truncate_v2(check, &inode->v2, kept);
+        else
+            truncate_v1(check, &inode->v1, kept);
+
+        bool keep_tail = tail_is_packed(inode) && walk.keep_tail;
+        if (tail_is_packed(inode) && !keep_tail) {
+            inode->v2.flags &= ~INODE_FLAG_TAIL;
+            inode->v2.tail_block = 0;
+            inode->v2.tail_offset = 0;
+            inode->v2.tail_length = 0;
+        }
+        if (!keep_tail && (uint64_t)kept * BLOCK_SIZE < size)
+            size = (uint64_t)kept * BLOCK_SIZE;
+    }
+
+    if (geometry_handle.inode_version == INODE_V2)
+        inode->v2.size = size;
+    else
+        inode->v1.size = (uint32_t)size;
+}
+
+/**
+ * @brief Reads a block of the mapped image, for `journal_scan()`.
+ */
+static int read_image_block(uint32_t block, uint8_t *buffer, void *arg) {
+    check_t *check = arg;
+    if ((uint64_t)(block + 1) * BLOCK_SIZE > check->mapping.size)
+        return vdisk_EEXCEED;
+    memcpy(buffer, check->mapping.data + (uint64_t)block * BLOCK_SIZE, BLOCK_SIZE);
+    return 0;
+}
+
+/**
+ * @brief Finds the images of the committed journal records, the latest one
+ * of each block standing in for it.
+ * @return 0 on success, negative error code on failure.
+ */
+static int load_journal(check_t *check) {
+    int ret = 0;
+    if (check->sb.journal_blocks == 0)
+        return ret;
+
+    journal_entry_t *entries = NULL;
+    uint32_t count = 0;
+    ret = journal_scan(check->sb.journal_start, check->sb.journal_blocks, read_image_block, check,
+        &entries, &count, &check->journal_next_seq);
+    if (ret != 0)
+        return ret;
+
+    check->overlay_sectors = malloc((count + 1) * sizeof(uint32_t));
+    check->overlay_positions = malloc((count + 1) * sizeof(uint32_t));
+    if (check->overlay_sectors == NULL || check->overlay_positions == NULL) {
+        free(entries);
+        return ssfs_EALLOC;
+    }
+
+    // Later images replace earlier ones, as the replay writes them in order
+    for (uint32_t e = 0; e < count; e++) {
+        if (!journal_entry_applies(entries, count, e) || entries[e].sector >= check->blocks)
+            continue;
+        uint32_t o = 0;
+        while (o < check->overlay_num && check->overlay_sectors[o] != entries[e].sector)
+            o++;
+        if (o == check->overlay_num)
+            check->overlay_num++;
+        check->overlay_sectors[o] = entries[e].sector;
+        check->overlay_positions[o] = entries[e].position;
+    }
+    free(entries);
+
+    // Sorted by sector for meta_block(), the positions following
+    for (uint32_t i = 1; i < check->overlay_num; i++) {
+        uint32_t sector = check->overlay_sectors[i], position = check->overlay_positions[i];
+        uint32_t j = i;
+        for (; j > 0 && check->overlay_sectors[j - 1] > sector; j--) {
+            check->overlay_sectors[j] = check->overlay_sectors[j - 1];
+            check->overlay_positions[j] = check->overlay_positions[j - 1];
+        }
+        check->overlay_sectors[j] = sector;
+        check->overlay_positions[j] = position;
+    }
+    return ret;
+}
+
+/**
+ * @brief Replays the journal images in place and starts a new journal
+ * cycle, as `mount()` does, so that the repair writes home blocks only.
+ */
+static void replay_journal(check_t *check) {
+    for (uint32_t o = 0; o < check->overlay_num; o++)
+        memcpy(check->mapping.data + (uint64_t)check->overlay_sectors[o] * BLOCK_SIZE,
+            check->mapping.data + (uint64_t)(check->sb.journal_start + check->overlay_positions[o]) * BLOCK_SIZE,
+            BLOCK_SIZE);
+    check->overlay_num = 0;
+
+    journal_block_t *header = (journal_block_t *)(check->mapping.data + (uint64_t)check->sb.journal_start * BLOCK_SIZE);
+    memset(header, 0, BLOCK_SIZE);
+    header->magic = JOURNAL_MAGIC;
+    header->type = JOURNAL_HEADER;
+    header->seq = check->journal_next_seq;
+}
+
+/**
+ * @brief Loads the extents of the inode table from the superblock and its
+ * chain, checking that they lie in the volume.
+ * @return 0 on success, ssfs_EINODE if the chain is damaged.
+ */
+static int load_table(check_t *check) {
+    uint32_t capacity = 16;
+    check->table = malloc(capacity * sizeof(extent_t));
+    if (check->table == NULL)
+        return ssfs_EALLOC;
+    check->table[0] = (extent_t){0, 1, check->sb.num_inode_blocks};
+    check->table_num = 1;
+    check->table_blocks = check->sb.num_inode_blocks;
+
+    uint32_t steps = 0;
+    for (uint32_t next = check->sb.inode_table_next; next != 0; steps++) {
+        if (next < check->first_data || next >= check->blocks || steps >= check->blocks)
+            return ssfs_EINODE;
+        extent_block_t *leaf = (extent_block_t *)meta_block(check, next);
+        if (leaf->count > LEAF_EXTENTS)
+            return ssfs_EINODE;
+
+        for (uint32_t e = 0; e < leaf->count; e++) {
+            extent_t extent = leaf->extents[e];
+            if (extent.logical != check->table_blocks || extent.physical < check->first_data ||
+                extent.physical >= check->blocks || check->blocks - extent.physical < extent.length)
+                return ssfs_EINODE;
+            if (check->table_num == capacity) {
+                capacity *= 2;
+                extent_t *grown = realloc(check->table, capacity * sizeof(extent_t));
+                if (grown == NULL)
+                    return ssfs_EALLOC;
+                check->table = grown;
+            }
+            check->table[check->table_num++] = extent;
+            check->table_blocks += extent.length;
+        }
+        next = leaf->next;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads the superblock and derives the layout of the volume.
+ * @return 0 on success, negative error code if the image isn't a volume.
+ */
+static int load_superblock(check_t *check) {
+    if (check->mapping.size < sizeof(superblock_t))
+        return ssfs_ESBINIT;
+    superblock_t *sb = (superblock_t *)check->mapping.data;
+    if (!is_magic_ok(sb->magic))
+        return ssfs_EMAGIC;
+
+    int ret = _compute_geometry(sb->block_size, sb->inode_version ? sb->inode_version : INODE_V1, &geometry_handle);
+    if (ret != 0)
+        return ret;
+    geometry_handle.features = sb->features;
+
+    check->blocks = sb->num_blocks;
+    check->first_data = 1 + sb->num_inode_blocks + sb->journal_blocks + sb->orphan_blocks;
+    if ((uint64_t)check->blocks * BLOCK_SIZE > check->mapping.size || check->first_data > check->blocks ||
+        sb->journal_start != 1 + sb->num_inode_blocks || sb->orphan_start != sb->journal_start + sb->journal_blocks)
+        return ssfs_ESBINIT;
+
+    // The superblock itself may be newer in the journal
+    check->sb = *sb;
+    ret = load_journal(check);
+    if (ret != 0)
+        return ret;
+    check->sb = *(superblock_t *)meta_block(check, 0);
+    return 0;
+}
+
+/**
+ * @brief Checks the consistency of an image offline, and repairs it if
+ * asked.
+ *
+ * Every file's block map is walked, in parallel, to find the blocks out of
+ * the data region, the blocks referenced twice, the sizes that don't match
+ * the blocks referenced and the bad packed tails; then the free blocks
+ * holding data, that is leaked, and the free counts of the superblock.
+ * Without repair, the image is only read, the committed journal records
+ * being taken into account as if replayed.
+ *
+ * @param disk_name The image, a file or an in-memory image. It must not be
+ * mounted.
+ * @param options How to check, NULL for a read-only check with the default
+ * number of threads.
+ * @param report Filled with the problems found, and those left after the
+ * repair. May be NULL.
+ *
+ * @return 0 if the check ran, whether problems were found or not.
+ * @return Negative integer (error codes) if it couldn't run, as for an
+ * image that isn't a volume.
+ */
+int ssfs_check(char *disk_name, const ssfs_check_options_t *options, ssfs_check_report_t *report_out) {
+    int ret = 0;
+    uint64_t start = stats_clock();
+    check_t check;
+    memset(&check, 0, sizeof(check));
+    pthread_mutex_init(&check.mutex, NULL);
+    check.repairing = options != NULL && options->repair;
+    check.verbose = options != NULL && options->verbose;
+    check.threads = options != NULL && options->threads > 0 ? options->threads : CHECK_THREADS;
+    if (check.threads > CHECK_MAX_THREADS)
+        check.threads = CHECK_MAX_THREADS;
+
+    // The geometry of the image replaces that of the volume, if one is mounted
+    if (is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    ret = vdisk_map(disk_name, check.repairing, &check.mapping);
+    if (ret != 0)
+        goto error_management;
+    ret = load_superblock(&check);
+    if (ret != 0)
+        goto error_management_unmap;
+    uint32_t journal_images = check.overlay_num;
+    if (check.repairing)
+        replay_journal(&check);
+
+    ret = load_table(&check);
+    if (ret != 0)
+        goto error_management_unmap;
+
+    check.owners = malloc((size_t)check.blocks * sizeof(uint32_t));
+    if (check.owners == NULL) {
+        ret = ssfs_EALLOC;
+        goto error_management_unmap;
+    }
+
+    ret = check_volume(&check);
+    if (ret != 0)
+        goto error_management_unmap;
+
+    ssfs_check_report_t result;
+    memset(&result, 0, sizeof(result));
+    memcpy(result.found, check.found, sizeof(result.found));
+    memcpy(result.remaining, check.found, sizeof(result.remaining));
+
+    // The damaged files are cut, then the volume checked again, which
+    // zeroes the blocks just cut
+    if (check.repairing && check.suspects.num > 0) {
+        check.visited = calloc(check.blocks, sizeof(uint32_t));
+        if (check.visited == NULL) {
+            ret = ssfs_EALLOC;
+            goto error_management_unmap;
+        }
+        for (uint32_t s = 0; s < check.suspects.num; s++)
+            repair_file(&check, check.suspects.items[s]);
+        ret = check_volume(&check);
+        if (ret != 0)
+            goto error_management_unmap;
+        memcpy(result.remaining, check.found, sizeof(result.remaining));
+        result.found[SSFS_CHECK_LEAK] += check.found[SSFS_CHECK_LEAK];
+    }
+
+    // Those are repaired as they are found
+    if (check.repairing) {
+        result.remaining[SSFS_CHECK_FREE_INODE] = 0;
+        result.remaining[SSFS_CHECK_LEAK] = 0;
+        result.remaining[SSFS_CHECK_COUNTERS] = 0;
+    }
+    if (check.repairing) {
+        ret = vdisk_map_sync(&check.mapping);
+        if (ret != 0)
+            goto error_management_unmap;
+    }
+
+    result.journal_blocks = journal_images;
+    result.inodes = check.table_blocks * geometry_handle.inodes_per_block;
+    result.used_inodes = check.used_inodes;
+    result.orphans = check.orphans;
+    result.blocks = check.blocks;
+    result.used_blocks = check.used_blocks;
+    result.elapsed_ns = stats_clock() - start;
+    if (report_out != NULL)
+        *report_out = result;
+
+error_management_unmap:
+    vdisk_unmap(&check.mapping);
+    free(check.overlay_sectors);
+    free(check.overlay_positions);
+    free(check.table);
+    free(check.owners);
+    free(check.visited);
+    free(check.suspects.items);
+    free(check.bad_tails.items);
+    free(check.tails.items);
+    pthread_mutex_destroy(&check.mutex);
+    if (ret == 0)
+        return ret;
+
+error_management:
+    fprintf(stderr, "Error when checking an image (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Returns the name of a problem, as "leaked blocks" for SSFS_CHECK_LEAK.
+ */
+const char *ssfs_check_problem_name(ssfs_check_problem_t problem) {
+    if ((int)problem < 0 || problem >= SSFS_CHECK_NUM)
+        return "unknown";
+    return problem_names[problem];
+}
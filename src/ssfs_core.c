@@ -1,269 +1,639 @@
-/*
- * Author: Valérian Wislez
- *
- * ssfs_core.c
- * ==============
- * 
- * Manages the core functionalities of the filesystem.
- * That is formating, mounting, unmounting, and their respective helper 
- * functions.
- *  
- */
-
-#include <stdint.h>
-#include <string.h>
-#include <stdlib.h>
-
-#include "fs.h"
-#include "ssfs_internal.h"
-#include "error.h"
-
-DISK* disk_handle = NULL;
-bool* allocated_blocks_handle = NULL;
-
-/**
- * @brief Formats a disk with the Simple and Secure File System (SSFS).
- *
- * This function initializes a disk image file with a new SSFS file system. It creates the
- * superblock in the first sector of the disk image.
- *
- * @param disk_name The file path of the disk image to format as a C-style string.
- * @param inodes The desired number of inodes to create in the file system. If this
- * value is 0 or negative, it will default to 1.
- *
- * @return 0 on success.
- * @return Negative integer (error codes) on failure. See errors.h.
- *
- * @note This is a destructive operation. Any existing data on the disk image
- * will be erased. The function assumes the disk is not currently mounted.
- */
-int format(char *disk_name, int inodes) {
-    int ret = 0;
-    uint8_t buffer[VDISK_SECTOR_SIZE];
-
-    if (is_mounted()) {
-        ret = ssfs_EMOUNT;
-        goto error_management;
-    }
-
-    if (!is_inode_positive(inodes))
-        inodes = 1;
-
-    // Turning on the virtual disk
-    DISK disk;
-    ret = vdisk_on(disk_name, &disk);
-    if (ret != 0)
-        goto error_management; 
-    
-    // Calculate how many 32-inodes blocks are needed.
-    // Need at least 1 superblock + inode blocks + 1 data block
-    uint32_t inode_blocks = (inodes + 31) / 32;
-    if (disk.size_in_sectors < inode_blocks + 2) {
-        ret = ssfs_ENOSPACE;
-        goto error_management_shutdown_disk;
-    }
-    
-    // Clear all the sectors on disk
-    memset(buffer, 0, VDISK_SECTOR_SIZE);
-    for (uint32_t sector = 0; sector < disk.size_in_sectors; sector++) {
-        ret = vdisk_write(&disk, sector, buffer);
-        if (ret != 0)
-            goto error_management_shutdown_disk;
-    }
-
-    // Initialize and fill the superblock
-    superblock_t sb;
-    memset(&sb, 0, sizeof(sb));
-    memcpy(sb.magic, MAGIC_NUMBER, 16);
-    sb.num_blocks       = disk.size_in_sectors;
-    sb.num_inode_blocks = inode_blocks;
-    sb.block_size       = VDISK_SECTOR_SIZE;
-    memcpy(buffer, &sb, sizeof(superblock_t));
-    ret = vdisk_write(&disk, 0, buffer);
-    if (ret != 0)
-        goto error_management_shutdown_disk;
-
-    // Terminate connection with virtual disk
-    ret = vdisk_sync(&disk);
-    if (ret != 0)
-        goto error_management_shutdown_disk;
-
-    vdisk_off(&disk);
-    return ret;
-
-error_management_shutdown_disk:
-    vdisk_off(&disk);
-
-error_management:
-    fprintf(stderr, "Error when formatting (code %d).\n", ret);
-    return ret;
-}
-
-/**
- * @brief Mounts a virtual disk for use.
- *
- * This function prepares a virtual disk, specified by its image file, for access
- * by the file system. It initializes internal data structures and makes the
- * file system ready for operations like creating, reading, and writing files.
- *
- * @param disk_name The file path of the disk image to mount, as a C-style string.
- *
- * @return 0 on success.
- * @return Negative integer (error codes) on failure.
- *
- * @note This implementation assumes and enforces that only a single volume
- * can be mounted at any given time. Subsequent calls to `mount` while another
- * volume is already mounted will result in an error.
- */
-int mount(char *disk_name) {
-    int ret = 0;
-    uint8_t buffer[VDISK_SECTOR_SIZE];
-
-    if (is_mounted()) {
-        ret = ssfs_EMOUNT;
-        goto error_management_simple_error;
-    }
-
-    // Allocate the global disk pointer
-    disk_handle = malloc(sizeof(DISK));
-    if (disk_handle == NULL) {
-        ret = ssfs_EDISKPTR;
-        goto error_management_simple_error;
-    }
-    
-    // Turning on the virtual disk
-    ret = vdisk_on(disk_name, disk_handle);
-    if (ret != 0) {
-        ret = vdisk_EACCESS;
-        goto error_management_deallocate_disk_handle;
-    }
-
-    // Reading superblock
-    ret = vdisk_read(disk_handle, 0, buffer);
-    if (ret != 0)
-        goto error_management_shut_down_disk;
-    superblock_t *sb = (superblock_t *)buffer;
-
-    // Check magic number
-    if (!is_magic_ok(sb->magic)) {
-        ret = ssfs_EMAGIC;
-        goto error_management_shut_down_disk;
-    }
-
-    // Allocating the block allocation bitmap
-    allocated_blocks_handle = (bool *)calloc(sb->num_blocks, sizeof(bool));
-    if (allocated_blocks_handle == NULL) {
-        ret = ssfs_EALLOC;
-        goto error_management_shut_down_disk;
-    }
-
-    ret = _initialize_allocated_blocks();
-    if (ret != 0)
-        goto error_management_deallocated_blocks_handle;
-    
-    return ret;
-
-    // Else, we incrementaly free ressources.
-error_management_deallocated_blocks_handle:
-    free(allocated_blocks_handle);
-    allocated_blocks_handle = NULL;
-
-error_management_shut_down_disk:
-    vdisk_off(disk_handle);
-
-error_management_deallocate_disk_handle:
-    free(disk_handle);
-    disk_handle = NULL;
-
-error_management_simple_error:
-    fprintf(stderr, "Error when mounting (code %d).\n", ret);
-    return ret;
-}
-
-/**
- * @brief Unmounts the currently mounted virtual disk volume.
- *
- * This function disengages the mounted virtual disk from the file system,
- * releasing associated resources and making it unavailable for further operations
- * until mounted again.
- *
- * @return 0 on success.
- * @return Negative integers (error codes) on failure.
- *
- * @note This function will fail if no volume is currently mounted.
- */
-int unmount() {
-    int ret = 0;
-
-    if (!is_mounted()) {
-        ret = ssfs_EMOUNT;
-        goto error_management;
-    }
-
-    vdisk_off(disk_handle);
-    free(disk_handle);
-    disk_handle = NULL;
-    free(allocated_blocks_handle);
-    allocated_blocks_handle = NULL;
-
-    return ret;
-
-error_management:
-    fprintf(stderr, "Error when unmounting (code %d).\n", ret);
-    return ret;
-}
-
-/**
- * @brief Initializes the block allocation bitmap based on existing file system usage.
- *
- * This internal procedure scans the file system to identify all blocks currently
- * in use (e.g. superblock, inodes, and existing data). It then updates
- * a global bitmap variable to reflect these used blocks.
- *
- * @return 0 on success.
- * @return Negative integer (error codes) on failure.
- *
- * @note This function is primarily used during the `mount()` operation to establish
- * the initial state of the bitmap.
- */
-
-int _initialize_allocated_blocks() {
-    int ret = 0;
-    uint8_t buffer[VDISK_SECTOR_SIZE];
-
-    // Read the superblock
-    ret = vdisk_read(disk_handle, 0, buffer);
-    if (ret != 0) 
-        return ret;
-    superblock_t *sb = (superblock_t *)buffer;
-
-    // Compute the number of system blocks and mark them.
-    int system_blocks = 1 + sb->num_inode_blocks;
-    for (int block_num = 0; block_num < system_blocks; block_num++)
-        allocate_block(block_num);
-
-    // Foreach inode block in the filesystem
-    for (uint32_t block_num = 1; block_num < 1 + sb->num_inode_blocks; block_num++) {
-        ret = vdisk_read(disk_handle, block_num, buffer);
-        if (ret != 0)
-            return ret;
-        inodes_block_t *ib = (inodes_block_t *)buffer;
-        
-        // For each used inode in an inode block
-        for (int i = 0; i < 32; i++) {
-            if (ib[0][i].valid) {
-                for (int d = 0; d < 4; d++)
-                    if (ib[0][i].direct[d])
-                        allocate_block(ib[0][i].direct[d]);
-
-                if (ib[0][i].indirect1)
-                    allocate_indirect_block(ib[0][i].indirect1);
-
-                if (ib[0][i].indirect2)
-                    allocate_double_indirect_block(ib[0][i].indirect2);
-            }
-        }
-    }
-
-    return ret;
-}
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_core.c
+ * ==============
+ * 
+ * Manages the core functionalities of the filesystem.
+ * That is formating, mounting, unmounting, and their respective helper 
+ * functions.
+ *  
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+DISK* disk_handle = NULL;
+bool* allocated_blocks_handle = NULL;
+geometry_t geometry_handle = {
+    .block_size = 1024,
+    .pointers_per_block = 256,
+    .inode_version = INODE_V1,
+    .inode_size = sizeof(inode_t),
+    .inodes_per_block = 32,
+    .features = 0
+};
+pthread_mutex_t fs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Bounds on the size of the journal reserved by format()
+#define MIN_JOURNAL_BLOCKS 16
+#define MAX_JOURNAL_BLOCKS 1024
+
+// Size of the orphan list reserved by format(), one inode per deleted file
+#define ORPHAN_BLOCKS 1
+
+// Blocks of the inode table read at once by mount()
+#define ITABLE_SCAN_BATCH 64
+
+/**
+ * @brief Formats a disk with the Simple and Secure File System (SSFS).
+ *
+ * This function initializes a disk image file with a new SSFS file system. It creates the
+ * superblock in the first sector of the disk image.
+ *
+ * @param disk_name The file path of the disk image to format as a C-style string.
+ * @param inodes The desired number of inodes to create in the file system. If this
+ * value is 0 or negative, it will default to 1.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure. See errors.h.
+ *
+ * @note This is a destructive operation. Any existing data on the disk image
+ * will be erased. The function assumes the disk is not currently mounted.
+ */
+int format(char *disk_name, int inodes) {
+    return ssfs_format_opts(disk_name, inodes, NULL);
+}
+
+/**
+ * @brief Formats a disk, like `format()`, with the given volume parameters.
+ *
+ * @param disk_name The file path of the disk image to format as a C-style string.
+ * @param inodes The desired number of inodes, see `format()`.
+ * @param options The volume parameters, NULL for the defaults. An inode
+ * version of 2 selects extent-based inodes. The block size is a power of two
+ * between 1 KiB and 64 KiB; the number of blocks follows from the image size.
+ * Optional features are only enabled when listed.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure. See errors.h.
+ */
+int _ssfs_format_opts(char *disk_name, int inodes, const ssfs_format_options_t *options) {
+    int ret = 0;
+
+    uint32_t inode_version = INODE_V1;
+    uint32_t block_size = MIN_BLOCK_SIZE;
+    if (options != NULL && options->inode_version != 0)
+        inode_version = options->inode_version;
+    if (options != NULL && options->block_size != 0)
+        block_size = options->block_size;
+    geometry_t geometry = {0};
+    ret = _compute_geometry(block_size, inode_version, &geometry);
+    if (ret != 0)
+        goto error_management;
+
+    // Tails are addressed from spare fields of version 2 inodes only
+    uint32_t features = options != NULL ? options->features : 0;
+    if ((features & SSFS_FEATURE_TAIL_PACKING) && inode_version != INODE_V2) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    if (is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    if (!is_inode_positive(inodes))
+        inodes = 1;
+
+    // Turning on the virtual disk
+    DISK disk;
+    ret = vdisk_on(disk_name, &disk);
+    if (ret != 0)
+        goto error_management; 
+    ret = vdisk_set_sector_size(&disk, block_size);
+    if (ret != 0)
+        goto error_management_shutdown_disk;
+    
+    // Calculate how many inode blocks are needed.
+    // Need at least 1 superblock + inode blocks + 1 data block
+    uint32_t inode_blocks = (inodes + geometry.inodes_per_block - 1) / geometry.inodes_per_block;
+    if (disk.size_in_sectors < inode_blocks + 2) {
+        ret = ssfs_ENOSPACE;
+        goto error_management_shutdown_disk;
+    }
+    
+    // Reserve the journal right after the inode table, if the disk is large enough
+    uint32_t journal_blocks = (disk.size_in_sectors - 1 - inode_blocks) / 16;
+    if (journal_blocks > MAX_JOURNAL_BLOCKS)
+        journal_blocks = MAX_JOURNAL_BLOCKS;
+    if (journal_blocks < MIN_JOURNAL_BLOCKS)
+        journal_blocks = 0;
+
+    // Then the orphan list of deleted files waiting to be reclaimed
+    uint32_t orphan_blocks = ORPHAN_BLOCKS;
+    if (disk.size_in_sectors < 1 + inode_blocks + journal_blocks + orphan_blocks + 1)
+        orphan_blocks = 0;
+
+    // Write zeros on the metadata region only, the data region is discarded
+    // from the image, which reads back as zeros without being written
+    uint32_t metadata_blocks = 1 + inode_blocks + journal_blocks + orphan_blocks;
+    ret = _zero_blocks(&disk, 0, metadata_blocks);
+    if (ret != 0)
+        goto error_management_shutdown_disk;
+    ret = vdisk_discard(&disk, metadata_blocks, disk.size_in_sectors - metadata_blocks);
+    if (ret != 0)
+        goto error_management_shutdown_disk;
+
+    // Initialize and fill the superblock
+    superblock_t sb;
+    memset(&sb, 0, sizeof(sb));
+    memcpy(sb.magic, MAGIC_NUMBER, 16);
+    sb.num_blocks       = disk.size_in_sectors;
+    sb.num_inode_blocks = inode_blocks;
+    sb.block_size       = block_size;
+    sb.journal_start    = 1 + inode_blocks;
+    sb.journal_blocks   = journal_blocks;
+    sb.orphan_start     = sb.journal_start + journal_blocks;
+    sb.orphan_blocks    = orphan_blocks;
+    sb.inode_version    = geometry.inode_version;
+    sb.inode_size       = geometry.inode_size;
+    sb.features         = features;
+    sb.free_blocks      = disk.size_in_sectors - metadata_blocks;
+    sb.free_inodes      = inode_blocks * geometry.inodes_per_block;
+    ret = _write_superblock(&disk, &sb);
+    if (ret != 0)
+        goto error_management_shutdown_disk;
+
+    // Terminate connection with virtual disk
+    ret = vdisk_sync(&disk);
+    if (ret != 0)
+        goto error_management_shutdown_disk;
+
+    vdisk_off(&disk);
+    return ret;
+
+error_management_shutdown_disk:
+    vdisk_off(&disk);
+
+error_management:
+    fprintf(stderr, "Error when formatting (code %d).\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_format_opts()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_format_opts(char *disk_name, int inodes, const ssfs_format_options_t *options) {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_format_opts(disk_name, inodes, options);
+    stats_op(SSFS_OP_FORMAT, start, ret);
+    trace_record_format(start, ret, inodes, options);
+    return ret;
+}
+
+/**
+ * @brief Creates a disk image of the given size and formats it.
+ *
+ * The image is created sparse: only the metadata region is written, so this
+ * takes the same time whatever the size.
+ *
+ * @param disk_name The file path of the disk image, created if it doesn't exist.
+ * @param size_in_blocks The size of the image, in blocks.
+ * @param inodes The desired number of inodes, see `format()`.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ *
+ * @note This is a destructive operation, an existing image is overwritten.
+ */
+int _ssfs_format_new(char *disk_name, uint32_t size_in_blocks, int inodes) {
+    int ret = 0;
+
+    if (is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    ret = vdisk_create(disk_name, size_in_blocks);
+    if (ret != 0)
+        goto error_management;
+
+    return _ssfs_format_opts(disk_name, inodes, NULL);
+
+error_management:
+    fprintf(stderr, "Error when creating an image (code %d).\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_format_new()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_format_new(char *disk_name, uint32_t size_in_blocks, int inodes) {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_format_new(disk_name, size_in_blocks, inodes);
+    stats_op(SSFS_OP_FORMAT_NEW, start, ret);
+    trace_record(SSFS_OP_FORMAT_NEW, start, ret, 0, inodes, (int)size_in_blocks, NULL);
+    return ret;
+}
+
+/**
+ * @brief Mounts a virtual disk for use.
+ *
+ * This function prepares a virtual disk, specified by its image file, for access
+ * by the file system. It initializes internal data structures and makes the
+ * file system ready for operations like creating, reading, and writing files.
+ *
+ * @param disk_name The file path of the disk image to mount, as a C-style string.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ *
+ * @note This implementation assumes and enforces that only a single volume
+ * can be mounted at any given time. Subsequent calls to `mount` while another
+ * volume is already mounted will result in an error.
+ */
+int _mount(char *disk_name) {
+    int ret = 0;
+    uint8_t buffer[VDISK_SECTOR_SIZE];
+
+    if (is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management_simple_error;
+    }
+
+    // Allocate the global disk pointer
+    disk_handle = malloc(sizeof(DISK));
+    if (disk_handle == NULL) {
+        ret = ssfs_EDISKPTR;
+        goto error_management_simple_error;
+    }
+    
+    // Turning on the virtual disk
+    ret = vdisk_on(disk_name, disk_handle);
+    if (ret != 0) {
+        ret = vdisk_EACCESS;
+        goto error_management_deallocate_disk_handle;
+    }
+
+    // Reading superblock, from the first sector whatever the block size
+    ret = vdisk_read(disk_handle, 0, buffer);
+    if (ret != 0)
+        goto error_management_shut_down_disk;
+    superblock_t *sb = (superblock_t *)buffer;
+
+    // Check magic number
+    if (!is_magic_ok(sb->magic)) {
+        ret = ssfs_EMAGIC;
+        goto error_management_shut_down_disk;
+    }
+
+    // Inodes of older volumes are always version 1
+    ret = _compute_geometry(sb->block_size, sb->inode_version ? sb->inode_version : INODE_V1, &geometry_handle);
+    if (ret != 0)
+        goto error_management_shut_down_disk;
+
+    geometry_handle.features = sb->features;
+
+    // From now on, the disk is addressed in blocks
+    ret = vdisk_set_sector_size(disk_handle, sb->block_size);
+    if (ret != 0)
+        goto error_management_shut_down_disk;
+
+    // Blocks past the recorded size, as left by a failed ssfs_grow(), are unused
+    if (disk_handle->size_in_sectors > sb->num_blocks)
+        disk_handle->size_in_sectors = sb->num_blocks;
+
+    // Allocating the block allocation bitmap
+    allocated_blocks_handle = (bool *)calloc(sb->num_blocks, sizeof(bool));
+    if (allocated_blocks_handle == NULL) {
+        ret = ssfs_EALLOC;
+        goto error_management_shut_down_disk;
+    }
+
+    // Committed metadata must be in place before scanning the inodes
+    ret = journal_load(sb);
+    if (ret != 0)
+        goto error_management_deallocated_blocks_handle;
+
+    // The inode table may have grown past the blocks reserved by format()
+    ret = itable_load();
+    if (ret != 0)
+        goto error_management_release_journal;
+
+    ret = dirty_load(itable_inodes());
+    if (ret != 0)
+        goto error_management_release_itable;
+
+    ret = _initialize_allocated_blocks();
+    if (ret != 0)
+        goto error_management_release_dirty;
+
+    // Not cleanly unmounted: free blocks may hold data of lost transactions
+    if (sb->unclean) {
+        ret = _zero_free_blocks();
+        if (ret != 0)
+            goto error_management_release_dirty;
+    }
+    ret = _set_unclean(true);
+    if (ret != 0)
+        goto error_management_release_dirty;
+
+    // Resumes the reclamation of the files deleted before unmounting
+    ret = reclaim_start(sb);
+    if (ret != 0)
+        goto error_management_release_dirty;
+    
+    return ret;
+
+    // Else, we incrementaly free ressources.
+error_management_release_dirty:
+    dirty_release();
+
+error_management_release_itable:
+    itable_release();
+
+error_management_release_journal:
+    journal_release();
+
+error_management_deallocated_blocks_handle:
+    free(allocated_blocks_handle);
+    allocated_blocks_handle = NULL;
+
+error_management_shut_down_disk:
+    vdisk_off(disk_handle);
+
+error_management_deallocate_disk_handle:
+    free(disk_handle);
+    disk_handle = NULL;
+
+error_management_simple_error:
+    fprintf(stderr, "Error when mounting (code %d).\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_mount()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int mount(char *disk_name) {
+    trace_start_from_env();
+    uint64_t start = stats_clock();
+    int ret = _mount(disk_name);
+    stats_op(SSFS_OP_MOUNT, start, ret);
+    trace_record(SSFS_OP_MOUNT, start, ret, 0, 0, 0, NULL);
+    return ret;
+}
+
+/**
+ * @brief Unmounts the currently mounted virtual disk volume.
+ *
+ * This function disengages the mounted virtual disk from the file system,
+ * releasing associated resources and making it unavailable for further operations
+ * until mounted again.
+ *
+ * @return 0 on success.
+ * @return Negative integers (error codes) on failure.
+ *
+ * @note This function will fail if no volume is currently mounted.
+ */
+int _unmount() {
+    int ret = 0;
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    parallel_shutdown();
+    reclaim_stop();
+
+    // Commit pending transactions, then make the checkpoint durable
+    ret = journal_commit();
+    if (ret != 0)
+        goto error_management;
+    ret = counters_save();
+    if (ret != 0)
+        goto error_management;
+    ret = vdisk_sync(disk_handle);
+    if (ret != 0)
+        goto error_management;
+    ret = _set_unclean(false);
+    if (ret != 0)
+        goto error_management;
+    journal_release();
+    dirty_release();
+    itable_release();
+    fragments_release();
+
+    vdisk_off(disk_handle);
+    free(disk_handle);
+    disk_handle = NULL;
+    free(allocated_blocks_handle);
+    allocated_blocks_handle = NULL;
+
+    return ret;
+
+error_management:
+    fprintf(stderr, "Error when unmounting (code %d).\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_unmount()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int unmount() {
+    uint64_t start = stats_clock();
+    int ret = _unmount();
+    stats_op(SSFS_OP_UNMOUNT, start, ret);
+    trace_record(SSFS_OP_UNMOUNT, start, ret, 0, 0, 0, NULL);
+    return ret;
+}
+
+/**
+ * @brief Initializes the block allocation bitmap based on existing file system usage.
+ *
+ * This internal procedure scans the file system to identify all blocks currently
+ * in use (e.g. superblock, inodes, and existing data). It then updates
+ * a global bitmap variable to reflect these used blocks.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ *
+ * @note This function is primarily used during the `mount()` operation to establish
+ * the initial state of the bitmap.
+ */
+
+int _initialize_allocated_blocks() {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    // Read the superblock
+    ret = vdisk_read(disk_handle, 0, buffer);
+    if (ret != 0) 
+        return ret;
+    superblock_t *sb = (superblock_t *)buffer;
+
+    // Tails and counters are found again in the inodes
+    fragments_release();
+    counters_reset(itable_inodes());
+
+    // Compute the number of system blocks (superblock, inodes, journal, orphans) and mark them.
+    int system_blocks = 1 + sb->num_inode_blocks + sb->journal_blocks + sb->orphan_blocks;
+    for (int block_num = 0; block_num < system_blocks; block_num++)
+        allocate_block(block_num);
+
+    // Then the blocks the inode table grew into
+    itable_mark_blocks();
+
+    // The inode table is read by batches, its contiguous blocks merged. No
+    // transaction is pending yet, the committed metadata is in place.
+    uint32_t orphan_start = sb->orphan_start;
+    uint32_t orphan_blocks = sb->orphan_blocks;
+    vdisk_request_t requests[ITABLE_SCAN_BATCH];
+    uint8_t *table = malloc((size_t)ITABLE_SCAN_BATCH * BLOCK_SIZE);
+    if (table == NULL)
+        return ssfs_EALLOC;
+
+    for (uint32_t index = 0; index < itable_blocks(); index += ITABLE_SCAN_BATCH) {
+        uint32_t batch = itable_blocks() - index < ITABLE_SCAN_BATCH ? itable_blocks() - index : ITABLE_SCAN_BATCH;
+        for (uint32_t b = 0; b < batch; b++)
+            requests[b] = (vdisk_request_t){VDISK_READ, itable_block(index + b), 1, table + (size_t)b * BLOCK_SIZE};
+        ret = vdisk_submit(disk_handle, requests, batch, false);
+        if (ret != 0)
+            goto error_management_free;
+
+        // For each used inode in an inode block
+        for (uint32_t b = 0; b < batch; b++) {
+            uint8_t *block = table + (size_t)b * BLOCK_SIZE;
+            for (uint32_t i = 0; i < geometry_handle.inodes_per_block; i++) {
+                if (inode_in_use(inode_at(block, i))) {
+                    inode_set_blocks_status(inode_at(block, i), true);
+                    counters_inodes_used(1);
+                }
+            }
+        }
+    }
+    free(table);
+
+    // The blocks of deleted files stay in use until they are reclaimed
+    for (uint32_t block_num = orphan_start; block_num < orphan_start + orphan_blocks; block_num++) {
+        ret = meta_read(block_num, buffer);
+        if (ret != 0)
+            return ret;
+
+        for (uint32_t i = 0; i < geometry_handle.inodes_per_block; i++)
+            if (inode_in_use(inode_at(buffer, i)))
+                inode_set_blocks_status(inode_at(buffer, i), true);
+    }
+
+    return ret;
+
+error_management_free:
+    free(table);
+    return ret;
+}
+
+/**
+ * @brief Writes zeros on the blocks [first_block, first_block + count) of a
+ * disk that is not mounted.
+ * @return 0 on success, negative error code on failure.
+ */
+int _zero_blocks(DISK *disk, uint32_t first_block, uint32_t count) {
+    int ret = 0;
+    uint32_t chunk = count < 256 ? count : 256;
+    if (chunk == 0)
+        return ret;
+
+    uint8_t *zeros = calloc(chunk, disk->sector_size);
+    if (zeros == NULL)
+        return ssfs_EALLOC;
+
+    for (uint32_t done = 0; done < count; done += chunk) {
+        uint32_t n = count - done < chunk ? count - done : chunk;
+        ret = vdisk_write_range(disk, first_block + done, n, zeros);
+        if (ret != 0)
+            break;
+    }
+    free(zeros);
+    return ret;
+}
+
+/**
+ * @brief Writes the superblock of a disk that is not mounted, in a block
+ * of the disk's block size.
+ * @return 0 on success, negative error code on failure.
+ */
+int _write_superblock(DISK *disk, superblock_t *sb) {
+    uint8_t buffer[disk->sector_size];
+    memset(buffer, 0, disk->sector_size);
+    memcpy(buffer, sb, sizeof(superblock_t));
+    return vdisk_write(disk, 0, buffer);
+}
+
+/**
+ * @brief Records in the superblock of the mounted volume whether it is in
+ * use, so that the next mount knows if it was left by a crash.
+ * @return 0 on success, negative error code on failure.
+ * @note Not journaled, the flag is written in place and synced at once.
+ */
+int _set_unclean(bool unclean) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    ret = meta_read(0, buffer);
+    if (ret != 0)
+        return ret;
+    ((superblock_t *)buffer)->unclean = unclean;
+    ret = vdisk_write(disk_handle, 0, buffer);
+    if (ret != 0)
+        return ret;
+    return vdisk_sync(disk_handle);
+}
+
+/**
+ * @brief Erases every free block of the mounted volume.
+ *
+ * Data is written to the blocks a transaction allocates before the
+ * transaction is committed. After a crash, the blocks of the transactions
+ * never committed are free again but still hold that data.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int _zero_free_blocks() {
+    int ret = 0;
+    uint32_t run = 0;
+
+    for (uint32_t block = 0; block <= disk_handle->size_in_sectors; block++) {
+        if (block < disk_handle->size_in_sectors && !allocated_blocks_handle[block]) {
+            run++;
+            continue;
+        }
+        if (run > 0) {
+            ret = erase_block_range(block - run, run);
+            if (ret != 0)
+                return ret;
+            run = 0;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Derives the block and inode layout from the block size and the
+ * inode version.
+ * @return 0 on success, ssfs_EINVAL if the block size isn't a power of two
+ * between MIN_BLOCK_SIZE and MAX_BLOCK_SIZE or if the version is unknown.
+ */
+int _compute_geometry(uint32_t block_size, uint32_t inode_version, geometry_t *geometry) {
+    if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE || (block_size & (block_size - 1)) != 0)
+        return ssfs_EINVAL;
+
+    if (inode_version == INODE_V1)
+        geometry->inode_size = sizeof(inode_t);
+    else if (inode_version == INODE_V2)
+        geometry->inode_size = sizeof(inode_v2_t);
+    else
+        return ssfs_EINVAL;
+
+    geometry->block_size = block_size;
+    geometry->pointers_per_block = block_size / sizeof(uint32_t);
+    geometry->inode_version = inode_version;
+    geometry->inodes_per_block = block_size / geometry->inode_size;
+    return 0;
+}
@@ -0,0 +1,456 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_defrag.c
+ * =============
+ *
+ * Online defragmentation of the mounted volume.
+ * The data blocks of a file are copied to the first run of free blocks long
+ * enough to hold them all, read and written as large batches of the vdisk
+ * scheduler. Its block map is then rewritten to point to the new run in one
+ * transaction, and the old blocks are freed and zeroed once it is committed,
+ * so a crash leaves either layout. A file is moved under the volume lock, and
+ * `ssfs_defrag_volume()` releases it between files and paces the copies, so
+ * that other calls go on meanwhile.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+// Blocks copied by one batch
+#define DEFRAG_CHUNK_BLOCKS 256
+
+/**
+ * @brief Counts the runs of physically contiguous blocks of a list.
+ */
+static uint32_t count_runs(const uint32_t *addresses, uint32_t count) {
+    uint32_t runs = count > 0;
+    for (uint32_t b = 1; b < count; b++)
+        runs += addresses[b] != addresses[b - 1] + 1;
+    return runs;
+}
+
+/**
+ * @brief Finds the first run of `count` free blocks, and allocates it.
+ * @return 0 on success, with *first set to its first block, negative error
+ * code on failure.
+ */
+static int allocate_run(uint32_t count, uint32_t *first) {
+    uint32_t run = 0;
+    for (uint32_t b = 0; b < disk_handle->size_in_sectors; b++) {
+        run = allocated_blocks_handle[b] ? 0 : run + 1;
+        if (run < count)
+            continue;
+
+        *first = b + 1 - count;
+        for (uint32_t r = 0; r < count; r++) {
+            int ret = set_block_status(*first + r, true);
+            if (ret != 0)
+                return ret;
+        }
+        return 0;
+    }
+    return ssfs_ENOSPACE;
+}
+
+/**
+ * @brief Copies the blocks at `addresses` to the run starting at `first`,
+ * by batches of `DEFRAG_CHUNK_BLOCKS` blocks: one read per run of the old
+ * blocks, one write for the new ones.
+ * @return 0 on success, negative error code on failure.
+ */
+static int copy_blocks(int inode_num, const uint32_t *addresses, uint32_t count, uint32_t first) {
+    int ret = 0;
+    vdisk_request_t *requests = malloc(DEFRAG_CHUNK_BLOCKS * (sizeof(vdisk_request_t) + BLOCK_SIZE));
+    if (requests == NULL)
+        return ssfs_EALLOC;
+    uint8_t *data = (uint8_t *)(requests + DEFRAG_CHUNK_BLOCKS);
+
+    for (uint32_t done = 0; done < count; done += DEFRAG_CHUNK_BLOCKS) {
+        uint32_t chunk = count - done < DEFRAG_CHUNK_BLOCKS ? count - done : DEFRAG_CHUNK_BLOCKS;
+
+        uint32_t reads = 0;
+        for (uint32_t b = 0; b < chunk; b++) {
+            if (reads > 0 && addresses[done + b] == addresses[done + b - 1] + 1) {
+                requests[reads - 1].count++;
+                continue;
+            }
+            requests[reads++] = (vdisk_request_t){VDISK_READ, addresses[done + b], 1, data + (size_t)b * BLOCK_SIZE};
+        }
+        ret = vdisk_submit(disk_handle, requests, reads, true);
+        if (ret != 0)
+            break;
+
+        requests[0] = (vdisk_request_t){VDISK_WRITE, first + done, chunk, data};
+        ret = vdisk_submit(disk_handle, requests, 1, true);
+        if (ret != 0)
+            break;
+        dirty_mark_data(inode_num, first + done, chunk);
+    }
+
+    free(requests);
+    return ret;
+}
+
+/**
+ * @brief Points the first `count` data block pointers of a version 1 inode,
+ * in the order `get_file_block_addresses()` reads them, to the run starting
+ * at `first`. The indirect blocks stay where they are.
+ * @return 0 on success, negative error code on failure.
+ */
+static int remap_v1(inode_t *inode, uint32_t count, uint32_t first) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    uint8_t inner[BLOCK_SIZE];
+    uint32_t *pointers = (uint32_t *)buffer;
+    uint32_t *inner_pointers = (uint32_t *)inner;
+    uint32_t logical = 0;
+
+    for (uint32_t d = 0; d < 4 && logical < count; d++)
+        if (inode->direct[d])
+            inode->direct[d] = first + logical++;
+
+    if (inode->indirect1 && logical < count) {
+        ret = meta_read(inode->indirect1, buffer);
+        if (ret != 0)
+            return ret;
+        for (uint32_t p = 0; p < POINTERS_PER_BLOCK && logical < count; p++)
+            if (pointers[p])
+                pointers[p] = first + logical++;
+        ret = meta_write(inode->indirect1, buffer);
+        if (ret != 0)
+            return ret;
+    }
+
+    if (inode->indirect2 && logical < count) {
+        ret = meta_read(inode->indirect2, buffer);
+        if (ret != 0)
+            return ret;
+        for (uint32_t i = 0; i < POINTERS_PER_BLOCK && logical < count; i++) {
+            if (!pointers[i])
+                continue;
+            ret = meta_read(pointers[i], inner);
+            if (ret != 0)
+                return ret;
+            for (uint32_t p = 0; p < POINTERS_PER_BLOCK && logical < count; p++)
+                if (inner_pointers[p])
+                    inner_pointers[p] = first + logical++;
+            ret = meta_write(pointers[i], inner);
+            if (ret != 0)
+                return ret;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Replaces the extents of a version 2 inode by a single one of
+ * `count` blocks starting at `first`, and frees its overflow extent blocks.
+ * @return 0 on success, negative error code on failure.
+ */
+static int remap_v2(inode_v2_t *inode, uint32_t count, uint32_t first) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    extent_block_t *leaf = (extent_block_t *)buffer;
+
+    for (uint32_t block = inode->extent_block; block != 0; block = leaf->next) {
+        ret = meta_read(block, buffer);
+        if (ret != 0)
+            return ret;
+        ret = set_block_status(block, false);
+        if (ret != 0)
+            return ret;
+    }
+
+    memset(inode->extents, 0, sizeof(inode->extents));
+    inode->extents[0] = (extent_t){0, first, count};
+    inode->extents_num = 1;
+    inode->extent_block = 0;
+    inode->extent_tail = 0;
+    return ret;
+}
+
+/**
+ * @brief Counts the data blocks mapped by a file, those past its size
+ * included for a version 2 inode.
+ * @return 0 on success, negative error code on failure.
+ */
+static int mapped_blocks(any_inode_t *inode, uint32_t *count) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    extent_block_t *leaf = (extent_block_t *)buffer;
+
+    if (geometry_handle.inode_version != INODE_V2) {
+        *count = inode_data_blocks(inode);
+        return ret;
+    }
+
+    *count = 0;
+    for (uint32_t e = 0; e < inode->v2.extents_num; e++)
+        *count += inode->v2.extents[e].length;
+    for (uint32_t block = inode->v2.extent_block; block != 0; block = leaf->next) {
+        ret = meta_read(block, buffer);
+        if (ret != 0)
+            return ret;
+        for (uint32_t e = 0; e < leaf->count; e++)
+            *count += leaf->extents[e].length;
+    }
+    return ret;
+}
+
+/**
+ * @brief Moves the data blocks of a file into a single run, if they aren't
+ * in one already.
+ *
+ * @param runs Set to the runs the data blocks were in.
+ *
+ * @return The number of blocks moved on success, 0 if the file was left as it is.
+ * @return Negative integer (error codes) on failure, ssfs_ENOSPACE when no
+ * run of free blocks is long enough.
+ *
+ * @note The caller holds `fs_mutex` and runs a transaction. It saves the
+ * inode when blocks were moved, and aborts the transaction on failure.
+ */
+static int defrag_inode(int inode_num, any_inode_t *inode, uint32_t *runs) {
+    int ret = 0;
+    *runs = 0;
+
+    if (inode_is_inline(inode))
+        return ret;
+
+    uint32_t count;
+    ret = mapped_blocks(inode, &count);
+    if (ret != 0 || count == 0)
+        return ret;
+
+    uint32_t *addresses = calloc(count, sizeof(uint32_t));
+    if (addresses == NULL)
+        return ssfs_EALLOC;
+    ret = inode_block_addresses(inode, addresses, count);
+    if (ret != 0)
+        goto cleanup;
+
+    // A file with holes in its block map keeps its layout
+    for (uint32_t b = 0; b < count; b++) {
+        if (addresses[b] == 0)
+            goto cleanup;
+    }
+    *runs = count_runs(addresses, count);
+    if (*runs <= 1)
+        goto cleanup;
+
+    uint32_t first = 0;
+    ret = allocate_run(count, &first);
+    if (ret != 0)
+        goto cleanup;
+
+    ret = copy_blocks(inode_num, addresses, count, first);
+    if (ret != 0)
+        goto error_management_release;
+
+    // Without a journal, the copy must be durable before the map changes
+    if (!journal_is_active()) {
+        ret = vdisk_sync(disk_handle);
+        if (ret != 0)
+            goto error_management_release;
+    }
+
+    ret = geometry_handle.inode_version == INODE_V2 ?
+        remap_v2(&inode->v2, count, first) :
+        remap_v1(&inode->v1, count, first);
+    if (ret != 0)
+        goto error_management_release;
+
+    for (uint32_t b = 0; b < count; b++)
+        set_block_status(addresses[b], false);
+    free(addresses);
+    return (int)count;
+
+error_management_release:
+    for (uint32_t r = 0; r < count; r++)
+        set_block_status(first + r, false);
+
+cleanup:
+    free(addresses);
+    return ret;
+}
+
+/**
+ * @brief Defragments a file of the mounted volume, see `defrag_inode()`.
+ * @return The number of blocks moved on success, negative error code on failure.
+ * @note The caller holds `fs_mutex`.
+ */
+static int defrag_file(int inode_num, uint32_t *runs) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    *runs = 0;
+    uint32_t inode_block = itable_block(inode_num / geometry_handle.inodes_per_block);
+
+    journal_begin();
+    ret = meta_read(inode_block, buffer);
+    if (ret != 0)
+        goto error_management_abort_transaction;
+
+    any_inode_t *inode = inode_at(buffer, inode_num % geometry_handle.inodes_per_block);
+    if (!inode_in_use(inode)) {
+        ret = ssfs_EINODE;
+        goto error_management_abort_transaction;
+    }
+
+    ret = defrag_inode(inode_num, inode, runs);
+    if (ret <= 0)
+        goto error_management_abort_transaction;
+
+    int moved = ret;
+    ret = meta_write(inode_block, buffer);
+    if (ret != 0)
+        goto error_management_abort_transaction;
+    dirty_mark_metadata(inode_num, true);
+
+    ret = journal_end();
+    return ret != 0 ? ret : moved;
+
+error_management_abort_transaction:
+    journal_abort();
+    return ret;
+}
+
+/**
+ * @brief Sleeps until `bytes` may have been copied since `start` at
+ * `bytes_per_second`.
+ */
+static void defrag_throttle(uint64_t start, uint64_t bytes, uint64_t bytes_per_second) {
+    if (bytes_per_second == 0)
+        return;
+
+    uint64_t due = start + (uint64_t)((double)bytes / bytes_per_second * 1e9);
+    uint64_t now = stats_clock();
+    if (now >= due)
+        return;
+    struct timespec wait = {(time_t)((due - now) / 1000000000ull), (long)((due - now) % 1000000000ull)};
+    nanosleep(&wait, NULL);
+}
+
+/**
+ * @brief Moves the data blocks of a file into a single run of free blocks.
+ *
+ * The blocks are copied to the first run long enough, then the block map
+ * points to it in one transaction; the old blocks are zeroed and freed once
+ * it is committed. A version 2 file ends up with a single extent, its
+ * overflow extent blocks being freed, while the indirect blocks of a version
+ * 1 file stay in place. Inline data and a packed tail aren't moved.
+ *
+ * @param inode_num The file.
+ *
+ * @return The number of blocks moved on success, 0 if the file is already
+ * in a single run or has no data blocks.
+ * @return Negative integer (error codes) on failure, ssfs_ENOSPACE when no
+ * run of free blocks is long enough.
+ */
+int ssfs_defrag(int inode_num) {
+    int ret = 0;
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+
+    if (!is_inode_valid(inode_num, itable_inodes())) {
+        ret = ssfs_EALLOC;
+        goto error_management_unlock;
+    }
+
+    uint32_t runs;
+    ret = defrag_file(inode_num, &runs);
+    if (ret < 0)
+        goto error_management_unlock;
+
+    pthread_mutex_unlock(&fs_mutex);
+    return ret;
+
+error_management_unlock:
+    pthread_mutex_unlock(&fs_mutex);
+
+error_management:
+    fprintf(stderr, "Error when defragmenting a file (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Defragments every file of the mounted volume, see `ssfs_defrag()`.
+ *
+ * The volume is locked for one file at a time, and the copies are paced at
+ * `options->bytes_per_second` by sleeping between files, so that the other
+ * calls go on meanwhile. A file for which no run of free blocks is long
+ * enough is skipped, once the blocks waiting for a commit or for the
+ * reclaimer were released.
+ *
+ * @param options The copy rate, NULL for no limit.
+ * @param report Filled with the files moved and their runs, may be NULL.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int ssfs_defrag_volume(const ssfs_defrag_options_t *options, ssfs_defrag_report_t *report) {
+    int ret = 0;
+    ssfs_defrag_report_t totals;
+    uint64_t bytes_per_second = options != NULL ? options->bytes_per_second : 0;
+    uint64_t start = stats_clock();
+    memset(&totals, 0, sizeof(totals));
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    for (uint32_t inode_num = 0;; inode_num++) {
+        pthread_mutex_lock(&fs_mutex);
+        if (!is_mounted() || inode_num >= itable_inodes()) {
+            ret = is_mounted() ? 0 : ssfs_EMOUNT;
+            pthread_mutex_unlock(&fs_mutex);
+            if (ret != 0)
+                goto error_management;
+            break;
+        }
+
+        uint32_t runs;
+        ret = defrag_file(inode_num, &runs);
+        if (ret == ssfs_ENOSPACE && release_blocks())
+            ret = defrag_file(inode_num, &runs);
+        pthread_mutex_unlock(&fs_mutex);
+
+        if (ret == ssfs_EINODE || (ret >= 0 && runs <= 1))
+            continue;
+        totals.files++;
+        if (ret == ssfs_ENOSPACE) {
+            totals.skipped++;
+            continue;
+        }
+        if (ret < 0)
+            goto error_management;
+
+        totals.defragmented++;
+        totals.blocks_moved += ret;
+        totals.runs_before += runs;
+        totals.runs_after++;
+        defrag_throttle(start, totals.blocks_moved * BLOCK_SIZE, bytes_per_second);
+    }
+
+    totals.elapsed_ns = stats_clock() - start;
+    if (report != NULL)
+        *report = totals;
+    return 0;
+
+error_management:
+    fprintf(stderr, "Error when defragmenting the volume (code %d)\n", ret);
+    return ret;
+}
@@ -0,0 +1,704 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_dir.c
+ * ==========
+ *
+ * Directories, mapping names to inode numbers.
+ * A directory is a regular file, read and written with `read()`/`write()`,
+ * made of 4 KiB directory blocks laid out for extendible hashing:
+ * - block 0 is the header, with the global depth and the list of the blocks
+ *   holding the hash table;
+ * - the hash table maps the lowest `global_depth` bits of the hash of a name
+ *   to the bucket holding the entry, 1024 slots per table block;
+ * - buckets hold the entries. A full bucket is split in two on its next
+ *   `local_depth` bit, the table doubling first when needed.
+ * A lookup thus reads the header, one table slot and one bucket, whatever
+ * the size of the directory. Buckets aren't merged back when entries go.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+#define DIR_BLOCK_SIZE 4096
+#define DIR_MAGIC    0x52494453  // "SDIR"
+#define BUCKET_MAGIC 0x4B435542  // "BUCK", larger than any block number in a table
+
+#define TABLE_SLOTS_PER_BLOCK (DIR_BLOCK_SIZE / sizeof(uint32_t))
+#define DIR_MAX_TABLE_BLOCKS ((DIR_BLOCK_SIZE - sizeof(dir_header_t)) / sizeof(uint32_t))
+#define DIR_MAX_DEPTH 19  // 512 table blocks, the largest power of two that fits
+#define BUCKET_CAPACITY (DIR_BLOCK_SIZE - sizeof(dir_bucket_t))
+
+typedef struct {
+    uint32_t magic;
+    uint32_t global_depth;
+    uint32_t blocks_num;        // Directory blocks of the file
+    uint32_t table_blocks_num;  // Blocks of the hash table
+    uint64_t entries_num;
+    uint32_t table_blocks[];    // Directory blocks holding the hash table, in order
+} dir_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t local_depth;
+    uint16_t used;  // Bytes of `entries` in use
+    uint8_t entries[];
+} dir_bucket_t;
+
+struct dir_entry {
+    uint32_t inode_num;
+    uint32_t hash;
+    uint8_t name_len;
+    char name[];  // Not NUL-terminated
+} __attribute__((packed));
+
+typedef struct dir_entry dir_entry_t;
+
+// Directory operations are serialized, `read()`/`write()` lock the volume in turn
+static pthread_mutex_t dir_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Hashes a name, FNV-1a.
+ */
+static uint32_t dir_hash(const char *name, uint32_t len) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Checks a name and returns its length.
+ * @return The length on success, ssfs_EINVAL for an empty or too long name.
+ */
+static int dir_name_length(const char *name) {
+    if (name == NULL)
+        return ssfs_EINVAL;
+    size_t len = strnlen(name, SSFS_NAME_MAX + 1);
+    if (len == 0 || len > SSFS_NAME_MAX)
+        return ssfs_EINVAL;
+    return (int)len;
+}
+
+/**
+ * @brief Reads exactly `len` bytes of a directory.
+ * @return 0 on success, negative error code on failure.
+ */
+static int dir_read(int dir_inode, uint32_t offset, void *buffer, uint32_t len) {
+    int ret = _read(dir_inode, buffer, (int)len, (int)offset);
+    if (ret < 0)
+        return ret;
+    return (uint32_t)ret == len ? 0 : ssfs_ENOTDIR;
+}
+
+/**
+ * @brief Writes exactly `len` bytes of a directory.
+ * @return 0 on success, negative error code on failure.
+ */
+static int dir_write(int dir_inode, uint32_t offset, void *buffer, uint32_t len) {
+    int ret = _write(dir_inode, buffer, (int)len, (int)offset);
+    if (ret < 0)
+        return ret;
+    return (uint32_t)ret == len ? 0 : ssfs_ENOSPACE;
+}
+
+/**
+ * @brief Reads the header of a directory, with its table block list when
+ * `full` is set, and checks it is one.
+ * @return 0 on success, negative error code on failure.
+ */
+static int header_read(int dir_inode, dir_header_t *header, bool full) {
+    int ret = dir_read(dir_inode, 0, header, sizeof(dir_header_t));
+    if (ret != 0)
+        return ret;
+    if (header->magic != DIR_MAGIC || header->global_depth > DIR_MAX_DEPTH ||
+        header->table_blocks_num > DIR_MAX_TABLE_BLOCKS)
+        return ssfs_ENOTDIR;
+    if (!full)
+        return 0;
+    return dir_read(dir_inode, sizeof(dir_header_t), header->table_blocks,
+        header->table_blocks_num * sizeof(uint32_t));
+}
+
+/**
+ * @brief Writes the header of a directory, with its table block list.
+ * @return 0 on success, negative error code on failure.
+ */
+static int header_write(int dir_inode, dir_header_t *header) {
+    return dir_write(dir_inode, 0, header,
+        sizeof(dir_header_t) + header->table_blocks_num * sizeof(uint32_t));
+}
+
+/**
+ * @brief Returns the byte offset of a slot of the hash table.
+ * @return 0 on success, negative error code on failure.
+ */
+static int slot_offset(int dir_inode, dir_header_t *header, uint32_t slot, uint32_t *offset) {
+    uint32_t index = slot / TABLE_SLOTS_PER_BLOCK;
+    uint32_t table_block;
+
+    // The list is read on demand, lookups only read the header itself
+    int ret = dir_read(dir_inode, sizeof(dir_header_t) + index * sizeof(uint32_t),
+        &table_block, sizeof(uint32_t));
+    if (ret != 0)
+        return ret;
+    if (index >= header->table_blocks_num || table_block >= header->blocks_num)
+        return ssfs_ENOTDIR;
+
+    *offset = table_block * DIR_BLOCK_SIZE + (slot % TABLE_SLOTS_PER_BLOCK) * sizeof(uint32_t);
+    return 0;
+}
+
+/**
+ * @brief Finds the bucket of a hash and reads it.
+ * @param slot Set to the slot of the hash in the table.
+ * @param bucket_block Set to the directory block of the bucket.
+ * @return 0 on success, negative error code on failure.
+ */
+static int bucket_find(int dir_inode, dir_header_t *header, uint32_t hash,
+                       uint32_t *slot, uint32_t *bucket_block, dir_bucket_t *bucket) {
+    uint32_t offset;
+
+    *slot = hash & ((1u << header->global_depth) - 1);
+    int ret = slot_offset(dir_inode, header, *slot, &offset);
+    if (ret != 0)
+        return ret;
+    ret = dir_read(dir_inode, offset, bucket_block, sizeof(uint32_t));
+    if (ret != 0)
+        return ret;
+    if (*bucket_block >= header->blocks_num)
+        return ssfs_ENOTDIR;
+
+    ret = dir_read(dir_inode, *bucket_block * DIR_BLOCK_SIZE, bucket, DIR_BLOCK_SIZE);
+    if (ret != 0)
+        return ret;
+    return bucket->magic == BUCKET_MAGIC ? 0 : ssfs_ENOTDIR;
+}
+
+/**
+ * @brief Returns the size of an entry.
+ */
+static uint32_t entry_size(dir_entry_t *entry) {
+    return sizeof(dir_entry_t) + entry->name_len;
+}
+
+/**
+ * @brief Finds a name in a bucket.
+ * @return The offset of its entry in `entries`, -1 if absent.
+ */
+static int bucket_lookup(dir_bucket_t *bucket, const char *name, uint32_t len, uint32_t hash) {
+    for (uint32_t offset = 0; offset < bucket->used;) {
+        dir_entry_t *entry = (dir_entry_t *)&bucket->entries[offset];
+        if (entry->hash == hash && entry->name_len == len && memcmp(entry->name, name, len) == 0)
+            return (int)offset;
+        offset += entry_size(entry);
+    }
+    return -1;
+}
+
+/**
+ * @brief Doubles the hash table, each new slot pointing to the same bucket
+ * as the slot it extends.
+ * @return 0 on success, negative error code on failure.
+ */
+static int table_double(int dir_inode, dir_header_t *header) {
+    int ret = 0;
+    uint8_t buffer[DIR_BLOCK_SIZE];
+    uint32_t slots = 1u << header->global_depth;
+
+    if (slots < TABLE_SLOTS_PER_BLOCK) {
+        // Still in the first table block, the slots are copied after themselves
+        uint32_t offset = header->table_blocks[0] * DIR_BLOCK_SIZE;
+        ret = dir_read(dir_inode, offset, buffer, slots * sizeof(uint32_t));
+        if (ret != 0)
+            return ret;
+        ret = dir_write(dir_inode, offset + slots * sizeof(uint32_t), buffer, slots * sizeof(uint32_t));
+        if (ret != 0)
+            return ret;
+    } else {
+        // The table blocks are copied at the end of the directory
+        uint32_t blocks = header->table_blocks_num;
+        for (uint32_t b = 0; b < blocks; b++) {
+            ret = dir_read(dir_inode, header->table_blocks[b] * DIR_BLOCK_SIZE, buffer, DIR_BLOCK_SIZE);
+            if (ret != 0)
+                return ret;
+            ret = dir_write(dir_inode, header->blocks_num * DIR_BLOCK_SIZE, buffer, DIR_BLOCK_SIZE);
+            if (ret != 0)
+                return ret;
+            header->table_blocks[blocks + b] = header->blocks_num++;
+        }
+        header->table_blocks_num = 2 * blocks;
+    }
+
+    header->global_depth++;
+    return header_write(dir_inode, header);
+}
+
+/**
+ * @brief Splits a full bucket on its next hash bit, into a new bucket at
+ * the end of the directory, and points half of its slots to the new one.
+ * @return 0 on success, negative error code on failure.
+ * @note The table must be deeper than the bucket.
+ */
+static int bucket_split(int dir_inode, dir_header_t *header, uint32_t slot,
+                        uint32_t bucket_block, dir_bucket_t *bucket) {
+    int ret = 0;
+    uint8_t new_buffer[DIR_BLOCK_SIZE];
+    dir_bucket_t *new_bucket = (dir_bucket_t *)new_buffer;
+    uint32_t depth = bucket->local_depth;
+
+    memset(new_buffer, 0, DIR_BLOCK_SIZE);
+    new_bucket->magic = BUCKET_MAGIC;
+    new_bucket->local_depth = depth + 1;
+    bucket->local_depth = depth + 1;
+
+    // Entries with the bit set move, the others are packed in place
+    uint32_t kept = 0;
+    for (uint32_t offset = 0; offset < bucket->used;) {
+        dir_entry_t *entry = (dir_entry_t *)&bucket->entries[offset];
+        uint32_t size = entry_size(entry);
+        if (entry->hash & (1u << depth)) {
+            memcpy(&new_bucket->entries[new_bucket->used], entry, size);
+            new_bucket->used += size;
+        } else {
+            memmove(&bucket->entries[kept], entry, size);
+            kept += size;
+        }
+        offset += size;
+    }
+    bucket->used = kept;
+    memset(&bucket->entries[kept], 0, BUCKET_CAPACITY - kept);
+
+    // Ordered so that a crash leaves duplicates, never unreachable entries:
+    // the new bucket and the header first, then the slots, the old bucket last
+    uint32_t new_block = header->blocks_num++;
+    ret = dir_write(dir_inode, new_block * DIR_BLOCK_SIZE, new_bucket, DIR_BLOCK_SIZE);
+    if (ret != 0)
+        return ret;
+    ret = header_write(dir_inode, header);
+    if (ret != 0)
+        return ret;
+
+    // Every slot ending with the bucket's bits and then a 1 moves to the new
+    // bucket, unless a split cut short by a crash already moved it
+    uint32_t low_bits = slot & ((1u << depth) - 1);
+    for (uint32_t s = low_bits | (1u << depth); s < (1u << header->global_depth); s += 1u << (depth + 1)) {
+        uint32_t offset, target;
+        ret = slot_offset(dir_inode, header, s, &offset);
+        if (ret != 0)
+            return ret;
+        ret = dir_read(dir_inode, offset, &target, sizeof(uint32_t));
+        if (ret != 0)
+            return ret;
+        if (target != bucket_block)
+            continue;
+        ret = dir_write(dir_inode, offset, &new_block, sizeof(uint32_t));
+        if (ret != 0)
+            return ret;
+    }
+
+    return dir_write(dir_inode, bucket_block * DIR_BLOCK_SIZE, bucket, DIR_BLOCK_SIZE);
+}
+
+/**
+ * @brief Creates an empty directory.
+ *
+ * @return The inode number of the directory on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int _ssfs_mkdir() {
+    int ret = 0;
+    uint8_t buffer[3 * DIR_BLOCK_SIZE];
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    // A header, one table block with a single slot, and its bucket
+    memset(buffer, 0, sizeof(buffer));
+    dir_header_t *header = (dir_header_t *)buffer;
+    header->magic = DIR_MAGIC;
+    header->blocks_num = 3;
+    header->table_blocks_num = 1;
+    header->table_blocks[0] = 1;
+    *(uint32_t *)&buffer[DIR_BLOCK_SIZE] = 2;
+    ((dir_bucket_t *)&buffer[2 * DIR_BLOCK_SIZE])->magic = BUCKET_MAGIC;
+
+    int dir_inode = _create();
+    if (dir_inode < 0) {
+        ret = dir_inode;
+        goto error_management;
+    }
+    ret = dir_write(dir_inode, 0, buffer, sizeof(buffer));
+    if (ret != 0) {
+        _delete(dir_inode);
+        goto error_management;
+    }
+    return dir_inode;
+
+error_management:
+    fprintf(stderr, "Error when creating a directory (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_mkdir()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_mkdir() {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_mkdir();
+    stats_op(SSFS_OP_MKDIR, start, ret);
+    trace_record(SSFS_OP_MKDIR, start, ret, 0, 0, 0, NULL);
+    return ret;
+}
+
+/**
+ * @brief Finds the inode number a name is linked to in a directory.
+ *
+ * @param dir_inode The inode number of the directory.
+ * @param name The NUL-terminated name, at most SSFS_NAME_MAX bytes.
+ *
+ * @return The inode number on success.
+ * @return ssfs_ENOENT if the name isn't in the directory.
+ * @return Other negative integers (error codes) on failure.
+ */
+int _ssfs_lookup(int dir_inode, const char *name) {
+    int ret = 0;
+    dir_header_t header;
+    uint8_t buffer[DIR_BLOCK_SIZE];
+    dir_bucket_t *bucket = (dir_bucket_t *)buffer;
+    uint32_t slot, bucket_block;
+
+    int len = dir_name_length(name);
+    if (len < 0) {
+        ret = len;
+        goto error_management;
+    }
+    uint32_t hash = dir_hash(name, len);
+
+    pthread_mutex_lock(&dir_mutex);
+
+    ret = header_read(dir_inode, &header, false);
+    if (ret != 0)
+        goto error_management_unlock;
+    ret = bucket_find(dir_inode, &header, hash, &slot, &bucket_block, bucket);
+    if (ret != 0)
+        goto error_management_unlock;
+
+    int offset = bucket_lookup(bucket, name, len, hash);
+    if (offset < 0) {
+        ret = ssfs_ENOENT;
+        goto error_management_unlock;
+    }
+    ret = (int)((dir_entry_t *)&bucket->entries[offset])->inode_num;
+
+    pthread_mutex_unlock(&dir_mutex);
+    return ret;
+
+error_management_unlock:
+    pthread_mutex_unlock(&dir_mutex);
+
+error_management:
+    // A missing name is an answer, not an error
+    if (ret != ssfs_ENOENT)
+        fprintf(stderr, "Error when looking up a name (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_lookup()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_lookup(int dir_inode, const char *name) {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_lookup(dir_inode, name);
+    stats_op(SSFS_OP_LOOKUP, start, ret);
+    trace_record(SSFS_OP_LOOKUP, start, ret, dir_inode, 0, 0, name);
+    return ret;
+}
+
+/**
+ * @brief Links a name to a file in a directory.
+ *
+ * @param dir_inode The inode number of the directory.
+ * @param name The NUL-terminated name, at most SSFS_NAME_MAX bytes.
+ * @param inode_num The inode number of the file, which must exist. A file
+ * may be linked under several names.
+ *
+ * @return 0 on success.
+ * @return ssfs_EEXIST if the name is already in the directory.
+ * @return Other negative integers (error codes) on failure.
+ */
+int _ssfs_link(int dir_inode, const char *name, int inode_num) {
+    int ret = 0;
+    uint8_t header_buffer[DIR_BLOCK_SIZE];
+    dir_header_t *header = (dir_header_t *)header_buffer;
+    uint8_t buffer[DIR_BLOCK_SIZE];
+    dir_bucket_t *bucket = (dir_bucket_t *)buffer;
+    uint32_t slot, bucket_block;
+
+    int len = dir_name_length(name);
+    if (len < 0) {
+        ret = len;
+        goto error_management;
+    }
+    uint32_t hash = dir_hash(name, len);
+
+    ret = _stat(inode_num);
+    if (ret < 0)
+        goto error_management;
+
+    pthread_mutex_lock(&dir_mutex);
+
+    ret = header_read(dir_inode, header, true);
+    if (ret != 0)
+        goto error_management_unlock;
+
+    while (true) {
+        ret = bucket_find(dir_inode, header, hash, &slot, &bucket_block, bucket);
+        if (ret != 0)
+            goto error_management_unlock;
+        if (bucket_lookup(bucket, name, len, hash) >= 0) {
+            ret = ssfs_EEXIST;
+            goto error_management_unlock;
+        }
+        if (bucket->used + sizeof(dir_entry_t) + len <= BUCKET_CAPACITY)
+            break;
+
+        // Names all sharing the same hash bits can't be told apart further
+        if (bucket->local_depth == header->global_depth) {
+            if (header->global_depth == DIR_MAX_DEPTH) {
+                ret = ssfs_ENOSPACE;
+                goto error_management_unlock;
+            }
+            ret = table_double(dir_inode, header);
+            if (ret != 0)
+                goto error_management_unlock;
+        }
+        ret = bucket_split(dir_inode, header, slot, bucket_block, bucket);
+        if (ret != 0)
+            goto error_management_unlock;
+    }
+
+    dir_entry_t *entry = (dir_entry_t *)&bucket->entries[bucket->used];
+    entry->inode_num = (uint32_t)inode_num;
+    entry->hash = hash;
+    entry->name_len = (uint8_t)len;
+    memcpy(entry->name, name, len);
+    uint32_t first = bucket->used;
+    bucket->used += entry_size(entry);
+
+    // Only the bucket header and the new entry change
+    uint32_t offset = bucket_block * DIR_BLOCK_SIZE;
+    ret = dir_write(dir_inode, offset, bucket, sizeof(dir_bucket_t));
+    if (ret != 0)
+        goto error_management_unlock;
+    ret = dir_write(dir_inode, offset + sizeof(dir_bucket_t) + first, entry, entry_size(entry));
+    if (ret != 0)
+        goto error_management_unlock;
+
+    header->entries_num++;
+    ret = dir_write(dir_inode, 0, header, sizeof(dir_header_t));
+    if (ret != 0)
+        goto error_management_unlock;
+
+    pthread_mutex_unlock(&dir_mutex);
+    return ret;
+
+error_management_unlock:
+    pthread_mutex_unlock(&dir_mutex);
+
+error_management:
+    fprintf(stderr, "Error when linking a name (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_link()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_link(int dir_inode, const char *name, int inode_num) {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_link(dir_inode, name, inode_num);
+    stats_op(SSFS_OP_LINK, start, ret);
+    trace_record(SSFS_OP_LINK, start, ret, dir_inode, inode_num, 0, name);
+    return ret;
+}
+
+/**
+ * @brief Removes a name from a directory.
+ *
+ * @param dir_inode The inode number of the directory.
+ * @param name The NUL-terminated name, at most SSFS_NAME_MAX bytes.
+ *
+ * @return The inode number the name was linked to on success.
+ * @return ssfs_ENOENT if the name isn't in the directory.
+ * @return Other negative integers (error codes) on failure.
+ *
+ * @note The file itself is left as is, the caller deletes it once it has no
+ * name left.
+ */
+int _ssfs_unlink(int dir_inode, const char *name) {
+    int ret = 0;
+    dir_header_t header;
+    uint8_t buffer[DIR_BLOCK_SIZE];
+    dir_bucket_t *bucket = (dir_bucket_t *)buffer;
+    uint32_t slot, bucket_block;
+
+    int len = dir_name_length(name);
+    if (len < 0) {
+        ret = len;
+        goto error_management;
+    }
+    uint32_t hash = dir_hash(name, len);
+
+    pthread_mutex_lock(&dir_mutex);
+
+    ret = header_read(dir_inode, &header, false);
+    if (ret != 0)
+        goto error_management_unlock;
+    ret = bucket_find(dir_inode, &header, hash, &slot, &bucket_block, bucket);
+    if (ret != 0)
+        goto error_management_unlock;
+
+    int offset = bucket_lookup(bucket, name, len, hash);
+    if (offset < 0) {
+        ret = ssfs_ENOENT;
+        goto error_management_unlock;
+    }
+    dir_entry_t *entry = (dir_entry_t *)&bucket->entries[offset];
+    int inode_num = (int)entry->inode_num;
+
+    // The following entries move down over the removed one
+    uint32_t size = entry_size(entry);
+    memmove(entry, (uint8_t *)entry + size, bucket->used - offset - size);
+    bucket->used -= size;
+    memset(&bucket->entries[bucket->used], 0, size);
+
+    ret = dir_write(dir_inode, bucket_block * DIR_BLOCK_SIZE, bucket, DIR_BLOCK_SIZE);
+    if (ret != 0)
+        goto error_management_unlock;
+
+    header.entries_num--;
+    ret = dir_write(dir_inode, 0, &header, sizeof(dir_header_t));
+    if (ret != 0)
+        goto error_management_unlock;
+
+    pthread_mutex_unlock(&dir_mutex);
+    return inode_num;
+
+error_management_unlock:
+    pthread_mutex_unlock(&dir_mutex);
+
+error_management:
+    if (ret != ssfs_ENOENT)
+        fprintf(stderr, "Error when unlinking a name (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_unlink()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_unlink(int dir_inode, const char *name) {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_unlink(dir_inode, name);
+    stats_op(SSFS_OP_UNLINK, start, ret);
+    trace_record(SSFS_OP_UNLINK, start, ret, dir_inode, 0, 0, name);
+    return ret;
+}
+
+/**
+ * @brief Reads the next entry of a directory.
+ *
+ * Entries come in no particular order. An entry linked or unlinked during
+ * the scan may be returned or not, the others are returned once, unless a
+ * bucket is split during the scan.
+ *
+ * @param dir_inode The inode number of the directory.
+ * @param cursor Position of the scan, 0 to start it. Updated past the
+ * returned entry.
+ * @param entry Filled with the next entry.
+ *
+ * @return 1 when an entry is returned, 0 at the end of the directory.
+ * @return Negative integer (error codes) on failure.
+ */
+int _ssfs_readdir(int dir_inode, uint32_t *cursor, ssfs_dirent_t *entry) {
+    int ret = 0;
+    dir_header_t header;
+    uint8_t buffer[sizeof(dir_entry_t) + SSFS_NAME_MAX];
+
+    if (cursor == NULL || entry == NULL) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&dir_mutex);
+
+    ret = header_read(dir_inode, &header, false);
+    if (ret != 0)
+        goto error_management_unlock;
+
+    // The cursor holds a directory block and an offset in its entries
+    uint32_t block = *cursor / DIR_BLOCK_SIZE;
+    uint32_t position = *cursor % DIR_BLOCK_SIZE;
+    if (block == 0)
+        block = 1;
+
+    for (; block < header.blocks_num; block++, position = 0) {
+        dir_bucket_t bucket;
+        ret = dir_read(dir_inode, block * DIR_BLOCK_SIZE, &bucket, sizeof(dir_bucket_t));
+        if (ret != 0)
+            goto error_management_unlock;
+
+        // Table blocks hold block numbers, never the bucket magic
+        if (bucket.magic != BUCKET_MAGIC || position >= bucket.used)
+            continue;
+
+        // Only the entry is read, not the whole bucket
+        uint32_t len = bucket.used - position;
+        if (len > sizeof(buffer))
+            len = sizeof(buffer);
+        ret = dir_read(dir_inode, block * DIR_BLOCK_SIZE + sizeof(dir_bucket_t) + position, buffer, len);
+        if (ret != 0)
+            goto error_management_unlock;
+
+        dir_entry_t *found = (dir_entry_t *)buffer;
+        entry->inode_num = (int)found->inode_num;
+        memcpy(entry->name, found->name, found->name_len);
+        entry->name[found->name_len] = '\0';
+        *cursor = block * DIR_BLOCK_SIZE + position + entry_size(found);
+
+        pthread_mutex_unlock(&dir_mutex);
+        return 1;
+    }
+
+    *cursor = header.blocks_num * DIR_BLOCK_SIZE;
+    pthread_mutex_unlock(&dir_mutex);
+    return 0;
+
+error_management_unlock:
+    pthread_mutex_unlock(&dir_mutex);
+
+error_management:
+    fprintf(stderr, "Error when reading a directory (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_readdir()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_readdir(int dir_inode, uint32_t *cursor, ssfs_dirent_t *entry) {
+    uint32_t first = cursor != NULL ? *cursor : 0;
+    uint64_t start = stats_clock();
+    int ret = _ssfs_readdir(dir_inode, cursor, entry);
+    stats_op(SSFS_OP_READDIR, start, ret);
+    trace_record(SSFS_OP_READDIR, start, ret, dir_inode, (int)first, 0, NULL);
+    return ret;
+}
@@ -0,0 +1,245 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_extent.c
+ * =============
+ *
+ * Block mapping of version 2 inodes.
+ * A file is described by extents, runs of contiguous blocks given as
+ * (logical start, physical start, length). The first ones are stored in the
+ * inode, the others in a chain of overflow extent blocks. Blocks are
+ * allocated next to the end of the last extent when possible, so a file
+ * written sequentially usually needs a single extent.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+#define EXTENTS_PER_BLOCK ((BLOCK_SIZE - sizeof(extent_block_t)) / sizeof(extent_t))
+
+/**
+ * @brief Writes the addresses of the data blocks of a file into
+ * `address_buffer`, in logical order.
+ *
+ * Only the overflow extent blocks are read, the inline extents need no I/O.
+ *
+ * @return 0 on success, negative error code on failure.
+ * @note It assumes the address_buffer holds `max_addresses` entries.
+ */
+int extent_block_addresses(inode_v2_t *inode, uint32_t *address_buffer, uint32_t max_addresses) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    extent_block_t *leaf = (extent_block_t *)buffer;
+    uint32_t addresses_collected = 0;
+
+    for (uint32_t e = 0; e < inode->extents_num && addresses_collected < max_addresses; e++)
+        for (uint32_t b = 0; b < inode->extents[e].length && addresses_collected < max_addresses; b++)
+            address_buffer[addresses_collected++] = inode->extents[e].physical + b;
+
+    for (uint32_t next = inode->extent_block; next != 0 && addresses_collected < max_addresses;) {
+        ret = meta_read(next, buffer);
+        if (ret != 0)
+            return ret;
+
+        for (uint32_t e = 0; e < leaf->count && addresses_collected < max_addresses; e++)
+            for (uint32_t b = 0; b < leaf->extents[e].length && addresses_collected < max_addresses; b++)
+                address_buffer[addresses_collected++] = leaf->extents[e].physical + b;
+        next = leaf->next;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Extends a file to a new size by allocating additional blocks.
+ *
+ * New blocks are appended to the last extent when they follow it on disk,
+ * else they start a new extent, in the inode while it has room, then in the
+ * last overflow extent block, allocating a new one when it is full.
+ * On failure, the size is unchanged but the inode must still be saved.
+ *
+ * @param inode Pointer to the inode to extend.
+ * @param new_size The new file size.
+ * @return 0 on success, negative error code on failure.
+ */
+int extent_extend_file(inode_v2_t *inode, uint64_t new_size) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    extent_block_t *leaf = (extent_block_t *)buffer;
+
+    if (new_size <= inode->size)
+        return ret;
+
+    uint64_t needed_blocks = (new_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (needed_blocks > UINT32_MAX)
+        return ssfs_ENOSPACE;
+
+    // The last overflow block is updated in memory, and written once
+    uint32_t leaf_num = inode->extent_tail;
+    if (leaf_num != 0) {
+        ret = meta_read(leaf_num, buffer);
+        if (ret != 0)
+            return ret;
+    }
+
+    // Blocks mapped past the size by a failed extension are used first
+    uint32_t mapped_blocks = 0;
+    if (leaf_num != 0)
+        mapped_blocks = leaf->extents[leaf->count - 1].logical + leaf->extents[leaf->count - 1].length;
+    else if (inode->extents_num > 0)
+        mapped_blocks = inode->extents[inode->extents_num - 1].logical + inode->extents[inode->extents_num - 1].length;
+
+    for (uint32_t logical = mapped_blocks; logical < needed_blocks; logical++) {
+        extent_t *last = NULL;
+        if (leaf_num != 0)
+            last = &leaf->extents[leaf->count - 1];
+        else if (inode->extents_num > 0)
+            last = &inode->extents[inode->extents_num - 1];
+
+        uint32_t physical;
+        ret = get_free_block_near(last ? last->physical + last->length : 0, &physical);
+        if (ret != 0)
+            goto error_management;
+
+        if (last && last->physical + last->length == physical && last->logical + last->length == logical) {
+            last->length++;
+            continue;
+        }
+
+        extent_t extent = {logical, physical, 1};
+        if (leaf_num == 0 && inode->extents_num < INODE_V2_EXTENTS) {
+            inode->extents[inode->extents_num++] = extent;
+            continue;
+        }
+        if (leaf_num != 0 && leaf->count < EXTENTS_PER_BLOCK) {
+            leaf->extents[leaf->count++] = extent;
+            continue;
+        }
+
+        // Chaining a new overflow block
+        uint32_t new_leaf;
+        ret = get_free_block(&new_leaf);
+        if (ret != 0) {
+            deallocate_block(physical);
+            goto error_management;
+        }
+        if (leaf_num != 0) {
+            leaf->next = new_leaf;
+            ret = meta_write(leaf_num, buffer);
+            if (ret != 0)
+                goto error_management;
+        } else {
+            inode->extent_block = new_leaf;
+        }
+        memset(buffer, 0, BLOCK_SIZE);
+        leaf->count = 1;
+        leaf->extents[0] = extent;
+        leaf_num = new_leaf;
+        inode->extent_tail = new_leaf;
+    }
+
+    if (leaf_num != 0) {
+        ret = meta_write(leaf_num, buffer);
+        if (ret != 0)
+            return ret;
+    }
+    inode->size = new_size;
+    return ret;
+
+error_management:
+    // The blocks allocated so far stay mapped past the size, the caller
+    // saves the inode so that they are used by the next extension
+    if (leaf_num != 0)
+        meta_write(leaf_num, buffer);
+    return ret;
+}
+
+/**
+ * @brief Calls `visit` on every run of blocks used by a file: the extents,
+ * then each overflow extent block as a run of one block.
+ *
+ * @return 0 on success, the first non-zero value returned by `visit`, or a
+ * negative error code on failure.
+ */
+int extent_for_each(inode_v2_t *inode, int (*visit)(uint32_t first, uint32_t count, void *arg), void *arg) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    extent_block_t *leaf = (extent_block_t *)buffer;
+
+    for (uint32_t e = 0; e < inode->extents_num; e++) {
+        ret = visit(inode->extents[e].physical, inode->extents[e].length, arg);
+        if (ret != 0)
+            return ret;
+    }
+
+    for (uint32_t next = inode->extent_block; next != 0;) {
+        ret = meta_read(next, buffer);
+        if (ret != 0)
+            return ret;
+
+        for (uint32_t e = 0; e < leaf->count; e++) {
+            ret = visit(leaf->extents[e].physical, leaf->extents[e].length, arg);
+            if (ret != 0)
+                return ret;
+        }
+
+        ret = visit(next, 1, arg);
+        if (ret != 0)
+            return ret;
+        next = leaf->next;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Visitor setting the status of a run of blocks.
+ */
+static int set_run_status(uint32_t first, uint32_t count, void *arg) {
+    bool status = *(bool *)arg;
+    for (uint32_t b = 0; b < count; b++)
+        set_block_status(first + b, status);
+    return 0;
+}
+
+/**
+ * @brief Sets the allocation status of the blocks used by a file, its
+ * overflow extent blocks included.
+ *
+ * @param status `true` to mark them as used, `false` to free them.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int extent_set_blocks_status(inode_v2_t *inode, bool status) {
+    return extent_for_each(inode, set_run_status, &status);
+}
+
+/**
+ * @brief Visitor printing a run of blocks.
+ */
+static int print_run(uint32_t first, uint32_t count, void *arg) {
+    (void)arg;
+    printf("    [%u, %u] (%u blocks)\n", first, first + count - 1, count);
+    return 0;
+}
+
+/**
+ * @brief Prints the metadata and the extents of a version 2 inode.
+ * @note This function is for developement purpose.
+ * @return 0 on success, negative error code on failure.
+ */
+int print_extents_info(inode_v2_t *inode) {
+    printf("  inode->valid: %u\n", inode->valid);
+    printf("  inode->size: %llu\n", (unsigned long long)inode->size);
+    printf("  inode->extents_num: %u\n", inode->extents_num);
+    printf("  inode->extent_block: %u\n", inode->extent_block);
+    if (inode->flags & INODE_FLAG_TAIL)
+        printf("  inode->tail: %u bytes in block %u at %u\n", inode->tail_length, inode->tail_block, inode->tail_offset);
+    return extent_for_each(inode, print_run, NULL);
+}
@@ -1,537 +1,725 @@
-/*
- * Author: Valérian Wislez
- *
- * ssfs_file_io.c
- * ==============
- * 
- * Manages data transfer to and from files within the file system.
- * Contains the read and write functions, along with their associated 
- * helper functions.
- * 
- * 
- */
-
-#include <string.h>
-#include <stdlib.h>
-
-#include "fs.h"
-#include "ssfs_internal.h"
-#include "error.h"
-
-/**
- * @brief Reads a specified number of bytes from a file at a given offset.
- *
- * This function reads `len` bytes from the file identified by `inode_num`,
- * starting at `offset` bytes from the beginning of the file. The read data
- * is then copied into the provided `data` buffer.
- * @note This buffer must be pre-allocated by the caller to be large
- * enough to hold `len` bytes.
- *
- * @param inode_num The inode number of the target file to read from.
- * @param data A pointer to the buffer where the read data will be stored.
- * @param len The maximum number of bytes to read into the `data` buffer.
- * @param offset The byte offset from the beginning of the file where reading should start.
- *
- * @return The number of bytes actually read and copied into the `data` buffer on success.
- * This value may be less than `len` if the end of the file is reached
- * before `len` bytes could be read.
- * @return A negative integer (error codes) on failure. 
- *
- * @note This function will fill portions of the `data` buffer with zeros if it encounters
- * file holes within the specified read range.
- * @note Won't test file reachability if reading 0 bytes.
- */
-int read(int inode_num, uint8_t *data, int _len, int _offset) {
-    int ret = 0;
-    uint8_t buffer[VDISK_SECTOR_SIZE];
-
-    // Checking input parameters
-    if (_len < 0 || _offset < 0) {
-        ret = ssfs_EINVAL;
-        goto error_management;
-    }
-
-    // Trivial empty reading
-    if (_len == 0)
-        return ret;
-
-    if (!is_mounted()) {
-        ret = ssfs_EMOUNT;
-        goto error_management;
-    }
-
-    uint32_t len = (uint32_t) _len;
-    uint32_t offset = (uint32_t) _offset;  
-
-    // Reading superblock
-    ret = vdisk_read(disk_handle, 0, buffer);
-    if (ret != 0)
-        goto error_management;
-    
-    superblock_t *sb = (superblock_t *)buffer;  
-
-    // Checking inode validity
-    uint32_t total_inodes = sb->num_inode_blocks * 32;
-    if (!is_inode_valid(inode_num, total_inodes)) {
-        ret = ssfs_EALLOC;
-        goto error_management;
-    }
-    
-    // Reading the inode block and finding the target inode
-    uint32_t target_inode_block = inode_num / 32;
-    uint32_t target_inode_num = inode_num % 32;
-    ret = vdisk_read(disk_handle, 1 + target_inode_block, buffer);
-    if (ret != 0)
-        goto error_management;
-    inodes_block_t* ib = (inodes_block_t *)buffer;
-    inode_t *target_inode = &ib[0][target_inode_num];
-
-    // Checking inode usage
-    if (!target_inode->valid) {
-        ret = ssfs_EINODE;
-        goto error_management;
-    }
-
-    // Checking file size
-    if (offset > target_inode->size) {
-        ret = ssfs_EREAD;  // Nothing to read if offset is beyond file size
-        goto error_management;
-    }
-    if (target_inode->size == 0)
-        return 0;
-    if (offset + len > target_inode->size)
-        len = target_inode->size - offset;  // Read only available data
-
-    // data_block_addresses will hold the addresses of data blocks we need to look for
-    uint32_t required_data_blocks_num = 1 + (offset + len - 1) / VDISK_SECTOR_SIZE;
-    uint32_t *data_block_addresses = malloc(required_data_blocks_num * sizeof(uint32_t));
-    if (data_block_addresses == NULL) {
-        ret = ssfs_EALLOC;
-        goto error_management;
-    }
-
-    ret = get_file_block_addresses(target_inode, data_block_addresses, required_data_blocks_num);
-    if (ret != 0)
-        goto error_management_free;
-
-    // Read data blocks
-    uint32_t bytes_read = 0;
-    while (bytes_read < len) {
-        uint32_t absolute_file_position = offset + bytes_read;
-        uint32_t block_index            = absolute_file_position / VDISK_SECTOR_SIZE;
-        uint32_t offset_within_block    = absolute_file_position % VDISK_SECTOR_SIZE;       
-
-        // Will copy the minimum between the remaining bytes in the block and in total
-        uint32_t bytes_remaining_in_block = VDISK_SECTOR_SIZE - offset_within_block;
-        uint32_t bytes_remaining_in_total = len - bytes_read;
-        uint32_t bytes_to_read = (bytes_remaining_in_block < bytes_remaining_in_total) ?
-            bytes_remaining_in_block :
-            bytes_remaining_in_total;
-
-        ret = vdisk_read(disk_handle, data_block_addresses[block_index], buffer);
-        if (ret != 0)
-            goto error_management_free;
-
-        memcpy(data + bytes_read, buffer + offset_within_block, bytes_to_read);
-
-        bytes_read += bytes_to_read;
-    }
-
-    free(data_block_addresses);
-    return (int)bytes_read;
-
-error_management_free:
-    free(data_block_addresses);
-
-error_management:
-    fprintf(stderr, "Error when reading (code %d).\n", ret);
-    return ret;
-}
-
-/**
- * @brief This function will write all the addresses of data blocks *used*
- * by a file into address_buffer.
- * @return 0 on success. Writes the data into address_buffer.
- * @return Error codes on failure.
- * @note It assumes the address_buffer is correctly sized. It assumes the caller
- * function will deal with the error codes.
- */
-int get_file_block_addresses(inode_t *inode, uint32_t *address_buffer, uint32_t max_addresses) {
-    int ret = 0;
-    uint32_t addresses_collected = 0;
-    uint8_t buffer[VDISK_SECTOR_SIZE];
-
-    // Looking for direct addresses
-    for (uint32_t d = 0; d < 4 && addresses_collected < max_addresses; d++) {
-        if (inode->direct[d]) {
-            address_buffer[addresses_collected++] = inode->direct[d];
-        }
-    }
-
-    // Looking for indirect addresses and related
-    if (inode->indirect1 && addresses_collected < max_addresses) {
-        ret = vdisk_read(disk_handle, inode->indirect1, buffer);
-        if (ret != 0)
-            return ret;
-
-        uint32_t *indirect_ptrs = (uint32_t *)buffer;
-
-        for (uint32_t db = 0; db < 256; db++) {
-            if (indirect_ptrs[db] && addresses_collected < max_addresses) {
-                address_buffer[addresses_collected++] = indirect_ptrs[db];
-            }
-        }
-    }
-
-    // Looking for double indirect addresses and related
-    if (inode->indirect2 && addresses_collected < max_addresses) {
-        ret = vdisk_read(disk_handle, inode->indirect2, buffer);
-        if (ret != 0)
-            return ret;
-
-        uint32_t *double_indirect_ptrs = (uint32_t *)buffer;
-
-        uint8_t indirect_pointers_buffer[VDISK_SECTOR_SIZE];
-        for (uint32_t ip = 0; ip < 256 && addresses_collected < max_addresses; ip++) {
-            if (double_indirect_ptrs[ip]) {
-                ret = vdisk_read(disk_handle, double_indirect_ptrs[ip], indirect_pointers_buffer);
-                if (ret != 0)
-                    return ret;
-
-                uint32_t *indirect_ptrs = (uint32_t *)indirect_pointers_buffer;
-
-                for (uint32_t db = 0; db < 256 && addresses_collected < max_addresses; db++) {
-                    if (indirect_ptrs[db]) {
-                        address_buffer[addresses_collected++] = indirect_ptrs[db];
-                    }
-                }
-            }
-        }
-    }
-
-    return ret;
-}
-
-
-/**
- * @brief Writes a specified number of bytes to a file at a given offset.
- *
- * This function writes `len` bytes from the `data` buffer into the file
- * identified by `inode_num`, starting at `offset` bytes from the beginning
- * of the file.
- *
- * The function handles file expansion if the write operation extends beyond
- * the current file size. If the write creates a gap (i.e., `offset` is
- * greater than the current file size), this gap will be implicitly filled
- * with zeros by allocating new blocks as needed. 
- *
- * @param inode_num The inode number of the target file.
- * @param data A pointer to the buffer containing the data to be written.
- * @param len The number of bytes to write from the `data` buffer.
- * @param offset The byte offset from the beginning of the file where writing should start.
- *
- * @return The number of bytes actually written from the `data` buffer on success.
- * (Note: Bytes used to fill implicit gaps with zeros are *not* counted in this return value).
- * @return A negative integer (error codes) on failure.
- *
- */
-int write(int inode_num, uint8_t *data, int _len, int _offset) {
-    int ret = 0;
-    uint8_t buffer[VDISK_SECTOR_SIZE];
-
-    // Checking input parameters
-    if (_len < 0 || _offset < 0) {
-        ret = ssfs_EINVAL;
-        goto error_management;
-    }
-
-    // Trivial empty reading
-    if (_len == 0)
-        return ret;
-    
-    if (!is_mounted()) {
-        ret = ssfs_EMOUNT;
-        goto error_management;
-    }
-
-    uint32_t len = (uint32_t) _len;
-    uint32_t offset = (uint32_t) _offset;
-    
-    // Reading superblock
-    ret = vdisk_read(disk_handle, 0, buffer);
-    if (ret != 0)
-        goto error_management;
-    superblock_t *sb = (superblock_t *)buffer;  
-
-    // Checking inode validity
-    uint32_t total_inodes = sb->num_inode_blocks * 32;
-    if (!is_inode_valid(inode_num, total_inodes)) {
-        ret = ssfs_EALLOC;
-        goto error_management;
-    }
-
-    // Reading the inode block and finding the target inode
-    uint32_t target_inode_block = inode_num / 32;
-    uint32_t target_inode_num  = inode_num % 32;
-    ret = vdisk_read(disk_handle, 1 + target_inode_block, buffer);
-    if (ret != 0) {
-        ret = vdisk_EACCESS;
-        goto error_management;
-    }
-    inodes_block_t* ib = (inodes_block_t *)buffer;
-    inode_t *target_inode = &ib[0][target_inode_num];
-
-    // Checking inode usage
-    uint32_t valid = target_inode->valid;
-    uint32_t size = target_inode->size;
-
-    if (!valid) {
-        ret = ssfs_EINODE;
-        goto error_management;
-    }
-
-    // From now on, len > 0, offset > 0, size >= 0 
-
-    // Extend file if needed to cover offset + len
-    uint32_t new_size = size > offset + len ? size : offset + len;
-    if (new_size > size) {
-        ret = extend_file(target_inode, new_size);
-        if (ret != 0)
-            goto error_management;
-
-        ret = vdisk_write(disk_handle, 1 + target_inode_block, buffer);
-        if (ret != 0) 
-            return ret;
-        ret = vdisk_sync(disk_handle);
-        if (ret != 0) 
-            return ret;
-    }
-
-    // Write the data (range is now within file size)
-    ret = write_in_file(target_inode, data, len, offset);
-    if (ret < 0)
-        goto error_management;
-
-    return ret;
-
-error_management:
-    fprintf(stderr, "Error when writing (code %d)\n", ret);
-    return ret;
-}
-
-/**
- * @brief This function will write inside an existing file.
- *
- * @param inode_num The inode number of the target file.
- * @param data A pointer to the buffer containing the data to be written.
- * @param len The number of bytes to write from the `data` buffer.
- * @param offset The byte offset from the beginning of the file where writing should start.
- *
- * @return Number of bytes actually written to the file on success; error codes on failure.
- */
-int write_in_file(inode_t *inode, uint8_t *data, uint32_t len, uint32_t offset) {
-    int ret = 0;
-    uint8_t buffer[VDISK_SECTOR_SIZE];
- 
-    // Computing the total number of DB for the file
-    uint32_t required_data_blocks_num = 1 + (offset + len - 1) / VDISK_SECTOR_SIZE;
-    uint32_t *data_block_addresses = malloc(required_data_blocks_num * sizeof(uint32_t));
-    if (data_block_addresses == NULL) {
-        ret = ssfs_EALLOC;
-        goto error_management;
-    }
-
-    ret = get_file_block_addresses(inode, data_block_addresses, required_data_blocks_num);
-    if (ret != 0)
-        goto error_management_free;
-    
-    uint32_t bytes_written = 0;
-    while (bytes_written < len) {
-        uint32_t absolute_file_position = offset + bytes_written;
-        uint32_t block_index = absolute_file_position / VDISK_SECTOR_SIZE;
-        uint32_t offset_within_block = absolute_file_position % VDISK_SECTOR_SIZE;
-
-        // Will copy the minimum between the remaining bytes in the block and in total
-        uint32_t bytes_remaining_in_block = VDISK_SECTOR_SIZE - offset_within_block;
-        uint32_t bytes_remaining_in_total = len - bytes_written;
-        uint32_t bytes_to_write = (bytes_remaining_in_block < bytes_remaining_in_total) ?
-            bytes_remaining_in_block :
-            bytes_remaining_in_total;
-     
-        ret = vdisk_read(disk_handle, data_block_addresses[block_index], buffer);
-        if (ret != 0)
-            goto error_management_free;
-
-        memcpy(buffer + offset_within_block, data + bytes_written, bytes_to_write);
-
-        ret = vdisk_write(disk_handle, data_block_addresses[block_index], buffer);
-        if (ret != 0)
-            goto error_management_free;
-        ret = vdisk_sync(disk_handle);
-        if (ret != 0)
-            goto error_management_free;
-
-        bytes_written += bytes_to_write;
-    }
-
-    free(data_block_addresses);
-    return bytes_written;
-
-error_management_free:
-    free(data_block_addresses);
-
-error_management:
-    return ret;
-}
-
-/**
- * @brief Helper function to allocate and return a free physical block. 
- * @return 0 on success, with *block set to the block number. Returns negative error code on failure.
- */
-int get_free_block(uint32_t *block) {
-    if (allocated_blocks_handle == NULL) 
-        return ssfs_EALLOC;
-
-    for (uint32_t b = 0; b < disk_handle->size_in_sectors; b++) {
-        if (!allocated_blocks_handle[b]) {
-            *block = b;
-            return set_block_status(b, true);  // Mark as allocated
-        }
-    }
-    return ssfs_ENOSPACE;
-}
-
-/**
- * @brief Helper function to set the physical block pointer for a logical block index
- * in the inode.
- * 
- * Allocates indirect/double-indirect blocks if needed.
- * @return Returns 0 on success, negative error code on failure.
- */
-int set_data_block_pointer(inode_t *inode, uint32_t logical) {
-    int ret = 0;
-    uint8_t buffer[VDISK_SECTOR_SIZE];
-
-    if (logical < 4) {
-        uint32_t physical;
-        ret = get_free_block(&physical);
-        if (ret != 0)
-            return ssfs_EALLOC;
-        inode->direct[logical] = physical;
-        return 0;
-    }
-
-    logical -= 4;
-    if (logical < 256) {
-        if (inode->indirect1 == 0) {
-            uint32_t ind_block;
-            ret = get_free_block(&ind_block);
-            if (ret != 0) 
-                return ret;
-            inode->indirect1 = ind_block;
-        }
-
-        uint32_t physical;
-        ret = get_free_block(&physical);
-        if (ret != 0)
-            return ssfs_EALLOC;
-
-        ret = vdisk_read(disk_handle, inode->indirect1, buffer);
-        if (ret != 0) 
-            return ret;
-        ((uint32_t *)buffer)[logical] = physical;
-        ret = vdisk_write(disk_handle, inode->indirect1, buffer);
-        if (ret != 0) 
-            return ret;
-        return vdisk_sync(disk_handle);
-    }
-
-    logical -= 256;
-    if (logical >= 256 * 256) 
-        return ssfs_ENOSPACE;
-
-    uint32_t ind_index = logical / 256;
-    uint32_t sub_index = logical % 256;
-
-    if (inode->indirect2 == 0) {
-        uint32_t dind_block;
-        ret = get_free_block(&dind_block);
-        if (ret != 0) 
-            return ret;
-        inode->indirect2 = dind_block;
-    }
-
-    ret = vdisk_read(disk_handle, inode->indirect2, buffer);
-    if (ret != 0) 
-        return vdisk_EACCESS;
-    uint32_t *dptrs = (uint32_t *)buffer;
-
-    if (dptrs[ind_index] == 0) {
-        uint32_t ind_block;
-        ret = get_free_block(&ind_block);
-        if (ret != 0) 
-            return ret;
-        dptrs[ind_index] = ind_block;
-
-        ret = vdisk_write(disk_handle, inode->indirect2, buffer);
-        if (ret != 0) 
-            return ret;
-        ret = vdisk_sync(disk_handle);
-        if (ret != 0) 
-            return ret;
-    }
-
-    uint32_t physical;
-        ret = get_free_block(&physical);
-        if (ret != 0)
-            return ssfs_EALLOC;
-
-    uint32_t ind_block = dptrs[ind_index];
-    ret = vdisk_read(disk_handle, ind_block, buffer);
-    if (ret != 0) 
-        return ret;
-    ((uint32_t *)buffer)[sub_index] = physical;
-
-    ret = vdisk_write(disk_handle, ind_block, buffer);
-    if (ret != 0) 
-        return ret;
-    ret = vdisk_sync(disk_handle);
-    if (ret != 0) 
-        return ret;
-
-    return ret;
-}
-
-/**
- * @brief Extends the file to a new size by allocating additional blocks if needed.
- *
- * Allocates new data blocks for the extension (implicitly zeroed), updates inode pointers,
- * and sets the new file size.
- *
- * @param inode Pointer to the inode to extend.
- * @param new_size The new file size (must be > inode->size).
- * @return 0 on success, negative error code on failure.
- */
-int extend_file(inode_t *inode, uint32_t new_size) {
-    int ret = 0;
-    if (new_size <= inode->size) 
-        return ret;
-
-    // Calculate current and needed block counts
-    uint32_t current_blocks = (inode->size + VDISK_SECTOR_SIZE - 1) / VDISK_SECTOR_SIZE;
-    uint32_t needed_blocks = (new_size + VDISK_SECTOR_SIZE - 1) / VDISK_SECTOR_SIZE;
-
-    // Allocate new blocks and assign to inode pointers
-    for (uint32_t logical = current_blocks; logical < needed_blocks; logical++) {
-        ret = set_data_block_pointer(inode, logical);
-        if (ret != 0)
-            goto error_management;
-    }
-
-    inode->size = new_size;
-    return ret;
-
-error_management:
-    return ret;
-}
-
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_file_io.c
+ * ==============
+ * 
+ * Manages data transfer to and from files within the file system.
+ * Contains the read and write functions, along with their associated 
+ * helper functions.
+ * 
+ * 
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+/**
+ * @brief Transfers the bytes [offset, offset + len) of a file between `data`
+ * and its blocks, as batches of the vdisk scheduler.
+ *
+ * Whole blocks go straight from or into `data`. A partial first or last
+ * block is read first and, for a write, written back merged with `data`.
+ *
+ * @param addresses The addresses of the data blocks of the file, from its
+ * first block.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+static int batch_transfer(uint32_t *addresses, uint8_t *data, uint32_t len, uint32_t offset, bool is_write) {
+    int ret = 0;
+    uint32_t first = offset / BLOCK_SIZE;
+    uint32_t count = (offset + len - 1) / BLOCK_SIZE - first + 1;
+    uint32_t head = offset % BLOCK_SIZE;                 // Bytes of the first block before the range
+    uint32_t end = (offset + len - 1) % BLOCK_SIZE + 1;  // Bytes of the last block up to its end
+    uint32_t first_bytes = (count == 1 ? end : (uint32_t)BLOCK_SIZE) - head;
+    bool first_partial = first_bytes != (uint32_t)BLOCK_SIZE;
+    bool last_partial = count > 1 && end != (uint32_t)BLOCK_SIZE;
+
+    vdisk_request_t *requests = malloc(count * sizeof(vdisk_request_t) + 2 * BLOCK_SIZE);
+    if (requests == NULL)
+        return ssfs_EALLOC;
+    uint8_t *first_block = (uint8_t *)(requests + count);
+    uint8_t *last_block = first_block + BLOCK_SIZE;
+
+    // Partial blocks keep the bytes around the range
+    if (is_write && (first_partial || last_partial)) {
+        uint32_t partial = 0;
+        if (first_partial)
+            requests[partial++] = (vdisk_request_t){VDISK_READ, addresses[first], 1, first_block};
+        if (last_partial)
+            requests[partial++] = (vdisk_request_t){VDISK_READ, addresses[first + count - 1], 1, last_block};
+        ret = vdisk_submit(disk_handle, requests, partial, false);
+        if (ret != 0)
+            goto cleanup;
+
+        if (first_partial)
+            memcpy(first_block + head, data, first_bytes);
+        if (last_partial)
+            memcpy(last_block, data + len - end, end);
+    }
+
+    for (uint32_t b = 0; b < count; b++) {
+        uint8_t *buffer;
+        if (b == 0 && first_partial)
+            buffer = first_block;
+        else if (b == count - 1 && last_partial)
+            buffer = last_block;
+        else
+            buffer = data + (size_t)b * BLOCK_SIZE - head;
+        requests[b] = (vdisk_request_t){is_write ? VDISK_WRITE : VDISK_READ, addresses[first + b], 1, buffer};
+    }
+    ret = vdisk_submit(disk_handle, requests, count, false);
+    if (ret != 0 || is_write)
+        goto cleanup;
+
+    if (first_partial)
+        memcpy(data, first_block + head, first_bytes);
+    if (last_partial)
+        memcpy(data + len - end, last_block, end);
+
+cleanup:
+    free(requests);
+    return ret;
+}
+
+/**
+ * @brief Reads a specified number of bytes from a file at a given offset.
+ *
+ * This function reads `len` bytes from the file identified by `inode_num`,
+ * starting at `offset` bytes from the beginning of the file. The read data
+ * is then copied into the provided `data` buffer.
+ * @note This buffer must be pre-allocated by the caller to be large
+ * enough to hold `len` bytes.
+ *
+ * @param inode_num The inode number of the target file to read from.
+ * @param data A pointer to the buffer where the read data will be stored.
+ * @param len The maximum number of bytes to read into the `data` buffer.
+ * @param offset The byte offset from the beginning of the file where reading should start.
+ *
+ * @return The number of bytes actually read and copied into the `data` buffer on success.
+ * This value may be less than `len` if the end of the file is reached
+ * before `len` bytes could be read.
+ * @return A negative integer (error codes) on failure. 
+ *
+ * @note This function will fill portions of the `data` buffer with zeros if it encounters
+ * file holes within the specified read range.
+ * @note Won't test file reachability if reading 0 bytes.
+ */
+int _read(int inode_num, uint8_t *data, int _len, int _offset) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    // Checking input parameters
+    if (_len < 0 || _offset < 0) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    // Trivial empty reading
+    if (_len == 0)
+        return ret;
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+
+    uint32_t len = (uint32_t) _len;
+    uint32_t offset = (uint32_t) _offset;  
+
+    // Checking inode validity
+    uint32_t total_inodes = itable_inodes();
+    if (!is_inode_valid(inode_num, total_inodes)) {
+        ret = ssfs_EALLOC;
+        goto error_management_unlock;
+    }
+    
+    // Reading the inode block and finding the target inode
+    uint32_t target_inode_block = inode_num / geometry_handle.inodes_per_block;
+    uint32_t target_inode_num = inode_num % geometry_handle.inodes_per_block;
+    ret = meta_read(itable_block(target_inode_block), buffer);
+    if (ret != 0)
+        goto error_management_unlock;
+    any_inode_t *target_inode = inode_at(buffer, target_inode_num);
+
+    // Checking inode usage
+    if (!inode_in_use(target_inode)) {
+        ret = ssfs_EINODE;
+        goto error_management_unlock;
+    }
+
+    // Checking file size
+    uint64_t size = inode_get_size(target_inode);
+    if (offset > size) {
+        ret = ssfs_EREAD;  // Nothing to read if offset is beyond file size
+        goto error_management_unlock;
+    }
+    if (size == 0) {
+        pthread_mutex_unlock(&fs_mutex);
+        return 0;
+    }
+    if ((uint64_t)offset + len > size)
+        len = (uint32_t)(size - offset);  // Read only available data
+
+    // Tiny files are read from the inode block
+    if (inode_is_inline(target_inode)) {
+        ret = inline_read(target_inode, data, len, offset);
+        pthread_mutex_unlock(&fs_mutex);
+        return ret;
+    }
+
+    // A packed tail is read from its fragment block, the rest from the blocks
+    uint32_t tail_bytes = 0;
+    if (tail_is_packed(target_inode) && (uint64_t)offset + len > tail_start(target_inode)) {
+        uint32_t start = (uint32_t)tail_start(target_inode);
+        uint32_t from = offset > start ? offset : start;
+        tail_bytes = offset + len - from;
+        ret = tail_read(target_inode, data + (from - offset), tail_bytes, from - start);
+        if (ret < 0)
+            goto error_management_unlock;
+
+        len -= tail_bytes;
+        if (len == 0) {
+            pthread_mutex_unlock(&fs_mutex);
+            return (int)tail_bytes;
+        }
+    }
+
+    // data_block_addresses will hold the addresses of data blocks we need to look for
+    uint32_t required_data_blocks_num = 1 + (offset + len - 1) / BLOCK_SIZE;
+    uint32_t *data_block_addresses = malloc(required_data_blocks_num * sizeof(uint32_t));
+    if (data_block_addresses == NULL) {
+        ret = ssfs_EALLOC;
+        goto error_management_unlock;
+    }
+
+    ret = inode_block_addresses(target_inode, data_block_addresses, required_data_blocks_num);
+    if (ret != 0)
+        goto error_management_free;
+
+    // Large calls are split in contiguous chunks served by the worker pool,
+    // the others are read as one batch
+    if (parallel_eligible(len))
+        ret = parallel_transfer(data_block_addresses, data, len, offset, false);
+    else
+        ret = batch_transfer(data_block_addresses, data, len, offset, false);
+    if (ret != 0)
+        goto error_management_free;
+
+    free(data_block_addresses);
+    pthread_mutex_unlock(&fs_mutex);
+    return (int)(len + tail_bytes);
+
+error_management_free:
+    free(data_block_addresses);
+
+error_management_unlock:
+    pthread_mutex_unlock(&fs_mutex);
+
+error_management:
+    fprintf(stderr, "Error when reading (code %d).\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_read()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int read(int inode_num, uint8_t *data, int _len, int _offset) {
+    uint64_t start = stats_clock();
+    int ret = _read(inode_num, data, _len, _offset);
+    stats_op(SSFS_OP_READ, start, ret);
+    trace_record(SSFS_OP_READ, start, ret, inode_num, _offset, _len, NULL);
+    return ret;
+}
+
+/**
+ * @brief This function will write all the addresses of data blocks *used*
+ * by a file into address_buffer.
+ * @return 0 on success. Writes the data into address_buffer.
+ * @return Error codes on failure.
+ * @note It assumes the address_buffer is correctly sized. It assumes the caller
+ * function will deal with the error codes.
+ */
+int get_file_block_addresses(inode_t *inode, uint32_t *address_buffer, uint32_t max_addresses) {
+    int ret = 0;
+    uint32_t addresses_collected = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    // Looking for direct addresses
+    for (uint32_t d = 0; d < 4 && addresses_collected < max_addresses; d++) {
+        if (inode->direct[d]) {
+            address_buffer[addresses_collected++] = inode->direct[d];
+        }
+    }
+
+    // Looking for indirect addresses and related
+    if (inode->indirect1 && addresses_collected < max_addresses) {
+        ret = meta_read(inode->indirect1, buffer);
+        if (ret != 0)
+            return ret;
+
+        uint32_t *indirect_ptrs = (uint32_t *)buffer;
+
+        for (uint32_t db = 0; db < POINTERS_PER_BLOCK; db++) {
+            if (indirect_ptrs[db] && addresses_collected < max_addresses) {
+                address_buffer[addresses_collected++] = indirect_ptrs[db];
+            }
+        }
+    }
+
+    // Looking for double indirect addresses and related
+    if (inode->indirect2 && addresses_collected < max_addresses) {
+        ret = meta_read(inode->indirect2, buffer);
+        if (ret != 0)
+            return ret;
+
+        uint32_t *double_indirect_ptrs = (uint32_t *)buffer;
+
+        uint8_t indirect_pointers_buffer[BLOCK_SIZE];
+        for (uint32_t ip = 0; ip < POINTERS_PER_BLOCK && addresses_collected < max_addresses; ip++) {
+            if (double_indirect_ptrs[ip]) {
+                ret = meta_read(double_indirect_ptrs[ip], indirect_pointers_buffer);
+                if (ret != 0)
+                    return ret;
+
+                uint32_t *indirect_ptrs = (uint32_t *)indirect_pointers_buffer;
+
+                for (uint32_t db = 0; db < POINTERS_PER_BLOCK && addresses_collected < max_addresses; db++) {
+                    if (indirect_ptrs[db]) {
+                        address_buffer[addresses_collected++] = indirect_ptrs[db];
+                    }
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+
+/**
+ * @brief Writes to a file in one transaction, see `_write()`.
+ * @return The number of bytes written on success, negative error code on failure.
+ * @note The caller holds `fs_mutex`. On failure, the transaction is aborted.
+ */
+static int write_transaction(int inode_num, uint8_t *data, uint32_t len, uint32_t offset) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    // Reading the inode block and finding the target inode
+    uint32_t target_inode_block = inode_num / geometry_handle.inodes_per_block;
+    uint32_t target_inode_num  = inode_num % geometry_handle.inodes_per_block;
+    ret = meta_read(itable_block(target_inode_block), buffer);
+    if (ret != 0)
+        return vdisk_EACCESS;
+    any_inode_t *target_inode = inode_at(buffer, target_inode_num);
+
+    // Checking inode usage
+    uint64_t size = inode_get_size(target_inode);
+
+    if (!inode_in_use(target_inode))
+        return ssfs_EINODE;
+
+    // From now on, len > 0, offset > 0, size >= 0 
+
+    // The extension's metadata is committed as one transaction
+    journal_begin();
+
+    // Extend file if needed to cover offset + len
+    uint64_t new_size = size > (uint64_t)offset + len ? size : (uint64_t)offset + len;
+
+    // Tiny files are written in the inode, their data is metadata
+    if (inline_fits(target_inode, new_size)) {
+        int bytes_written = inline_write(target_inode, data, len, offset);
+        ret = meta_write(itable_block(target_inode_block), buffer);
+        if (ret != 0)
+            goto error_management_abort_transaction;
+        dirty_mark_metadata(inode_num, true);
+
+        ret = journal_end();
+        return ret != 0 ? ret : bytes_written;
+    }
+
+    // A packed tail moves back to a block before it is written or followed
+    if (tail_is_packed(target_inode) && (uint64_t)offset + len > tail_start(target_inode)) {
+        ret = tail_unpack(inode_num, target_inode);
+        if (ret != 0)
+            goto error_management_abort_transaction;
+
+        ret = meta_write(itable_block(target_inode_block), buffer);
+        if (ret != 0)
+            goto error_management_abort_transaction;
+        dirty_mark_metadata(inode_num, true);
+    }
+
+    if (new_size > size) {
+        // A file outgrowing its inode moves to data blocks first
+        if (inode_is_inline(target_inode))
+            ret = inline_migrate(inode_num, target_inode, new_size);
+        else
+            ret = inode_extend(target_inode, new_size);
+        if (ret != 0)
+            goto error_management_abort_transaction;
+
+        ret = meta_write(itable_block(target_inode_block), buffer);
+        if (ret != 0) 
+            goto error_management_abort_transaction;
+        dirty_mark_metadata(inode_num, true);
+    }
+
+    // Write the data (range is now within file size)
+    ret = write_in_file(inode_num, target_inode, data, len, offset);
+    if (ret < 0)
+        goto error_management_abort_transaction;
+
+    int bytes_written = ret;
+
+    // Then its last partial block is shared with the tails of other files
+    ret = tail_pack(inode_num, target_inode);
+    if (ret < 0)
+        goto error_management_abort_transaction;
+    if (ret > 0) {
+        ret = meta_write(itable_block(target_inode_block), buffer);
+        if (ret != 0)
+            goto error_management_abort_transaction;
+        dirty_mark_metadata(inode_num, true);
+    }
+
+    ret = journal_end();
+    return ret != 0 ? ret : bytes_written;
+
+error_management_abort_transaction:
+    journal_abort();
+    return ret;
+}
+
+/**
+ * @brief Writes a specified number of bytes to a file at a given offset.
+ *
+ * This function writes `len` bytes from the `data` buffer into the file
+ * identified by `inode_num`, starting at `offset` bytes from the beginning
+ * of the file.
+ *
+ * The function handles file expansion if the write operation extends beyond
+ * the current file size. If the write creates a gap (i.e., `offset` is
+ * greater than the current file size), this gap will be implicitly filled
+ * with zeros by allocating new blocks as needed. 
+ *
+ * @param inode_num The inode number of the target file.
+ * @param data A pointer to the buffer containing the data to be written.
+ * @param len The number of bytes to write from the `data` buffer.
+ * @param offset The byte offset from the beginning of the file where writing should start.
+ *
+ * @return The number of bytes actually written from the `data` buffer on success.
+ * (Note: Bytes used to fill implicit gaps with zeros are *not* counted in this return value).
+ * @return A negative integer (error codes) on failure.
+ *
+ * @note `stat()` returns the size as an int, so a write can't take a file
+ * past INT_MAX bytes (ssfs_EINVAL).
+ */
+int _write(int inode_num, uint8_t *data, int _len, int _offset) {
+    int ret = 0;
+
+    // Checking input parameters
+    if (_len < 0 || _offset < 0 || _len > INT_MAX - _offset) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    // Trivial empty reading
+    if (_len == 0)
+        return ret;
+    
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+
+    uint32_t len = (uint32_t) _len;
+    uint32_t offset = (uint32_t) _offset;
+    
+    // Checking inode validity
+    uint32_t total_inodes = itable_inodes();
+    if (!is_inode_valid(inode_num, total_inodes)) {
+        ret = ssfs_EALLOC;
+        goto error_management_unlock;
+    }
+
+    // Blocks waiting for a commit or for the reclaimer are released between
+    // two attempts, outside of the transaction
+    ret = write_transaction(inode_num, data, len, offset);
+    if (ret == ssfs_ENOSPACE && release_blocks())
+        ret = write_transaction(inode_num, data, len, offset);
+    if (ret < 0)
+        goto error_management_unlock;
+
+    pthread_mutex_unlock(&fs_mutex);
+    return ret;
+
+error_management_unlock:
+    pthread_mutex_unlock(&fs_mutex);
+
+error_management:
+    fprintf(stderr, "Error when writing (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_write()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int write(int inode_num, uint8_t *data, int _len, int _offset) {
+    uint64_t start = stats_clock();
+    int ret = _write(inode_num, data, _len, _offset);
+    stats_op(SSFS_OP_WRITE, start, ret);
+    trace_record(SSFS_OP_WRITE, start, ret, inode_num, _offset, _len, NULL);
+    return ret;
+}
+
+/**
+ * @brief This function will write inside an existing file.
+ *
+ * The written blocks are not synced, they are recorded as dirty ranges of
+ * the file instead.
+ *
+ * @param inode_num The inode number of the target file.
+ * @param inode A pointer to the inode of the target file.
+ * @param data A pointer to the buffer containing the data to be written.
+ * @param len The number of bytes to write from the `data` buffer.
+ * @param offset The byte offset from the beginning of the file where writing should start.
+ *
+ * @return Number of bytes actually written to the file on success; error codes on failure.
+ */
+int write_in_file(int inode_num, any_inode_t *inode, uint8_t *data, uint32_t len, uint32_t offset) {
+    int ret = 0;
+
+    // Computing the total number of DB for the file
+    uint32_t required_data_blocks_num = 1 + (offset + len - 1) / BLOCK_SIZE;
+    uint32_t *data_block_addresses = malloc(required_data_blocks_num * sizeof(uint32_t));
+    if (data_block_addresses == NULL) {
+        ret = ssfs_EALLOC;
+        goto error_management;
+    }
+
+    ret = inode_block_addresses(inode, data_block_addresses, required_data_blocks_num);
+    if (ret != 0)
+        goto error_management_free;
+    
+    // Large calls are served by the worker pool, the others as one batch
+    if (parallel_eligible(len))
+        ret = parallel_transfer(data_block_addresses, data, len, offset, true);
+    else
+        ret = batch_transfer(data_block_addresses, data, len, offset, true);
+    if (ret != 0)
+        goto error_management_free;
+
+    for (uint32_t b = offset / BLOCK_SIZE; b < required_data_blocks_num; b++)
+        dirty_mark_data(inode_num, data_block_addresses[b], 1);
+
+    free(data_block_addresses);
+    return len;
+
+error_management_free:
+    free(data_block_addresses);
+
+error_management:
+    return ret;
+}
+
+/**
+ * @brief Helper function to allocate and return a free physical block. 
+ * @return 0 on success, with *block set to the block number. Returns negative error code on failure.
+ * @note Inside a transaction, ssfs_ENOSPACE may only mean that the blocks
+ * waiting for a commit or for the reclaimer must be released first, see
+ * `release_blocks()`.
+ */
+int get_free_block(uint32_t *block) {
+    if (allocated_blocks_handle == NULL) 
+        return ssfs_EALLOC;
+
+    for (uint32_t b = 0; b < disk_handle->size_in_sectors; b++) {
+        if (!allocated_blocks_handle[b]) {
+            *block = b;
+            stats_allocation(b + 1, true);
+            return set_block_status(b, true);  // Mark as allocated
+        }
+    }
+    uint32_t scanned = disk_handle->size_in_sectors;
+
+    // A running transaction can't be committed, its caller aborts it and
+    // releases the blocks before retrying
+    if (!journal_in_transaction() && release_blocks()) {
+        for (uint32_t b = 0; b < disk_handle->size_in_sectors; b++) {
+            if (!allocated_blocks_handle[b]) {
+                *block = b;
+                stats_allocation(scanned + b + 1, true);
+                return set_block_status(b, true);
+            }
+        }
+        scanned += disk_handle->size_in_sectors;
+    }
+    stats_allocation(scanned, false);
+    return ssfs_ENOSPACE;
+}
+
+/**
+ * @brief Releases the blocks freed by uncommitted transactions, with a
+ * commit, and those of deleted files, once zeroed.
+ * @return true if blocks may have been released.
+ * @note The caller holds `fs_mutex` and runs no transaction.
+ */
+bool release_blocks() {
+    bool released = journal_is_active() && journal_commit() == 0;
+    if (reclaim_pending() && reclaim_all() == 0)
+        released = true;
+    return released;
+}
+
+/**
+ * @brief Allocates `goal` if it is free, so that files stay contiguous,
+ * or any free block otherwise.
+ * @return 0 on success, with *block set to the block number. Returns negative error code on failure.
+ */
+int get_free_block_near(uint32_t goal, uint32_t *block) {
+    if (allocated_blocks_handle == NULL)
+        return ssfs_EALLOC;
+
+    if (goal != 0 && goal < disk_handle->size_in_sectors && !allocated_blocks_handle[goal]) {
+        *block = goal;
+        stats_allocation(1, true);
+        return set_block_status(goal, true);
+    }
+    return get_free_block(block);
+}
+
+/**
+ * @brief Helper function to set the physical block pointer for a logical block index
+ * in the inode.
+ * 
+ * Allocates indirect/double-indirect blocks if needed.
+ * @return Returns 0 on success, negative error code on failure.
+ */
+int set_data_block_pointer(inode_t *inode, uint32_t logical) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    if (logical < 4) {
+        uint32_t physical;
+        ret = get_free_block(&physical);
+        if (ret != 0)
+            return ret;
+        inode->direct[logical] = physical;
+        return 0;
+    }
+
+    logical -= 4;
+    uint32_t pointers = POINTERS_PER_BLOCK;
+    if (logical < pointers) {
+        if (inode->indirect1 == 0) {
+            uint32_t ind_block;
+            ret = get_free_block(&ind_block);
+            if (ret != 0) 
+                return ret;
+            inode->indirect1 = ind_block;
+        }
+
+        uint32_t physical;
+        ret = get_free_block(&physical);
+        if (ret != 0)
+            return ret;
+
+        ret = meta_read(inode->indirect1, buffer);
+        if (ret != 0) 
+            return ret;
+        ((uint32_t *)buffer)[logical] = physical;
+        return meta_write(inode->indirect1, buffer);
+    }
+
+    logical -= pointers;
+    if (logical >= pointers * pointers) 
+        return ssfs_ENOSPACE;
+
+    uint32_t ind_index = logical / pointers;
+    uint32_t sub_index = logical % pointers;
+
+    if (inode->indirect2 == 0) {
+        uint32_t dind_block;
+        ret = get_free_block(&dind_block);
+        if (ret != 0) 
+            return ret;
+        inode->indirect2 = dind_block;
+    }
+
+    ret = meta_read(inode->indirect2, buffer);
+    if (ret != 0) 
+        return vdisk_EACCESS;
+    uint32_t *dptrs = (uint32_t *)buffer;
+
+    if (dptrs[ind_index] == 0) {
+        uint32_t ind_block;
+        ret = get_free_block(&ind_block);
+        if (ret != 0) 
+            return ret;
+        dptrs[ind_index] = ind_block;
+
+        ret = meta_write(inode->indirect2, buffer);
+        if (ret != 0) 
+            return ret;
+    }
+
+    uint32_t physical;
+        ret = get_free_block(&physical);
+        if (ret != 0)
+            return ret;
+
+    uint32_t ind_block = dptrs[ind_index];
+    ret = meta_read(ind_block, buffer);
+    if (ret != 0) 
+        return ret;
+    ((uint32_t *)buffer)[sub_index] = physical;
+
+    return meta_write(ind_block, buffer);
+}
+
+/**
+ * @brief Extends the file to a new size by allocating additional blocks if needed.
+ *
+ * Allocates new data blocks for the extension (implicitly zeroed), updates inode pointers,
+ * and sets the new file size.
+ *
+ * @param inode Pointer to the inode to extend.
+ * @param new_size The new file size (must be > inode->size).
+ * @return 0 on success, negative error code on failure.
+ */
+int extend_file(inode_t *inode, uint32_t new_size) {
+    int ret = 0;
+    if (new_size <= inode->size) 
+        return ret;
+
+    // Calculate current and needed block counts
+    uint32_t current_blocks = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t needed_blocks = (new_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // Allocate new blocks and assign to inode pointers
+    for (uint32_t logical = current_blocks; logical < needed_blocks; logical++) {
+        ret = set_data_block_pointer(inode, logical);
+        if (ret != 0)
+            goto error_management;
+    }
+
+    inode->size = new_size;
+    return ret;
+
+error_management:
+    return ret;
+}
+
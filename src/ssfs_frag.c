@@ -0,0 +1,287 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_frag.c
+ * ===========
+ *
+ * Fragmentation of the mounted volume, reported by the `ssfs_frag` tool.
+ * A file is measured by the runs of physically contiguous blocks holding
+ * its data, in logical order: a sequential read of it seeks once per run,
+ * where one would do. Indirect and extent blocks are measured by their
+ * distance to the first block they map, the seek a read pays to follow
+ * them. The free space is measured from the bitmap, by the lengths of its
+ * runs of free blocks. Nothing is written.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+/**
+ * @brief Adds `count` data blocks from `first` to a file, in logical order.
+ */
+static void tally_data(ssfs_frag_file_t *file, uint32_t *next, uint32_t first, uint32_t count) {
+    if (count == 0)
+        return;
+    if (file->blocks == 0 || first != *next)
+        file->runs++;
+    file->blocks += count;
+    *next = first + count;
+}
+
+/**
+ * @brief Adds an indirect or extent block to a file, `mapped` being the
+ * first block it maps, 0 if none.
+ */
+static void tally_meta(ssfs_frag_file_t *file, uint32_t block, uint32_t mapped) {
+    file->meta_blocks++;
+    if (mapped != 0)
+        file->meta_distance += block > mapped ? block - mapped : mapped - block;
+}
+
+/**
+ * @brief Measures the block map of a version 1 inode.
+ * @return 0 on success, negative error code on failure.
+ */
+static int frag_v1(inode_t *inode, ssfs_frag_file_t *file) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    uint8_t inner[BLOCK_SIZE];
+    uint32_t *pointers = (uint32_t *)buffer;
+    uint32_t *inner_pointers = (uint32_t *)inner;
+    uint32_t next = 0;
+
+    for (uint32_t d = 0; d < 4; d++)
+        if (inode->direct[d])
+            tally_data(file, &next, inode->direct[d], 1);
+
+    if (inode->indirect1) {
+        ret = meta_read(inode->indirect1, buffer);
+        if (ret != 0)
+            return ret;
+        tally_meta(file, inode->indirect1, pointers[0]);
+        for (uint32_t p = 0; p < POINTERS_PER_BLOCK; p++)
+            if (pointers[p])
+                tally_data(file, &next, pointers[p], 1);
+    }
+
+    if (inode->indirect2) {
+        ret = meta_read(inode->indirect2, buffer);
+        if (ret != 0)
+            return ret;
+        tally_meta(file, inode->indirect2, pointers[0]);
+        for (uint32_t i = 0; i < POINTERS_PER_BLOCK; i++) {
+            if (!pointers[i])
+                continue;
+            ret = meta_read(pointers[i], inner);
+            if (ret != 0)
+                return ret;
+            tally_meta(file, pointers[i], inner_pointers[0]);
+            for (uint32_t p = 0; p < POINTERS_PER_BLOCK; p++)
+                if (inner_pointers[p])
+                    tally_data(file, &next, inner_pointers[p], 1);
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Measures the block map of a version 2 inode. The packed tail isn't
+ * counted, as it shares its block by design.
+ * @return 0 on success, negative error code on failure.
+ */
+static int frag_v2(inode_v2_t *inode, ssfs_frag_file_t *file) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    extent_block_t *leaf = (extent_block_t *)buffer;
+    uint32_t next = 0;
+
+    for (uint32_t e = 0; e < inode->extents_num; e++)
+        tally_data(file, &next, inode->extents[e].physical, inode->extents[e].length);
+
+    for (uint32_t block = inode->extent_block; block != 0; block = leaf->next) {
+        ret = meta_read(block, buffer);
+        if (ret != 0)
+            return ret;
+        tally_meta(file, block, leaf->count > 0 ? leaf->extents[0].physical : 0);
+        for (uint32_t e = 0; e < leaf->count; e++)
+            tally_data(file, &next, leaf->extents[e].physical, leaf->extents[e].length);
+    }
+    return ret;
+}
+
+/**
+ * @brief Measures the fragmentation of a file.
+ * @return 0 on success, negative error code on failure.
+ * @note The caller holds `fs_mutex`.
+ */
+static int frag_inode(any_inode_t *inode, ssfs_frag_file_t *file) {
+    memset(file, 0, sizeof(ssfs_frag_file_t));
+    if (inode_is_inline(inode))
+        return 0;
+
+    int ret = geometry_handle.inode_version == INODE_V2 ? frag_v2(&inode->v2, file) : frag_v1(&inode->v1, file);
+    file->ideal_runs = file->blocks > 0 ? 1 : 0;
+    return ret;
+}
+
+/**
+ * @brief Measures the runs of free blocks of the bitmap.
+ * @note The caller holds `fs_mutex`.
+ */
+static void frag_free_space(ssfs_frag_report_t *report) {
+    uint32_t run = 0;
+    for (uint32_t b = 0; b <= disk_handle->size_in_sectors; b++) {
+        if (b < disk_handle->size_in_sectors && !allocated_blocks_handle[b]) {
+            run++;
+            continue;
+        }
+        if (run == 0)
+            continue;
+
+        uint32_t bucket = 31 - __builtin_clz(run);
+        report->free_extents++;
+        report->free_blocks += run;
+        report->free_histogram[bucket < SSFS_FRAG_BUCKETS ? bucket : SSFS_FRAG_BUCKETS - 1]++;
+        if (run > report->largest_free_extent)
+            report->largest_free_extent = run;
+        run = 0;
+    }
+
+    report->itable_runs = 1;
+    for (uint32_t i = 1; i < itable_blocks(); i++)
+        if (itable_block(i) != itable_block(i - 1) + 1)
+            report->itable_runs++;
+}
+
+/**
+ * @brief Measures the fragmentation of a file.
+ *
+ * @param inode_num The file.
+ * @param file Filled with its data blocks, their runs of physically
+ * contiguous blocks and the runs they would need, and its indirect or extent
+ * blocks with their distance to the blocks they map.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int ssfs_frag_file(int inode_num, ssfs_frag_file_t *file) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    if (file == NULL) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+
+    if (!is_inode_valid(inode_num, itable_inodes())) {
+        ret = ssfs_EALLOC;
+        goto error_management_unlock;
+    }
+
+    ret = meta_read(itable_block(inode_num / geometry_handle.inodes_per_block), buffer);
+    if (ret != 0)
+        goto error_management_unlock;
+
+    any_inode_t *inode = inode_at(buffer, inode_num % geometry_handle.inodes_per_block);
+    if (!inode_in_use(inode)) {
+        ret = ssfs_EINODE;
+        goto error_management_unlock;
+    }
+
+    ret = frag_inode(inode, file);
+    if (ret != 0)
+        goto error_management_unlock;
+
+    pthread_mutex_unlock(&fs_mutex);
+    return ret;
+
+error_management_unlock:
+    pthread_mutex_unlock(&fs_mutex);
+error_management:
+    fprintf(stderr, "Error when measuring the fragmentation of a file (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Measures the fragmentation of the mounted volume.
+ *
+ * Every file is measured as by `ssfs_frag_file()`, one block of the inode
+ * table at a time, so that the other calls go on between them: files
+ * changed meanwhile may be measured before or after the change.
+ *
+ * @param report Filled with the totals over the files, the runs of free
+ * blocks by length and the runs of the inode table.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int ssfs_frag_report(ssfs_frag_report_t *report) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    if (report == NULL) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    memset(report, 0, sizeof(ssfs_frag_report_t));
+    for (uint32_t block_index = 0;; block_index++) {
+        pthread_mutex_lock(&fs_mutex);
+        if (!is_mounted() || block_index >= itable_blocks()) {
+            ret = is_mounted() ? 0 : ssfs_EMOUNT;
+            pthread_mutex_unlock(&fs_mutex);
+            if (ret != 0)
+                goto error_management;
+            break;
+        }
+
+        ret = meta_read(itable_block(block_index), buffer);
+        for (uint32_t i = 0; ret == 0 && i < geometry_handle.inodes_per_block; i++) {
+            any_inode_t *inode = inode_at(buffer, i);
+            if (!inode_in_use(inode))
+                continue;
+
+            ssfs_frag_file_t file;
+            ret = frag_inode(inode, &file);
+            if (ret != 0 || file.blocks == 0)
+                continue;
+            report->files++;
+            report->fragmented_files += file.runs > file.ideal_runs;
+            report->data_blocks += file.blocks;
+            report->data_runs += file.runs;
+            report->ideal_runs += file.ideal_runs;
+            report->meta_blocks += file.meta_blocks;
+            report->meta_distance += file.meta_distance;
+        }
+        pthread_mutex_unlock(&fs_mutex);
+        if (ret != 0)
+            goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+    frag_free_space(report);
+    pthread_mutex_unlock(&fs_mutex);
+    return ret;
+
+error_management:
+    fprintf(stderr, "Error when measuring the fragmentation of the volume (code %d)\n", ret);
+    return ret;
+}
@@ -0,0 +1,297 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_fsync.c
+ * ============
+ *
+ * Per-file durability.
+ * Data writes are buffered: the sectors they touch are recorded per inode
+ * as dirty ranges, and only written back when the file is synced or when
+ * the journal commits metadata of that file. `ssfs_fsync()` and
+ * `ssfs_fdatasync()` let applications choose their own durability points.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+// Beyond this many ranges, the ranges of an inode are merged into one span.
+#define MAX_DIRTY_RANGES 64
+
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+} sector_range_t;
+
+typedef struct {
+    sector_range_t ranges[MAX_DIRTY_RANGES];
+    uint32_t ranges_num;
+    bool metadata_dirty;  // Uncommitted metadata (creation, size, block map)
+    bool alloc_dirty;     // Uncommitted size or block map change
+} inode_dirty_t;
+
+static inode_dirty_t *dirty_inodes = NULL;
+static uint32_t dirty_inodes_num = 0;
+
+/**
+ * @brief Allocates the dirty tracking state of the mounted volume.
+ * @return 0 on success, negative error code on failure.
+ */
+int dirty_load(uint32_t inodes_num) {
+    dirty_inodes = calloc(inodes_num, sizeof(inode_dirty_t));
+    if (dirty_inodes == NULL)
+        return ssfs_EALLOC;
+    dirty_inodes_num = inodes_num;
+    return 0;
+}
+
+/**
+ * @brief Extends the dirty tracking state to the inodes added to the table.
+ * @return 0 on success, negative error code on failure.
+ */
+int dirty_grow(uint32_t inodes_num) {
+    if (inodes_num <= dirty_inodes_num)
+        return 0;
+    inode_dirty_t *grown = realloc(dirty_inodes, inodes_num * sizeof(inode_dirty_t));
+    if (grown == NULL)
+        return ssfs_EALLOC;
+    memset(&grown[dirty_inodes_num], 0, (inodes_num - dirty_inodes_num) * sizeof(inode_dirty_t));
+    dirty_inodes = grown;
+    dirty_inodes_num = inodes_num;
+    return 0;
+}
+
+/**
+ * @brief Frees the dirty tracking state.
+ */
+void dirty_release() {
+    free(dirty_inodes);
+    dirty_inodes = NULL;
+    dirty_inodes_num = 0;
+}
+
+/**
+ * @brief Records that the sectors [sector, sector + count) of a file hold
+ * data that was not written back yet.
+ *
+ * Adjacent ranges are merged. Once an inode has too many ranges they are
+ * merged into a single span, which may also cover sectors of other files.
+ */
+void dirty_mark_data(int inode_num, uint32_t sector, uint32_t count) {
+    if (dirty_inodes == NULL || (uint32_t)inode_num >= dirty_inodes_num)
+        return;
+    inode_dirty_t *dirty = &dirty_inodes[inode_num];
+
+    if (dirty->ranges_num > 0) {
+        sector_range_t *last = &dirty->ranges[dirty->ranges_num - 1];
+        if (sector >= last->start && sector <= last->start + last->count) {
+            uint32_t end = sector + count > last->start + last->count ?
+                sector + count :
+                last->start + last->count;
+            last->count = end - last->start;
+            return;
+        }
+    }
+
+    if (dirty->ranges_num == MAX_DIRTY_RANGES) {
+        uint32_t low = sector;
+        uint32_t high = sector + count;
+        for (uint32_t r = 0; r < dirty->ranges_num; r++) {
+            if (dirty->ranges[r].start < low)
+                low = dirty->ranges[r].start;
+            if (dirty->ranges[r].start + dirty->ranges[r].count > high)
+                high = dirty->ranges[r].start + dirty->ranges[r].count;
+        }
+        dirty->ranges[0].start = low;
+        dirty->ranges[0].count = high - low;
+        dirty->ranges_num = 1;
+        return;
+    }
+
+    dirty->ranges[dirty->ranges_num].start = sector;
+    dirty->ranges[dirty->ranges_num].count = count;
+    dirty->ranges_num++;
+}
+
+/**
+ * @brief Records that a file has uncommitted metadata.
+ *
+ * @param allocation true when the size or the block map changed, which
+ * `ssfs_fdatasync()` must also make durable.
+ */
+void dirty_mark_metadata(int inode_num, bool allocation) {
+    if (dirty_inodes == NULL || (uint32_t)inode_num >= dirty_inodes_num)
+        return;
+    dirty_inodes[inode_num].metadata_dirty = true;
+    dirty_inodes[inode_num].alloc_dirty |= allocation;
+}
+
+/**
+ * @brief Forgets everything about a deleted file.
+ */
+void dirty_forget(int inode_num) {
+    if (dirty_inodes == NULL || (uint32_t)inode_num >= dirty_inodes_num)
+        return;
+    memset(&dirty_inodes[inode_num], 0, sizeof(inode_dirty_t));
+}
+
+/**
+ * @brief Widens [*low, *high) to the dirty data ranges of a file.
+ */
+static void dirty_span(inode_dirty_t *dirty, uint32_t *low, uint32_t *high) {
+    for (uint32_t r = 0; r < dirty->ranges_num; r++) {
+        if (dirty->ranges[r].start < *low)
+            *low = dirty->ranges[r].start;
+        if (dirty->ranges[r].start + dirty->ranges[r].count > *high)
+            *high = dirty->ranges[r].start + dirty->ranges[r].count;
+    }
+}
+
+/**
+ * @brief Makes the dirty data ranges of a file durable.
+ *
+ * The span covering them is synced at once, as the sync ends with a flush
+ * of the whole image anyway.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int dirty_flush_data(int inode_num) {
+    int ret = 0;
+    if (dirty_inodes == NULL || (uint32_t)inode_num >= dirty_inodes_num)
+        return ret;
+    inode_dirty_t *dirty = &dirty_inodes[inode_num];
+    if (dirty->ranges_num == 0)
+        return ret;
+
+    uint32_t low = UINT32_MAX, high = 0;
+    dirty_span(dirty, &low, &high);
+    ret = vdisk_sync_range(disk_handle, low, high - low);
+    if (ret != 0)
+        return ret;
+    dirty->ranges_num = 0;
+    return ret;
+}
+
+/**
+ * @brief Makes the data of every file whose metadata is about to be
+ * committed durable, so committed metadata never points to unwritten data.
+ *
+ * @return 0 on success, negative error code on failure.
+ *
+ * @note Called by the journal before writing a commit record.
+ */
+int dirty_flush_committing() {
+    int ret = 0;
+    uint32_t low = UINT32_MAX, high = 0;
+    for (uint32_t i = 0; i < dirty_inodes_num; i++)
+        if (dirty_inodes[i].metadata_dirty)
+            dirty_span(&dirty_inodes[i], &low, &high);
+    if (high == 0)
+        return ret;
+
+    // One sync for all of them
+    ret = vdisk_sync_range(disk_handle, low, high - low);
+    if (ret != 0)
+        return ret;
+    for (uint32_t i = 0; i < dirty_inodes_num; i++)
+        if (dirty_inodes[i].metadata_dirty)
+            dirty_inodes[i].ranges_num = 0;
+    return ret;
+}
+
+/**
+ * @brief Clears the metadata flags once the journal committed them.
+ */
+void dirty_committed() {
+    for (uint32_t i = 0; i < dirty_inodes_num; i++) {
+        dirty_inodes[i].metadata_dirty = false;
+        dirty_inodes[i].alloc_dirty = false;
+    }
+}
+
+/**
+ * @brief Common part of `ssfs_fsync()` and `ssfs_fdatasync()`.
+ */
+static int sync_file(int inode_num, bool data_only) {
+    int ret = 0;
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+
+    uint32_t total_inodes = itable_inodes();
+    if (!is_inode_valid(inode_num, total_inodes) || (uint32_t)inode_num >= dirty_inodes_num) {
+        ret = ssfs_EALLOC;
+        goto error_management_unlock;
+    }
+
+    ret = dirty_flush_data(inode_num);
+    if (ret != 0)
+        goto error_management_unlock;
+
+    inode_dirty_t *dirty = &dirty_inodes[inode_num];
+    bool commit = data_only ? dirty->alloc_dirty : dirty->metadata_dirty;
+    if (commit && journal_is_active()) {
+        ret = journal_commit();
+        if (ret != 0)
+            goto error_management_unlock;
+    }
+
+    pthread_mutex_unlock(&fs_mutex);
+    return ret;
+
+error_management_unlock:
+    pthread_mutex_unlock(&fs_mutex);
+
+error_management:
+    fprintf(stderr, "Error when syncing a file (code %d).\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Makes the data and metadata of a file durable.
+ *
+ * The dirty data ranges of this file are written back and flushed with
+ * `fdatasync()`, which also makes durable the blocks the image file
+ * allocated for them and empties the device cache. If the file has
+ * uncommitted metadata, the journal is committed as well.
+ *
+ * @param inode_num The inode number of the file.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int ssfs_fsync(int inode_num) {
+    uint64_t start = stats_clock();
+    int ret = sync_file(inode_num, false);
+    stats_op(SSFS_OP_FSYNC, start, ret);
+    trace_record(SSFS_OP_FSYNC, start, ret, inode_num, 0, 0, NULL);
+    return ret;
+}
+
+/**
+ * @brief Makes the data of a file durable.
+ *
+ * Like `ssfs_fsync()`, but the journal is only committed when the size or
+ * the block map of the file changed, as the data can't be read back without.
+ *
+ * @param inode_num The inode number of the file.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int ssfs_fdatasync(int inode_num) {
+    uint64_t start = stats_clock();
+    int ret = sync_file(inode_num, true);
+    stats_op(SSFS_OP_FDATASYNC, start, ret);
+    trace_record(SSFS_OP_FDATASYNC, start, ret, inode_num, 0, 0, NULL);
+    return ret;
+}
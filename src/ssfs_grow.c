@@ -0,0 +1,136 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_grow.c
+ * ===========
+ *
+ * Online growth of the mounted volume.
+ * The blocks added at the end of the image are free data blocks: the
+ * superblock records the new size, the in-memory bitmap and journal state
+ * are extended, and the image file is extended with holes, which read as
+ * zeros as every free block must. No data moves, and the new blocks can be
+ * allocated as soon as `ssfs_grow()` returns.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+/**
+ * @brief Records the size of the volume in its superblock, and makes it
+ * durable.
+ * @return 0 on success, negative error code on failure.
+ */
+static int grow_superblock(uint32_t num_blocks) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    journal_begin();
+    ret = meta_read(0, buffer);
+    if (ret != 0) {
+        journal_abort();
+        return ret;
+    }
+    ((superblock_t *)buffer)->num_blocks = num_blocks;
+    ret = meta_write(0, buffer);
+    if (ret != 0) {
+        journal_abort();
+        return ret;
+    }
+    ret = journal_end();
+    if (ret != 0)
+        return ret;
+
+    // Blocks past the old end must not be used before the size is durable
+    ret = journal_commit();
+    if (ret != 0)
+        return ret;
+    return vdisk_sync(disk_handle);
+}
+
+/**
+ * @brief Extends the mounted volume to `new_size` blocks, without
+ * reformatting it.
+ *
+ * The image file is extended as needed and the new blocks are free at once.
+ *
+ * @param new_size The new number of blocks of the volume, at least its
+ * current one.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ *
+ * @note A volume can't shrink. If the image can't be extended once the
+ * superblock is updated, the volume keeps its size on the next mount too.
+ */
+int _ssfs_grow(uint32_t new_size) {
+    int ret = 0;
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+
+    uint32_t old_size = disk_handle->size_in_sectors;
+    if (new_size < old_size) {
+        ret = ssfs_EINVAL;
+        goto error_management_unlock;
+    }
+    if (new_size == old_size) {
+        pthread_mutex_unlock(&fs_mutex);
+        return ret;
+    }
+
+    // The in-memory state is extended first, larger arrays are harmless
+    bool *grown = realloc(allocated_blocks_handle, new_size * sizeof(bool));
+    if (grown == NULL) {
+        ret = ssfs_EALLOC;
+        goto error_management_unlock;
+    }
+    memset(&grown[old_size], 0, (new_size - old_size) * sizeof(bool));
+    allocated_blocks_handle = grown;
+
+    ret = journal_grow(old_size, new_size);
+    if (ret != 0)
+        goto error_management_unlock;
+
+    // A mount only uses the blocks that are both recorded and in the image
+    ret = grow_superblock(new_size);
+    if (ret != 0)
+        goto error_management_unlock;
+
+    ret = vdisk_resize(disk_handle, new_size);
+    if (ret != 0) {
+        grow_superblock(old_size);
+        goto error_management_unlock;
+    }
+    counters_blocks_added();
+
+    pthread_mutex_unlock(&fs_mutex);
+    return ret;
+
+error_management_unlock:
+    pthread_mutex_unlock(&fs_mutex);
+
+error_management:
+    fprintf(stderr, "Error when growing the volume (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_grow()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_grow(uint32_t new_size) {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_grow(new_size);
+    stats_op(SSFS_OP_GROW, start, ret);
+    trace_record(SSFS_OP_GROW, start, ret, 0, (int)new_size, 0, NULL);
+    return ret;
+}
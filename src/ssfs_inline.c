@@ -0,0 +1,171 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_inline.c
+ * =============
+ *
+ * Inline data of tiny files.
+ * On volumes formatted with SSFS_FEATURE_INLINE_DATA, a file small enough
+ * is stored in the inode, in place of its block map: the 24 bytes of the
+ * block pointers of a version 1 inode, or the 112 bytes following the size
+ * of a version 2 inode. Such a file uses no data block and is read with the
+ * inode block alone. It is moved to data blocks once it outgrows the inode.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+/**
+ * @brief Returns the area of the inode holding the inline data.
+ */
+static uint8_t *inline_area(any_inode_t *inode) {
+    if (geometry_handle.inode_version == INODE_V2)
+        return (uint8_t *)&inode->v2.extents_num;
+    return (uint8_t *)inode->v1.direct;
+}
+
+/**
+ * @brief Returns the number of bytes a file can hold inline on the mounted
+ * volume, 0 when the feature is disabled.
+ */
+uint32_t inline_capacity() {
+    if (!(geometry_handle.features & SSFS_FEATURE_INLINE_DATA))
+        return 0;
+    if (geometry_handle.inode_version == INODE_V2)
+        return geometry_handle.inode_size - offsetof(inode_v2_t, extents_num);
+    return geometry_handle.inode_size - offsetof(inode_t, direct);
+}
+
+/**
+ * @brief Tells whether the contents of a file are stored in its inode.
+ * @return 1 if so, 0 otherwise.
+ */
+int inode_is_inline(any_inode_t *inode) {
+    if (geometry_handle.inode_version == INODE_V2)
+        return (inode->v2.flags & INODE_FLAG_INLINE) != 0;
+    return (inode->v1.valid & INODE_V1_INLINE) != 0;
+}
+
+/**
+ * @brief Sets or clears the inline flag of an inode.
+ */
+static void inode_set_inline(any_inode_t *inode, bool is_inline) {
+    if (geometry_handle.inode_version == INODE_V2) {
+        if (is_inline)
+            inode->v2.flags |= INODE_FLAG_INLINE;
+        else
+            inode->v2.flags &= ~INODE_FLAG_INLINE;
+        return;
+    }
+    if (is_inline)
+        inode->v1.valid |= INODE_V1_INLINE;
+    else
+        inode->v1.valid &= ~INODE_V1_INLINE;
+}
+
+/**
+ * @brief Sets the size of a file, whatever the inode version.
+ */
+static void inode_set_size(any_inode_t *inode, uint64_t size) {
+    if (geometry_handle.inode_version == INODE_V2)
+        inode->v2.size = size;
+    else
+        inode->v1.size = (uint32_t)size;
+}
+
+/**
+ * @brief Tells whether a file can be stored inline once `new_size` bytes long.
+ *
+ * It must already be inline, or be empty with no block mapped, since a
+ * failed extension may leave blocks mapped past the size.
+ *
+ * @return 1 if so, 0 otherwise.
+ */
+int inline_fits(any_inode_t *inode, uint64_t new_size) {
+    uint32_t capacity = inline_capacity();
+    if (new_size > capacity)
+        return 0;
+    if (inode_is_inline(inode))
+        return 1;
+    if (inode_get_size(inode) != 0)
+        return 0;
+
+    // The block map is all zeros when no block is mapped
+    uint8_t *area = inline_area(inode);
+    for (uint32_t i = 0; i < capacity; i++)
+        if (area[i] != 0)
+            return 0;
+    return 1;
+}
+
+/**
+ * @brief Copies `len` bytes at `offset` of an inline file into `data`.
+ * @return The number of bytes copied.
+ * @note The range must lie within the file.
+ */
+int inline_read(any_inode_t *inode, uint8_t *data, uint32_t len, uint32_t offset) {
+    memcpy(data, inline_area(inode) + offset, len);
+    return (int)len;
+}
+
+/**
+ * @brief Writes `len` bytes at `offset` of a file stored inline, growing it
+ * if needed. The gap before `offset` already reads as zeros.
+ * @return The number of bytes written.
+ * @note `inline_fits()` must hold for the new size. The caller saves the inode.
+ */
+int inline_write(any_inode_t *inode, uint8_t *data, uint32_t len, uint32_t offset) {
+    memcpy(inline_area(inode) + offset, data, len);
+    inode_set_inline(inode, true);
+    if ((uint64_t)offset + len > inode_get_size(inode))
+        inode_set_size(inode, (uint64_t)offset + len);
+    return (int)len;
+}
+
+/**
+ * @brief Moves the contents of an inline file to data blocks, and extends
+ * it to `new_size` bytes.
+ *
+ * On failure, the inode is left inline and unchanged.
+ *
+ * @return 0 on success, negative error code on failure.
+ * @note The caller saves the inode, in the transaction of the write.
+ */
+int inline_migrate(int inode_num, any_inode_t *inode, uint64_t new_size) {
+    int ret = 0;
+    uint32_t capacity = inline_capacity();
+    uint8_t *area = inline_area(inode);
+
+    uint32_t size = (uint32_t)inode_get_size(inode);
+    uint8_t contents[capacity];
+    memcpy(contents, area, capacity);
+
+    memset(area, 0, capacity);
+    inode_set_inline(inode, false);
+    inode_set_size(inode, 0);
+
+    ret = inode_extend(inode, new_size);
+    if (ret != 0)
+        goto error_management;
+
+    if (size > 0) {
+        ret = write_in_file(inode_num, inode, contents, size, 0);
+        if (ret < 0)
+            goto error_management;
+    }
+    return 0;
+
+error_management:
+    // The blocks mapped so far were never written, they are simply freed
+    inode_set_blocks_status(inode, false);
+    memcpy(area, contents, capacity);
+    inode_set_inline(inode, true);
+    inode_set_size(inode, size);
+    return ret;
+}
@@ -1,232 +1,431 @@
-/*
- * Author: Valérian Wislez
- *
- * ssfs_inode.c
- * ============
- * 
- * This file handles all operations on inodes.
- * That is, getting statistics about a file, creating and deleting a file
- * and all their local helper functions. 
- * 
- */
-
-#include <stdint.h>
-#include <string.h>
-
-#include "fs.h"
-#include "ssfs_internal.h"
-#include "error.h"
-
-/**
- * @brief Retrieves the size of a file identified by its inode number.
- *
- * This function queries the file system to obtain details about a specific file,
- * identified by its unique inode number.
- *
- * @param inode_num The inode number of the file to retrieve information from.
- *
- * @return The file size in bytes on success.
- * @return Negative integer (error codes) on failure.
- *
- * @note The error codes are defined in `error.c`.
- */
-int stat(int inode_num) {
-    int ret = 0;
-    uint8_t buffer[VDISK_SECTOR_SIZE];
-    
-    if (!is_mounted()) {
-        ret = ssfs_EMOUNT;
-        goto error_management;
-    }
-    
-    ret = vdisk_read(disk_handle, 0, buffer);
-    if (ret != 0)
-        goto error_management;
-
-    superblock_t *sb = (superblock_t *)buffer;
-    
-    // Checking validity of the function parameter
-    uint32_t total_inodes = sb->num_inode_blocks * 32;
-    if (!is_inode_valid(inode_num, total_inodes)) {
-        ret = ssfs_EALLOC;
-        goto error_management;
-    }
-
-    // Determining which precise inode we are looking for
-    uint32_t target_inode_block = inode_num / 32;
-    uint32_t target_inode_num   = inode_num % 32;
-
-    // Reading the sector where the inode is (skip the superblock)
-    ret = vdisk_read(disk_handle, 1 + target_inode_block, buffer);
-    if (ret != 0) {
-        ret = vdisk_EACCESS;
-        goto error_management;
-    }
-
-    inodes_block_t *ib = (inodes_block_t *)buffer;
-    inode_t *target_inode = &(*ib)[target_inode_num];
-
-    if (target_inode->valid == 0) {
-        ret = ssfs_EINODE;
-        goto error_management;
-    }
-
-    return (int)target_inode->size;
-    
-error_management:
-    fprintf(stderr, "Error when retrieving stats of file (code %d)\n", ret);
-    return ret;
-}
-
-/**
- * @brief Creates a new file in the file system.
- *
- * This function allocates the necessary resources to create a new file,
- * which consists of assigning an inode.
- *
- * @return The inode number that identifies the newly created file on success.
- * @return Negative integer (error codes) on failure.
- *
- * @note Inode numbers start from zero included.
- */
-int create() {
-    int ret = 0;
-    uint8_t buffer[VDISK_SECTOR_SIZE];
-
-    if (!is_mounted()) {
-        ret = ssfs_EMOUNT;
-        goto error_management;
-    }
-    
-    ret = vdisk_read(disk_handle, 0, buffer);
-    if (ret != 0)
-        goto error_management;
-
-    superblock_t *sb = (superblock_t *)buffer;
-    uint32_t num_inode_blocks = sb->num_inode_blocks;
-    
-    // Look for a free inode starting from block index 1.
-    // Foreach inode_block in the filesystem:
-    uint32_t inode_block_num = 0;
-    for (uint32_t block_num = 1; inode_block_num < num_inode_blocks;) {
-        ret = vdisk_read(disk_handle, block_num, buffer);
-        if (ret != 0)
-            goto error_management;
-
-        inodes_block_t* inodes_block = (inodes_block_t*)buffer;
-
-        // Foreach inode:
-        for (int i = 0; i < 32; i++) {
-            if ((*inodes_block)[i].valid == 0) {
-
-                (*inodes_block)[i].valid = 1;
-
-                ret = vdisk_write(disk_handle, block_num, buffer);
-                if (ret != 0)
-                    goto error_management;
-                
-                ret = vdisk_sync(disk_handle);
-                if (ret != 0)
-                    goto error_management;
-
-                // Return the inode number
-                return inode_block_num * 32 + i;
-            }
-        }
-
-        block_num++;
-        inode_block_num++;
-    }
-
-    ret = ssfs_ENOSPACE;
-
-error_management:
-    fprintf(stderr, "Error when creating a new file (code %d)\n", ret);
-    return ret;
-}
-
-/**
- * @brief Deletes a file from the file system.
- *
- * This function removes the file identified by `inode_num` from the file system.
- * This involves resetting the corresponding inode structure and freeing all the
- * blocks used by that file.
- *
- * @param inode_num The inode number of the file to be deleted.
- *
- * @return 0 on success.
- * @return Negative integer (error codes) on failure.
- *
- * @note As "SSFS is said to be safe because everything is always zero, 
- * unless other values are strictly needed", this function must rewrite zeros
- * on all deleted blocks.
- */
-int delete(int inode_num) {
-    int ret = 0;
-    uint8_t buffer[VDISK_SECTOR_SIZE];
-
-    if (!is_mounted()) {
-        ret = ssfs_EMOUNT;
-        goto error_management;
-    }
-
-    ret = vdisk_read(disk_handle, 0, buffer);
-    if (ret != 0) {
-        ret = vdisk_EACCESS;
-        goto error_management;
-    }
-    superblock_t *sb = (superblock_t *)buffer;
-
-    // Checking validity of the function parameter
-    uint32_t total_inodes = sb->num_inode_blocks * 32;
-    if (!is_inode_valid(inode_num, total_inodes)) {
-        ret = ssfs_EALLOC;
-        goto error_management;
-    }
-
-    // Determining which precise inode we are looking for
-    uint32_t target_inode_block = inode_num / 32;
-    uint32_t target_inode_num   = inode_num % 32;
-
-    // Reading the sector where the inode is (skip the superblock)
-    ret = vdisk_read(disk_handle, 1 + target_inode_block, buffer);
-    if (ret != 0) {
-        ret = vdisk_EACCESS;
-        goto error_management;
-    }
-    inodes_block_t *ib = (inodes_block_t *)buffer;
-
-    inode_t * target_inode = &ib[0][target_inode_num]; 
-    if (!target_inode->valid) {
-        ret = ssfs_EINODE;
-        goto error_management;
-    }
-
-    target_inode->valid = 0;
-    target_inode->size = 0;
-    memset(target_inode->direct, 0, sizeof(target_inode->direct));
-    target_inode->indirect1 = 0;
-    target_inode->indirect2 = 0;
-    vdisk_write(disk_handle, 1 + target_inode_block, buffer);
-    vdisk_sync(disk_handle);
-
-    // Freeing blocks
-    for (int d = 0; d < 4; d++) {
-        if (target_inode->direct[d]) {
-            deallocate_block(target_inode->direct[d]);
-        }
-    }
-
-    if (target_inode->indirect1)
-        deallocate_indirect_block(target_inode->indirect1);
-
-    if (target_inode->indirect2)
-        deallocate_double_indirect_block(target_inode->indirect2);
-
-    return ret;
-
-error_management:
-    fprintf(stderr, "Error when deleting a file (code %d)\n", ret);
-    return ret;
-}
-
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_inode.c
+ * ============
+ * 
+ * This file handles all operations on inodes.
+ * That is, getting statistics about a file, creating and deleting a file
+ * and all their local helper functions. 
+ * 
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+/**
+ * @brief Retrieves the size of a file identified by its inode number.
+ *
+ * This function queries the file system to obtain details about a specific file,
+ * identified by its unique inode number.
+ *
+ * @param inode_num The inode number of the file to retrieve information from.
+ *
+ * @return The file size in bytes on success.
+ * @return Negative integer (error codes) on failure.
+ *
+ * @note The error codes are defined in `error.c`.
+ */
+int _stat(int inode_num) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+        
+    // Checking validity of the function parameter
+    uint32_t total_inodes = itable_inodes();
+    if (!is_inode_valid(inode_num, total_inodes)) {
+        ret = ssfs_EALLOC;
+        goto error_management_unlock;
+    }
+
+    // Determining which precise inode we are looking for
+    uint32_t target_inode_block = inode_num / geometry_handle.inodes_per_block;
+    uint32_t target_inode_num   = inode_num % geometry_handle.inodes_per_block;
+
+    // Reading the block where the inode is
+    ret = meta_read(itable_block(target_inode_block), buffer);
+    if (ret != 0) {
+        ret = vdisk_EACCESS;
+        goto error_management_unlock;
+    }
+
+    any_inode_t *target_inode = inode_at(buffer, target_inode_num);
+
+    if (!inode_in_use(target_inode)) {
+        ret = ssfs_EINODE;
+        goto error_management_unlock;
+    }
+
+    pthread_mutex_unlock(&fs_mutex);
+    return (int)inode_get_size(target_inode);
+    
+error_management_unlock:
+    pthread_mutex_unlock(&fs_mutex);
+
+error_management:
+    fprintf(stderr, "Error when retrieving stats of file (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_stat()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int stat(int inode_num) {
+    uint64_t start = stats_clock();
+    int ret = _stat(inode_num);
+    stats_op(SSFS_OP_STAT, start, ret);
+    trace_record(SSFS_OP_STAT, start, ret, inode_num, 0, 0, NULL);
+    return ret;
+}
+
+/**
+ * @brief Grows the inode table and takes its first new inode, in the same
+ * transaction.
+ * @return The inode number on success, negative error code on failure.
+ * @note The caller holds `fs_mutex`. On failure, the transaction is aborted.
+ */
+static int grow_and_take() {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    uint32_t inodes_per_block = geometry_handle.inodes_per_block;
+    uint32_t inode_num;
+
+    journal_begin();
+    ret = itable_grow(&inode_num);
+    if (ret != 0)
+        goto error_management_abort_transaction;
+
+    uint32_t target_inode_block = itable_block(inode_num / inodes_per_block);
+    ret = meta_read(target_inode_block, buffer);
+    if (ret != 0)
+        goto error_management_abort_transaction;
+    inode_at(buffer, inode_num % inodes_per_block)->v1.valid = 1;
+    ret = meta_write(target_inode_block, buffer);
+    if (ret != 0)
+        goto error_management_abort_transaction;
+    ret = journal_end();
+    if (ret != 0)
+        return ret;
+    dirty_mark_metadata(inode_num, false);
+    counters_inodes_used(1);
+    return (int)inode_num;
+
+error_management_abort_transaction:
+    journal_abort();
+    return ret;
+}
+
+/**
+ * @brief Creates a new file in the file system.
+ *
+ * This function allocates the necessary resources to create a new file,
+ * which consists of assigning an inode.
+ *
+ * @return The inode number that identifies the newly created file on success.
+ * @return Negative integer (error codes) on failure.
+ *
+ * @note Inode numbers start from zero included.
+ */
+int _create() {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+
+    // Look for a free inode in the allocated part of the table.
+    // Foreach inode_block in the table:
+    uint32_t inodes_per_block = geometry_handle.inodes_per_block;
+    uint32_t inode_block_num = 0;
+    for (; inode_block_num < itable_blocks(); inode_block_num++) {
+        ret = meta_read(itable_block(inode_block_num), buffer);
+        if (ret != 0)
+            goto error_management_unlock;
+
+        // Foreach inode:
+        for (uint32_t i = 0; i < inodes_per_block; i++) {
+            any_inode_t *inode = inode_at(buffer, i);
+            if (!inode_in_use(inode)) {
+
+                // The valid field comes first in every inode version
+                inode->v1.valid = 1;
+
+                ret = meta_write(itable_block(inode_block_num), buffer);
+                if (ret != 0)
+                    goto error_management_unlock;
+                dirty_mark_metadata(inode_block_num * inodes_per_block + i, false);
+                counters_inodes_used(1);
+
+                // Return the inode number
+                pthread_mutex_unlock(&fs_mutex);
+                return inode_block_num * inodes_per_block + i;
+            }
+        }
+    }
+
+    // Every inode is used, the table grows, once the blocks waiting for a
+    // commit or for the reclaimer are released if need be
+    ret = grow_and_take();
+    if (ret == ssfs_ENOSPACE && release_blocks())
+        ret = grow_and_take();
+    if (ret < 0)
+        goto error_management_unlock;
+
+    pthread_mutex_unlock(&fs_mutex);
+    return ret;
+
+error_management_unlock:
+    pthread_mutex_unlock(&fs_mutex);
+
+error_management:
+    fprintf(stderr, "Error when creating a new file (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_create()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int create() {
+    uint64_t start = stats_clock();
+    int ret = _create();
+    stats_op(SSFS_OP_CREATE, start, ret);
+    trace_record(SSFS_OP_CREATE, start, ret, 0, 0, 0, NULL);
+    return ret;
+}
+
+/**
+ * @brief Releases the blocks and state of a file whose inode was just
+ * cleared, in the transaction clearing it.
+ *
+ * The blocks are handed over to the reclaimer, or freed here when the
+ * volume has no orphan list or it is full. Inline files have none, and
+ * a packed tail is freed with the transaction.
+ *
+ * @param old_inode A copy of the inode before it was cleared.
+ * @return 0 on success, negative error code on failure.
+ */
+int inode_release(int inode_num, any_inode_t *old_inode) {
+    int ret = tail_free(old_inode);
+    if (ret == 0 && !inode_is_inline(old_inode))
+        ret = orphan_add(old_inode);
+    if (ret == ssfs_ENOSPACE)
+        ret = inode_set_blocks_status(old_inode, false);
+    if (ret != 0)
+        return ret;
+
+    dirty_forget(inode_num);
+    counters_inodes_used(-1);
+    return ret;
+}
+
+/**
+ * @brief Deletes a file from the file system.
+ *
+ * This function removes the file identified by `inode_num` from the file system.
+ * This involves resetting the corresponding inode structure and freeing all the
+ * blocks used by that file.
+ *
+ * @param inode_num The inode number of the file to be deleted.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ *
+ * @note As "SSFS is said to be safe because everything is always zero, 
+ * unless other values are strictly needed", all deleted blocks must be
+ * rewritten with zeros. The inode is cleared and its block tree recorded in
+ * the on-disk orphan list, then the background reclaimer zeroes the blocks
+ * and frees them. They can't be reused before being zeroed.
+ */
+int _delete(int inode_num) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+
+    // Checking validity of the function parameter
+    uint32_t total_inodes = itable_inodes();
+    if (!is_inode_valid(inode_num, total_inodes)) {
+        ret = ssfs_EALLOC;
+        goto error_management_unlock;
+    }
+
+    // Determining which precise inode we are looking for
+    uint32_t target_inode_block = inode_num / geometry_handle.inodes_per_block;
+    uint32_t target_inode_num   = inode_num % geometry_handle.inodes_per_block;
+
+    // Reading the block where the inode is
+    ret = meta_read(itable_block(target_inode_block), buffer);
+    if (ret != 0) {
+        ret = vdisk_EACCESS;
+        goto error_management_unlock;
+    }
+    any_inode_t *target_inode = inode_at(buffer, target_inode_num);
+    if (!inode_in_use(target_inode)) {
+        ret = ssfs_EINODE;
+        goto error_management_unlock;
+    }
+
+    // Clearing the inode and freeing its blocks is a single transaction
+    any_inode_t old_inode;
+    memcpy(&old_inode, target_inode, geometry_handle.inode_size);
+    journal_begin();
+
+    memset(target_inode, 0, geometry_handle.inode_size);
+    ret = meta_write(itable_block(target_inode_block), buffer);
+    if (ret != 0) {
+        journal_abort();
+        goto error_management_unlock;
+    }
+
+    ret = inode_release(inode_num, &old_inode);
+    if (ret != 0) {
+        journal_abort();
+        goto error_management_unlock;
+    }
+
+    ret = journal_end();
+    if (ret != 0)
+        goto error_management_unlock;
+
+    reclaim_wakeup();
+    pthread_mutex_unlock(&fs_mutex);
+    return ret;
+
+error_management_unlock:
+    pthread_mutex_unlock(&fs_mutex);
+
+error_management:
+    fprintf(stderr, "Error when deleting a file (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_delete()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int delete(int inode_num) {
+    uint64_t start = stats_clock();
+    int ret = _delete(inode_num);
+    stats_op(SSFS_OP_DELETE, start, ret);
+    trace_record(SSFS_OP_DELETE, start, ret, inode_num, 0, 0, NULL);
+    return ret;
+}
+
+
+/**
+ * @brief Returns the inode at `index` in an inode block of the mounted volume.
+ */
+any_inode_t *inode_at(uint8_t *block_buffer, uint32_t index) {
+    return (any_inode_t *)(block_buffer + index * geometry_handle.inode_size);
+}
+
+/**
+ * @brief Tells whether an inode is used by a file.
+ * @return 1 if so, 0 otherwise.
+ */
+int inode_in_use(any_inode_t *inode) {
+    return inode->v1.valid != 0;
+}
+
+/**
+ * @brief Returns the size of a file, in bytes.
+ */
+uint64_t inode_get_size(any_inode_t *inode) {
+    if (geometry_handle.inode_version == INODE_V2)
+        return inode->v2.size;
+    return inode->v1.size;
+}
+
+/**
+ * @brief Returns the number of data blocks holding the contents of a file,
+ * without I/O. Files have no holes, so it follows from the size.
+ */
+uint32_t inode_data_blocks(any_inode_t *inode) {
+    if (inode_is_inline(inode))
+        return 0;
+    uint64_t size = inode_get_size(inode);
+    if (tail_is_packed(inode))
+        return (uint32_t)(size / BLOCK_SIZE);
+    return (uint32_t)((size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+}
+
+/**
+ * @brief Writes the addresses of the data blocks used by a file into
+ * `address_buffer`, whatever the inode version.
+ * @return 0 on success, negative error code on failure.
+ */
+int inode_block_addresses(any_inode_t *inode, uint32_t *address_buffer, uint32_t max_addresses) {
+    if (geometry_handle.inode_version == INODE_V2)
+        return extent_block_addresses(&inode->v2, address_buffer, max_addresses);
+    return get_file_block_addresses(&inode->v1, address_buffer, max_addresses);
+}
+
+/**
+ * @brief Extends a file to `new_size` bytes, whatever the inode version.
+ * @return 0 on success, negative error code on failure.
+ */
+int inode_extend(any_inode_t *inode, uint64_t new_size) {
+    if (geometry_handle.inode_version == INODE_V2)
+        return extent_extend_file(&inode->v2, new_size);
+    if (new_size > UINT32_MAX)
+        return ssfs_ENOSPACE;
+    return extend_file(&inode->v1, (uint32_t)new_size);
+}
+
+/**
+ * @brief Sets the allocation status of every block used by a file, the
+ * blocks describing it and its packed tail included. Inline files use none.
+ *
+ * @param status `true` to mark them as used, `false` to free them.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int inode_set_blocks_status(any_inode_t *inode, bool status) {
+    int ret = 0;
+
+    if (inode_is_inline(inode))
+        return ret;
+
+    if (tail_is_packed(inode)) {
+        ret = status ?
+            fragment_mark(inode->v2.tail_block, inode->v2.tail_offset, inode->v2.tail_length) :
+            tail_free(inode);
+        if (ret != 0)
+            return ret;
+    }
+
+    if (geometry_handle.inode_version == INODE_V2)
+        return extent_set_blocks_status(&inode->v2, status);
+
+    for (int d = 0; d < 4; d++)
+        if (inode->v1.direct[d])
+            set_block_status(inode->v1.direct[d], status);
+
+    if (inode->v1.indirect1) {
+        ret = _update_indirect_block_status(inode->v1.indirect1, status);
+        if (ret != 0)
+            return ret;
+    }
+
+    if (inode->v1.indirect2)
+        ret = _update_double_indirect_block_status(inode->v1.indirect2, status);
+    return ret;
+}
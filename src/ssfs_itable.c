@@ -0,0 +1,309 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_itable.c
+ * =============
+ *
+ * Growable inode table.
+ * The table starts with the `num_inode_blocks` blocks reserved by `format()`
+ * after the superblock. When every inode is used, `create()` grows it with
+ * free data blocks, recorded as extents (first table block, first physical
+ * block, length) in a chain of extent blocks starting at
+ * `superblock_t.inode_table_next`. The whole mapping is kept in memory, so
+ * finding an inode block needs no I/O, and only the allocated part of the
+ * table is ever scanned.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+// Blocks added to the table at once
+#define ITABLE_GROWTH_BLOCKS 16
+
+#define TABLE_EXTENTS_PER_BLOCK ((BLOCK_SIZE - sizeof(extent_block_t)) / sizeof(extent_t))
+
+static extent_t *table = NULL;  // Extents of the table, the first one reserved by format()
+static uint32_t table_extents_num = 0;
+static uint32_t table_extents_capacity = 0;
+static uint32_t table_blocks = 0;
+
+static uint32_t *chain = NULL;  // Blocks of the extent chain
+static uint32_t chain_num = 0;
+static uint32_t chain_capacity = 0;
+
+// Table when the running transaction began
+static uint32_t begin_extents_num = 0;
+static uint32_t begin_last_length = 0;
+static uint32_t begin_table_blocks = 0;
+static uint32_t begin_chain_num = 0;
+
+/**
+ * @brief Appends an extent to the in-memory table, merging it with the last
+ * one when they are contiguous.
+ * @return 0 on success, negative error code on failure.
+ */
+static int table_append(extent_t extent) {
+    if (table_extents_num > 0) {
+        extent_t *last = &table[table_extents_num - 1];
+        if (last->physical + last->length == extent.physical && last->logical + last->length == extent.logical) {
+            last->length += extent.length;
+            table_blocks += extent.length;
+            return 0;
+        }
+    }
+
+    if (table_extents_num == table_extents_capacity) {
+        uint32_t capacity = table_extents_capacity ? 2 * table_extents_capacity : 16;
+        extent_t *grown = realloc(table, capacity * sizeof(extent_t));
+        if (grown == NULL)
+            return ssfs_EALLOC;
+        table = grown;
+        table_extents_capacity = capacity;
+    }
+    table[table_extents_num++] = extent;
+    table_blocks += extent.length;
+    return 0;
+}
+
+/**
+ * @brief Appends a block to the list of chain blocks.
+ * @return 0 on success, negative error code on failure.
+ */
+static int chain_append(uint32_t block) {
+    if (chain_num == chain_capacity) {
+        uint32_t capacity = chain_capacity ? 2 * chain_capacity : 8;
+        uint32_t *grown = realloc(chain, capacity * sizeof(uint32_t));
+        if (grown == NULL)
+            return ssfs_EALLOC;
+        chain = grown;
+        chain_capacity = capacity;
+    }
+    chain[chain_num++] = block;
+    return 0;
+}
+
+/**
+ * @brief Loads the inode table of the volume being mounted.
+ * @return 0 on success, negative error code on failure.
+ * @note The journal must be loaded first, the superblock may be in it.
+ */
+int itable_load() {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    extent_block_t *leaf = (extent_block_t *)buffer;
+
+    itable_release();
+
+    ret = meta_read(0, buffer);
+    if (ret != 0)
+        return ret;
+    superblock_t *sb = (superblock_t *)buffer;
+    uint32_t next = sb->inode_table_next;
+
+    ret = table_append((extent_t){0, 1, sb->num_inode_blocks});
+    if (ret != 0)
+        goto error_management;
+
+    while (next != 0) {
+        ret = chain_append(next);
+        if (ret != 0)
+            goto error_management;
+        ret = meta_read(next, buffer);
+        if (ret != 0)
+            goto error_management;
+
+        for (uint32_t e = 0; e < leaf->count; e++) {
+            ret = table_append(leaf->extents[e]);
+            if (ret != 0)
+                goto error_management;
+        }
+        next = leaf->next;
+    }
+    return ret;
+
+error_management:
+    itable_release();
+    return ret;
+}
+
+/**
+ * @brief Frees the in-memory inode table.
+ */
+void itable_release() {
+    free(table);
+    table = NULL;
+    table_extents_num = 0;
+    table_extents_capacity = 0;
+    table_blocks = 0;
+    free(chain);
+    chain = NULL;
+    chain_num = 0;
+    chain_capacity = 0;
+}
+
+/**
+ * @brief Remembers the table when a transaction begins.
+ * @note Called by the journal.
+ */
+void itable_begun() {
+    begin_extents_num  = table_extents_num;
+    begin_last_length  = table_extents_num > 0 ? table[table_extents_num - 1].length : 0;
+    begin_table_blocks = table_blocks;
+    begin_chain_num    = chain_num;
+}
+
+/**
+ * @brief Forgets the growth of the table by an aborted transaction, whose
+ * blocks the journal frees.
+ * @note Called by the journal.
+ */
+void itable_aborted() {
+    table_extents_num = begin_extents_num;
+    if (table_extents_num > 0)
+        table[table_extents_num - 1].length = begin_last_length;
+    table_blocks = begin_table_blocks;
+    chain_num    = begin_chain_num;
+}
+
+/**
+ * @brief Returns the number of inodes of the table.
+ */
+uint32_t itable_inodes() {
+    return table_blocks * geometry_handle.inodes_per_block;
+}
+
+/**
+ * @brief Returns the number of blocks of the table.
+ */
+uint32_t itable_blocks() {
+    return table_blocks;
+}
+
+/**
+ * @brief Returns the physical block of the `index`-th block of the table.
+ * @note `index` must be lower than `itable_blocks()`.
+ */
+uint32_t itable_block(uint32_t index) {
+    for (uint32_t e = 0; e < table_extents_num; e++)
+        if (index < table[e].logical + table[e].length)
+            return table[e].physical + (index - table[e].logical);
+    return 0;
+}
+
+/**
+ * @brief Marks the blocks added to the table and its chain blocks as used.
+ * @note The blocks reserved by `format()` are marked as system blocks.
+ */
+void itable_mark_blocks() {
+    for (uint32_t e = 1; e < table_extents_num; e++)
+        for (uint32_t b = 0; b < table[e].length; b++)
+            allocate_block(table[e].physical + b);
+    for (uint32_t c = 0; c < chain_num; c++)
+        allocate_block(chain[c]);
+}
+
+/**
+ * @brief Records a new extent of the table at the end of the on-disk chain,
+ * chaining a new block when the last one is full.
+ * @return 0 on success, negative error code on failure.
+ */
+static int chain_record(extent_t extent) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    extent_block_t *leaf = (extent_block_t *)buffer;
+
+    if (chain_num > 0) {
+        uint32_t tail = chain[chain_num - 1];
+        ret = meta_read(tail, buffer);
+        if (ret != 0)
+            return ret;
+
+        extent_t *last = &leaf->extents[leaf->count - 1];
+        if (last->physical + last->length == extent.physical && last->logical + last->length == extent.logical) {
+            last->length += extent.length;
+            return meta_write(tail, buffer);
+        }
+        if (leaf->count < TABLE_EXTENTS_PER_BLOCK) {
+            leaf->extents[leaf->count++] = extent;
+            return meta_write(tail, buffer);
+        }
+    }
+
+    uint32_t new_leaf;
+    ret = get_free_block(&new_leaf);
+    if (ret != 0)
+        return ret;
+    ret = chain_append(new_leaf);
+    if (ret != 0) {
+        deallocate_block(new_leaf);
+        return ret;
+    }
+
+    // Linking it from the superblock or the previous chain block
+    uint32_t previous = chain_num > 1 ? chain[chain_num - 2] : 0;
+    ret = meta_read(previous, buffer);
+    if (ret != 0)
+        return ret;
+    if (previous == 0)
+        ((superblock_t *)buffer)->inode_table_next = new_leaf;
+    else
+        leaf->next = new_leaf;
+    ret = meta_write(previous, buffer);
+    if (ret != 0)
+        return ret;
+
+    memset(buffer, 0, BLOCK_SIZE);
+    leaf->count = 1;
+    leaf->extents[0] = extent;
+    return meta_write(new_leaf, buffer);
+}
+
+/**
+ * @brief Grows the inode table by ITABLE_GROWTH_BLOCKS free blocks, taken
+ * after its last block when possible.
+ *
+ * The new blocks are zeroed, as every free block, so their inodes are unused.
+ *
+ * @param first_inode Set to the number of the first new inode.
+ * @return 0 on success, negative error code on failure.
+ * @note The caller runs it in a transaction.
+ */
+int itable_grow(uint32_t *first_inode) {
+    int ret = 0;
+    uint32_t old_inodes = itable_inodes();
+
+    for (uint32_t b = 0; b < ITABLE_GROWTH_BLOCKS; b++) {
+        extent_t *last = &table[table_extents_num - 1];
+        uint32_t physical;
+        ret = get_free_block_near(last->physical + last->length, &physical);
+        if (ret != 0)
+            break;
+
+        extent_t extent = {table_blocks, physical, 1};
+        ret = chain_record(extent);
+        if (ret != 0) {
+            deallocate_block(physical);
+            break;
+        }
+        ret = table_append(extent);
+        if (ret != 0)
+            break;
+    }
+
+    // A partial growth is kept, as long as it added some inodes
+    if (itable_inodes() == old_inodes)
+        return ret != 0 ? ret : ssfs_ENOSPACE;
+
+    ret = dirty_grow(itable_inodes());
+    if (ret != 0)
+        return ret;
+    counters_inodes_added(itable_inodes() - old_inodes);
+    *first_inode = old_inodes;
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_iter.c
+ * ===========
+ *
+ * Iteration over the files of the volume.
+ * The iterator reads the inode table one block at a time and only yields
+ * the inodes in use, so enumerating the files costs one read per table
+ * block instead of a `stat()` per inode. While the caller processes a block,
+ * the next one is read ahead by the disk.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+/**
+ * @brief Starts a scan of the files of the mounted volume.
+ *
+ * @param iter The iterator to initialize, released by `ssfs_inode_iter_end()`.
+ * @param start_inode The first inode to look at, 0 for a full scan, or the
+ * `cursor` of a previous iterator to resume its scan.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int _ssfs_inode_iter_begin(ssfs_inode_iter_t *iter, int start_inode) {
+    int ret = 0;
+
+    if (iter == NULL || start_inode < 0) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    iter->block = malloc(BLOCK_SIZE);
+    if (iter->block == NULL) {
+        ret = ssfs_EALLOC;
+        goto error_management;
+    }
+    iter->cursor = (uint32_t)start_inode;
+    iter->block_index = UINT32_MAX;
+    return ret;
+
+error_management:
+    fprintf(stderr, "Error when starting a scan of the files (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_inode_iter_begin()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_inode_iter_begin(ssfs_inode_iter_t *iter, int start_inode) {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_inode_iter_begin(iter, start_inode);
+    stats_op(SSFS_OP_ITER_BEGIN, start, ret);
+    trace_record(SSFS_OP_ITER_BEGIN, start, ret, 0, start_inode, 0, NULL);
+    return ret;
+}
+
+/**
+ * @brief Reads a block of the inode table into the iterator, and hints the
+ * disk to read the following one.
+ * @return 0 on success, negative error code on failure.
+ */
+static int iter_load(ssfs_inode_iter_t *iter, uint32_t block_index) {
+    int ret = 0;
+
+    pthread_mutex_lock(&fs_mutex);
+    ret = meta_read(itable_block(block_index), iter->block);
+    if (ret == 0 && block_index + 1 < itable_blocks())
+        vdisk_prefetch(disk_handle, itable_block(block_index + 1), 1);
+    pthread_mutex_unlock(&fs_mutex);
+
+    if (ret != 0)
+        return ret;
+    iter->block_index = block_index;
+    return ret;
+}
+
+/**
+ * @brief Yields the next file of the scan.
+ *
+ * Each table block is read once, when the scan reaches it: a file created
+ * or deleted afterwards in a block being scanned isn't seen.
+ *
+ * @param iter The iterator.
+ * @param info Filled with the inode number, size and number of data blocks
+ * of the file.
+ *
+ * @return 1 when a file is returned, 0 at the end of the table.
+ * @return Negative integer (error codes) on failure.
+ */
+int _ssfs_inode_iter_next(ssfs_inode_iter_t *iter, ssfs_inode_info_t *info) {
+    int ret = 0;
+
+    if (iter == NULL || iter->block == NULL || info == NULL) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    uint32_t inodes_per_block = geometry_handle.inodes_per_block;
+    for (; iter->cursor < itable_inodes(); iter->cursor++) {
+        uint32_t block_index = iter->cursor / inodes_per_block;
+        if (block_index != iter->block_index) {
+            ret = iter_load(iter, block_index);
+            if (ret != 0)
+                goto error_management;
+        }
+
+        any_inode_t *inode = inode_at(iter->block, iter->cursor % inodes_per_block);
+        if (!inode_in_use(inode))
+            continue;
+
+        info->inode_num = (int)iter->cursor;
+        info->size = inode_get_size(inode);
+        info->blocks = inode_data_blocks(inode);
+        iter->cursor++;
+        return 1;
+    }
+    return ret;
+
+error_management:
+    fprintf(stderr, "Error when scanning the files (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_inode_iter_next()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_inode_iter_next(ssfs_inode_iter_t *iter, ssfs_inode_info_t *info) {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_inode_iter_next(iter, info);
+    stats_op(SSFS_OP_ITER_NEXT, start, ret);
+    trace_record(SSFS_OP_ITER_NEXT, start, ret, ret == 1 ? info->inode_num : 0, 0, 0, NULL);
+    return ret;
+}
+
+/**
+ * @brief Releases an iterator. Its cursor stays valid to resume the scan.
+ */
+void ssfs_inode_iter_end(ssfs_inode_iter_t *iter) {
+    if (iter == NULL)
+        return;
+    free(iter->block);
+    iter->block = NULL;
+    iter->block_index = UINT32_MAX;
+}
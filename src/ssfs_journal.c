@@ -0,0 +1,990 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_journal.c
+ * ==============
+ *
+ * Metadata write-ahead journal.
+ * Metadata blocks (inode blocks, indirect blocks) updated by an operation
+ * are kept in memory until the transaction is committed. Several
+ * transactions are committed together as one record in the journal region
+ * reserved by `format()`, with a single sync, and then written to their
+ * home location. Records found at `mount()` are replayed.
+ *
+ * Journal region layout:
+ *   [header][descriptor][images...][descriptor][images...]...[commit] ...
+ * A descriptor lists the home sectors of the images following it. An entry
+ * with JOURNAL_REVOKE set has no image: it tells the replay to skip older
+ * images of a block that has been freed since.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+// Deferred free of a block already zeroed by the reclaimer
+#define DEFERRED_ZEROED     0x80000000u
+
+// Transactions committed together by default.
+#define DEFAULT_COMMIT_BATCH 16
+
+#define DESCRIPTOR_ENTRIES ((BLOCK_SIZE - sizeof(journal_block_t)) / sizeof(uint32_t))
+
+static bool journal_active = false;
+static uint32_t journal_start = 0;
+static uint32_t journal_blocks = 0;
+static uint32_t journal_head = 0;  // Next free position, relative to journal_start
+static uint32_t journal_seq = 0;   // Sequence number of the next record
+
+// Uncommitted metadata images
+static uint32_t pending_capacity = 0;
+static uint32_t pending_count = 0;
+static uint32_t *pending_sectors = NULL;
+static bool *pending_dropped = NULL;
+static uint8_t *pending_images = NULL;
+static uint32_t *pending_index = NULL;  // Open addressing: slot + 1, 0 when empty
+static vdisk_request_t *checkpoint_requests = NULL;  // One per pending slot
+static uint32_t pending_index_mask = 0;
+
+// Revoked blocks and frees waiting for the commit
+static uint32_t *revoked = NULL;
+static uint32_t revoked_count = 0;
+static uint32_t *deferred_frees = NULL;
+static uint32_t deferred_count = 0;
+static uint32_t deferred_capacity = 0;
+
+// Blocks having an image in the journal records of the current cycle
+static bool *journaled = NULL;
+
+// Undo log of the running transaction: where the pending state stood when it
+// began, the images it overwrote and the blocks it allocated
+static uint32_t begin_pending = 0;
+static uint32_t begin_revoked = 0;
+static uint32_t begin_deferred = 0;
+static bool *undo_saved = NULL;       // One per pending slot
+static uint32_t *undo_slots = NULL;
+static bool *undo_dropped = NULL;
+static uint8_t *undo_images = NULL;
+static uint32_t undo_count = 0;
+static uint32_t undo_capacity = 0;
+static uint32_t *allocated = NULL;
+static uint32_t allocated_count = 0;
+static uint32_t allocated_capacity = 0;
+static bool aborted = false;
+
+static int nesting = 0;
+static int transactions_since_commit = 0;
+static int commit_batch = DEFAULT_COMMIT_BATCH;
+
+/**
+ * @brief 32-bit FNV-1a hash, continued from `hash`.
+ */
+static uint32_t checksum_update(uint32_t hash, const uint8_t *data, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Finds the pending slot holding the image of `sector`.
+ * @return The slot, or -1 if the sector has no pending image.
+ */
+static int64_t pending_lookup(uint32_t sector) {
+    for (uint32_t h = sector & pending_index_mask;; h = (h + 1) & pending_index_mask) {
+        uint32_t entry = pending_index[h];
+        if (entry == 0)
+            return -1;
+        if (pending_sectors[entry - 1] == sector)
+            return entry - 1;
+    }
+}
+
+/**
+ * @brief Writes the journal header announcing the sequence number of the
+ * first record of the current cycle.
+ */
+static int write_header(uint32_t start_seq) {
+    uint8_t buffer[BLOCK_SIZE];
+    memset(buffer, 0, BLOCK_SIZE);
+
+    journal_block_t *header = (journal_block_t *)buffer;
+    header->magic = JOURNAL_MAGIC;
+    header->type  = JOURNAL_HEADER;
+    header->seq   = start_seq;
+    return vdisk_write(disk_handle, journal_start, buffer);
+}
+
+/**
+ * @brief Tells whether the mounted volume has a journal.
+ * @return 1 if so, 0 otherwise.
+ */
+int journal_is_active() {
+    return journal_active;
+}
+
+/**
+ * @brief Tells whether a transaction is running, which can't be committed.
+ * @return 1 if so, 0 otherwise.
+ */
+int journal_in_transaction() {
+    return nesting > 0;
+}
+
+/**
+ * @brief Collects the entries of the committed records of a journal.
+ *
+ * The records of the current cycle are chained by consecutive sequence
+ * numbers from the header's one, each one ending with a commit block whose
+ * checksum covers its descriptors and images. The scan stops at the first
+ * incomplete record.
+ *
+ * @param start The first block of the journal region.
+ * @param blocks The size of the journal region, in blocks.
+ * @param read_block Reads a block of the volume.
+ * @param arg Passed to `read_block`.
+ * @param entries Set to the entries found, in journal order, to be freed by
+ * the caller.
+ * @param count Set to the number of entries.
+ * @param next_seq Set to the sequence number following the last record.
+ *
+ * @return 0 on success, negative error code on failure.
+ * @note It only reads the journal, so that `ssfs_fsck` can see the metadata
+ * as the next `mount()` will without writing to the image.
+ */
+int journal_scan(uint32_t start, uint32_t blocks, block_reader_t read_block, void *arg,
+                 journal_entry_t **entries, uint32_t *count, uint32_t *next_seq) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    uint8_t image[BLOCK_SIZE];
+    journal_block_t *block = (journal_block_t *)buffer;
+
+    uint32_t capacity = blocks * DESCRIPTOR_ENTRIES;
+    journal_entry_t *found = malloc(capacity * sizeof(journal_entry_t));
+    uint32_t found_count = 0;
+    if (found == NULL)
+        return ssfs_EALLOC;
+
+    ret = read_block(start, buffer, arg);
+    if (ret != 0)
+        goto error_management;
+    uint32_t start_seq = 1;
+    if (block->magic == JOURNAL_MAGIC && block->type == JOURNAL_HEADER)
+        start_seq = block->seq;
+    *next_seq = start_seq;
+
+    uint32_t position = 1;
+    uint32_t expected_seq = start_seq;
+    bool first = true;
+
+    while (position < blocks) {
+        uint32_t record_start = position;
+        uint32_t record_entries = found_count;
+        uint32_t hash = 2166136261u;
+        bool committed = false;
+
+        ret = read_block(start + position, buffer, arg);
+        if (ret != 0)
+            goto error_management;
+        if (block->magic != JOURNAL_MAGIC || block->type != JOURNAL_DESCRIPTOR)
+            break;
+        // The first record may come from a newer cycle whose header was lost
+        if (first ? block->seq < start_seq : block->seq != expected_seq)
+            break;
+        uint32_t seq = block->seq;
+
+        while (position < blocks) {
+            ret = read_block(start + position, buffer, arg);
+            if (ret != 0)
+                goto error_management;
+            if (block->magic != JOURNAL_MAGIC || block->seq != seq)
+                break;
+
+            if (block->type == JOURNAL_COMMIT) {
+                committed = block->checksum == hash && block->count == position - record_start;
+                position++;
+                break;
+            }
+            if (block->type != JOURNAL_DESCRIPTOR || block->count > DESCRIPTOR_ENTRIES)
+                break;
+
+            hash = checksum_update(hash, buffer, BLOCK_SIZE);
+            position++;
+
+            uint32_t descriptor_count = block->count;
+            uint32_t descriptor_entries[DESCRIPTOR_ENTRIES];
+            memcpy(descriptor_entries, block->entries, descriptor_count * sizeof(uint32_t));
+
+            for (uint32_t e = 0; e < descriptor_count && found_count < capacity; e++) {
+                journal_entry_t *entry = &found[found_count];
+                entry->sector = descriptor_entries[e];
+                entry->seq = seq;
+                entry->position = 0;
+                if (!(descriptor_entries[e] & JOURNAL_REVOKE)) {
+                    if (position >= blocks)
+                        break;
+                    ret = read_block(start + position, image, arg);
+                    if (ret != 0)
+                        goto error_management;
+                    hash = checksum_update(hash, image, BLOCK_SIZE);
+                    entry->position = position++;
+                }
+                found_count++;
+            }
+        }
+
+        if (!committed) {
+            found_count = record_entries;
+            break;
+        }
+        first = false;
+        expected_seq = seq + 1;
+        *next_seq = expected_seq;
+    }
+
+    *entries = found;
+    *count = found_count;
+    return ret;
+
+error_management:
+    free(found);
+    return ret;
+}
+
+/**
+ * @brief Tells whether the image of an entry found by `journal_scan()` is to
+ * be applied, that is whether its block wasn't revoked by the same or a
+ * later record.
+ * @return 1 if so, 0 for revokes and revoked images.
+ */
+int journal_entry_applies(const journal_entry_t *entries, uint32_t count, uint32_t e) {
+    if (entries[e].sector & JOURNAL_REVOKE)
+        return 0;
+    for (uint32_t r = 0; r < count; r++)
+        if (entries[r].sector == (entries[e].sector | JOURNAL_REVOKE) && entries[r].seq >= entries[e].seq)
+            return 0;
+    return 1;
+}
+
+/**
+ * @brief Reads a block of the mounted volume, for `journal_scan()`.
+ */
+static int read_mounted_block(uint32_t block, uint8_t *buffer, void *arg) {
+    (void)arg;
+    return vdisk_read(disk_handle, block, buffer);
+}
+
+/**
+ * @brief Replays the committed records of the journal, see `journal_scan()`.
+ * @return 0 on success, negative error code on failure.
+ */
+static int journal_replay(uint32_t *next_seq) {
+    int ret = 0;
+    uint8_t image[BLOCK_SIZE];
+    journal_entry_t *entries = NULL;
+    uint32_t count = 0;
+
+    ret = journal_scan(journal_start, journal_blocks, read_mounted_block, NULL, &entries, &count, next_seq);
+    if (ret != 0)
+        return ret;
+
+    for (uint32_t e = 0; e < count; e++) {
+        if (!journal_entry_applies(entries, count, e))
+            continue;
+
+        ret = vdisk_read(disk_handle, journal_start + entries[e].position, image);
+        if (ret != 0)
+            break;
+        ret = vdisk_write(disk_handle, entries[e].sector, image);
+        if (ret != 0)
+            break;
+    }
+
+    free(entries);
+    return ret;
+}
+
+/**
+ * @brief Loads the journal of the volume being mounted and replays it.
+ *
+ * @param sb The superblock of the volume.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ *
+ * @note A volume formatted without a journal (journal_blocks = 0) is still
+ * supported, its metadata is then written in place and synced at the end of
+ * each operation.
+ */
+int journal_load(superblock_t *sb) {
+    int ret = 0;
+
+    journal_active = false;
+    nesting = 0;
+    aborted = false;
+    transactions_since_commit = 0;
+    if (sb->journal_blocks == 0)
+        return ret;
+
+    journal_start  = sb->journal_start;
+    journal_blocks = sb->journal_blocks;
+
+    // Every record needs descriptors, one commit block, and room for revokes
+    uint32_t descriptors = 2 * (2 * journal_blocks / DESCRIPTOR_ENTRIES + 1);
+    if (journal_blocks < 2 + descriptors + 1) {
+        ret = ssfs_EJOURNAL;
+        goto error_management;
+    }
+    pending_capacity = journal_blocks - 2 - descriptors;
+
+    uint32_t index_size = 1;
+    while (index_size < 2 * pending_capacity)
+        index_size <<= 1;
+    pending_index_mask = index_size - 1;
+
+    pending_sectors = malloc(pending_capacity * sizeof(uint32_t));
+    pending_dropped = malloc(pending_capacity * sizeof(bool));
+    pending_images  = malloc((size_t)pending_capacity * BLOCK_SIZE);
+    pending_index   = calloc(index_size, sizeof(uint32_t));
+    revoked         = malloc(journal_blocks * sizeof(uint32_t));
+    journaled       = calloc(disk_handle->size_in_sectors, sizeof(bool));
+    checkpoint_requests = malloc(pending_capacity * sizeof(vdisk_request_t));
+    undo_saved      = calloc(pending_capacity, sizeof(bool));
+    if (pending_sectors == NULL || pending_dropped == NULL || pending_images == NULL ||
+        pending_index == NULL || revoked == NULL || journaled == NULL || checkpoint_requests == NULL ||
+        undo_saved == NULL) {
+        ret = ssfs_EALLOC;
+        goto error_management_free;
+    }
+    pending_count = 0;
+    revoked_count = 0;
+    deferred_count = 0;
+
+    ret = journal_replay(&journal_seq);
+    if (ret != 0)
+        goto error_management_free;
+
+    // Start a new cycle, the replayed blocks being durable first
+    ret = vdisk_sync(disk_handle);
+    if (ret != 0)
+        goto error_management_free;
+    ret = write_header(journal_seq);
+    if (ret != 0)
+        goto error_management_free;
+    ret = vdisk_sync(disk_handle);
+    if (ret != 0)
+        goto error_management_free;
+
+    journal_head = 1;
+    journal_active = true;
+    return ret;
+
+error_management_free:
+    journal_release();
+
+error_management:
+    fprintf(stderr, "Error when loading the journal (code %d).\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Extends the in-memory state of the journal from `old_size` to
+ * `new_size` blocks, before the disk grows.
+ * @return 0 on success, negative error code on failure.
+ */
+int journal_grow(uint32_t old_size, uint32_t new_size) {
+    if (!journal_active)
+        return 0;
+
+    bool *grown = realloc(journaled, new_size * sizeof(bool));
+    if (grown == NULL)
+        return ssfs_EALLOC;
+    memset(&grown[old_size], 0, (new_size - old_size) * sizeof(bool));
+    journaled = grown;
+    return 0;
+}
+
+/**
+ * @brief Frees the in-memory state of the journal.
+ *
+ * @note Pending transactions are lost, `journal_commit()` must be called first.
+ */
+void journal_release() {
+    free(pending_sectors);
+    free(pending_dropped);
+    free(pending_images);
+    free(pending_index);
+    free(revoked);
+    free(deferred_frees);
+    free(journaled);
+    free(checkpoint_requests);
+    free(undo_saved);
+    free(undo_slots);
+    free(undo_dropped);
+    free(undo_images);
+    free(allocated);
+    pending_sectors = NULL;
+    pending_dropped = NULL;
+    pending_images  = NULL;
+    pending_index   = NULL;
+    revoked         = NULL;
+    deferred_frees  = NULL;
+    journaled       = NULL;
+    checkpoint_requests = NULL;
+    undo_saved      = NULL;
+    undo_slots      = NULL;
+    undo_dropped    = NULL;
+    undo_images     = NULL;
+    allocated       = NULL;
+    pending_count = 0;
+    revoked_count = 0;
+    deferred_count = 0;
+    deferred_capacity = 0;
+    undo_count = 0;
+    undo_capacity = 0;
+    allocated_count = 0;
+    allocated_capacity = 0;
+    journal_active = false;
+}
+
+/**
+ * @brief Reads a metadata block, as updated by uncommitted transactions.
+ * @return 0 on success, negative error code on failure.
+ */
+int meta_read(uint32_t sector, uint8_t *buffer) {
+    if (journal_active) {
+        int64_t slot = pending_lookup(sector);
+        if (slot >= 0 && !pending_dropped[slot]) {
+            memcpy(buffer, pending_images + slot * BLOCK_SIZE, BLOCK_SIZE);
+            return 0;
+        }
+    }
+    return vdisk_read(disk_handle, sector, buffer);
+}
+
+/**
+ * @brief Indexes the pending slot `slot`.
+ */
+static void pending_insert(uint32_t slot) {
+    uint32_t h = pending_sectors[slot] & pending_index_mask;
+    while (pending_index[h] != 0)
+        h = (h + 1) & pending_index_mask;
+    pending_index[h] = slot + 1;
+}
+
+/**
+ * @brief Saves a pending slot filled before the running transaction began,
+ * before the transaction changes it, so that `journal_abort()` can restore it.
+ * @return 0 on success, negative error code on failure.
+ */
+static int undo_save(uint32_t slot) {
+    if (nesting == 0 || slot >= begin_pending || undo_saved[slot])
+        return 0;
+
+    if (undo_count == undo_capacity) {
+        uint32_t capacity = undo_capacity ? 2 * undo_capacity : 16;
+        uint32_t *slots = realloc(undo_slots, capacity * sizeof(uint32_t));
+        if (slots == NULL)
+            return ssfs_EALLOC;
+        undo_slots = slots;
+        bool *dropped = realloc(undo_dropped, capacity * sizeof(bool));
+        if (dropped == NULL)
+            return ssfs_EALLOC;
+        undo_dropped = dropped;
+        uint8_t *images = realloc(undo_images, (size_t)capacity * BLOCK_SIZE);
+        if (images == NULL)
+            return ssfs_EALLOC;
+        undo_images = images;
+        undo_capacity = capacity;
+    }
+    undo_slots[undo_count] = slot;
+    undo_dropped[undo_count] = pending_dropped[slot];
+    memcpy(undo_images + (size_t)undo_count * BLOCK_SIZE, pending_images + (size_t)slot * BLOCK_SIZE, BLOCK_SIZE);
+    undo_count++;
+    undo_saved[slot] = true;
+    return 0;
+}
+
+/**
+ * @brief Writes a metadata block as part of the current transaction.
+ *
+ * The block reaches its home location once the transaction is committed.
+ * Outside of any transaction, the write is a transaction by itself.
+ *
+ * @return 0 on success.
+ * @return ssfs_ENOSPACE if the running transaction doesn't fit in the
+ * journal, which it must then abort.
+ * @return Negative integer (error codes) on failure.
+ */
+int meta_write(uint32_t sector, uint8_t *buffer) {
+    int ret = 0;
+
+    if (!journal_active) {
+        ret = vdisk_write(disk_handle, sector, buffer);
+        if (ret == 0 && nesting == 0)
+            ret = vdisk_sync(disk_handle);
+        return ret;
+    }
+
+    int64_t slot = pending_lookup(sector);
+    if (slot < 0) {
+        // A transaction is never committed in part
+        if (pending_count == pending_capacity) {
+            if (nesting > 0)
+                return ssfs_ENOSPACE;
+            ret = journal_commit();
+            if (ret != 0)
+                return ret;
+        }
+
+        slot = pending_count++;
+        pending_sectors[slot] = sector;
+        pending_dropped[slot] = false;
+        pending_insert(slot);
+    } else {
+        ret = undo_save(slot);
+        if (ret != 0)
+            return ret;
+    }
+    memcpy(pending_images + slot * BLOCK_SIZE, buffer, BLOCK_SIZE);
+
+    if (nesting == 0) {
+        journal_begin();
+        ret = journal_end();
+    }
+    return ret;
+}
+
+/**
+ * @brief Frees a block once the current transaction is committed.
+ *
+ * The block stays allocated until then, so it can't be reused before the
+ * metadata no longer referencing it is durable.
+ *
+ * @param zeroed false if the block must be zeroed when released.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int journal_defer_free(uint32_t block, bool zeroed) {
+    int ret = 0;
+
+    int64_t slot = pending_lookup(block);
+    if (slot >= 0) {
+        ret = undo_save(slot);
+        if (ret != 0)
+            return ret;
+    }
+
+    if (deferred_count == deferred_capacity) {
+        uint32_t capacity = deferred_capacity ? 2 * deferred_capacity : 256;
+        uint32_t *frees = realloc(deferred_frees, capacity * sizeof(uint32_t));
+        if (frees == NULL)
+            return ssfs_EALLOC;
+        deferred_frees = frees;
+        deferred_capacity = capacity;
+    }
+    deferred_frees[deferred_count++] = zeroed ? block | DEFERRED_ZEROED : block;
+
+    // The block's images must neither be checkpointed nor replayed anymore
+    if (slot >= 0)
+        pending_dropped[slot] = true;
+
+    // At most one revoke per journaled block, so `revoked` can't overflow
+    if (journaled[block])
+        revoked[revoked_count++] = block;
+    return ret;
+}
+
+/**
+ * @brief Records a block allocated by the running transaction, so that
+ * `journal_abort()` frees it again.
+ * @return 0 on success, negative error code on failure.
+ */
+int journal_allocated(uint32_t block) {
+    if (!journal_active || nesting == 0)
+        return 0;
+
+    if (allocated_count == allocated_capacity) {
+        uint32_t capacity = allocated_capacity ? 2 * allocated_capacity : 64;
+        uint32_t *blocks = realloc(allocated, capacity * sizeof(uint32_t));
+        if (blocks == NULL)
+            return ssfs_EALLOC;
+        allocated = blocks;
+        allocated_capacity = capacity;
+    }
+    allocated[allocated_count++] = block;
+    return 0;
+}
+
+/**
+ * @brief Starts a transaction. Transactions may be nested, only the outermost
+ * one is a unit of atomicity.
+ */
+void journal_begin() {
+    if (nesting++ > 0 || !journal_active)
+        return;
+
+    begin_pending  = pending_count;
+    begin_revoked  = revoked_count;
+    begin_deferred = deferred_count;
+    for (uint32_t u = 0; u < undo_count; u++)
+        undo_saved[undo_slots[u]] = false;
+    undo_count = 0;
+    allocated_count = 0;
+
+    fragments_begun();
+    itable_begun();
+    orphans_begun();
+    counters_begun();
+}
+
+/**
+ * @brief Undoes the running transaction in memory: its images, revokes and
+ * deferred frees are dropped, the images it overwrote restored, and the
+ * blocks it allocated zeroed and freed.
+ * @return 0 on success, negative error code on failure.
+ */
+static int rollback() {
+    int ret = 0;
+    aborted = false;
+
+    // Tails packed by the transaction go first, their blocks may be freed
+    ret = fragments_aborted();
+    itable_aborted();
+    orphans_aborted();
+    counters_aborted();
+
+    pending_count  = begin_pending;
+    revoked_count  = begin_revoked;
+    deferred_count = begin_deferred;
+    for (uint32_t u = 0; u < undo_count; u++) {
+        uint32_t slot = undo_slots[u];
+        memcpy(pending_images + (size_t)slot * BLOCK_SIZE, undo_images + (size_t)u * BLOCK_SIZE, BLOCK_SIZE);
+        pending_dropped[slot] = undo_dropped[u];
+        undo_saved[slot] = false;
+    }
+    undo_count = 0;
+    memset(pending_index, 0, (pending_index_mask + 1) * sizeof(uint32_t));
+    for (uint32_t s = 0; s < pending_count; s++)
+        pending_insert(s);
+
+    // Free blocks are zeroed, so a block that can't be is left allocated
+    for (uint32_t a = 0; a < allocated_count; a++) {
+        uint32_t block = allocated[a];
+        if (!allocated_blocks_handle[block])
+            continue;
+        int erased = erase_block_content(block);
+        if (erased == 0)
+            bitmap_set(block, false);
+        else if (ret == 0)
+            ret = erased;
+    }
+    allocated_count = 0;
+
+    if (ret != 0)
+        fprintf(stderr, "Error when aborting a transaction (code %d).\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Aborts a transaction that failed.
+ *
+ * Nothing it did reaches the disk: the metadata blocks it wrote, the blocks
+ * it freed and allocated, and the inode table, tails, orphans and counters
+ * are back to their state when the outermost transaction began. An inner
+ * transaction aborts the outermost one, when it ends.
+ *
+ * @return 0 on success, negative error code on failure.
+ * @note Without a journal the metadata is already in place, the transaction
+ * just ends.
+ */
+int journal_abort() {
+    if (!journal_active)
+        return journal_end();
+
+    aborted = true;
+    if (--nesting > 0)
+        return 0;
+    return rollback();
+}
+
+/**
+ * @brief Ends a transaction.
+ *
+ * Outermost transactions are committed together, once `commit_batch` of them
+ * ended or the pending images fill half of the journal.
+ *
+ * @return 0 on success.
+ * @return ssfs_EJOURNAL if an inner transaction aborted, the transaction is
+ * then aborted.
+ * @return Negative integer (error codes) on failure.
+ */
+int journal_end() {
+    if (--nesting > 0)
+        return 0;
+
+    if (!journal_active)
+        return vdisk_sync(disk_handle);
+
+    if (aborted) {
+        int ret = rollback();
+        return ret != 0 ? ret : ssfs_EJOURNAL;
+    }
+
+    transactions_since_commit++;
+    if (transactions_since_commit >= commit_batch || pending_count >= pending_capacity / 2)
+        return journal_commit();
+    return 0;
+}
+
+/**
+ * @brief Writes one record holding the pending images and revokes.
+ * @return 0 on success, negative error code on failure.
+ */
+static int write_record(uint32_t images, uint32_t record_len) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    journal_block_t *block = (journal_block_t *)buffer;
+    uint32_t position = journal_head;
+    uint32_t hash = 2166136261u;
+
+    uint32_t slot = 0;
+    uint32_t revoke = 0;
+    uint32_t entries_left = images + revoked_count;
+
+    while (entries_left > 0) {
+        uint32_t count = entries_left < DESCRIPTOR_ENTRIES ? entries_left : DESCRIPTOR_ENTRIES;
+        uint32_t descriptor_position = position++;
+        uint32_t first_slot = slot;
+
+        memset(buffer, 0, BLOCK_SIZE);
+        block->magic = JOURNAL_MAGIC;
+        block->type  = JOURNAL_DESCRIPTOR;
+        block->seq   = journal_seq;
+        block->count = count;
+
+        uint32_t e = 0;
+        for (; e < count && revoke < revoked_count; e++)
+            block->entries[e] = revoked[revoke++] | JOURNAL_REVOKE;
+        for (; e < count; slot++) {
+            if (!pending_dropped[slot])
+                block->entries[e++] = pending_sectors[slot];
+        }
+        entries_left -= count;
+
+        ret = vdisk_write(disk_handle, journal_start + descriptor_position, buffer);
+        if (ret != 0)
+            return ret;
+        hash = checksum_update(hash, buffer, BLOCK_SIZE);
+
+        for (uint32_t s = first_slot; s < slot; s++) {
+            if (pending_dropped[s])
+                continue;
+            uint8_t *image = pending_images + s * BLOCK_SIZE;
+            ret = vdisk_write(disk_handle, journal_start + position++, image);
+            if (ret != 0)
+                return ret;
+            hash = checksum_update(hash, image, BLOCK_SIZE);
+        }
+    }
+
+    memset(buffer, 0, BLOCK_SIZE);
+    block->magic    = JOURNAL_MAGIC;
+    block->type     = JOURNAL_COMMIT;
+    block->seq      = journal_seq;
+    block->count    = record_len - 1;
+    block->checksum = hash;
+    return vdisk_write(disk_handle, journal_start + position, buffer);
+}
+
+/**
+ * @brief Commits every pending transaction with a single sync.
+ *
+ * The data of the files concerned and the pending images and revokes (as one
+ * record) are written back, then the images are written to their home
+ * location and the deferred frees, packed tails included, are zeroed and
+ * released. The home writes are made durable by the next full sync, at the
+ * latest when the journal wraps around.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int journal_commit() {
+    int ret = 0;
+
+    if (!journal_active)
+        return vdisk_sync(disk_handle);
+
+    // A running transaction is never committed in part
+    if (nesting > 0) {
+        ret = ssfs_EJOURNAL;
+        goto error_management;
+    }
+
+    transactions_since_commit = 0;
+    if (pending_count == 0 && revoked_count == 0 && deferred_count == 0)
+        return ret;
+
+    uint32_t images = 0;
+    for (uint32_t s = 0; s < pending_count; s++)
+        images += !pending_dropped[s];
+
+    uint32_t entries = images + revoked_count;
+    uint32_t descriptors = (entries + DESCRIPTOR_ENTRIES - 1) / DESCRIPTOR_ENTRIES;
+    uint32_t record_len = descriptors + images + 1;
+
+    if (entries > 0) {
+        // Start a new cycle at the beginning of the region when full
+        if (journal_head + record_len > journal_blocks) {
+            ret = vdisk_sync(disk_handle);
+            if (ret != 0)
+                goto error_management;
+            memset(journaled, 0, disk_handle->size_in_sectors * sizeof(bool));
+            journal_head = 1;
+            ret = write_header(journal_seq);
+            if (ret != 0)
+                goto error_management;
+        }
+
+        // Committed metadata must not point to data still in the host's cache
+        ret = dirty_flush_committing();
+        if (ret != 0)
+            goto error_management;
+
+        ret = write_record(images, record_len);
+        if (ret != 0)
+            goto error_management;
+
+        ret = vdisk_sync_range(disk_handle, journal_start + journal_head, record_len);
+        if (ret != 0)
+            goto error_management;
+
+        journal_head += record_len;
+        journal_seq++;
+    }
+
+    // Checkpoint, as a background batch the scheduler may sort and merge
+    uint32_t checkpoint_count = 0;
+    for (uint32_t s = 0; s < pending_count; s++) {
+        if (pending_dropped[s])
+            continue;
+        checkpoint_requests[checkpoint_count++] = (vdisk_request_t){
+            .op = VDISK_WRITE,
+            .sector = pending_sectors[s],
+            .count = 1,
+            .buffer = pending_images + (size_t)s * BLOCK_SIZE,
+        };
+        journaled[pending_sectors[s]] = true;
+    }
+    ret = vdisk_submit(disk_handle, checkpoint_requests, checkpoint_count, true);
+    if (ret != 0)
+        goto error_management;
+    for (uint32_t r = 0; r < revoked_count; r++)
+        journaled[revoked[r]] = false;
+
+    // Consecutive blocks to zero are erased as one range
+    for (uint32_t f = 0; f < deferred_count;) {
+        uint32_t block = deferred_frees[f] & ~DEFERRED_ZEROED;
+        uint32_t run = 1;
+        if (!(deferred_frees[f] & DEFERRED_ZEROED)) {
+            while (f + run < deferred_count && deferred_frees[f + run] == block + run)
+                run++;
+            ret = erase_block_range(block, run);
+            if (ret != 0)
+                goto error_management;
+        }
+        for (uint32_t r = 0; r < run; r++)
+            bitmap_set(block + r, false);
+        f += run;
+    }
+
+    dirty_committed();
+    memset(pending_index, 0, (pending_index_mask + 1) * sizeof(uint32_t));
+    pending_count = 0;
+    revoked_count = 0;
+    deferred_count = 0;
+
+    // Tails freed by the committed transactions can be reused
+    return fragments_committed();
+
+error_management:
+    fprintf(stderr, "Error when committing the journal (code %d).\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Commits the pending transactions and makes them durable.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int _ssfs_sync() {
+    int ret = 0;
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+
+    ret = journal_commit();
+    if (ret != 0)
+        goto error_management_unlock;
+
+    ret = counters_save();
+    if (ret != 0)
+        goto error_management_unlock;
+
+    // Also makes the checkpoint, the released blocks and the counters durable
+    ret = vdisk_sync(disk_handle);
+    if (ret != 0)
+        goto error_management_unlock;
+
+    pthread_mutex_unlock(&fs_mutex);
+    return ret;
+
+error_management_unlock:
+    pthread_mutex_unlock(&fs_mutex);
+
+error_management:
+    fprintf(stderr, "Error when syncing (code %d).\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_sync()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_sync() {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_sync();
+    stats_op(SSFS_OP_SYNC, start, ret);
+    trace_record(SSFS_OP_SYNC, start, ret, 0, 0, 0, NULL);
+    return ret;
+}
+
+/**
+ * @brief Sets how many operations are committed together.
+ *
+ * @param transactions The number of transactions per commit. 1 makes the
+ * metadata of every operation durable when it returns, along with the data
+ * of the files whose metadata it changed; data overwritten in place is only
+ * durable after `ssfs_fsync()` or the next commit touching the file.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int ssfs_set_commit_batch(int transactions) {
+    if (transactions < 1) {
+        fprintf(stderr, "Error when setting the commit batch (code %d).\n", ssfs_EINVAL);
+        return ssfs_EINVAL;
+    }
+    commit_batch = transactions;
+    return 0;
+}
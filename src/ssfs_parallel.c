@@ -0,0 +1,397 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_parallel.c
+ * ===============
+ *
+ * Opt-in parallel execution of large read() and write() calls.
+ * The block list of a call is cut into physically contiguous chunks which
+ * are transferred with positional I/O by a small pool of worker threads.
+ * Every participant owns a queue of chunks and steals from the others once
+ * its own queue is empty.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+// Upper bound on the blocks moved by a single chunk transfer.
+#define MAX_CHUNK_BLOCKS 256
+
+// Calls smaller than this many bytes always run on the caller's thread.
+#define DEFAULT_PARALLEL_THRESHOLD (1024 * 1024)
+
+typedef struct {
+    uint32_t first;  // Index of the first block of the chunk in the address list
+    uint32_t count;  // Number of physically contiguous blocks
+} chunk_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t head;  // Next chunk taken by the owner
+    uint32_t tail;  // One past the last chunk, stolen from by the others
+} chunk_queue_t;
+
+typedef struct {
+    chunk_t *chunks;
+    chunk_queue_t *queues;
+    int queues_num;
+    uint32_t *addresses;
+    uint8_t *data;
+    uint32_t len;
+    uint32_t offset;
+    bool is_write;
+    int ret;  // First error met by any participant
+} parallel_job_t;
+
+static int parallelism = 1;
+static uint32_t parallel_threshold = DEFAULT_PARALLEL_THRESHOLD;
+
+static pthread_t *workers = NULL;
+static int workers_num = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t submit_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_posted = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_finished = PTHREAD_COND_INITIALIZER;
+static parallel_job_t *current_job = NULL;
+static uint64_t job_generation = 0;
+static uint64_t pool_start_generation = 0;
+static int job_active = 0;
+static bool pool_stopping = false;
+
+static void stop_pool();
+
+/**
+ * @brief Configures the parallel execution of large read() and write() calls.
+ *
+ * @param threads The degree of parallelism, caller's thread included. A value
+ * of 1 or less disables the parallel mode (default).
+ * @param threshold Calls transferring at least this many bytes run in parallel.
+ * Zero or a negative value keeps the current threshold.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ *
+ * @note The worker pool is (re)started lazily by the next large call. A call
+ * running in parallel finishes first, its queues are sized by the parallelism.
+ */
+int ssfs_set_parallelism(int threads, int threshold) {
+    pthread_mutex_lock(&submit_lock);
+    stop_pool();
+    parallelism = threads > 1 ? threads : 1;
+    if (threshold > 0)
+        parallel_threshold = (uint32_t)threshold;
+    pthread_mutex_unlock(&submit_lock);
+    return 0;
+}
+
+/**
+ * @brief Tells whether a call transferring `len` bytes should run in parallel.
+ * @return 1 if so, 0 otherwise.
+ */
+int parallel_eligible(uint32_t len) {
+    return parallelism > 1 && len >= parallel_threshold;
+}
+
+/**
+ * @brief Moves the part of [offset, offset + len) covered by one chunk.
+ *
+ * The whole chunk is transferred with a single vdisk call. On write, partial
+ * first and last blocks are read first so their other bytes are preserved.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+static int transfer_chunk(parallel_job_t *job, chunk_t *chunk) {
+    int ret = 0;
+    uint32_t physical = job->addresses[chunk->first];
+
+    uint64_t chunk_start = (uint64_t)chunk->first * BLOCK_SIZE;
+    uint64_t chunk_end   = chunk_start + (uint64_t)chunk->count * BLOCK_SIZE;
+    uint64_t low  = job->offset > chunk_start ? job->offset : chunk_start;
+    uint64_t high = (uint64_t)job->offset + job->len < chunk_end ?
+        (uint64_t)job->offset + job->len :
+        chunk_end;
+
+    uint8_t *buffer = malloc((size_t)chunk->count * BLOCK_SIZE);
+    if (buffer == NULL)
+        return ssfs_EALLOC;
+
+    uint8_t *user = job->data + (low - job->offset);
+    uint8_t *inside = buffer + (low - chunk_start);
+
+    if (!job->is_write) {
+        ret = vdisk_read_range(disk_handle, physical, chunk->count, buffer);
+        if (ret == 0)
+            memcpy(user, inside, high - low);
+        goto cleanup;
+    }
+
+    // Partial first and last blocks keep the bytes around the written range
+    if (low > chunk_start) {
+        ret = vdisk_read(disk_handle, physical, buffer);
+        if (ret != 0)
+            goto cleanup;
+    }
+    if (high < chunk_end && (chunk->count > 1 || low == chunk_start)) {
+        uint32_t last = chunk->count - 1;
+        ret = vdisk_read(disk_handle, physical + last, buffer + (size_t)last * BLOCK_SIZE);
+        if (ret != 0)
+            goto cleanup;
+    }
+
+    memcpy(inside, user, high - low);
+    ret = vdisk_write_range(disk_handle, physical, chunk->count, buffer);
+
+cleanup:
+    free(buffer);
+    return ret;
+}
+
+/**
+ * @brief Takes the next chunk, from the participant's own queue first and
+ * otherwise from the end of another participant's queue.
+ * @return 1 if a chunk was taken, 0 once every queue is empty.
+ */
+static int take_chunk(parallel_job_t *job, int self, chunk_t **chunk) {
+    chunk_queue_t *own = &job->queues[self];
+
+    pthread_mutex_lock(&own->lock);
+    if (own->head < own->tail) {
+        *chunk = &job->chunks[own->head++];
+        pthread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for (int i = 1; i < job->queues_num; i++) {
+        chunk_queue_t *victim = &job->queues[(self + i) % job->queues_num];
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail) {
+            *chunk = &job->chunks[--victim->tail];
+            pthread_mutex_unlock(&victim->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return 0;
+}
+
+/**
+ * @brief Work loop of a participant, runs until no chunk is left.
+ */
+static void run_participant(parallel_job_t *job, int self) {
+    chunk_t *chunk;
+    while (take_chunk(job, self, &chunk)) {
+        int ret = transfer_chunk(job, chunk);
+        if (ret != 0) {
+            pthread_mutex_lock(&pool_lock);
+            if (job->ret == 0)
+                job->ret = ret;
+            pthread_mutex_unlock(&pool_lock);
+        }
+    }
+}
+
+/**
+ * @brief Body of a pool thread: waits for jobs and takes part in them.
+ */
+static void *worker_main(void *arg) {
+    int self = (int)(intptr_t)arg;
+    uint64_t seen = pool_start_generation;
+
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (!pool_stopping && job_generation == seen)
+            pthread_cond_wait(&job_posted, &pool_lock);
+        if (pool_stopping)
+            break;
+
+        seen = job_generation;
+        parallel_job_t *job = current_job;
+        pthread_mutex_unlock(&pool_lock);
+
+        run_participant(job, self);
+
+        pthread_mutex_lock(&pool_lock);
+        if (--job_active == 0)
+            pthread_cond_signal(&job_finished);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+/**
+ * @brief Stops and joins the worker threads that are running.
+ * @note The caller holds `submit_lock`.
+ */
+static void stop_pool() {
+    if (workers == NULL)
+        return;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_stopping = true;
+    pthread_cond_broadcast(&job_posted);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (int i = 0; i < workers_num; i++)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+    workers = NULL;
+    workers_num = 0;
+}
+
+/**
+ * @brief Starts the worker threads if they are not running yet.
+ * @return 0 on success, negative error code on failure.
+ * @note The caller holds `submit_lock`, so `parallelism` can't change.
+ */
+static int start_pool() {
+    if (workers != NULL)
+        return 0;
+
+    workers = malloc((parallelism - 1) * sizeof(pthread_t));
+    if (workers == NULL)
+        return ssfs_EALLOC;
+
+    pool_stopping = false;
+    pool_start_generation = job_generation;
+    for (workers_num = 0; workers_num < parallelism - 1; workers_num++) {
+        // Participant 0 is the caller's thread
+        intptr_t self = workers_num + 1;
+        if (pthread_create(&workers[workers_num], NULL, worker_main, (void *)self) != 0) {
+            stop_pool();
+            return ssfs_E3RDPARTY;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Stops and joins the worker threads, if any.
+ *
+ * @note Called by `unmount()`.
+ */
+void parallel_shutdown() {
+    pthread_mutex_lock(&submit_lock);
+    stop_pool();
+    pthread_mutex_unlock(&submit_lock);
+}
+
+/**
+ * @brief Cuts the blocks covering [offset, offset + len) into physically
+ * contiguous chunks of at most MAX_CHUNK_BLOCKS blocks.
+ * @return The number of chunks written into `chunks`.
+ */
+static uint32_t split_in_chunks(uint32_t *addresses, uint32_t len, uint32_t offset, chunk_t *chunks) {
+    uint32_t first_block = offset / BLOCK_SIZE;
+    uint32_t last_block  = (offset + len - 1) / BLOCK_SIZE;
+    uint32_t chunks_num  = 0;
+
+    for (uint32_t b = first_block; b <= last_block; b++) {
+        chunk_t *chunk = chunks_num ? &chunks[chunks_num - 1] : NULL;
+        if (chunk != NULL &&
+            chunk->count < MAX_CHUNK_BLOCKS &&
+            addresses[b] == addresses[b - 1] + 1) {
+            chunk->count++;
+            continue;
+        }
+        chunks[chunks_num].first = b;
+        chunks[chunks_num].count = 1;
+        chunks_num++;
+    }
+    return chunks_num;
+}
+
+/**
+ * @brief Transfers [offset, offset + len) of a file between `data` and its
+ * data blocks using the worker pool.
+ *
+ * @param addresses The physical addresses of the file blocks, as returned by
+ * `get_file_block_addresses()`.
+ * @param data The user buffer.
+ * @param len The number of bytes to transfer.
+ * @param offset The byte offset from the beginning of the file.
+ * @param is_write true to write `data` into the file, false to read.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ *
+ * @note The range must lie inside the file. Written blocks are not synced.
+ */
+int parallel_transfer(uint32_t *addresses, uint8_t *data, uint32_t len, uint32_t offset, bool is_write) {
+    int ret = 0;
+
+    // One job at a time, and the parallelism can't change under it
+    pthread_mutex_lock(&submit_lock);
+
+    uint32_t blocks_num = (offset + len - 1) / BLOCK_SIZE - offset / BLOCK_SIZE + 1;
+    chunk_t *chunks = malloc(blocks_num * sizeof(chunk_t));
+    chunk_queue_t *queues = malloc(parallelism * sizeof(chunk_queue_t));
+    if (chunks == NULL || queues == NULL) {
+        ret = ssfs_EALLOC;
+        goto cleanup;
+    }
+
+    parallel_job_t job = {
+        .chunks     = chunks,
+        .queues     = queues,
+        .queues_num = parallelism,
+        .addresses  = addresses,
+        .data       = data,
+        .len        = len,
+        .offset     = offset,
+        .is_write   = is_write,
+        .ret        = 0,
+    };
+
+    // Every participant starts with an even share of consecutive chunks
+    uint32_t chunks_num = split_in_chunks(addresses, len, offset, chunks);
+    for (int q = 0; q < parallelism; q++) {
+        pthread_mutex_init(&queues[q].lock, NULL);
+        queues[q].head = (uint64_t)chunks_num * q / parallelism;
+        queues[q].tail = (uint64_t)chunks_num * (q + 1) / parallelism;
+    }
+
+    ret = start_pool();
+    if (ret != 0) {
+        // Without workers, the caller's thread drains every queue itself
+        run_participant(&job, 0);
+        ret = job.ret;
+        goto cleanup_queues;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    current_job = &job;
+    job_active = workers_num;
+    job_generation++;
+    pthread_cond_broadcast(&job_posted);
+    pthread_mutex_unlock(&pool_lock);
+
+    run_participant(&job, 0);
+
+    pthread_mutex_lock(&pool_lock);
+    while (job_active > 0)
+        pthread_cond_wait(&job_finished, &pool_lock);
+    current_job = NULL;
+    pthread_mutex_unlock(&pool_lock);
+
+    ret = job.ret;
+
+cleanup_queues:
+    for (int q = 0; q < parallelism; q++)
+        pthread_mutex_destroy(&queues[q].lock);
+
+cleanup:
+    pthread_mutex_unlock(&submit_lock);
+    free(chunks);
+    free(queues);
+    return ret;
+}
@@ -0,0 +1,443 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_reclaim.c
+ * ==============
+ *
+ * Background reclamation of deleted files.
+ * `delete()` only clears the inode and copies it to the orphan list, a
+ * region reserved by `format()` after the journal. A reclaimer thread then
+ * zeroes the blocks of each orphan by ranges, and frees them by
+ * clearing its slot. The blocks stay allocated until then, and orphans left
+ * at unmount or by a crash are reclaimed after the next `mount()`.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+static uint32_t orphan_start = 0;
+static uint32_t orphan_blocks = 0;
+static uint32_t orphans_count = 0;  // Valid slots in the orphan list
+static uint32_t begin_orphans = 0;  // When the running transaction began
+static int64_t busy_slot = -1;      // Slot being zeroed by the reclaimer
+
+static pthread_t reclaimer;
+static pthread_cond_t reclaim_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t reclaimed_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t reclaimed = 0;  // Orphans reclaimed since mount
+static bool reclaimer_running = false;
+static bool reclaimer_stopping = false;
+static bool wakeup_pending = false;
+
+typedef struct {
+    uint32_t *blocks;
+    uint32_t count;
+    uint32_t capacity;
+} block_list_t;
+
+/**
+ * @brief Appends a block to a list.
+ * @return 0 on success, negative error code on failure.
+ */
+static int list_append(block_list_t *list, uint32_t block) {
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity ? 2 * list->capacity : 64;
+        uint32_t *blocks = realloc(list->blocks, capacity * sizeof(uint32_t));
+        if (blocks == NULL)
+            return ssfs_EALLOC;
+        list->blocks = blocks;
+        list->capacity = capacity;
+    }
+    list->blocks[list->count++] = block;
+    return 0;
+}
+
+/**
+ * @brief Appends an indirect block and the blocks it points to.
+ * @param depth 1 for an indirect block, 2 for a double indirect one.
+ * @return 0 on success, negative error code on failure.
+ */
+static int collect_indirect(block_list_t *list, uint32_t indirect_block, int depth) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    ret = meta_read(indirect_block, buffer);
+    if (ret != 0)
+        return ret;
+    uint32_t *pointers = (uint32_t *)buffer;
+
+    for (uint32_t p = 0; p < BLOCK_SIZE / sizeof(uint32_t); p++) {
+        if (pointers[p] == 0)
+            continue;
+        ret = depth > 1 ?
+            collect_indirect(list, pointers[p], depth - 1) :
+            list_append(list, pointers[p]);
+        if (ret != 0)
+            return ret;
+    }
+    return list_append(list, indirect_block);
+}
+
+/**
+ * @brief Visitor appending a run of blocks to a list.
+ */
+static int collect_run(uint32_t first, uint32_t count, void *arg) {
+    int ret = 0;
+    for (uint32_t b = 0; b < count && ret == 0; b++)
+        ret = list_append((block_list_t *)arg, first + b);
+    return ret;
+}
+
+/**
+ * @brief Lists every block used by an inode, indirect or extent blocks included.
+ * @return 0 on success, negative error code on failure.
+ */
+static int collect_blocks(any_inode_t *any_inode, block_list_t *list) {
+    int ret = 0;
+
+    if (geometry_handle.inode_version == INODE_V2)
+        return extent_for_each(&any_inode->v2, collect_run, list);
+    inode_t *inode = &any_inode->v1;
+
+    for (int d = 0; d < 4; d++) {
+        if (inode->direct[d]) {
+            ret = list_append(list, inode->direct[d]);
+            if (ret != 0)
+                return ret;
+        }
+    }
+
+    if (inode->indirect1) {
+        ret = collect_indirect(list, inode->indirect1, 1);
+        if (ret != 0)
+            return ret;
+    }
+
+    if (inode->indirect2)
+        ret = collect_indirect(list, inode->indirect2, 2);
+    return ret;
+}
+
+static int compare_blocks(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Zeroes a list of blocks, contiguous ones being erased together,
+ * and makes the zeros durable.
+ *
+ * The ranges are discarded as a background batch, which gives way to the
+ * reads of the file system under the deadline scheduler.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+static int zero_blocks(block_list_t *list) {
+    int ret = 0;
+
+    if (list->count == 0)
+        return ret;
+
+    vdisk_request_t *requests = malloc(list->count * sizeof(vdisk_request_t));
+    if (requests == NULL)
+        return ssfs_EALLOC;
+
+    qsort(list->blocks, list->count, sizeof(uint32_t), compare_blocks);
+    uint32_t ranges = 0;
+    for (uint32_t i = 0; i < list->count;) {
+        uint32_t run = 1;
+        while (i + run < list->count && list->blocks[i + run] == list->blocks[i] + run)
+            run++;
+
+        requests[ranges++] = (vdisk_request_t){.op = VDISK_DISCARD, .sector = list->blocks[i], .count = run};
+        i += run;
+    }
+    ret = vdisk_submit(disk_handle, requests, ranges, true);
+    free(requests);
+    if (ret != 0)
+        return ret;
+    return vdisk_sync(disk_handle);
+}
+
+/**
+ * @brief Reclaims one orphan: zeroes its blocks, then clears its slot and
+ * frees the blocks in a single transaction.
+ *
+ * @param release_lock true to release `fs_mutex` while zeroing, so that
+ * operations are not blocked by the writes.
+ *
+ * @return 1 if an orphan was reclaimed, 0 if there is none left.
+ * @return Negative integer (error codes) on failure.
+ *
+ * @note The caller holds `fs_mutex`.
+ */
+static int reclaim_next(bool release_lock) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+    block_list_t list = {NULL, 0, 0};
+
+    // Finding an orphan
+    uint32_t slots_per_block = geometry_handle.inodes_per_block;
+    int64_t slot = -1;
+    for (uint32_t b = 0; b < orphan_blocks && slot < 0; b++) {
+        ret = meta_read(orphan_start + b, buffer);
+        if (ret != 0)
+            return ret;
+        for (uint32_t i = 0; i < slots_per_block && slot < 0; i++)
+            if (inode_in_use(inode_at(buffer, i)) && (int64_t)b * slots_per_block + i != busy_slot)
+                slot = (int64_t)b * slots_per_block + i;
+    }
+    if (slot < 0)
+        return 0;
+    uint32_t slot_block = orphan_start + slot / slots_per_block;
+    any_inode_t orphan;
+    memcpy(&orphan, inode_at(buffer, slot % slots_per_block), geometry_handle.inode_size);
+
+    // Pending images of the indirect blocks would overwrite the zeros
+    ret = journal_commit();
+    if (ret != 0)
+        return ret;
+
+    ret = collect_blocks(&orphan, &list);
+    if (ret != 0)
+        goto cleanup;
+
+    busy_slot = slot;
+    if (release_lock)
+        pthread_mutex_unlock(&fs_mutex);
+    ret = zero_blocks(&list);
+    if (release_lock)
+        pthread_mutex_lock(&fs_mutex);
+    busy_slot = -1;
+    if (ret != 0) {
+        pthread_cond_broadcast(&reclaimed_cond);
+        goto cleanup;
+    }
+
+    journal_begin();
+    ret = meta_read(slot_block, buffer);
+    if (ret != 0) {
+        journal_abort();
+        goto cleanup;
+    }
+    memset(inode_at(buffer, slot % slots_per_block), 0, geometry_handle.inode_size);
+    ret = meta_write(slot_block, buffer);
+    if (ret != 0) {
+        journal_abort();
+        goto cleanup;
+    }
+    if (journal_is_active()) {
+        for (uint32_t i = 0; i < list.count; i++) {
+            ret = journal_defer_free(list.blocks[i], true);
+            if (ret != 0) {
+                journal_abort();
+                goto cleanup;
+            }
+        }
+    }
+    ret = journal_end();
+    if (ret != 0)
+        goto cleanup;
+
+    // Released once the cleared slot is durable
+    if (journal_is_active()) {
+        ret = journal_commit();
+        if (ret != 0)
+            goto cleanup;
+    } else {
+        for (uint32_t i = 0; i < list.count; i++)
+            bitmap_set(list.blocks[i], false);
+    }
+
+    orphans_count--;
+    reclaimed++;
+    pthread_cond_broadcast(&reclaimed_cond);
+    ret = 1;
+
+cleanup:
+    free(list.blocks);
+    return ret;
+}
+
+/**
+ * @brief Body of the reclaimer thread.
+ */
+static void *reclaimer_loop(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&fs_mutex);
+    while (!reclaimer_stopping) {
+        if (!wakeup_pending) {
+            pthread_cond_wait(&reclaim_cond, &fs_mutex);
+            continue;
+        }
+
+        int ret = reclaim_next(true);
+        if (ret < 0)
+            fprintf(stderr, "Error when reclaiming a deleted file (code %d).\n", ret);
+        // On failure, retried after the next delete
+        if (ret <= 0)
+            wakeup_pending = false;
+    }
+    pthread_mutex_unlock(&fs_mutex);
+    return NULL;
+}
+
+/**
+ * @brief Starts the reclaimer of the volume being mounted.
+ *
+ * @param sb The superblock of the volume.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ *
+ * @note Volumes formatted without an orphan list delete synchronously.
+ */
+int reclaim_start(superblock_t *sb) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    orphan_start  = sb->orphan_start;
+    orphan_blocks = sb->orphan_blocks;
+    orphans_count = 0;
+    busy_slot = -1;
+    if (orphan_blocks == 0)
+        return ret;
+
+    for (uint32_t b = 0; b < orphan_blocks; b++) {
+        ret = meta_read(orphan_start + b, buffer);
+        if (ret != 0)
+            return ret;
+        for (uint32_t i = 0; i < geometry_handle.inodes_per_block; i++)
+            orphans_count += inode_in_use(inode_at(buffer, i));
+    }
+
+    reclaimer_stopping = false;
+    wakeup_pending = orphans_count > 0;
+    if (pthread_create(&reclaimer, NULL, reclaimer_loop, NULL) != 0)
+        return ssfs_EALLOC;
+    reclaimer_running = true;
+    return ret;
+}
+
+/**
+ * @brief Stops the reclaimer once it is done with the current orphan.
+ *
+ * @note The remaining orphans are reclaimed after the next `mount()`.
+ */
+void reclaim_stop() {
+    if (!reclaimer_running)
+        return;
+
+    pthread_mutex_lock(&fs_mutex);
+    reclaimer_stopping = true;
+    pthread_cond_signal(&reclaim_cond);
+    pthread_mutex_unlock(&fs_mutex);
+
+    pthread_join(reclaimer, NULL);
+    reclaimer_running = false;
+    orphan_blocks = 0;
+}
+
+/**
+ * @brief Tells the reclaimer that orphans were added.
+ *
+ * @note The caller holds `fs_mutex`.
+ */
+void reclaim_wakeup() {
+    if (!reclaimer_running)
+        return;
+    wakeup_pending = true;
+    pthread_cond_signal(&reclaim_cond);
+}
+
+/**
+ * @brief Tells whether deleted files are waiting to be reclaimed.
+ * @return 1 if so, 0 otherwise.
+ */
+int reclaim_pending() {
+    return orphans_count > 0;
+}
+
+/**
+ * @brief Reclaims the orphans on the caller's thread, when free blocks are
+ * needed right away.
+ *
+ * @return 0 on success, negative error code on failure.
+ *
+ * @note The caller holds `fs_mutex` and runs no transaction: each orphan is
+ * freed by a commit, and `fs_mutex` is released while waiting for the orphan
+ * being zeroed by the reclaimer, if any.
+ */
+int reclaim_all() {
+    int ret = 0;
+
+    if (busy_slot >= 0) {
+        uint64_t seen = reclaimed;
+        while (busy_slot >= 0 && reclaimed == seen)
+            pthread_cond_wait(&reclaimed_cond, &fs_mutex);
+    }
+
+    do {
+        ret = reclaim_next(false);
+    } while (ret > 0);
+    return ret;
+}
+
+/**
+ * @brief Adds the inode of a deleted file to the orphan list, as part of the
+ * current transaction.
+ *
+ * @param inode A copy of the inode, still referencing its blocks.
+ *
+ * @return 0 on success.
+ * @return ssfs_ENOSPACE if the list is full or the volume has none.
+ * @return Negative integer (error codes) on failure.
+ */
+int orphan_add(any_inode_t *inode) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    for (uint32_t b = 0; b < orphan_blocks; b++) {
+        ret = meta_read(orphan_start + b, buffer);
+        if (ret != 0)
+            return ret;
+        for (uint32_t i = 0; i < geometry_handle.inodes_per_block; i++) {
+            any_inode_t *slot = inode_at(buffer, i);
+            if (inode_in_use(slot))
+                continue;
+            memcpy(slot, inode, geometry_handle.inode_size);
+            slot->v1.valid = 1;
+            ret = meta_write(orphan_start + b, buffer);
+            if (ret != 0)
+                return ret;
+            orphans_count++;
+            return ret;
+        }
+    }
+    return ssfs_ENOSPACE;
+}
+
+/**
+ * @brief Remembers the number of orphans when a transaction begins.
+ * @note Called by the journal.
+ */
+void orphans_begun() {
+    begin_orphans = orphans_count;
+}
+
+/**
+ * @brief Forgets the orphans added by an aborted transaction.
+ * @note Called by the journal.
+ */
+void orphans_aborted() {
+    orphans_count = begin_orphans;
+}
@@ -0,0 +1,249 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_statfs.c
+ * =============
+ *
+ * Space and inode usage of the mounted volume.
+ * Every change of the block bitmap goes through `bitmap_set()`, which keeps
+ * the count of used blocks, and `create()`/`delete()` keep the count of used
+ * inodes, so `ssfs_statfs()` needs no scan. The largest free extent is
+ * cached: a free measures the free run it joins and keeps it if it is
+ * longer, and only an allocation inside the cached extent makes the next
+ * `ssfs_statfs()` search it again.
+ * The counters are saved in the superblock by `ssfs_sync()` and `unmount()`.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+static uint32_t used_blocks = 0;
+static uint32_t total_inodes = 0;
+static uint32_t used_inodes = 0;
+
+// Inode counters when the running transaction began
+static uint32_t begin_total_inodes = 0;
+static uint32_t begin_used_inodes = 0;
+
+static uint32_t largest_start = 0;
+static uint32_t largest_length = 0;
+static bool largest_valid = false;
+
+// Free run holding the last block freed, extended without a scan by the
+// frees next to it, as those of a file released in order
+static uint32_t run_start = 0;
+static uint32_t run_length = 0;
+
+/**
+ * @brief Resets the counters of the volume being mounted, before its scan.
+ */
+void counters_reset(uint32_t inodes) {
+    used_blocks = 0;
+    total_inodes = inodes;
+    used_inodes = 0;
+    largest_valid = false;
+    run_length = 0;
+}
+
+/**
+ * @brief Measures the free run holding the free block `block`, starting
+ * from the last one measured when they touch, and keeps it as the largest
+ * free extent if it is longer.
+ */
+static void measure_free_run(uint32_t block) {
+    uint32_t size = disk_handle->size_in_sectors;
+
+    if (run_length > 0 && block == run_start + run_length) {
+        run_length++;
+    } else if (run_length > 0 && block + 1 == run_start) {
+        run_start--;
+        run_length++;
+    } else {
+        run_start = block;
+        run_length = 1;
+    }
+
+    // The blocks around the run were allocated when it was measured, some
+    // may have been freed since
+    while (run_start > 0 && !allocated_blocks_handle[run_start - 1]) {
+        run_start--;
+        run_length++;
+    }
+    while (run_start + run_length < size && !allocated_blocks_handle[run_start + run_length])
+        run_length++;
+
+    if (run_length > largest_length) {
+        largest_start = run_start;
+        largest_length = run_length;
+    }
+}
+
+/**
+ * @brief Sets the status of a block in the bitmap and updates the counters.
+ *
+ * @note Every write to `allocated_blocks_handle` goes through here.
+ */
+void bitmap_set(uint32_t block, bool status) {
+    if (allocated_blocks_handle[block] == status)
+        return;
+    allocated_blocks_handle[block] = status;
+
+    if (status) {
+        used_blocks++;
+        if (block >= largest_start && block < largest_start + largest_length)
+            largest_valid = false;
+        if (block >= run_start && block < run_start + run_length)
+            run_length = 0;
+    } else {
+        used_blocks--;
+        if (largest_valid)
+            measure_free_run(block);
+        stats_block_freed();
+    }
+}
+
+/**
+ * @brief Records that `count` inodes were taken (positive) or released
+ * (negative).
+ */
+void counters_inodes_used(int count) {
+    used_inodes += count;
+}
+
+/**
+ * @brief Records that `count` inodes were added to the inode table.
+ */
+void counters_inodes_added(uint32_t count) {
+    total_inodes += count;
+}
+
+/**
+ * @brief Returns the number of unused inodes of the table.
+ */
+uint32_t counters_free_inodes() {
+    return total_inodes - used_inodes;
+}
+
+/**
+ * @brief Records that blocks were added at the end of the volume.
+ */
+void counters_blocks_added() {
+    largest_valid = false;
+    run_length = 0;
+}
+
+/**
+ * @brief Remembers the inode counters when a transaction begins.
+ * @note Called by the journal. The block counters follow `bitmap_set()`.
+ */
+void counters_begun() {
+    begin_total_inodes = total_inodes;
+    begin_used_inodes = used_inodes;
+}
+
+/**
+ * @brief Restores the inode counters of an aborted transaction.
+ * @note Called by the journal.
+ */
+void counters_aborted() {
+    total_inodes = begin_total_inodes;
+    used_inodes = begin_used_inodes;
+}
+
+/**
+ * @brief Finds the longest run of free blocks.
+ */
+static void find_largest_extent() {
+    largest_start = 0;
+    largest_length = 0;
+
+    uint32_t run = 0;
+    for (uint32_t b = 0; b < disk_handle->size_in_sectors; b++) {
+        run = allocated_blocks_handle[b] ? 0 : run + 1;
+        if (run > largest_length) {
+            largest_length = run;
+            largest_start = b + 1 - run;
+        }
+    }
+    largest_valid = true;
+}
+
+/**
+ * @brief Saves the counters in the superblock.
+ * @return 0 on success, negative error code on failure.
+ * @note The counters aren't journaled, they are recomputed at mount.
+ */
+int counters_save() {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    // The latest superblock, its journaled fields may not be in place yet
+    ret = meta_read(0, buffer);
+    if (ret != 0)
+        return ret;
+    superblock_t *sb = (superblock_t *)buffer;
+
+    sb->free_blocks = disk_handle->size_in_sectors - used_blocks;
+    sb->free_inodes = total_inodes - used_inodes;
+    return vdisk_write(disk_handle, 0, buffer);
+}
+
+/**
+ * @brief Retrieves the usage of the mounted volume.
+ *
+ * Blocks of deleted files count as used until they are reclaimed.
+ *
+ * @param stats Filled with the totals and free counts of blocks and inodes,
+ * and the length of the largest run of free blocks.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int _ssfs_statfs(ssfs_statfs_t *stats) {
+    int ret = 0;
+
+    if (stats == NULL) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    if (!is_mounted()) {
+        ret = ssfs_EMOUNT;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&fs_mutex);
+
+    if (!largest_valid)
+        find_largest_extent();
+
+    stats->block_size          = geometry_handle.block_size;
+    stats->total_blocks        = disk_handle->size_in_sectors;
+    stats->free_blocks         = disk_handle->size_in_sectors - used_blocks;
+    stats->total_inodes        = total_inodes;
+    stats->free_inodes         = total_inodes - used_inodes;
+    stats->largest_free_extent = largest_length;
+
+    pthread_mutex_unlock(&fs_mutex);
+    return ret;
+
+error_management:
+    fprintf(stderr, "Error when retrieving stats of the volume (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Timed and traced entry point of `_ssfs_statfs()`, see `ssfs_get_stats()` and `ssfs_trace_start()`.
+ */
+int ssfs_statfs(ssfs_statfs_t *stats) {
+    uint64_t start = stats_clock();
+    int ret = _ssfs_statfs(stats);
+    stats_op(SSFS_OP_STATFS, start, ret);
+    trace_record(SSFS_OP_STATFS, start, ret, 0, 0, 0, NULL);
+    return ret;
+}
@@ -0,0 +1,292 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_stats.c
+ * ============
+ *
+ * Always-on statistics of the file system.
+ * Each thread counts its calls, their latencies and the allocator work in
+ * its own block, without locking; `ssfs_get_stats()` sums the blocks of
+ * every thread and adds the disk I/O counted by the vdisk layer the same
+ * way. Latencies go to log-linear histograms, as in HdrHistogram: 4 buckets
+ * per power of two, so a percentile is known within 25%.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+// Sub-buckets per power of two, as a power of two
+#define HISTOGRAM_SUB_BITS 2
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+
+// Names of the operations, in ssfs_op_t order
+static const char *op_names[SSFS_OP_NUM] = {
+    "format", "mount", "unmount", "create", "delete", "stat", "read", "write",
+    "fsync", "fdatasync", "sync", "lookup", "link", "unlink", "mkdir",
+    "create_many", "delete_many", "stat_many", "stat_range", "statfs", "grow",
+    "readdir", "inode_iter_begin", "inode_iter_next", "format_new",
+};
+
+// Every field of ssfs_stats_t is a uint64_t, summed as an array
+#define STATS_FIELDS (sizeof(ssfs_stats_t) / sizeof(uint64_t))
+
+typedef struct thread_stats {
+    ssfs_stats_t counters;  // Device fields unused, counted by the vdisk layer
+    bool live;              // False once its thread exited, to be taken over
+    struct thread_stats *next;
+} thread_stats_t;
+
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static thread_stats_t *stats_threads = NULL;
+static ssfs_stats_t stats_baseline;  // Totals at the last ssfs_reset_stats()
+
+/**
+ * @brief Releases the block of an exiting thread. Its counts are kept.
+ */
+static void stats_thread_exit(void *block) {
+    pthread_mutex_lock(&stats_mutex);
+    ((thread_stats_t *)block)->live = false;
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+static void stats_init() {
+    pthread_key_create(&stats_key, stats_thread_exit);
+}
+
+/**
+ * @brief Returns the counters of the calling thread, taking over the block of
+ * an exited thread or allocating one on its first call.
+ * @return The counters, or NULL if they can't be allocated, in which case the
+ * calls of the thread aren't counted.
+ */
+static ssfs_stats_t *local_stats() {
+    pthread_once(&stats_once, stats_init);
+    thread_stats_t *local = pthread_getspecific(stats_key);
+    if (local != NULL)
+        return &local->counters;
+
+    pthread_mutex_lock(&stats_mutex);
+    for (local = stats_threads; local != NULL; local = local->next)
+        if (!local->live)
+            break;
+    if (local == NULL) {
+        local = calloc(1, sizeof(thread_stats_t));
+        if (local != NULL) {
+            local->next = stats_threads;
+            stats_threads = local;
+        }
+    }
+    if (local != NULL)
+        local->live = true;
+    pthread_mutex_unlock(&stats_mutex);
+
+    if (local == NULL || pthread_setspecific(stats_key, local) != 0)
+        return NULL;
+    return &local->counters;
+}
+
+/**
+ * @brief Sums the counters of every thread, disk I/O included, since the
+ * first call.
+ */
+static void stats_totals(ssfs_stats_t *totals) {
+    uint64_t *sum = (uint64_t *)totals;
+    memset(totals, 0, sizeof(ssfs_stats_t));
+
+    pthread_mutex_lock(&stats_mutex);
+    for (thread_stats_t *block = stats_threads; block != NULL; block = block->next) {
+        uint64_t *counters = (uint64_t *)&block->counters;
+        for (size_t f = 0; f < STATS_FIELDS; f++)
+            sum[f] += counters[f];
+    }
+    pthread_mutex_unlock(&stats_mutex);
+
+    vdisk_stats_t device;
+    vdisk_get_stats(&device);
+    totals->device_reads = device.reads;
+    totals->device_writes = device.writes;
+    totals->device_bytes_read = device.bytes_read;
+    totals->device_bytes_written = device.bytes_written;
+    totals->device_syncs = device.syncs;
+    totals->device_discards = device.discards;
+    totals->device_simulated_ns = device.simulated_ns;
+    totals->device_batched = device.batched_requests;
+    totals->device_batch_transfers = device.batched_transfers;
+    totals->device_batch_wait_ns = device.batch_wait_ns;
+}
+
+/**
+ * @brief Returns a monotonic timestamp in nanoseconds, the start of a call
+ * given to `stats_op()`.
+ */
+uint64_t stats_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief Returns the histogram bucket of a latency.
+ */
+static uint32_t histogram_bucket(uint64_t ns) {
+    if (ns < HISTOGRAM_SUB_BUCKETS)
+        return (uint32_t)ns;
+
+    uint32_t magnitude = 63 - __builtin_clzll(ns);  // Highest bit set
+    uint32_t sub = (uint32_t)(ns >> (magnitude - HISTOGRAM_SUB_BITS)) - HISTOGRAM_SUB_BUCKETS;
+    uint32_t bucket = HISTOGRAM_SUB_BUCKETS * (magnitude - HISTOGRAM_SUB_BITS + 1) + sub;
+    return bucket < SSFS_HISTOGRAM_BUCKETS ? bucket : SSFS_HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * @brief Returns the highest latency counted in a histogram bucket.
+ */
+static uint64_t histogram_bucket_max(uint32_t bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+
+    uint32_t magnitude = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+    uint32_t shift = magnitude - HISTOGRAM_SUB_BITS;
+    return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * @brief Records a call of the API.
+ *
+ * @param op The operation.
+ * @param start The value of `stats_clock()` when the call started.
+ * @param ret What the call returned. For read() and write(), a positive value
+ * is the number of bytes transferred.
+ */
+void stats_op(ssfs_op_t op, uint64_t start, int ret) {
+    uint64_t elapsed = stats_clock() - start;
+    ssfs_stats_t *stats = local_stats();
+    if (stats == NULL)
+        return;
+
+    ssfs_op_stats_t *op_stats = &stats->ops[op];
+    op_stats->calls++;
+    op_stats->total_ns += elapsed;
+    op_stats->histogram[histogram_bucket(elapsed)]++;
+    if (ret < 0)
+        op_stats->errors++;
+    else if (op == SSFS_OP_READ)
+        stats->user_bytes_read += ret;
+    else if (op == SSFS_OP_WRITE)
+        stats->user_bytes_written += ret;
+}
+
+/**
+ * @brief Records a request for a free block.
+ *
+ * @param scanned The number of bitmap entries looked at.
+ * @param found Whether a block was allocated.
+ */
+void stats_allocation(uint32_t scanned, bool found) {
+    ssfs_stats_t *stats = local_stats();
+    if (stats == NULL)
+        return;
+    stats->allocator_calls++;
+    stats->allocator_scanned += scanned;
+    if (found)
+        stats->blocks_allocated++;
+}
+
+/**
+ * @brief Records that a block went back to the free blocks.
+ */
+void stats_block_freed() {
+    ssfs_stats_t *stats = local_stats();
+    if (stats != NULL)
+        stats->blocks_freed++;
+}
+
+/**
+ * @brief Retrieves what the file system did since the last
+ * `ssfs_reset_stats()`, or since the start of the program.
+ *
+ * The counters of every thread are summed, those of exited threads included.
+ * Calls still running in other threads may be partly counted.
+ *
+ * @param stats Filled with the statistics.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure.
+ */
+int ssfs_get_stats(ssfs_stats_t *stats) {
+    if (stats == NULL) {
+        fprintf(stderr, "Error when retrieving statistics (code %d)\n", ssfs_EINVAL);
+        return ssfs_EINVAL;
+    }
+
+    stats_totals(stats);
+    uint64_t *counters = (uint64_t *)stats;
+    uint64_t *baseline = (uint64_t *)&stats_baseline;
+    pthread_mutex_lock(&stats_mutex);
+    for (size_t f = 0; f < STATS_FIELDS; f++)
+        counters[f] -= baseline[f];
+    pthread_mutex_unlock(&stats_mutex);
+    return 0;
+}
+
+/**
+ * @brief Restarts the statistics from zero.
+ *
+ * The counters of the threads are left as they are, the current totals
+ * being subtracted from the next `ssfs_get_stats()` instead, so that a reset
+ * never races with a thread counting.
+ */
+void ssfs_reset_stats() {
+    ssfs_stats_t totals;
+    stats_totals(&totals);
+
+    pthread_mutex_lock(&stats_mutex);
+    stats_baseline = totals;
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+/**
+ * @brief Returns a percentile of the latencies of an operation.
+ *
+ * @param op The statistics of the operation, from `ssfs_get_stats()`.
+ * @param percent The percentile, from 0 to 100.
+ *
+ * @return The latency in nanoseconds, rounded up to the end of its bucket
+ * (at most 25% above), 0 if the operation wasn't called.
+ */
+uint64_t ssfs_stats_percentile(const ssfs_op_stats_t *op, double percent) {
+    if (op == NULL || op->calls == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(percent / 100 * op->calls + 0.5);
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (uint32_t bucket = 0; bucket < SSFS_HISTOGRAM_BUCKETS; bucket++) {
+        seen += op->histogram[bucket];
+        if (seen >= rank)
+            return histogram_bucket_max(bucket);
+    }
+    return histogram_bucket_max(SSFS_HISTOGRAM_BUCKETS - 1);
+}
+
+/**
+ * @brief Returns the name of an operation, as "read" for SSFS_OP_READ.
+ */
+const char *ssfs_op_name(ssfs_op_t op) {
+    if ((int)op < 0 || op >= SSFS_OP_NUM)
+        return "unknown";
+    return op_names[op];
+}
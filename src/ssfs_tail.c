@@ -0,0 +1,484 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_tail.c
+ * ===========
+ *
+ * Tail packing of version 2 inodes.
+ * On volumes formatted with SSFS_FEATURE_TAIL_PACKING, the last partial
+ * block of a file, its tail, is stored in a fragment block shared with the
+ * tails of other files, at (tail_block, tail_offset, tail_length). Fragment
+ * blocks are split in units of FRAGMENT_UNIT bytes, whose usage is only
+ * kept in memory and rebuilt from the inodes at mount, like the bitmap.
+ * A tail moves back to a block of its own before the file is written around
+ * it, and is packed again after the write.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+#define FRAGMENT_UNIT 64
+#define MAX_FRAGMENT_UNITS (MAX_BLOCK_SIZE / FRAGMENT_UNIT)
+#define UNITS_PER_BLOCK ((uint32_t)BLOCK_SIZE / FRAGMENT_UNIT)
+
+typedef struct {
+    uint32_t block;
+    uint32_t used_units;
+    uint64_t used[MAX_FRAGMENT_UNITS / 64];  // One bit per unit
+} fragment_block_t;
+
+typedef struct {
+    uint32_t block;
+    uint32_t offset;
+    uint32_t length;
+} fragment_range_t;
+
+static fragment_block_t *fragments = NULL;
+static uint32_t fragments_num = 0;
+static uint32_t fragments_capacity = 0;
+
+// Ranges freed by the running transactions, released once committed
+static fragment_range_t *released = NULL;
+static uint32_t released_num = 0;
+static uint32_t released_capacity = 0;
+
+// Ranges taken by the running transaction, released if it is aborted
+static fragment_range_t *taken = NULL;
+static uint32_t taken_num = 0;
+static uint32_t taken_capacity = 0;
+static uint32_t begin_released = 0;
+
+/**
+ * @brief Tells whether the tails of files are packed on the mounted volume.
+ * @return 1 if so, 0 otherwise.
+ */
+int tail_packing_enabled() {
+    return (geometry_handle.features & SSFS_FEATURE_TAIL_PACKING) &&
+        geometry_handle.inode_version == INODE_V2;
+}
+
+/**
+ * @brief Tells whether the tail of a file is stored in a fragment block.
+ * @return 1 if so, 0 otherwise.
+ */
+int tail_is_packed(any_inode_t *inode) {
+    return geometry_handle.inode_version == INODE_V2 && (inode->v2.flags & INODE_FLAG_TAIL) != 0;
+}
+
+/**
+ * @brief Returns the position of the tail in a file, that is its size
+ * rounded down to a block boundary.
+ */
+uint64_t tail_start(any_inode_t *inode) {
+    uint64_t size = inode_get_size(inode);
+    return size - size % BLOCK_SIZE;
+}
+
+static int unit_used(fragment_block_t *fragment, uint32_t unit) {
+    return (fragment->used[unit / 64] >> (unit % 64)) & 1;
+}
+
+/**
+ * @brief Sets the status of the units covering [offset, offset + length).
+ */
+static void units_set(fragment_block_t *fragment, uint32_t offset, uint32_t length, bool status) {
+    uint32_t first = offset / FRAGMENT_UNIT;
+    uint32_t count = (length + FRAGMENT_UNIT - 1) / FRAGMENT_UNIT;
+    for (uint32_t u = first; u < first + count; u++) {
+        if (unit_used(fragment, u) == status)
+            continue;
+        fragment->used[u / 64] ^= (uint64_t)1 << (u % 64);
+        if (status)
+            fragment->used_units++;
+        else
+            fragment->used_units--;
+    }
+}
+
+/**
+ * @brief Returns the fragment block `block`, NULL if it isn't one.
+ */
+static fragment_block_t *fragment_find(uint32_t block) {
+    for (uint32_t f = 0; f < fragments_num; f++)
+        if (fragments[f].block == block)
+            return &fragments[f];
+    return NULL;
+}
+
+/**
+ * @brief Registers `block` as an empty fragment block.
+ * @return 0 on success, negative error code on failure.
+ */
+static int fragment_add(uint32_t block, fragment_block_t **fragment) {
+    if (fragments_num == fragments_capacity) {
+        uint32_t capacity = fragments_capacity ? 2 * fragments_capacity : 64;
+        fragment_block_t *grown = realloc(fragments, capacity * sizeof(fragment_block_t));
+        if (grown == NULL)
+            return ssfs_EALLOC;
+        fragments = grown;
+        fragments_capacity = capacity;
+    }
+    *fragment = &fragments[fragments_num++];
+    memset(*fragment, 0, sizeof(fragment_block_t));
+    (*fragment)->block = block;
+    return 0;
+}
+
+/**
+ * @brief Makes room for one more range in a list.
+ * @return 0 on success, negative error code on failure.
+ */
+static int ranges_reserve(fragment_range_t **list, uint32_t num, uint32_t *capacity) {
+    if (num < *capacity)
+        return 0;
+    uint32_t grown_capacity = *capacity ? 2 * *capacity : 64;
+    fragment_range_t *grown = realloc(*list, grown_capacity * sizeof(fragment_range_t));
+    if (grown == NULL)
+        return ssfs_EALLOC;
+    *list = grown;
+    *capacity = grown_capacity;
+    return 0;
+}
+
+/**
+ * @brief Reserves `length` bytes in a fragment block, the first one with
+ * enough contiguous free units, or a new block.
+ * @return 0 on success, negative error code on failure.
+ * @note The range is recorded for `fragments_aborted()`.
+ */
+static int fragment_alloc(uint32_t length, uint32_t *block, uint32_t *offset) {
+    int ret = 0;
+    uint32_t units = (length + FRAGMENT_UNIT - 1) / FRAGMENT_UNIT;
+
+    ret = ranges_reserve(&taken, taken_num, &taken_capacity);
+    if (ret != 0)
+        return ret;
+
+    for (uint32_t f = 0; f < fragments_num; f++) {
+        fragment_block_t *fragment = &fragments[f];
+        if (UNITS_PER_BLOCK - fragment->used_units < units)
+            continue;
+
+        uint32_t run = 0;
+        for (uint32_t u = 0; u < UNITS_PER_BLOCK; u++) {
+            run = unit_used(fragment, u) ? 0 : run + 1;
+            if (run == units) {
+                *block = fragment->block;
+                *offset = (u + 1 - units) * FRAGMENT_UNIT;
+                units_set(fragment, *offset, length, true);
+                if (journal_is_active())
+                    taken[taken_num++] = (fragment_range_t){*block, *offset, length};
+                return ret;
+            }
+        }
+    }
+
+    // Free blocks are zeroed, so is a new fragment block
+    uint32_t new_block;
+    ret = get_free_block(&new_block);
+    if (ret != 0)
+        return ret;
+    fragment_block_t *fragment;
+    ret = fragment_add(new_block, &fragment);
+    if (ret != 0) {
+        deallocate_block(new_block);
+        return ret;
+    }
+    *block = new_block;
+    *offset = 0;
+    units_set(fragment, 0, length, true);
+    if (journal_is_active())
+        taken[taken_num++] = (fragment_range_t){new_block, 0, length};
+    return ret;
+}
+
+/**
+ * @brief Zeroes [offset, offset + length) of a fragment block and frees its
+ * units, and the block itself once it holds no tail.
+ * @return 0 on success, negative error code on failure.
+ */
+static int fragment_release(uint32_t block, uint32_t offset, uint32_t length) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    fragment_block_t *fragment = fragment_find(block);
+    if (fragment == NULL)
+        return ret;
+    units_set(fragment, offset, length, false);
+
+    if (fragment->used_units > 0) {
+        ret = vdisk_read(disk_handle, block, buffer);
+        if (ret != 0)
+            return ret;
+        memset(buffer + offset, 0, length);
+        return vdisk_write(disk_handle, block, buffer);
+    }
+
+    *fragment = fragments[--fragments_num];
+    ret = erase_block_content(block);
+    if (ret != 0)
+        return ret;
+    bitmap_set(block, false);
+    return ret;
+}
+
+/**
+ * @brief Frees a range of a fragment block, once the transactions that stop
+ * using it are committed.
+ * @return 0 on success, negative error code on failure.
+ */
+static int fragment_free(uint32_t block, uint32_t offset, uint32_t length) {
+    if (!journal_is_active())
+        return fragment_release(block, offset, length);
+
+    int ret = ranges_reserve(&released, released_num, &released_capacity);
+    if (ret != 0)
+        return ret;
+    released[released_num++] = (fragment_range_t){block, offset, length};
+    return 0;
+}
+
+/**
+ * @brief Marks a tail found in an inode at mount as used.
+ * @return 0 on success, negative error code on failure.
+ */
+int fragment_mark(uint32_t block, uint32_t offset, uint32_t length) {
+    int ret = 0;
+    fragment_block_t *fragment = fragment_find(block);
+    if (fragment == NULL) {
+        ret = fragment_add(block, &fragment);
+        if (ret != 0)
+            return ret;
+    }
+    units_set(fragment, offset, length, true);
+    return set_block_status(block, true);
+}
+
+/**
+ * @brief Releases the ranges freed by the transactions just committed.
+ * @return 0 on success, negative error code on failure.
+ * @note Called by the journal once a commit is durable.
+ */
+int fragments_committed() {
+    int ret = 0;
+    for (uint32_t r = 0; r < released_num && ret == 0; r++)
+        ret = fragment_release(released[r].block, released[r].offset, released[r].length);
+    released_num = 0;
+    return ret;
+}
+
+/**
+ * @brief Starts recording the ranges taken and freed by a transaction.
+ * @note Called by the journal.
+ */
+void fragments_begun() {
+    taken_num = 0;
+    begin_released = released_num;
+}
+
+/**
+ * @brief Releases the ranges taken by an aborted transaction, and keeps
+ * those it freed.
+ * @return 0 on success, negative error code on failure.
+ * @note Called by the journal.
+ */
+int fragments_aborted() {
+    int ret = 0;
+    released_num = begin_released;
+    while (taken_num > 0 && ret == 0) {
+        taken_num--;
+        ret = fragment_release(taken[taken_num].block, taken[taken_num].offset, taken[taken_num].length);
+    }
+    taken_num = 0;
+    return ret;
+}
+
+/**
+ * @brief Forgets the fragment blocks, before scanning a volume or after
+ * unmounting it.
+ */
+void fragments_release() {
+    free(fragments);
+    fragments = NULL;
+    fragments_num = 0;
+    fragments_capacity = 0;
+    free(released);
+    released = NULL;
+    released_num = 0;
+    released_capacity = 0;
+    free(taken);
+    taken = NULL;
+    taken_num = 0;
+    taken_capacity = 0;
+}
+
+/**
+ * @brief Copies `len` bytes at `offset` of the tail of a file into `data`.
+ * @return The number of bytes copied, negative error code on failure.
+ * @note The range must lie within the tail.
+ */
+int tail_read(any_inode_t *inode, uint8_t *data, uint32_t len, uint32_t offset) {
+    int ret = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    ret = vdisk_read(disk_handle, inode->v2.tail_block, buffer);
+    if (ret != 0)
+        return ret;
+    memcpy(data, buffer + inode->v2.tail_offset + offset, len);
+    return (int)len;
+}
+
+/**
+ * @brief Moves the last partial block of a file into a fragment block, and
+ * frees it.
+ *
+ * Nothing is done when the last mapped block isn't the one holding the
+ * tail, or when it is alone in an overflow extent block.
+ *
+ * @return 1 if the tail was packed, 0 if not, negative error code on failure.
+ * @note The caller saves the inode.
+ */
+int tail_pack(int inode_num, any_inode_t *any_inode) {
+    int ret = 0;
+    inode_v2_t *inode = &any_inode->v2;
+    uint8_t leaf_buffer[BLOCK_SIZE];
+    extent_block_t *leaf = (extent_block_t *)leaf_buffer;
+
+    if (!tail_packing_enabled() || inode_is_inline(any_inode) || tail_is_packed(any_inode))
+        return ret;
+    uint32_t length = inode->size % BLOCK_SIZE;
+    uint64_t logical = inode->size / BLOCK_SIZE;
+    if (length == 0)
+        return ret;
+
+    extent_t *last = NULL;
+    uint32_t leaf_num = inode->extent_tail;
+    if (leaf_num != 0) {
+        ret = meta_read(leaf_num, leaf_buffer);
+        if (ret != 0)
+            return ret;
+        last = &leaf->extents[leaf->count - 1];
+        if (leaf->count == 1 && last->length == 1)
+            return ret;
+    } else if (inode->extents_num > 0) {
+        last = &inode->extents[inode->extents_num - 1];
+    }
+    if (last == NULL || (uint64_t)last->logical + last->length != logical + 1)
+        return ret;
+    uint32_t physical = last->physical + last->length - 1;
+
+    uint32_t fragment, offset;
+    ret = fragment_alloc(length, &fragment, &offset);
+    if (ret == ssfs_ENOSPACE)
+        return 0;  // Stays in its block
+    if (ret != 0)
+        return ret;
+
+    uint8_t buffer[BLOCK_SIZE];
+    uint8_t fragment_buffer[BLOCK_SIZE];
+    ret = vdisk_read(disk_handle, physical, buffer);
+    if (ret != 0)
+        goto error_management;
+    ret = vdisk_read(disk_handle, fragment, fragment_buffer);
+    if (ret != 0)
+        goto error_management;
+    memcpy(fragment_buffer + offset, buffer, length);
+    ret = vdisk_write(disk_handle, fragment, fragment_buffer);
+    if (ret != 0)
+        goto error_management;
+    dirty_mark_data(inode_num, fragment, 1);
+
+    // Unmapping the block
+    last->length--;
+    if (last->length == 0) {
+        if (leaf_num != 0)
+            leaf->count--;
+        else
+            inode->extents_num--;
+    }
+    if (leaf_num != 0) {
+        ret = meta_write(leaf_num, leaf_buffer);
+        if (ret != 0)
+            goto error_management;
+    }
+    set_block_status(physical, false);
+
+    inode->tail_block = fragment;
+    inode->tail_offset = (uint16_t)offset;
+    inode->tail_length = (uint16_t)length;
+    inode->flags |= INODE_FLAG_TAIL;
+    return 1;
+
+error_management:
+    fragment_release(fragment, offset, length);
+    return ret;
+}
+
+/**
+ * @brief Moves the tail of a file back to a block of its own.
+ *
+ * On failure, the tail stays packed.
+ *
+ * @return 0 on success, negative error code on failure.
+ * @note The caller saves the inode.
+ */
+int tail_unpack(int inode_num, any_inode_t *any_inode) {
+    int ret = 0;
+    inode_v2_t *inode = &any_inode->v2;
+    uint8_t buffer[BLOCK_SIZE];
+
+    if (!tail_is_packed(any_inode))
+        return ret;
+
+    uint64_t size = inode->size;
+    uint64_t start = tail_start(any_inode);
+    uint32_t length = inode->tail_length;
+    ret = tail_read(any_inode, buffer, length, 0);
+    if (ret < 0)
+        return ret;
+
+    inode->flags &= ~INODE_FLAG_TAIL;
+    inode->size = start;
+    ret = extent_extend_file(inode, size);
+    if (ret != 0)
+        goto error_management;
+
+    ret = write_in_file(inode_num, any_inode, buffer, length, (uint32_t)start);
+    if (ret < 0)
+        goto error_management;
+
+    ret = fragment_free(inode->tail_block, inode->tail_offset, inode->tail_length);
+    inode->tail_block = 0;
+    inode->tail_offset = 0;
+    inode->tail_length = 0;
+    return ret;
+
+error_management:
+    // A block mapped for the tail is used by the next attempt
+    inode->flags |= INODE_FLAG_TAIL;
+    inode->size = size;
+    return ret;
+}
+
+/**
+ * @brief Frees the tail of a file being deleted, and forgets it.
+ * @return 0 on success, negative error code on failure.
+ */
+int tail_free(any_inode_t *inode) {
+    int ret = 0;
+    if (!tail_is_packed(inode))
+        return ret;
+
+    ret = fragment_free(inode->v2.tail_block, inode->v2.tail_offset, inode->v2.tail_length);
+    inode->v2.flags &= ~INODE_FLAG_TAIL;
+    inode->v2.tail_block = 0;
+    inode->v2.tail_offset = 0;
+    inode->v2.tail_length = 0;
+    return ret;
+}
@@ -0,0 +1,225 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_trace.c
+ * ============
+ *
+ * Recording of the calls of the API, to replay them with `ssfs_replay`.
+ * While a trace is on, every call of fs.h that uses the volume appends a
+ * fixed-size record (operation, arguments, result, start time and
+ * duration) to the trace file, followed by the name for directory
+ * operations and by the inode numbers for batch operations. The data of
+ * read() and write() isn't recorded, only offsets and lengths. The offline
+ * check, the fragmentation and defragmentation calls, and the settings,
+ * statistics and trace calls aren't recorded.
+ * A trace is started by `ssfs_trace_start()`, or by `mount()` when the
+ * SSFS_TRACE environment variable names a file, so that a program can be
+ * traced without being changed.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "fs.h"
+#include "ssfs_internal.h"
+#include "error.h"
+
+// Stdio buffer of the trace file, records are written in batches
+#define TRACE_BUFFER_SIZE (1024 * 1024)
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file = NULL;
+static volatile bool tracing = false;  // Checked without the lock by every call
+static uint64_t trace_start_ns = 0;    // stats_clock() at the start of the trace
+
+/**
+ * @brief Starts recording the calls of the API into a new trace file.
+ *
+ * @param path The trace file, replaced if it exists.
+ *
+ * @return 0 on success.
+ * @return Negative integer (error codes) on failure, ssfs_EEXIST if a trace
+ * is already on.
+ */
+int ssfs_trace_start(const char *path) {
+    int ret = 0;
+
+    if (path == NULL) {
+        ret = ssfs_EINVAL;
+        goto error_management;
+    }
+
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file != NULL) {
+        ret = ssfs_EEXIST;
+        goto error_management_unlock;
+    }
+
+    trace_file = fopen(path, "wb");
+    if (trace_file == NULL) {
+        ret = ssfs_E3RDPARTY;
+        goto error_management_unlock;
+    }
+    setvbuf(trace_file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    trace_header_t header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .start_time_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec,
+    };
+    if (fwrite(&header, sizeof(header), 1, trace_file) != 1) {
+        fclose(trace_file);
+        trace_file = NULL;
+        ret = ssfs_E3RDPARTY;
+        goto error_management_unlock;
+    }
+
+    trace_start_ns = stats_clock();
+    tracing = true;
+    pthread_mutex_unlock(&trace_mutex);
+    return ret;
+
+error_management_unlock:
+    pthread_mutex_unlock(&trace_mutex);
+
+error_management:
+    fprintf(stderr, "Error when starting a trace (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Stops the trace and closes its file.
+ *
+ * @return 0 on success, or if no trace is on.
+ * @return Negative integer (error codes) if the end of the trace couldn't
+ * be written.
+ */
+int ssfs_trace_stop() {
+    int ret = 0;
+
+    pthread_mutex_lock(&trace_mutex);
+    tracing = false;
+    if (trace_file != NULL && fclose(trace_file) != 0)
+        ret = ssfs_E3RDPARTY;
+    trace_file = NULL;
+    pthread_mutex_unlock(&trace_mutex);
+
+    if (ret != 0)
+        fprintf(stderr, "Error when stopping a trace (code %d)\n", ret);
+    return ret;
+}
+
+/**
+ * @brief Starts a trace into the file named by SSFS_TRACE, if it is set and
+ * no trace is on.
+ */
+void trace_start_from_env() {
+    if (tracing)
+        return;
+    const char *path = getenv("SSFS_TRACE");
+    if (path != NULL && path[0] != '\0')
+        ssfs_trace_start(path);
+}
+
+/**
+ * @brief Appends a record to the trace, followed by `name` or by `arg2`
+ * inode numbers of `inode_nums` when either isn't NULL.
+ * @note The caller holds `trace_mutex`.
+ */
+static void trace_append(trace_record_t *record, uint64_t start, const char *name, const int *inode_nums) {
+    if (trace_file == NULL)
+        return;
+
+    uint64_t duration = stats_clock() - start;
+    record->start_ns = start > trace_start_ns ? start - trace_start_ns : 0;
+    record->duration_ns = duration < UINT32_MAX ? (uint32_t)duration : UINT32_MAX;
+
+    size_t name_len = name != NULL ? strnlen(name, SSFS_NAME_MAX) : 0;
+    record->name_len = (uint16_t)name_len;
+
+    // A failed write stops the trace, rather than leaving a truncated record
+    size_t inodes_num = inode_nums != NULL && record->arg2 > 0 ? (size_t)record->arg2 : 0;
+    if (fwrite(record, sizeof(trace_record_t), 1, trace_file) != 1 ||
+        (name_len > 0 && fwrite(name, name_len, 1, trace_file) != 1) ||
+        (inodes_num > 0 && fwrite(inode_nums, sizeof(int32_t), inodes_num, trace_file) != inodes_num)) {
+        fprintf(stderr, "Error when writing the trace, stopped\n");
+        fclose(trace_file);
+        trace_file = NULL;
+        tracing = false;
+    }
+}
+
+/**
+ * @brief Records a call of the API, if a trace is on.
+ *
+ * @param op The operation.
+ * @param start The value of `stats_clock()` when the call started.
+ * @param ret What the call returned.
+ * @param inode, arg1, arg2, name The arguments of the call, as described by
+ * `trace_record_t`.
+ */
+void trace_record(ssfs_op_t op, uint64_t start, int ret, int inode, int arg1, int arg2, const char *name) {
+    if (!tracing)
+        return;
+
+    trace_record_t record = {
+        .op = (uint8_t)op,
+        .inode = inode,
+        .arg1 = arg1,
+        .arg2 = arg2,
+        .result = ret,
+    };
+    pthread_mutex_lock(&trace_mutex);
+    trace_append(&record, start, name, NULL);
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+/**
+ * @brief Records a call of `ssfs_format_opts()`, if a trace is on.
+ */
+void trace_record_format(uint64_t start, int ret, int inodes, const ssfs_format_options_t *options) {
+    if (!tracing)
+        return;
+
+    trace_record_t record = {
+        .op = SSFS_OP_FORMAT,
+        .flags = options != NULL ? (uint8_t)options->features : 0,
+        .inode = options != NULL ? (int32_t)options->inode_version : 0,
+        .arg1 = inodes,
+        .arg2 = options != NULL ? (int32_t)options->block_size : 0,
+        .result = ret,
+    };
+    pthread_mutex_lock(&trace_mutex);
+    trace_append(&record, start, NULL, NULL);
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+/**
+ * @brief Records a call of a batch operation and its inode numbers, if a
+ * trace is on.
+ *
+ * @param count The number of files of the call.
+ * @param inode_nums The inode numbers created or given.
+ * @param listed How many of `inode_nums` to record.
+ */
+void trace_record_inodes(ssfs_op_t op, uint64_t start, int ret, int count, const int *inode_nums, int listed) {
+    if (!tracing)
+        return;
+
+    trace_record_t record = {
+        .op = (uint8_t)op,
+        .arg1 = count,
+        .arg2 = inode_nums != NULL ? listed : 0,
+        .result = ret,
+    };
+    pthread_mutex_lock(&trace_mutex);
+    trace_append(&record, start, NULL, inode_nums);
+    pthread_mutex_unlock(&trace_mutex);
+}
@@ -1,590 +1,2282 @@
-/*
- * Author: Valérian Wislez
- *
- * tests.c
- * =======
- * 
- * This file only serves testing purposes.
- * It defines functions for different tests.
- *
- */
-
-
-#include "ssfs_internal.h"
-#include "fs.h"
-#include <stdbool.h>
-#include <stdlib.h>
-#include <time.h>
-#include <stdarg.h>
-#include <string.h>
-
-// format, mount, create, stats, delete, create, unmount
-void test1() {
-    print_warning("Starting test1...", NULL);
-
-    char *disk_name = "testdisk.img";
-    int inodes = 200;
-
-    print_info("Formatting", "%s", disk_name);
-    print_info("Number of inodes", "%d", inodes);
-    format(disk_name, inodes);
-
-    print_info("Mounting...", NULL);
-    mount(disk_name);
-    
-    srand((unsigned int)time(NULL));
-    int files_num = (rand() % (inodes / 2 - 1)) + 1; // at least 1, at most inodes / 2 - 1
-    int delete_files_num = (rand() % files_num) + 1; // at least 1, at most files_num
-
-    print_info("Number of file to be created", "%d", files_num);
-    for (int f = 0; f < files_num; f++) {
-        int file = create();
-        if (file >= 0)
-            printf("Created file with inode %d\n", file);
-        else
-            print_error("Error when creating file: ", "%d", file);
-    }
-
-    print_info("Number of statistics", "%d", files_num);
-    for (int f = 0; f < files_num; f++) {
-        int ret = stat(f);
-        if (ret >= 0)
-            printf("Size(%d) -> %d bytes\n", f, ret);
-        else
-            print_error("Statistics error", "%d", ret);
-    }
-    
-    print_info("Number of files to be deleted", "%d", delete_files_num);
-    for (int f = 0; f < delete_files_num; f++) {
-        int ret = delete(f);
-        if (ret == 0)
-            printf("Deleted file number: %d\n", f);
-        else
-            print_error("Error when deleting file number", "%d", f);
-    }
-
-    files_num = (rand() % (inodes / 2 - 1)) + 1;
-
-    print_info("Number of file to be created", "%d", files_num);
-    for (int f = 0; f < files_num; f++) {
-        int file = create();
-        if (file >= 0)
-            printf("Created file with inode %d\n", file);
-        else
-            print_error("Error when creating file: ", "%d", file);
-    }
-
-    print_info("Unmounting...", NULL);
-    unmount();
-}
-
-// Reading some files with different lengths and offsets
-void test2() {
-    print_warning("Starting test2...", NULL);
-
-    int bytes_num = 14558;
-    print_info("Allocating ressources", "%d", bytes_num);
-    uint8_t *data = malloc(bytes_num);
-
-    int inodes[]    = {4};
-    int lens[]      = {bytes_num};
-    int offsets[]   = {0};
-
-    int num_inodes  = sizeof(inodes)    / sizeof(inodes[0]);
-    int num_lens    = sizeof(lens)      / sizeof(lens[0]);
-    int num_offsets = sizeof(offsets)   / sizeof(offsets[0]);
-
-    char *disk_name = "disk_img.3.bin";
-    print_info("Mounting", "%s", disk_name);
-    mount(disk_name);
-
-    for (int i = 0; i < num_inodes; i++) {
-        for (int l = 0; l < num_lens; l++) {
-            for (int o = 0; o < num_offsets; o++) {
-                int inode = inodes[i];
-                int len = lens[l];
-                int offset = offsets[o];
-
-                // Creating output file for hex dump of the content
-                char file_name[256];
-                snprintf(
-                    file_name, 
-                    sizeof(file_name),
-                    "output/output_inode_%d_len_%d_offset_%d.hex",
-                    inode,
-                    len, 
-                    offset
-                );
-
-                FILE *hex_output = fopen(file_name, "w");
-                if (hex_output == NULL) {
-                    print_error("Failed to open output file", "%s", file_name);
-                    free(data);
-                    return;
-                }
-
-                print_info("Reading parameters", NULL);
-                print_info("inode: ",   "%d", inode);
-                print_info("len: ",     "%d", len);
-                print_info("offset: ",  "%d", offset);
-
-                print_info("Statistics... ", NULL);
-                int size = stat(inode);
-                if (size >= 0)
-                    printf("size(%d) = %d\n", inode, size);
-                else
-                    print_error("Error when reading", "%d", size);
-
-                int bytes = read(inode, data, len, offset);
-                if (bytes >= 0)
-                    print_success("Number of bytes successfully read", "%d", bytes);
-                else
-                    print_error("Error when reading", "%d", bytes);
-                
-                print_info("Writing data to", "%s", file_name);
-                for (int i = 0; i < bytes; i++) {
-                    fprintf(stdout, "%02x", data[i]);
-                    fprintf(hex_output, "%02x", data[i]);
-                }
-                fprintf(stdout, "\n");
-
-                fclose(hex_output);
-            }
-        }
-    }
-
-    print_info("Unmounting...", NULL);
-    free(data);
-    unmount();
-}
-
-// Read and write to file
-void test3() {
-    print_warning("Starting test3...", NULL);
-
-    int bytes_num = VDISK_SECTOR_SIZE;
-    print_info("Allocating resources", "%d", bytes_num);
-    uint8_t *data = malloc(bytes_num);
-    if (!data) {
-        print_error("Memory allocation failed", NULL);
-        return;
-    }
-
-    // Fill data with a pattern
-    for (int i = 0; i < bytes_num; i++) {
-        data[i] = (uint8_t)(i % 16);
-    }
-
-    int inode = 0;  // value will be overriden
-    int lens[] = {1, 7};
-    int offsets[] = {0, 16, 32};
-    int num_lens = sizeof(lens) / sizeof(lens[0]);
-    int num_offsets = sizeof(offsets) / sizeof(offsets[0]);
-
-    char *disk_name = "disk_img.2";
-    print_info("Mounting", "%s", disk_name);
-    mount(disk_name);
-
-    // Create a file to write to
-    inode = create();
-    if (inode < 0) {
-        print_error("Failed to create file", "%d", inode);
-        free(data);
-        unmount();
-        return;
-    }
-    print_success("Created file with inode", "%d", inode);
-    print_inode_num_info(inode);
-
-    for (int l = 0; l < num_lens; l++) {
-        for (int o = 0; o < num_offsets; o++) {
-            int len = lens[l];
-            int offset = offsets[o];
-
-            print_info("Writing parameters", NULL);
-            print_info("inode: ", "%d", inode);
-            print_info("len: ", "%d", len);
-            print_info("offset: ", "%d", offset);
-
-            int bytes = write(inode, data, len, offset);
-            if (bytes >= 0)
-                print_success("Number of bytes successfully written", "%d", bytes);
-            else
-                print_error("Error when writing", "%d", bytes);
-            print_inode_num_info(inode);
-            
-            // Read back and verify
-            uint8_t *verify = malloc(len);
-            if (verify) {
-                int read_bytes = read(inode, verify, len, offset);
-                print_info("Reading data:", NULL);
-                for (int vi = 0; vi < read_bytes; vi++) {
-                    if (vi && vi % 16 == 0)
-                        fprintf(stdout, "\n");
-                    fprintf(stdout, "%02X ", verify[vi]);                    
-
-                }
-                fprintf(stdout, "\n");
-
-                if (read_bytes == len && memcmp(data, verify, len) == 0) {
-                    print_success("Verification passed", NULL);
-                } else {
-                    print_error("Verification failed", NULL);
-                }
-                memset(verify, 0, len);
-                free(verify);
-            }
-            verify = malloc(len + offset);
-            if (verify) {
-                int read_bytes = read(inode, verify, len + offset, 0);
-                print_info("Reading file from 0:", NULL);
-                for (int vi = 0; vi < read_bytes; vi++) {
-                    if (vi && vi % 16 == 0)
-                        fprintf(stdout, "\n");
-                    fprintf(stdout, "%02X ", verify[vi]);                    
-                }
-                fprintf(stdout, "\n");
-                memset(verify, 0, len + offset);
-                free(verify);
-            }
-        }
-    }
-
-    print_info("Unmounting...", NULL);
-    free(data);
-    unmount();
-}
-
-// Tests writing helper functions: get_free_block, set_data_block_pointer, get_data_block_pointer, and extend_file
-void test4() {
-    print_warning("Starting test4...", NULL);
-
-    // Allocate a small buffer for reading/writing data
-    int bytes_num = VDISK_SECTOR_SIZE;  // 1024 bytes
-    uint8_t *data = malloc(bytes_num);
-    if (!data) {
-        print_error("Memory allocation failed", NULL);
-        return;
-    }
-    memset(data, 0xAA, bytes_num);  // Fill with a pattern for write tests
-    print_info("Allocating resources", "data is %d bytes", bytes_num);
-
-    // Format and mount a new disk
-    char *disk_name = "disk_img.4";
-    int minimum_inodes = 32;
-    print_info("Formatting", "%s with %d inodes", disk_name, minimum_inodes);
-    int ret = format(disk_name, minimum_inodes);
-    if (ret != 0) {
-        print_error("Failed to format disk", "%d", ret);
-        free(data);
-        return;
-    }
-
-    print_info("Mounting", "%s", disk_name);
-    ret = mount(disk_name);
-    if (ret != 0) {
-        print_error("Failed to mount disk", "%d", ret);
-        free(data);
-        return;
-    }
-
-    // Create a file for testing
-    int inode_num = create();
-    if (inode_num < 0) {
-        print_error("Failed to create file", "%d", inode_num);
-        free(data);
-        unmount();
-        return;
-    }
-    print_success("Created file with inode", "%d", inode_num);
-
-    // Read inode block for testing
-    uint8_t buffer[VDISK_SECTOR_SIZE];
-    uint32_t target_inode_block = inode_num / 32;
-    uint32_t target_inode_num = inode_num % 32;
-    ret = vdisk_read(disk_handle, 1 + target_inode_block, buffer);
-    if (ret != 0) {
-        print_error("Failed to read inode block", "%d", ret);
-        free(data);
-        unmount();
-        return;
-    }
-
-    inodes_block_t *ib = (inodes_block_t *)buffer;
-    inode_t *target_inode = &ib[0][target_inode_num];
-
-    print_info("Reading again inode", "number: %d", inode_num);
-    print_inode_info(target_inode);
-
-    // Test 1: get_free_block
-    print_warning("Testing get_free_block", NULL);
-    uint32_t block1, block2;
-    ret = get_free_block(&block1);
-    if (ret == 0) {
-        print_success("Allocated block", "%u", block1); 
-    } else {
-        print_error("Failed to get first free block", "%d", ret); 
-    }
-
-    ret = get_free_block(&block2);
-    if (ret == 0) {
-        print_success("Allocated block", "%u", block2);
-    } else {
-        print_error("Failed to get second free block", "%d", ret);
-    }      
-
-    print_info("Reading again inode", "number: %d", inode_num);
-    print_inode_info(target_inode);
-
-    // Test 2: set_data_block_pointer (direct, indirect, double-indirect)
-    print_warning("Testing set_data_block_pointer", NULL);
-    uint32_t logical_indices[] = {0, 3, 4, 260};  // Direct, last direct, first indirect, double-indirect
-    int num_indices = sizeof(logical_indices) / sizeof(logical_indices[0]);
-    for (int i = 0; i < num_indices; i++) {
-        uint32_t logical = logical_indices[i];
-        uint32_t physical;
-
-        ret = get_free_block(&physical);
-        if (ret == 0) {
-            print_success("Allocated block", "%u", physical);
-        } else {
-            print_error("Failed to get free block", "%d", ret);
-        }
-
-        ret = set_data_block_pointer(target_inode, logical);
-        if (ret == 0) {
-            print_success("Set pointer blocks", "logical: %u, physical: %u", logical, physical);
-        } else {
-            print_error("Failed to set pointer for logical block", "logical: %u, error code: %d", logical, ret);
-        }            
-    }
-
-    // Save inode after setting pointers
-    ret = vdisk_write(disk_handle, 1 + target_inode_block, buffer);
-    if (ret != 0) {
-        print_error("Failed to save inode block", "%d", ret);
-        free(data);
-        unmount();
-        return;
-    }
-    vdisk_sync(disk_handle);
-
-    print_info("Reading again inode", "number: %d", inode_num);
-    print_inode_info(target_inode);
-
-    // Test 3: extend_file
-    print_warning("Testing extend_file", NULL);
-    uint32_t new_sizes[] = {1024, 4096, 5120, 266240};  // 1 block, 4 blocks (direct), 5 blocks (indirect), 260 blocks (double-indirect)
-    int num_sizes = sizeof(new_sizes) / sizeof(new_sizes[0]);
-    for (int i = 0; i < num_sizes; i++) {
-        uint32_t new_size = new_sizes[i];
-        ret = extend_file(target_inode, new_size);
-        if (ret == 0) {
-            print_success("Extended file to size", "%u", new_size);
-            
-            // Verify size
-            if (target_inode->size == new_size) {
-                print_success("Inode size updated correctly to", "%u", target_inode->size); 
-            } else {
-                print_error("Inode size mismatch", "new_size: %u, target_inode->size: %u", new_size, target_inode->size); 
-            }
-
-            // Verify blocks are allocated and zeroed
-            ret = read(inode_num, data, VDISK_SECTOR_SIZE, new_size - VDISK_SECTOR_SIZE);
-            if (ret >= 0) {
-                int all_zeros = 1;
-                for (int j = 0; j < ret; j++) {
-                    if (data[j] != 0) {
-                        all_zeros = 0;
-                        break;
-                    }
-                }
-                if (all_zeros) {
-                    print_success("Last block is zeroed", "new_size: %u", new_size); 
-                } else {
-                    print_error("Last block is not zeroed", "new_size: %u", new_size); 
-                }
-            } else {
-                print_error("Failed to read last block", "new_size: %u, code: %d", new_size, ret);
-            }
-        } else {
-            print_error("Failed to extend file", "new_size: %u, code: %d", new_size, ret);
-        }
-
-        // Save inode after extension
-        ret = vdisk_write(disk_handle, 1 + target_inode_block, buffer);
-        if (ret != 0) {
-            print_error("Failed to save inode block", "%d", ret);
-            break;
-        }
-        vdisk_sync(disk_handle);
-
-        print_inode_info(target_inode);
-    }
-
-    // Test 4: Write and verify (uses extend_file and set_data_block_pointer indirectly)
-    print_warning("Testing write (with extend_file)", NULL);
-    int offset = 2048;
-    ret = write(inode_num, data, VDISK_SECTOR_SIZE, offset);  // Write 1 block at offset 2048
-    if (ret >= 0) {
-        print_success("Wrote ", "%d bytes", ret);
-        // Read back to verify
-        memset(data, 0, bytes_num);
-        ret = read(inode_num, data, VDISK_SECTOR_SIZE, offset);
-        if (ret >= 0) {
-            int correct_data = 1;
-            int i;
-            for (i = 0; i < ret; i++) {
-                if (data[i] != 0xAA) {
-                    correct_data = 0;
-                    break;
-                }
-            }
-            if (correct_data) {
-                print_success("Data verified", "offset: %d", offset);
-            } else {
-                print_error("Data incorrect", "offset: %d, i:", offset, i);
-            }
-        } else {
-            print_error("Failed to read back data", "offset: %d, code: %d", offset, ret);
-        }
-    } else {
-        print_error("Failed to write at offset", "offset: %d, code: %d", offset, ret);
-    }
-
-    // Cleanup
-    print_info("Unmounting & freeing...", NULL);
-    free(data);
-    unmount();
-}
-
-// One test to rule them all
-void test5() {
-    print_warning("Starting test5...", NULL);
-    
-    int ret = 0;
-    char *disk_name = "disk_img.5";
-    int inodes = 128;
-    
-
-    // Allocate a small buffer for reading/writing data
-    int bytes_num = 550000;
-    uint8_t *data = malloc(bytes_num);
-    if (!data) {
-        print_error("Memory allocation failed", NULL);
-        return;
-    }
-    for (int i = 0; i < bytes_num; i++) {
-        data[i] = (uint8_t)(i % 256 + 1);  // 01, 02, ..., FF
-    }
-
-    print_info("Allocating resources", "data is %d bytes", bytes_num);
-
-    print_info("Formatting", "%s", disk_name);
-    print_info("Number of inodes", "%d", inodes);
-    format(disk_name, inodes);
-
-    print_info("Mounting...", NULL);
-    mount(disk_name);
-
-    int files_num = 1;
-    int max_len = 10 * 1024;
-    int max_offset = max_len;
-    int len = rand() % max_len + 1;
-    int offset = rand() % max_offset + 1;
-
-    len = bytes_num;
-    offset = 0;
-
-    print_info("Number of file to be created", "%d", files_num);
-    for (int f = 0; f < files_num; f++) {
-        int file = create();
-        if (file >= 0)
-            printf("Created file with inode %d\n", file);
-        else
-            print_error("Error when creating file: ", "%d", file);
-    }
-
-    print_info("Get some stats", NULL);
-    for (int f = 0; f < files_num; f++)
-        print_inode_num_info(f);
-
-    for (int f = 0; f < files_num; f++) {
-        print_info("Let's write...", "f: %d, len: %d, offset: %d", f, len, offset);
-
-        ret = write(f, data, len, offset);
-
-        print_inode_num_info(f);
-        
-        if (ret >= 0) {
-            print_success("Wrote ", "%d bytes", ret);
-            
-            // Read back to verify
-            uint8_t *verify = malloc(len);
-            if (verify) {
-                int read_bytes = read(f, verify, len, offset);
-                
-                print_info("Reading data:", NULL);
-                for (int vi = 0; vi < read_bytes; vi++) {
-                    if (vi && vi % 16 == 0)
-                        fprintf(stdout, "\n");
-                    fprintf(stdout, "%02X ", verify[vi]);                    
-
-                }
-                fprintf(stdout, "\n");
-
-                if (read_bytes == len && memcmp(data, verify, len) == 0) {
-                    print_success("Verification passed", NULL);
-                } else {
-                    print_error("Verification failed", NULL);
-                }
-                memset(verify, 0, len);
-                free(verify);
-            }
-
-            verify = malloc(len + offset);
-            if (verify) {
-                int read_bytes = read(f, verify, len + offset, offset);
-                
-                if (read_bytes > 0) {
-                    print_info("Reading file from 0:", NULL);
-                    
-                    // This counter will keep track of how many non-zero bytes have been printed.
-                    int printed_count = 0;
-                    
-                    for (int vi = 0; vi < read_bytes; vi++) {
-                        // We'll print a marker every 128 characters from the file's beginning.
-                        // This check is independent of whether the byte is zero or not.
-                        // The 'vi' index here is relative to the start of the buffer.
-                        if ((offset + vi) > 0 && (offset + vi) % 256 == 0) {
-                            fprintf(stdout, "\n-- Offset %d --\n", offset + vi);
-                            // Reset the printed count to start a new block of output.
-                            printed_count = 0;
-                        }
-                        
-                        // Only print the hex value if the byte is non-zero
-                        if (verify[vi] != 0) {
-                            if (printed_count > 0 && printed_count % 16 == 0) {
-                                fprintf(stdout, "\n");
-                            }
-                            fprintf(stdout, "%02X ", verify[vi]);
-                            
-                            printed_count++;
-                        }
-                    }
-                    fprintf(stdout, "\n");
-                }
-                
-                // Free the allocated memory
-                free(verify);
-            }
-
-        } else {
-            print_error("Failed to write at offset", "offset: %d, code: %d", offset, ret);
-        }
-    }
-
-    print_info("Unmounting & freeing...", NULL);
-    free(data);
-    unmount();
-}
\ No newline at end of file
+/*
+ * Author: Valérian Wislez
+ *
+ * tests.c
+ * =======
+ * 
+ * This file only serves testing purposes.
+ * It defines functions for different tests.
+ *
+ */
+
+
+#include "ssfs_internal.h"
+#include "fs.h"
+#include "error.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+// format, mount, create, stats, delete, create, unmount
+void test1() {
+    print_warning("Starting test1...", NULL);
+
+    char *disk_name = "testdisk.img";
+    int inodes = 200;
+
+    print_info("Formatting", "%s", disk_name);
+    print_info("Number of inodes", "%d", inodes);
+    format(disk_name, inodes);
+
+    print_info("Mounting...", NULL);
+    mount(disk_name);
+    
+    srand((unsigned int)time(NULL));
+    int files_num = (rand() % (inodes / 2 - 1)) + 1; // at least 1, at most inodes / 2 - 1
+    int delete_files_num = (rand() % files_num) + 1; // at least 1, at most files_num
+
+    print_info("Number of file to be created", "%d", files_num);
+    for (int f = 0; f < files_num; f++) {
+        int file = create();
+        if (file >= 0)
+            printf("Created file with inode %d\n", file);
+        else
+            print_error("Error when creating file: ", "%d", file);
+    }
+
+    print_info("Number of statistics", "%d", files_num);
+    for (int f = 0; f < files_num; f++) {
+        int ret = stat(f);
+        if (ret >= 0)
+            printf("Size(%d) -> %d bytes\n", f, ret);
+        else
+            print_error("Statistics error", "%d", ret);
+    }
+    
+    print_info("Number of files to be deleted", "%d", delete_files_num);
+    for (int f = 0; f < delete_files_num; f++) {
+        int ret = delete(f);
+        if (ret == 0)
+            printf("Deleted file number: %d\n", f);
+        else
+            print_error("Error when deleting file number", "%d", f);
+    }
+
+    files_num = (rand() % (inodes / 2 - 1)) + 1;
+
+    print_info("Number of file to be created", "%d", files_num);
+    for (int f = 0; f < files_num; f++) {
+        int file = create();
+        if (file >= 0)
+            printf("Created file with inode %d\n", file);
+        else
+            print_error("Error when creating file: ", "%d", file);
+    }
+
+    print_info("Unmounting...", NULL);
+    unmount();
+}
+
+// Reading some files with different lengths and offsets
+void test2() {
+    print_warning("Starting test2...", NULL);
+
+    int bytes_num = 14558;
+    print_info("Allocating ressources", "%d", bytes_num);
+    uint8_t *data = malloc(bytes_num);
+
+    int inodes[]    = {4};
+    int lens[]      = {bytes_num};
+    int offsets[]   = {0};
+
+    int num_inodes  = sizeof(inodes)    / sizeof(inodes[0]);
+    int num_lens    = sizeof(lens)      / sizeof(lens[0]);
+    int num_offsets = sizeof(offsets)   / sizeof(offsets[0]);
+
+    char *disk_name = "disk_img.3.bin";
+    print_info("Mounting", "%s", disk_name);
+    mount(disk_name);
+
+    for (int i = 0; i < num_inodes; i++) {
+        for (int l = 0; l < num_lens; l++) {
+            for (int o = 0; o < num_offsets; o++) {
+                int inode = inodes[i];
+                int len = lens[l];
+                int offset = offsets[o];
+
+                // Creating output file for hex dump of the content
+                char file_name[256];
+                snprintf(
+                    file_name, 
+                    sizeof(file_name),
+                    "output/output_inode_%d_len_%d_offset_%d.hex",
+                    inode,
+                    len, 
+                    offset
+                );
+
+                FILE *hex_output = fopen(file_name, "w");
+                if (hex_output == NULL) {
+                    print_error("Failed to open output file", "%s", file_name);
+                    free(data);
+                    return;
+                }
+
+                print_info("Reading parameters", NULL);
+                print_info("inode: ",   "%d", inode);
+                print_info("len: ",     "%d", len);
+                print_info("offset: ",  "%d", offset);
+
+                print_info("Statistics... ", NULL);
+                int size = stat(inode);
+                if (size >= 0)
+                    printf("size(%d) = %d\n", inode, size);
+                else
+                    print_error("Error when reading", "%d", size);
+
+                int bytes = read(inode, data, len, offset);
+                if (bytes >= 0)
+                    print_success("Number of bytes successfully read", "%d", bytes);
+                else
+                    print_error("Error when reading", "%d", bytes);
+                
+                print_info("Writing data to", "%s", file_name);
+                for (int i = 0; i < bytes; i++) {
+                    fprintf(stdout, "%02x", data[i]);
+                    fprintf(hex_output, "%02x", data[i]);
+                }
+                fprintf(stdout, "\n");
+
+                fclose(hex_output);
+            }
+        }
+    }
+
+    print_info("Unmounting...", NULL);
+    free(data);
+    unmount();
+}
+
+// Read and write to file
+void test3() {
+    print_warning("Starting test3...", NULL);
+
+    int bytes_num = BLOCK_SIZE;
+    print_info("Allocating resources", "%d", bytes_num);
+    uint8_t *data = malloc(bytes_num);
+    if (!data) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+
+    // Fill data with a pattern
+    for (int i = 0; i < bytes_num; i++) {
+        data[i] = (uint8_t)(i % 16);
+    }
+
+    int inode = 0;  // value will be overriden
+    int lens[] = {1, 7};
+    int offsets[] = {0, 16, 32};
+    int num_lens = sizeof(lens) / sizeof(lens[0]);
+    int num_offsets = sizeof(offsets) / sizeof(offsets[0]);
+
+    char *disk_name = "disk_img.2";
+    print_info("Mounting", "%s", disk_name);
+    mount(disk_name);
+
+    // Create a file to write to
+    inode = create();
+    if (inode < 0) {
+        print_error("Failed to create file", "%d", inode);
+        free(data);
+        unmount();
+        return;
+    }
+    print_success("Created file with inode", "%d", inode);
+    print_inode_num_info(inode);
+
+    for (int l = 0; l < num_lens; l++) {
+        for (int o = 0; o < num_offsets; o++) {
+            int len = lens[l];
+            int offset = offsets[o];
+
+            print_info("Writing parameters", NULL);
+            print_info("inode: ", "%d", inode);
+            print_info("len: ", "%d", len);
+            print_info("offset: ", "%d", offset);
+
+            int bytes = write(inode, data, len, offset);
+            if (bytes >= 0)
+                print_success("Number of bytes successfully written", "%d", bytes);
+            else
+                print_error("Error when writing", "%d", bytes);
+            print_inode_num_info(inode);
+            
+            // Read back and verify
+            uint8_t *verify = malloc(len);
+            if (verify) {
+                int read_bytes = read(inode, verify, len, offset);
+                print_info("Reading data:", NULL);
+                for (int vi = 0; vi < read_bytes; vi++) {
+                    if (vi && vi % 16 == 0)
+                        fprintf(stdout, "\n");
+                    fprintf(stdout, "%02X ", verify[vi]);                    
+
+                }
+                fprintf(stdout, "\n");
+
+                if (read_bytes == len && memcmp(data, verify, len) == 0) {
+                    print_success("Verification passed", NULL);
+                } else {
+                    print_error("Verification failed", NULL);
+                }
+                memset(verify, 0, len);
+                free(verify);
+            }
+            verify = malloc(len + offset);
+            if (verify) {
+                int read_bytes = read(inode, verify, len + offset, 0);
+                print_info("Reading file from 0:", NULL);
+                for (int vi = 0; vi < read_bytes; vi++) {
+                    if (vi && vi % 16 == 0)
+                        fprintf(stdout, "\n");
+                    fprintf(stdout, "%02X ", verify[vi]);                    
+                }
+                fprintf(stdout, "\n");
+                memset(verify, 0, len + offset);
+                free(verify);
+            }
+        }
+    }
+
+    print_info("Unmounting...", NULL);
+    free(data);
+    unmount();
+}
+
+// Tests writing helper functions: get_free_block, set_data_block_pointer, get_data_block_pointer, and extend_file
+void test4() {
+    print_warning("Starting test4...", NULL);
+
+    // Allocate a small buffer for reading/writing data
+    int bytes_num = BLOCK_SIZE;  // 1024 bytes
+    uint8_t *data = malloc(bytes_num);
+    if (!data) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+    memset(data, 0xAA, bytes_num);  // Fill with a pattern for write tests
+    print_info("Allocating resources", "data is %d bytes", bytes_num);
+
+    // Format and mount a new disk
+    char *disk_name = "disk_img.4";
+    int minimum_inodes = 32;
+    print_info("Formatting", "%s with %d inodes", disk_name, minimum_inodes);
+    int ret = format(disk_name, minimum_inodes);
+    if (ret != 0) {
+        print_error("Failed to format disk", "%d", ret);
+        free(data);
+        return;
+    }
+
+    print_info("Mounting", "%s", disk_name);
+    ret = mount(disk_name);
+    if (ret != 0) {
+        print_error("Failed to mount disk", "%d", ret);
+        free(data);
+        return;
+    }
+
+    // Create a file for testing
+    int inode_num = create();
+    if (inode_num < 0) {
+        print_error("Failed to create file", "%d", inode_num);
+        free(data);
+        unmount();
+        return;
+    }
+    print_success("Created file with inode", "%d", inode_num);
+
+    // Read inode block for testing
+    uint8_t buffer[BLOCK_SIZE];
+    uint32_t target_inode_block = inode_num / 32;
+    uint32_t target_inode_num = inode_num % 32;
+    ret = meta_read(1 + target_inode_block, buffer);
+    if (ret != 0) {
+        print_error("Failed to read inode block", "%d", ret);
+        free(data);
+        unmount();
+        return;
+    }
+
+    inodes_block_t *ib = (inodes_block_t *)buffer;
+    inode_t *target_inode = &ib[0][target_inode_num];
+
+    print_info("Reading again inode", "number: %d", inode_num);
+    print_inode_info(target_inode);
+
+    // Test 1: get_free_block
+    print_warning("Testing get_free_block", NULL);
+    uint32_t block1, block2;
+    ret = get_free_block(&block1);
+    if (ret == 0) {
+        print_success("Allocated block", "%u", block1); 
+    } else {
+        print_error("Failed to get first free block", "%d", ret); 
+    }
+
+    ret = get_free_block(&block2);
+    if (ret == 0) {
+        print_success("Allocated block", "%u", block2);
+    } else {
+        print_error("Failed to get second free block", "%d", ret);
+    }      
+
+    print_info("Reading again inode", "number: %d", inode_num);
+    print_inode_info(target_inode);
+
+    // Test 2: set_data_block_pointer (direct, indirect, double-indirect)
+    print_warning("Testing set_data_block_pointer", NULL);
+    uint32_t logical_indices[] = {0, 3, 4, 260};  // Direct, last direct, first indirect, double-indirect
+    int num_indices = sizeof(logical_indices) / sizeof(logical_indices[0]);
+    for (int i = 0; i < num_indices; i++) {
+        uint32_t logical = logical_indices[i];
+        uint32_t physical;
+
+        ret = get_free_block(&physical);
+        if (ret == 0) {
+            print_success("Allocated block", "%u", physical);
+        } else {
+            print_error("Failed to get free block", "%d", ret);
+        }
+
+        ret = set_data_block_pointer(target_inode, logical);
+        if (ret == 0) {
+            print_success("Set pointer blocks", "logical: %u, physical: %u", logical, physical);
+        } else {
+            print_error("Failed to set pointer for logical block", "logical: %u, error code: %d", logical, ret);
+        }            
+    }
+
+    // Save inode after setting pointers
+    ret = meta_write(1 + target_inode_block, buffer);
+    if (ret != 0) {
+        print_error("Failed to save inode block", "%d", ret);
+        free(data);
+        unmount();
+        return;
+    }
+    vdisk_sync(disk_handle);
+
+    print_info("Reading again inode", "number: %d", inode_num);
+    print_inode_info(target_inode);
+
+    // Test 3: extend_file
+    print_warning("Testing extend_file", NULL);
+    uint32_t new_sizes[] = {1024, 4096, 5120, 266240};  // 1 block, 4 blocks (direct), 5 blocks (indirect), 260 blocks (double-indirect)
+    int num_sizes = sizeof(new_sizes) / sizeof(new_sizes[0]);
+    for (int i = 0; i < num_sizes; i++) {
+        uint32_t new_size = new_sizes[i];
+        ret = extend_file(target_inode, new_size);
+        if (ret == 0) {
+            print_success("Extended file to size", "%u", new_size);
+            
+            // Verify size
+            if (target_inode->size == new_size) {
+                print_success("Inode size updated correctly to", "%u", target_inode->size); 
+            } else {
+                print_error("Inode size mismatch", "new_size: %u, target_inode->size: %u", new_size, target_inode->size); 
+            }
+
+            // Verify blocks are allocated and zeroed
+            ret = read(inode_num, data, BLOCK_SIZE, new_size - BLOCK_SIZE);
+            if (ret >= 0) {
+                int all_zeros = 1;
+                for (int j = 0; j < ret; j++) {
+                    if (data[j] != 0) {
+                        all_zeros = 0;
+                        break;
+                    }
+                }
+                if (all_zeros) {
+                    print_success("Last block is zeroed", "new_size: %u", new_size); 
+                } else {
+                    print_error("Last block is not zeroed", "new_size: %u", new_size); 
+                }
+            } else {
+                print_error("Failed to read last block", "new_size: %u, code: %d", new_size, ret);
+            }
+        } else {
+            print_error("Failed to extend file", "new_size: %u, code: %d", new_size, ret);
+        }
+
+        // Save inode after extension
+        ret = meta_write(1 + target_inode_block, buffer);
+        if (ret != 0) {
+            print_error("Failed to save inode block", "%d", ret);
+            break;
+        }
+        vdisk_sync(disk_handle);
+
+        print_inode_info(target_inode);
+    }
+
+    // Test 4: Write and verify (uses extend_file and set_data_block_pointer indirectly)
+    print_warning("Testing write (with extend_file)", NULL);
+    int offset = 2048;
+    ret = write(inode_num, data, BLOCK_SIZE, offset);  // Write 1 block at offset 2048
+    if (ret >= 0) {
+        print_success("Wrote ", "%d bytes", ret);
+        // Read back to verify
+        memset(data, 0, bytes_num);
+        ret = read(inode_num, data, BLOCK_SIZE, offset);
+        if (ret >= 0) {
+            int correct_data = 1;
+            int i;
+            for (i = 0; i < ret; i++) {
+                if (data[i] != 0xAA) {
+                    correct_data = 0;
+                    break;
+                }
+            }
+            if (correct_data) {
+                print_success("Data verified", "offset: %d", offset);
+            } else {
+                print_error("Data incorrect", "offset: %d, i:", offset, i);
+            }
+        } else {
+            print_error("Failed to read back data", "offset: %d, code: %d", offset, ret);
+        }
+    } else {
+        print_error("Failed to write at offset", "offset: %d, code: %d", offset, ret);
+    }
+
+    // Cleanup
+    print_info("Unmounting & freeing...", NULL);
+    free(data);
+    unmount();
+}
+
+// One test to rule them all
+void test5() {
+    print_warning("Starting test5...", NULL);
+    
+    int ret = 0;
+    char *disk_name = "disk_img.5";
+    int inodes = 128;
+    
+
+    // Allocate a small buffer for reading/writing data
+    int bytes_num = 550000;
+    uint8_t *data = malloc(bytes_num);
+    if (!data) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+    for (int i = 0; i < bytes_num; i++) {
+        data[i] = (uint8_t)(i % 256 + 1);  // 01, 02, ..., FF
+    }
+
+    print_info("Allocating resources", "data is %d bytes", bytes_num);
+
+    print_info("Formatting", "%s", disk_name);
+    print_info("Number of inodes", "%d", inodes);
+    format(disk_name, inodes);
+
+    print_info("Mounting...", NULL);
+    mount(disk_name);
+
+    int files_num = 1;
+    int max_len = 10 * 1024;
+    int max_offset = max_len;
+    int len = rand() % max_len + 1;
+    int offset = rand() % max_offset + 1;
+
+    len = bytes_num;
+    offset = 0;
+
+    print_info("Number of file to be created", "%d", files_num);
+    for (int f = 0; f < files_num; f++) {
+        int file = create();
+        if (file >= 0)
+            printf("Created file with inode %d\n", file);
+        else
+            print_error("Error when creating file: ", "%d", file);
+    }
+
+    print_info("Get some stats", NULL);
+    for (int f = 0; f < files_num; f++)
+        print_inode_num_info(f);
+
+    for (int f = 0; f < files_num; f++) {
+        print_info("Let's write...", "f: %d, len: %d, offset: %d", f, len, offset);
+
+        ret = write(f, data, len, offset);
+
+        print_inode_num_info(f);
+        
+        if (ret >= 0) {
+            print_success("Wrote ", "%d bytes", ret);
+            
+            // Read back to verify
+            uint8_t *verify = malloc(len);
+            if (verify) {
+                int read_bytes = read(f, verify, len, offset);
+                
+                print_info("Reading data:", NULL);
+                for (int vi = 0; vi < read_bytes; vi++) {
+                    if (vi && vi % 16 == 0)
+                        fprintf(stdout, "\n");
+                    fprintf(stdout, "%02X ", verify[vi]);                    
+
+                }
+                fprintf(stdout, "\n");
+
+                if (read_bytes == len && memcmp(data, verify, len) == 0) {
+                    print_success("Verification passed", NULL);
+                } else {
+                    print_error("Verification failed", NULL);
+                }
+                memset(verify, 0, len);
+                free(verify);
+            }
+
+            verify = malloc(len + offset);
+            if (verify) {
+                int read_bytes = read(f, verify, len + offset, offset);
+                
+                if (read_bytes > 0) {
+                    print_info("Reading file from 0:", NULL);
+                    
+                    // This counter will keep track of how many non-zero bytes have been printed.
+                    int printed_count = 0;
+                    
+                    for (int vi = 0; vi < read_bytes; vi++) {
+                        // We'll print a marker every 128 characters from the file's beginning.
+                        // This check is independent of whether the byte is zero or not.
+                        // The 'vi' index here is relative to the start of the buffer.
+                        if ((offset + vi) > 0 && (offset + vi) % 256 == 0) {
+                            fprintf(stdout, "\n-- Offset %d --\n", offset + vi);
+                            // Reset the printed count to start a new block of output.
+                            printed_count = 0;
+                        }
+                        
+                        // Only print the hex value if the byte is non-zero
+                        if (verify[vi] != 0) {
+                            if (printed_count > 0 && printed_count % 16 == 0) {
+                                fprintf(stdout, "\n");
+                            }
+                            fprintf(stdout, "%02X ", verify[vi]);
+                            
+                            printed_count++;
+                        }
+                    }
+                    fprintf(stdout, "\n");
+                }
+                
+                // Free the allocated memory
+                free(verify);
+            }
+
+        } else {
+            print_error("Failed to write at offset", "offset: %d, code: %d", offset, ret);
+        }
+    }
+
+    print_info("Unmounting & freeing...", NULL);
+    free(data);
+    unmount();
+}
+// Journal replay after a crash between the commit and the checkpoint, the
+// blocks of the lost transactions zeroed again
+void test6() {
+    print_warning("Starting test6...", NULL);
+
+    char *disk_name = "disk_img.6";
+    int inodes = 64;
+    int bytes_num = 300000;
+
+    uint8_t *data = malloc(bytes_num);
+    uint8_t *verify = malloc(bytes_num);
+    if (!data || !verify) {
+        print_error("Memory allocation failed", NULL);
+        free(data);
+        free(verify);
+        return;
+    }
+    for (int i = 0; i < bytes_num; i++)
+        data[i] = (uint8_t)(i % 253 + 1);
+
+    print_info("Formatting", "%s", disk_name);
+    if (vdisk_create(disk_name, 1024) != 0 || format(disk_name, inodes) != 0 || mount(disk_name) != 0) {
+        print_error("Failed to format or mount", "%s", disk_name);
+        free(data);
+        free(verify);
+        return;
+    }
+
+    int committed = create();
+    write(committed, data, bytes_num, 0);
+    ssfs_sync();
+    print_info("Committed file", "inode: %d, size: %d", committed, bytes_num);
+
+    // Never committed: lost by the crash, its data left in blocks that are free again
+    int uncommitted = create();
+    write(uncommitted, data, 8 * BLOCK_SIZE, 0);
+    print_info("Uncommitted file", "inode: %d", uncommitted);
+
+    // The home copy of the inode block is lost, only the journal has it
+    uint8_t buffer[BLOCK_SIZE];
+    memset(buffer, 0, BLOCK_SIZE);
+    vdisk_write(disk_handle, 1, buffer);
+    vdisk_sync(disk_handle);
+
+    print_info("Crashing without unmounting...", NULL);
+    reclaim_stop();
+    journal_release();
+    vdisk_off(disk_handle);
+    free(disk_handle);
+    disk_handle = NULL;
+    free(allocated_blocks_handle);
+    allocated_blocks_handle = NULL;
+
+    print_info("Mounting again", "%s", disk_name);
+    if (mount(disk_name) != 0) {
+        print_error("Failed to mount after the crash", "%s", disk_name);
+        free(data);
+        free(verify);
+        return;
+    }
+
+    if (stat(committed) == bytes_num &&
+        read(committed, verify, bytes_num, 0) == bytes_num &&
+        memcmp(data, verify, bytes_num) == 0) {
+        print_success("Committed file replayed", "inode: %d", committed);
+    } else {
+        print_error("Committed file lost", "inode: %d", committed);
+    }
+
+    if (stat(uncommitted) < 0)
+        print_success("Uncommitted file discarded", "inode: %d", uncommitted);
+    else
+        print_error("Uncommitted file survived", "inode: %d", uncommitted);
+
+    // Every free block holds zeros again, so a gap in a new file reads as zeros
+    int dirty_blocks = 0;
+    for (uint32_t b = 0; b < disk_handle->size_in_sectors; b++) {
+        if (allocated_blocks_handle[b] || vdisk_read(disk_handle, b, buffer) != 0)
+            continue;
+        for (int i = 0; i < BLOCK_SIZE; i++) {
+            if (buffer[i] != 0) {
+                dirty_blocks++;
+                break;
+            }
+        }
+    }
+    int gap = 8 * BLOCK_SIZE;
+    int sparse = create();
+    memset(verify, 0xFF, gap);
+    write(sparse, data, 1, gap);
+    int dirty_bytes = read(sparse, verify, gap, 0) == gap ? 0 : gap;
+    for (int i = 0; i < gap; i++)
+        dirty_bytes += verify[i] != 0;
+    if (dirty_blocks == 0 && dirty_bytes == 0)
+        print_success("Free blocks zeroed after the crash", NULL);
+    else
+        print_error("Free blocks hold data after the crash", "%d blocks, %d bytes of a gap",
+            dirty_blocks, dirty_bytes);
+
+    print_info("Unmounting & freeing...", NULL);
+    free(data);
+    free(verify);
+    unmount();
+}
+
+// Asynchronous delete: blocks of a deleted file are zeroed before being reused
+void test7() {
+    print_warning("Starting test7...", NULL);
+
+    char *disk_name = "disk_img.7";
+    int inodes = 64;
+
+    print_info("Formatting", "%s", disk_name);
+    if (vdisk_create(disk_name, 1024) != 0 || format(disk_name, inodes) != 0 || mount(disk_name) != 0) {
+        print_error("Failed to format or mount", "%s", disk_name);
+        return;
+    }
+
+    // Two copies of the file don't fit on the disk
+    int bytes_num = (int)(disk_handle->size_in_sectors * 2 / 3) * BLOCK_SIZE;
+    uint8_t *data = malloc(bytes_num);
+    uint8_t *verify = malloc(bytes_num);
+    if (!data || !verify) {
+        print_error("Memory allocation failed", NULL);
+        free(data);
+        free(verify);
+        unmount();
+        return;
+    }
+    for (int i = 0; i < bytes_num; i++)
+        data[i] = (uint8_t)(i % 253 + 1);
+
+    int first = create();
+    write(first, data, bytes_num, 0);
+    ssfs_sync();
+
+    clock_t start = clock();
+    int ret = delete(first);
+    print_info("Deleted file", "inode: %d, size: %d, code: %d, %.3f ms",
+        first, bytes_num, ret, 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+
+    // Needs the blocks of the deleted file, reclaimed on demand
+    int second = create();
+    if (write(second, data, bytes_num, 0) == bytes_num &&
+        read(second, verify, bytes_num, 0) == bytes_num &&
+        memcmp(data, verify, bytes_num) == 0) {
+        print_success("Blocks reused after reclamation", "inode: %d, discarded: %llu bytes",
+            second, (unsigned long long)disk_handle->discarded_bytes);
+    } else {
+        print_error("Blocks of the deleted file not reusable", "inode: %d", second);
+    }
+
+    print_info("Unmounting & freeing...", NULL);
+    free(data);
+    free(verify);
+    unmount();
+}
+
+// Extent-based inodes: a sequential file is mapped by a single inline extent,
+// and can't grow past the sizes stat() returns
+void test8() {
+    print_warning("Starting test8...", NULL);
+
+    char *disk_name = "disk_img.8";
+    int inodes = 64;
+    int bytes_num = 2 * 1024 * 1024;
+    ssfs_format_options_t options = {.inode_version = INODE_V2};
+
+    uint8_t *data = malloc(bytes_num);
+    uint8_t *verify = malloc(bytes_num);
+    if (!data || !verify) {
+        print_error("Memory allocation failed", NULL);
+        free(data);
+        free(verify);
+        return;
+    }
+    for (int i = 0; i < bytes_num; i++)
+        data[i] = (uint8_t)(i % 253 + 1);
+
+    print_info("Formatting with extent inodes", "%s", disk_name);
+    if (vdisk_create(disk_name, 4096) != 0 || ssfs_format_opts(disk_name, inodes, &options) != 0 ||
+        mount(disk_name) != 0) {
+        print_error("Failed to format or mount", "%s", disk_name);
+        free(data);
+        free(verify);
+        return;
+    }
+
+    int inode_num = create();
+    write(inode_num, data, bytes_num / 2, 0);
+    write(inode_num, data + bytes_num / 2, bytes_num / 2, bytes_num / 2);
+    print_inode_num_info(inode_num);
+
+    print_info("Mounting again", "%s", disk_name);
+    unmount();
+    if (mount(disk_name) != 0) {
+        print_error("Failed to mount again", "%s", disk_name);
+        free(data);
+        free(verify);
+        return;
+    }
+
+    if (stat(inode_num) == bytes_num &&
+        read(inode_num, verify, bytes_num, 0) == bytes_num &&
+        memcmp(data, verify, bytes_num) == 0) {
+        print_success("File read back", "inode: %d, size: %d", inode_num, bytes_num);
+    } else {
+        print_error("File corrupted", "inode: %d", inode_num);
+    }
+
+    uint8_t buffer[BLOCK_SIZE];
+    meta_read(itable_block(inode_num / geometry_handle.inodes_per_block), buffer);
+    inode_v2_t *inode = &inode_at(buffer, inode_num % geometry_handle.inodes_per_block)->v2;
+    if (inode->extents_num == 1 && inode->extent_block == 0)
+        print_success("Mapped by a single extent", "length: %u blocks", inode->extents[0].length);
+    else
+        print_error("Fragmented mapping", "extents: %u, extent block: %u", inode->extents_num, inode->extent_block);
+
+    int ret = write(inode_num, data, BLOCK_SIZE, INT_MAX - BLOCK_SIZE / 2);
+    if (ret == ssfs_EINVAL && stat(inode_num) == bytes_num)
+        print_success("Write past INT_MAX refused", "size: %d", stat(inode_num));
+    else
+        print_error("Write past INT_MAX accepted", "ret: %d, size: %d", ret, stat(inode_num));
+
+    print_info("Unmounting & freeing...", NULL);
+    free(data);
+    free(verify);
+    unmount();
+}
+
+// Inline data: a tiny file lives in its inode, and moves to a data block
+// once it outgrows it
+void test9() {
+    print_warning("Starting test9...", NULL);
+
+    char *disk_name = "disk_img.9";
+    int inodes = 64;
+    ssfs_format_options_t options = {.features = SSFS_FEATURE_INLINE_DATA};
+
+    uint8_t data[200];
+    uint8_t verify[200];
+    for (int i = 0; i < 200; i++)
+        data[i] = (uint8_t)(i % 253 + 1);
+
+    print_info("Formatting with inline data", "%s", disk_name);
+    vdisk_create(disk_name, 1024);
+    ssfs_format_opts(disk_name, inodes, &options);
+    mount(disk_name);
+
+    uint32_t used_before = 0;
+    for (uint32_t b = 0; b < disk_handle->size_in_sectors; b++)
+        used_before += allocated_blocks_handle[b];
+
+    int inode_num = create();
+    int tiny_size = (int)inline_capacity();
+    write(inode_num, data, tiny_size / 2, 0);
+    write(inode_num, data + tiny_size / 2, tiny_size - tiny_size / 2, tiny_size / 2);
+
+    uint32_t used_after = 0;
+    for (uint32_t b = 0; b < disk_handle->size_in_sectors; b++)
+        used_after += allocated_blocks_handle[b];
+
+    if (used_after == used_before &&
+        read(inode_num, verify, tiny_size, 0) == tiny_size &&
+        memcmp(data, verify, tiny_size) == 0)
+        print_success("Stored in the inode", "inode: %d, size: %d", inode_num, tiny_size);
+    else
+        print_error("Tiny file not inline", "inode: %d, blocks used: %u", inode_num, used_after - used_before);
+
+    print_info("Growing past the inode", "size: %d", 200);
+    write(inode_num, data + tiny_size, 200 - tiny_size, tiny_size);
+
+    print_info("Mounting again", "%s", disk_name);
+    unmount();
+    mount(disk_name);
+
+    if (stat(inode_num) == 200 &&
+        read(inode_num, verify, 200, 0) == 200 &&
+        memcmp(data, verify, 200) == 0)
+        print_success("Moved to a data block", "inode: %d, size: %d", inode_num, 200);
+    else
+        print_error("File corrupted", "inode: %d", inode_num);
+
+    print_info("Unmounting & freeing...", NULL);
+    delete(inode_num);
+    unmount();
+}
+
+// Tail packing: the last partial blocks of two files share a fragment block,
+// and a tail moves back to a block when its file grows
+void test10() {
+    print_warning("Starting test10...", NULL);
+
+    char *disk_name = "disk_img.10";
+    int inodes = 64;
+    ssfs_format_options_t options = {
+        .inode_version = INODE_V2,
+        .features = SSFS_FEATURE_TAIL_PACKING
+    };
+
+    uint8_t data[5000];
+    uint8_t verify[5000];
+    for (int i = 0; i < 5000; i++)
+        data[i] = (uint8_t)(i % 253 + 1);
+
+    print_info("Formatting with tail packing", "%s", disk_name);
+    vdisk_create(disk_name, 1024);
+    ssfs_format_opts(disk_name, inodes, &options);
+    mount(disk_name);
+
+    int first = create();
+    int second = create();
+    write(first, data, 1300, 0);
+    write(second, data, 1200, 0);
+
+    uint8_t buffer[BLOCK_SIZE];
+    meta_read(1, buffer);
+    inode_v2_t *first_inode = &inode_at(buffer, first)->v2;
+    inode_v2_t *second_inode = &inode_at(buffer, second)->v2;
+    if ((first_inode->flags & INODE_FLAG_TAIL) && (second_inode->flags & INODE_FLAG_TAIL) &&
+        first_inode->tail_block == second_inode->tail_block)
+        print_success("Tails share a block", "block: %u", first_inode->tail_block);
+    else
+        print_error("Tails not packed", "inodes: %d, %d", first, second);
+
+    print_info("Growing the first file", "size: %d", 5000);
+    write(first, data + 1300, 3700, 1300);
+
+    print_info("Mounting again", "%s", disk_name);
+    unmount();
+    mount(disk_name);
+
+    if (read(first, verify, 5000, 0) == 5000 && memcmp(data, verify, 5000) == 0 &&
+        read(second, verify, 1200, 0) == 1200 && memcmp(data, verify, 1200) == 0)
+        print_success("Files read back", "sizes: %d, %d", stat(first), stat(second));
+    else
+        print_error("File corrupted", "inodes: %d, %d", first, second);
+
+    print_info("Unmounting & freeing...", NULL);
+    delete(first);
+    delete(second);
+    unmount();
+}
+
+// Volume usage: the counters follow creations and deletions, survive a
+// remount, and the largest free extent follows the frees
+void test11() {
+    print_warning("Starting test11...", NULL);
+
+    char *disk_name = "disk_img.11";
+    int inodes = 64;
+    int bytes_num = 64 * 1024;
+    ssfs_statfs_t before, after;
+
+    uint8_t *data = calloc(bytes_num, 1);
+    if (data == NULL) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+
+    ssfs_format_new(disk_name, 4096, inodes);
+    mount(disk_name);
+    ssfs_statfs(&before);
+    print_info("Empty volume", "free blocks: %u/%u, free inodes: %u/%u, largest free extent: %u",
+        before.free_blocks, before.total_blocks, before.free_inodes, before.total_inodes,
+        before.largest_free_extent);
+
+    int inode_num = create();
+    write(inode_num, data, bytes_num, 0);
+    ssfs_statfs(&after);
+    if (after.free_inodes == before.free_inodes - 1 &&
+        after.free_blocks <= before.free_blocks - bytes_num / before.block_size)
+        print_success("Counters updated", "free blocks: %u, free inodes: %u", after.free_blocks, after.free_inodes);
+    else
+        print_error("Wrong counters", "free blocks: %u, free inodes: %u", after.free_blocks, after.free_inodes);
+
+    print_info("Mounting again", "%s", disk_name);
+    unmount();
+    mount(disk_name);
+
+    ssfs_statfs_t remounted;
+    ssfs_statfs(&remounted);
+    if (remounted.free_blocks == after.free_blocks && remounted.free_inodes == after.free_inodes)
+        print_success("Counters kept", "free blocks: %u, free inodes: %u", remounted.free_blocks, remounted.free_inodes);
+    else
+        print_error("Counters changed", "free blocks: %u, free inodes: %u", remounted.free_blocks, remounted.free_inodes);
+
+    // The largest free extent follows the frees, every other file first
+    int files[40];
+    for (int f = 0; f < 40; f++) {
+        files[f] = create();
+        write(files[f], data, 3 * remounted.block_size, 0);
+    }
+    ssfs_statfs(&after);
+    int wrong_extents = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int f = pass; f < 40; f += 2)
+            delete(files[f]);
+        ssfs_sync();
+        pthread_mutex_lock(&fs_mutex);
+        reclaim_all();
+        uint32_t largest = 0, run = 0;
+        for (uint32_t b = 0; b < disk_handle->size_in_sectors; b++) {
+            run = allocated_blocks_handle[b] ? 0 : run + 1;
+            largest = run > largest ? run : largest;
+        }
+        pthread_mutex_unlock(&fs_mutex);
+        ssfs_statfs(&after);
+        wrong_extents += after.largest_free_extent != largest;
+    }
+    if (wrong_extents == 0)
+        print_success("Largest free extent kept", "%u blocks", after.largest_free_extent);
+    else
+        print_error("Wrong largest free extent", "%u blocks", after.largest_free_extent);
+
+    print_info("Unmounting & freeing...", NULL);
+    free(data);
+    delete(inode_num);
+    unmount();
+}
+
+// Growable inode table: a volume formatted with 32 inodes holds 1000 files
+void test12() {
+    print_warning("Starting test12...", NULL);
+
+    char *disk_name = "disk_img.12";
+    int inodes = 32;
+    int files_num = 1000;
+    ssfs_statfs_t stats;
+
+    int *inode_nums = calloc(files_num, sizeof(int));
+    if (inode_nums == NULL) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+
+    ssfs_format_new(disk_name, 8192, inodes);
+    mount(disk_name);
+    ssfs_statfs(&stats);
+    print_info("Formatted", "inodes: %u", stats.total_inodes);
+
+    // Each file holds its own number, to be checked after mounting again
+    for (int i = 0; i < files_num; i++) {
+        inode_nums[i] = create();
+        if (inode_nums[i] < 0) {
+            print_error("Creation failed", "file %d (code %d)", i, inode_nums[i]);
+            goto cleanup;
+        }
+        write(inode_nums[i], (uint8_t *)&i, sizeof(i), 0);
+    }
+    ssfs_statfs(&stats);
+    print_success("Table grown", "inodes: %u, free: %u", stats.total_inodes, stats.free_inodes);
+
+    print_info("Mounting again", "%s", disk_name);
+    unmount();
+    mount(disk_name);
+
+    int errors = 0;
+    for (int i = 0; i < files_num; i++) {
+        int value = -1;
+        if (read(inode_nums[i], (uint8_t *)&value, sizeof(value), 0) != sizeof(value) || value != i)
+            errors++;
+    }
+    ssfs_statfs(&stats);
+    if (errors == 0 && stats.total_inodes - stats.free_inodes == (uint32_t)files_num)
+        print_success("Files kept", "%d files, inodes: %u", files_num, stats.total_inodes);
+    else
+        print_error("Files lost", "%d errors, used inodes: %u", errors, stats.total_inodes - stats.free_inodes);
+
+    print_info("Unmounting & freeing...", NULL);
+    for (int i = 0; i < files_num; i++)
+        delete(inode_nums[i]);
+
+cleanup:
+    free(inode_nums);
+    unmount();
+}
+
+// Online growth: a full volume grows, and its new blocks are used and kept
+void test13() {
+    print_warning("Starting test13...", NULL);
+
+    char *disk_name = "disk_img.13";
+    int inodes = 32;
+    int bytes_num = 128 * 1024;
+    ssfs_statfs_t stats;
+
+    uint8_t *data = calloc(bytes_num, 1);
+    if (data == NULL) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+    for (int i = 0; i < bytes_num; i++)
+        data[i] = (uint8_t)(i * 7);
+
+    ssfs_format_new(disk_name, 1024, inodes);
+    mount(disk_name);
+
+    // Files of 128 KiB until the volume is full
+    int files_num = 0;
+    int inode_nums[16];
+    while (files_num < 16) {
+        inode_nums[files_num] = create();
+        if (write(inode_nums[files_num], data, bytes_num, 0) != bytes_num) {
+            delete(inode_nums[files_num]);
+            break;
+        }
+        files_num++;
+    }
+    ssfs_statfs(&stats);
+    print_info("Volume full", "%d files, free blocks: %u/%u", files_num, stats.free_blocks, stats.total_blocks);
+
+    ssfs_grow(4096);
+    ssfs_statfs(&stats);
+    print_info("Volume grown", "free blocks: %u/%u", stats.free_blocks, stats.total_blocks);
+
+    int more = create();
+    if (write(more, data, bytes_num, 0) == bytes_num)
+        print_success("New blocks used", "inode %d", more);
+    else
+        print_error("New blocks unusable", NULL);
+
+    print_info("Mounting again", "%s", disk_name);
+    unmount();
+    mount(disk_name);
+
+    ssfs_statfs(&stats);
+    uint8_t *check = malloc(bytes_num);
+    int errors = 0;
+    for (int f = 0; f < files_num && check != NULL; f++)
+        if (read(inode_nums[f], check, bytes_num, 0) != bytes_num || memcmp(check, data, bytes_num) != 0)
+            errors++;
+    if (check == NULL || read(more, check, bytes_num, 0) != bytes_num || memcmp(check, data, bytes_num) != 0)
+        errors++;
+    if (errors == 0 && stats.total_blocks == 4096)
+        print_success("Size and files kept", "blocks: %u", stats.total_blocks);
+    else
+        print_error("Growth lost", "%d errors, blocks: %u", errors, stats.total_blocks);
+
+    print_info("Unmounting & freeing...", NULL);
+    free(check);
+    free(data);
+    for (int f = 0; f < files_num; f++)
+        delete(inode_nums[f]);
+    delete(more);
+    unmount();
+}
+
+// Hashed directories: thousands of names linked, looked up, unlinked and listed
+void test14() {
+    print_warning("Starting test14...", NULL);
+
+    char *disk_name = "disk_img.14";
+    int names_num = 5000;
+    char name[32];
+
+    ssfs_format_new(disk_name, 8192, 32);
+    mount(disk_name);
+
+    int dir_inode = ssfs_mkdir();
+    int file_inode = create();
+    print_info("Directory created", "inode %d, linking %d names to inode %d", dir_inode, names_num, file_inode);
+
+    for (int i = 0; i < names_num; i++) {
+        snprintf(name, sizeof(name), "name-%d", i);
+        if (ssfs_link(dir_inode, name, file_inode) != 0) {
+            print_error("Link failed", "%s", name);
+            goto cleanup;
+        }
+    }
+    if (ssfs_link(dir_inode, "name-0", file_inode) == ssfs_EEXIST)
+        print_success("Duplicate refused", "name-0");
+    else
+        print_error("Duplicate accepted", "name-0");
+
+    // One name out of two goes
+    for (int i = 0; i < names_num; i += 2) {
+        snprintf(name, sizeof(name), "name-%d", i);
+        ssfs_unlink(dir_inode, name);
+    }
+
+    print_info("Mounting again", "%s", disk_name);
+    unmount();
+    mount(disk_name);
+
+    int errors = 0;
+    for (int i = 0; i < names_num; i++) {
+        snprintf(name, sizeof(name), "name-%d", i);
+        int found = ssfs_lookup(dir_inode, name);
+        if (i % 2 == 0 ? found != ssfs_ENOENT : found != file_inode)
+            errors++;
+    }
+
+    int listed = 0;
+    uint32_t cursor = 0;
+    ssfs_dirent_t entry;
+    while (ssfs_readdir(dir_inode, &cursor, &entry) == 1)
+        listed++;
+
+    if (errors == 0 && listed == names_num / 2)
+        print_success("Names kept", "%d listed, directory size: %d bytes", listed, stat(dir_inode));
+    else
+        print_error("Wrong names", "%d lookup errors, %d listed", errors, listed);
+
+cleanup:
+    print_info("Unmounting & freeing...", NULL);
+    delete(dir_inode);
+    delete(file_inode);
+    unmount();
+}
+
+// test1, with the batched operations
+void test15() {
+    print_warning("Starting test15...", NULL);
+
+    char *disk_name = "disk_img.15";
+    int inodes = 200;
+    int files_num = 150;
+
+    int *inode_nums = malloc(files_num * sizeof(int));
+    int *sizes = malloc(inodes * sizeof(int));
+    if (inode_nums == NULL || sizes == NULL) {
+        print_error("Memory allocation failed", NULL);
+        free(inode_nums);
+        free(sizes);
+        return;
+    }
+
+    ssfs_format_new(disk_name, 1024, inodes);
+    mount(disk_name);
+
+    int created = ssfs_create_many(inode_nums, files_num);
+    if (created == files_num)
+        print_success("Files created", "%d, inodes %d to %d", created, inode_nums[0], inode_nums[created - 1]);
+    else
+        print_error("Creation failed", "code %d", created);
+
+    for (int f = 0; f < files_num; f += 3)
+        write(inode_nums[f], (uint8_t *)"batched", 7, 0);
+
+    ssfs_stat_range(0, inodes, sizes);
+    int errors = 0;
+    for (int f = 0; f < inodes; f++) {
+        int expected = f >= files_num ? ssfs_EINODE : (f % 3 == 0 ? 7 : 0);
+        if (sizes[f] != expected)
+            errors++;
+    }
+    if (errors == 0)
+        print_success("Sizes retrieved", "%d inodes", inodes);
+    else
+        print_error("Wrong sizes", "%d errors", errors);
+
+    // Every other file goes, with one inode listed twice
+    int delete_num = files_num / 2;
+    for (int f = 0; f < delete_num; f++)
+        inode_nums[f] = 2 * f;
+    inode_nums[delete_num] = 0;
+    int deleted = ssfs_delete_many(inode_nums, delete_num + 1);
+
+    ssfs_stat_many(inode_nums, delete_num, sizes);
+    errors = 0;
+    for (int f = 0; f < delete_num; f++)
+        if (sizes[f] != ssfs_EINODE)
+            errors++;
+    if (deleted == delete_num && errors == 0)
+        print_success("Files deleted", "%d", deleted);
+    else
+        print_error("Deletion failed", "%d deleted, %d left", deleted, errors);
+
+    print_info("Unmounting & freeing...", NULL);
+    free(inode_nums);
+    free(sizes);
+    unmount();
+}
+
+// Inode iterator: a scan finds every used inode, and resumes from its cursor
+void test16() {
+    print_warning("Starting test16...", NULL);
+
+    char *disk_name = "disk_img.16";
+    int inodes = 1024;
+    int files_num = 100;
+
+    ssfs_format_new(disk_name, 4096, inodes);
+    mount(disk_name);
+
+    // Files spread over the table, of 0 to 3 KiB
+    int inode_nums[100];
+    ssfs_create_many(inode_nums, files_num);
+    for (int f = 0; f < files_num; f++) {
+        if (f % 4 == 0)
+            continue;
+        uint8_t data[3 * 1024] = {0};
+        write(inode_nums[f], data, (f % 4) * 1024, 0);
+    }
+    for (int f = 0; f < files_num; f += 5)
+        delete(inode_nums[f]);
+
+    ssfs_inode_iter_t iter;
+    ssfs_inode_info_t info;
+    int found = 0, errors = 0;
+    uint32_t blocks = 0;
+    ssfs_inode_iter_begin(&iter, 0);
+    while (ssfs_inode_iter_next(&iter, &info) == 1) {
+        int f = info.inode_num;
+        if (f % 5 == 0 || info.size != (uint64_t)(f % 4) * 1024)
+            errors++;
+        blocks += info.blocks;
+        found++;
+
+        // The scan is stopped halfway, then resumed from its cursor
+        if (found == files_num / 2) {
+            ssfs_inode_iter_end(&iter);
+            ssfs_inode_iter_begin(&iter, iter.cursor);
+        }
+    }
+    ssfs_inode_iter_end(&iter);
+
+    if (found == files_num - files_num / 5 && errors == 0)
+        print_success("Files found", "%d, %u data blocks", found, blocks);
+    else
+        print_error("Wrong scan", "%d found, %d errors", found, errors);
+
+    print_info("Unmounting...", NULL);
+    unmount();
+}
+
+/**
+ * @brief Thread of test17, stat()ing the file given as argument.
+ */
+static void *stat_thread(void *arg) {
+    int inode = *(int *)arg;
+    for (int i = 0; i < 100; i++)
+        stat(inode);
+    return NULL;
+}
+
+// Statistics: calls, device I/O and freed blocks are counted, in every thread
+void test17() {
+    print_warning("Starting test17...", NULL);
+
+    char *disk_name = "disk_img.17";
+    int file_size = 64 * 1024;
+    uint8_t data[64 * 1024];
+    memset(data, 0x5a, file_size);
+
+    ssfs_reset_stats();
+    ssfs_format_new(disk_name, 4096, 32);
+    mount(disk_name);
+
+    int inode = create();
+    write(inode, data, file_size, 0);
+    read(inode, data, file_size, 0);
+    ssfs_fsync(inode);
+
+    ssfs_stats_t stats;
+    ssfs_get_stats(&stats);
+    if (stats.ops[SSFS_OP_FORMAT_NEW].calls == 1 && stats.ops[SSFS_OP_MOUNT].calls == 1 &&
+        stats.ops[SSFS_OP_WRITE].calls == 1 && stats.ops[SSFS_OP_READ].calls == 1 &&
+        stats.user_bytes_written == (uint64_t)file_size && stats.user_bytes_read == (uint64_t)file_size)
+        print_success("Calls counted", "write p50: %llu ns", (unsigned long long)ssfs_stats_percentile(&stats.ops[SSFS_OP_WRITE], 50));
+    else
+        print_error("Wrong call counts", NULL);
+
+    if (stats.device_bytes_written >= (uint64_t)file_size && stats.device_bytes_read >= (uint64_t)file_size &&
+        stats.blocks_allocated >= (uint64_t)file_size / 1024 && stats.device_syncs > 0)
+        print_success("Device I/O counted", "write amplification: %.2f, %llu blocks allocated, %llu bitmap entries scanned",
+            (double)stats.device_bytes_written / stats.user_bytes_written,
+            (unsigned long long)stats.blocks_allocated, (unsigned long long)stats.allocator_scanned);
+    else
+        print_error("Wrong device counts", NULL);
+
+    // Calls of other threads are summed, those having exited included
+    ssfs_reset_stats();
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++)
+        pthread_create(&threads[t], NULL, stat_thread, &inode);
+    for (int t = 0; t < 4; t++)
+        pthread_join(threads[t], NULL);
+    ssfs_get_stats(&stats);
+    if (stats.ops[SSFS_OP_STAT].calls == 400 && stats.ops[SSFS_OP_WRITE].calls == 0)
+        print_success("Threads summed", "%llu stat() calls", (unsigned long long)stats.ops[SSFS_OP_STAT].calls);
+    else
+        print_error("Wrong thread counts", "%llu stat() calls", (unsigned long long)stats.ops[SSFS_OP_STAT].calls);
+
+    // The blocks of the deleted file are freed once the reclaimer zeroed them
+    delete(inode);
+    ssfs_sync();
+    pthread_mutex_lock(&fs_mutex);
+    reclaim_all();
+    pthread_mutex_unlock(&fs_mutex);
+    ssfs_get_stats(&stats);
+    if (stats.blocks_freed >= (uint64_t)file_size / 1024 && stats.ops[SSFS_OP_DELETE].calls == 1)
+        print_success("Blocks freed", "%llu", (unsigned long long)stats.blocks_freed);
+    else
+        print_error("Wrong freed blocks", "%llu", (unsigned long long)stats.blocks_freed);
+
+    // Batch, volume, directory and iterator calls are counted too
+    ssfs_reset_stats();
+    int batch[3], sizes[3];
+    ssfs_statfs_t volume;
+    ssfs_inode_iter_t iter;
+    ssfs_inode_info_t info;
+    ssfs_dirent_t entry;
+    uint32_t cursor = 0;
+    ssfs_create_many(batch, 3);
+    ssfs_stat_many(batch, 3, sizes);
+    ssfs_stat_range(0, 3, sizes);
+    ssfs_delete_many(batch, 3);
+    ssfs_statfs(&volume);
+    ssfs_grow(volume.total_blocks + 64);
+    ssfs_readdir(ssfs_mkdir(), &cursor, &entry);
+    ssfs_inode_iter_begin(&iter, 0);
+    while (ssfs_inode_iter_next(&iter, &info) == 1)
+        ;
+    ssfs_inode_iter_end(&iter);
+    ssfs_get_stats(&stats);
+    int uncounted = 0;
+    for (int op = SSFS_OP_CREATE_MANY; op <= SSFS_OP_ITER_NEXT; op++)
+        uncounted += stats.ops[op].calls == 0 || stats.ops[op].errors != 0;
+    if (uncounted == 0 && stats.ops[SSFS_OP_ITER_NEXT].calls == 2)
+        print_success("Other calls counted", "%llu statfs() call", (unsigned long long)stats.ops[SSFS_OP_STATFS].calls);
+    else
+        print_error("Other calls not counted", "%d operations", uncounted);
+
+    print_info("Unmounting...", NULL);
+    unmount();
+}
+
+// Call tracing: every public call is recorded once, with its arguments
+void test18() {
+    print_warning("Starting test18...", NULL);
+
+    char *disk_name = "disk_img.18";
+    char *trace_name = "trace.18";
+    uint8_t data[4096] = {0};
+
+    ssfs_trace_start(trace_name);
+    ssfs_format_new(disk_name, 1024, 32);
+    mount(disk_name);
+    int inode = create();
+    write(inode, data, sizeof(data), 1000);
+    read(inode, data, 100, 2000);
+    int dir = ssfs_mkdir();
+    ssfs_link(dir, "traced", inode);
+    ssfs_lookup(dir, "traced");
+    ssfs_unlink(dir, "traced");
+    delete(inode);
+    int batch[3];
+    ssfs_create_many(batch, 3);
+    ssfs_delete_many(batch, 3);
+    unmount();
+    ssfs_trace_stop();
+
+    // The calls of the directory operations and of ssfs_format_new() aren't traced twice
+    ssfs_op_t expected[] = {SSFS_OP_FORMAT_NEW, SSFS_OP_MOUNT, SSFS_OP_CREATE, SSFS_OP_WRITE, SSFS_OP_READ,
+        SSFS_OP_MKDIR, SSFS_OP_LINK, SSFS_OP_LOOKUP, SSFS_OP_UNLINK, SSFS_OP_DELETE, SSFS_OP_CREATE_MANY,
+        SSFS_OP_DELETE_MANY, SSFS_OP_UNMOUNT};
+    int expected_num = sizeof(expected) / sizeof(expected[0]);
+
+    FILE *trace = fopen(trace_name, "rb");
+    if (trace == NULL) {
+        print_error("No trace", "%s", trace_name);
+        return;
+    }
+    trace_header_t header;
+    trace_record_t record;
+    char name[SSFS_NAME_MAX + 1];
+    int32_t listed[3];
+    int records = 0, errors = 0;
+    if (fread(&header, sizeof(header), 1, trace) != 1 || header.magic != TRACE_MAGIC)
+        errors++;
+    while (fread(&record, sizeof(record), 1, trace) == 1) {
+        if (record.name_len > 0 && fread(name, record.name_len, 1, trace) != 1)
+            break;
+        name[record.name_len] = '\0';
+
+        // The batch operations are followed by their inode numbers
+        if ((record.op == SSFS_OP_CREATE_MANY || record.op == SSFS_OP_DELETE_MANY) &&
+            (record.arg1 != 3 || record.arg2 != 3 || fread(listed, sizeof(int32_t), 3, trace) != 3 ||
+             memcmp(listed, batch, sizeof(listed)) != 0))
+            errors++;
+
+        if (records >= expected_num || record.op != expected[records])
+            errors++;
+        else if (record.op == SSFS_OP_WRITE && (record.inode != inode || record.arg1 != 1000 ||
+                 record.arg2 != (int)sizeof(data) || record.result != (int)sizeof(data)))
+            errors++;
+        else if (record.op == SSFS_OP_LINK && (strcmp(name, "traced") != 0 || record.arg1 != inode))
+            errors++;
+        records++;
+    }
+    fclose(trace);
+
+    if (records == expected_num && errors == 0)
+        print_success("Calls traced", "%d records", records);
+    else
+        print_error("Wrong trace", "%d records, %d errors", records, errors);
+}
+
+// In-memory images: a volume used in memory, saved to a file and loaded back
+void test19() {
+    print_warning("Starting test19...", NULL);
+
+    char *disk_name = VDISK_MEMORY_PREFIX "test19";
+    char *copy_name = VDISK_MEMORY_PREFIX "test19_copy";
+    char *file_name = "disk_img.19";
+    uint8_t data[8192], check[8192];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)(i * 7 + 3);
+
+    // The whole life of the volume, without a file
+    if (ssfs_format_new(disk_name, 4096, 64) != 0 || mount(disk_name) != 0) {
+        print_error("Failed to use an in-memory image", "%s", disk_name);
+        return;
+    }
+    int inode = create();
+    int written = write(inode, data, sizeof(data), 5000);
+    unmount();
+    if (written != (int)sizeof(data)) {
+        print_error("Failed to write in memory", "%d", written);
+        vdisk_delete(disk_name);
+        return;
+    }
+
+    // Saved to a file, then loaded back into another in-memory image
+    int saved = vdisk_save(disk_name, file_name);
+    int deleted = vdisk_delete(disk_name);
+    int loaded = vdisk_load(copy_name, file_name);
+    if (saved != 0 || deleted != 0 || loaded != 0) {
+        print_error("Failed to save and load", "save %d, delete %d, load %d", saved, deleted, loaded);
+        return;
+    }
+
+    int errors = 0;
+    char *names[] = {copy_name, file_name};
+    for (int n = 0; n < 2; n++) {
+        memset(check, 0, sizeof(check));
+        if (mount(names[n]) != 0 || read(inode, check, sizeof(check), 5000) != (int)sizeof(check) ||
+            memcmp(data, check, sizeof(data)) != 0)
+            errors++;
+        unmount();
+    }
+
+    // An image can't be removed while turned on
+    DISK disk;
+    vdisk_on(copy_name, &disk);
+    if (vdisk_delete(copy_name) != vdisk_EACCESS)
+        errors++;
+    vdisk_off(&disk);
+    if (vdisk_delete(copy_name) != 0 || vdisk_on(copy_name, &disk) != vdisk_ENOEXIST)
+        errors++;
+
+    if (errors == 0)
+        print_success("In-memory image", "formatted, saved and loaded back");
+    else
+        print_error("Wrong in-memory image", "%d errors", errors);
+}
+
+// Simulated device: requests take the time of the model, seeks included
+void test20() {
+    print_warning("Starting test20...", NULL);
+
+    char *disk_name = VDISK_MEMORY_PREFIX "test20";
+    uint8_t sector[VDISK_SECTOR_SIZE];
+    memset(sector, 0, sizeof(sector));
+    int errors = 0;
+
+    vdisk_model_t model = {.read_ns = 100, .write_ns = 200, .seek_min_ns = 1000, .seek_max_ns = 5000,
+                           .sync_ns = 10000, .queue_depth = 1};
+    vdisk_create(disk_name, 1024);
+    DISK disk;
+    vdisk_on(disk_name, &disk);
+    vdisk_set_model(&model);
+    vdisk_reset_stats();
+
+    // The head starts at 0: the seeks cross 1/1024 then 1/4 of the disk,
+    // costing 1000 ns plus 4000 ns times the square root of that
+    vdisk_read(&disk, 1, sector);     // 100 + 1000 + 125
+    vdisk_read(&disk, 2, sector);     // 100, sequential
+    vdisk_write(&disk, 259, sector);  // 200 + 1000 + 2000
+    vdisk_write(&disk, 260, sector);  // 200
+    vdisk_sync(&disk);                // 10000
+    uint64_t expected = 1225 + 100 + 3200 + 200 + 10000;
+
+    vdisk_stats_t stats;
+    vdisk_get_stats(&stats);
+    if (stats.simulated_ns != expected)
+        errors++;
+    vdisk_off(&disk);
+
+    // The time is also found in the statistics of the file system
+    ssfs_reset_stats();
+    format(disk_name, 16);
+    ssfs_stats_t fs_stats;
+    ssfs_get_stats(&fs_stats);
+    if (fs_stats.device_simulated_ns < model.sync_ns)
+        errors++;
+
+    vdisk_model_t profile;
+    if (vdisk_model_profile("hdd", &profile) != 0 || profile.seek_min_ns == 0 ||
+        vdisk_model_profile("floppy", &profile) != vdisk_ENOEXIST)
+        errors++;
+
+    // Without a model, I/O takes no simulated time
+    vdisk_set_model(NULL);
+    vdisk_reset_stats();
+    vdisk_on(disk_name, &disk);
+    vdisk_read(&disk, 500, sector);
+    vdisk_off(&disk);
+    vdisk_get_stats(&stats);
+    if (stats.simulated_ns != 0)
+        errors++;
+    vdisk_delete(disk_name);
+
+    if (errors == 0)
+        print_success("Simulated device", "%llu ns for 5 requests", (unsigned long long)expected);
+    else
+        print_error("Wrong simulated device", "%d errors, %llu ns instead of %llu", errors,
+            (unsigned long long)stats.simulated_ns, (unsigned long long)expected);
+}
+
+// Request scheduler: sorted batches are merged, reads first under the deadline policy
+void test21() {
+    print_warning("Starting test21...", NULL);
+
+    char *disk_name = VDISK_MEMORY_PREFIX "test21";
+    uint8_t *sectors = malloc(16 * VDISK_SECTOR_SIZE);
+    uint8_t *check = malloc(16 * VDISK_SECTOR_SIZE);
+    if (sectors == NULL || check == NULL) {
+        print_error("Failed to allocate", NULL);
+        free(sectors);
+        free(check);
+        return;
+    }
+    for (int i = 0; i < 16 * VDISK_SECTOR_SIZE; i++)
+        sectors[i] = (uint8_t)(i / VDISK_SECTOR_SIZE + 1);
+
+    vdisk_create(disk_name, 1024);
+    DISK disk;
+    vdisk_on(disk_name, &disk);
+    int errors = 0;
+
+    // 8 writes given out of order, then 8 reads: one transfer each once
+    // sorted, 8 as given
+    uint32_t shuffled[8] = {107, 103, 104, 105, 106, 100, 101, 102};
+    vdisk_scheduler_t policies[] = {VDISK_SCHED_ELEVATOR, VDISK_SCHED_NONE, VDISK_SCHED_DEADLINE};
+    uint64_t expected_transfers[] = {2, 16, 2};
+    for (int p = 0; p < 3; p++) {
+        vdisk_request_t requests[8];
+        vdisk_set_scheduler(policies[p]);
+        vdisk_reset_stats();
+        for (int r = 0; r < 8; r++)
+            requests[r] = (vdisk_request_t){VDISK_WRITE, shuffled[r] + p * 8, 1, sectors + (shuffled[r] - 100) * VDISK_SECTOR_SIZE};
+        errors += vdisk_submit(&disk, requests, 8, true) != 0;
+        memset(check, 0, 16 * VDISK_SECTOR_SIZE);
+        for (int r = 0; r < 8; r++)
+            requests[r] = (vdisk_request_t){VDISK_READ, shuffled[r] + p * 8, 1, check + (shuffled[r] - 100) * VDISK_SECTOR_SIZE};
+        errors += vdisk_submit(&disk, requests, 8, false) != 0;
+        errors += memcmp(sectors, check, 8 * VDISK_SECTOR_SIZE) != 0;
+
+        vdisk_stats_t stats;
+        vdisk_get_stats(&stats);
+        if (stats.batched_requests != 16 || stats.batched_transfers != expected_transfers[p])
+            errors++;
+    }
+
+    // Under the deadline policy, reads of a batch are served before its writes
+    vdisk_request_t mixed[4] = {
+        {VDISK_WRITE, 200, 1, sectors},
+        {VDISK_READ, 300, 1, check},
+        {VDISK_WRITE, 201, 1, sectors + VDISK_SECTOR_SIZE},
+        {VDISK_READ, 301, 1, check + VDISK_SECTOR_SIZE},
+    };
+    vdisk_reset_stats();
+    errors += vdisk_submit(&disk, mixed, 4, false) != 0;
+    vdisk_stats_t stats;
+    vdisk_get_stats(&stats);
+    if (stats.batched_transfers != 2)
+        errors++;
+    vdisk_off(&disk);
+
+    // The file system still reads what it wrote, with fewer transfers
+    vdisk_set_scheduler(VDISK_SCHED_ELEVATOR);
+    format(disk_name, 16);
+    mount(disk_name);
+    int inode = create();
+    write(inode, sectors, 16 * VDISK_SECTOR_SIZE, 100);
+    ssfs_reset_stats();
+    memset(check, 0, 16 * VDISK_SECTOR_SIZE);
+    int read_bytes = read(inode, check, 16 * VDISK_SECTOR_SIZE, 100);
+    ssfs_stats_t fs_stats;
+    ssfs_get_stats(&fs_stats);
+    unmount();
+    if (read_bytes != 16 * VDISK_SECTOR_SIZE || memcmp(sectors, check, 16 * VDISK_SECTOR_SIZE) != 0)
+        errors++;
+    if (fs_stats.device_batched < 17 || fs_stats.device_batch_transfers >= fs_stats.device_batched)
+        errors++;
+    vdisk_set_scheduler(VDISK_SCHED_NONE);
+    vdisk_delete(disk_name);
+    free(sectors);
+    free(check);
+
+    if (errors == 0)
+        print_success("Requests merged", "read of 17 blocks in %llu transfers",
+            (unsigned long long)fs_stats.device_batch_transfers);
+    else
+        print_error("Wrong scheduling", "%d errors", errors);
+}
+
+// Offline check: a damaged image is found damaged, repaired, then found
+// clean, the data of the files left as they were
+void test22() {
+    print_warning("Starting test22...", NULL);
+
+    char *disk_name = VDISK_MEMORY_PREFIX "test22";
+    uint8_t data[6 * BLOCK_SIZE];
+    uint8_t verify[6 * BLOCK_SIZE];
+    for (int i = 0; i < 6 * BLOCK_SIZE; i++)
+        data[i] = (uint8_t)(i % 251 + 1);
+    int errors = 0;
+
+    vdisk_create(disk_name, 1024);
+    format(disk_name, 64);
+    mount(disk_name);
+    int kept = create();
+    int shared = create();
+    int wild = create();
+    write(kept, data, 6 * BLOCK_SIZE, 0);
+    write(shared, data, 2 * BLOCK_SIZE, 0);
+    write(wild, data, BLOCK_SIZE, 0);
+
+    // The second file takes a block of the first, the third points out of
+    // the volume, and the first claims more blocks than it has
+    uint8_t buffer[BLOCK_SIZE];
+    meta_read(itable_block(0), buffer);
+    inode_t *kept_inode = &inode_at(buffer, kept)->v1;
+    inode_at(buffer, shared)->v1.direct[1] = kept_inode->direct[0];
+    inode_at(buffer, wild)->v1.direct[0] = 1 << 30;
+    kept_inode->size = 9 * BLOCK_SIZE;
+    meta_write(itable_block(0), buffer);
+    unmount();
+
+    // And a free block holds data
+    DISK disk;
+    memset(buffer, 0xa5, sizeof(buffer));
+    vdisk_on(disk_name, &disk);
+    vdisk_write(&disk, 1000, buffer);
+    vdisk_off(&disk);
+
+    ssfs_check_options_t options = {.threads = 4};
+    ssfs_check_report_t report;
+    if (ssfs_check(disk_name, &options, &report) != 0 || report.found[SSFS_CHECK_RANGE] != 1 ||
+        report.found[SSFS_CHECK_DUPLICATE] != 1 || report.found[SSFS_CHECK_SIZE] == 0 ||
+        report.found[SSFS_CHECK_LEAK] == 0 || report.remaining[SSFS_CHECK_DUPLICATE] != 1)
+        errors++;
+
+    options.repair = 1;
+    if (ssfs_check(disk_name, &options, &report) != 0)
+        errors++;
+    for (int p = 0; p < SSFS_CHECK_NUM; p++)
+        errors += report.remaining[p] != 0;
+
+    options.repair = 0;
+    if (ssfs_check(disk_name, &options, &report) != 0)
+        errors++;
+    for (int p = 0; p < SSFS_CHECK_NUM; p++)
+        errors += report.found[p] != 0;
+
+    // The first file keeps its 6 blocks, the others what was theirs
+    mount(disk_name);
+    if (stat(kept) != 6 * BLOCK_SIZE || read(kept, verify, 6 * BLOCK_SIZE, 0) != 6 * BLOCK_SIZE ||
+        memcmp(data, verify, 6 * BLOCK_SIZE) != 0 || stat(shared) != BLOCK_SIZE || stat(wild) != 0)
+        errors++;
+    unmount();
+    vdisk_delete(disk_name);
+
+    if (errors == 0)
+        print_success("Image repaired", "%u blocks used", report.used_blocks);
+    else
+        print_error("Wrong check", "%d errors", errors);
+}
+
+// Fragmentation report: files written in turn are in more runs than
+// needed, and a deleted file leaves a free run before the free end
+void test23() {
+    print_warning("Starting test23...", NULL);
+
+    char *disk_name = VDISK_MEMORY_PREFIX "test23";
+    uint8_t data[BLOCK_SIZE];
+    memset(data, 0x5a, sizeof(data));
+    int errors = 0;
+
+    vdisk_create(disk_name, 1024);
+    format(disk_name, 64);
+    mount(disk_name);
+
+    // One file written in one go, two written a block each in turn
+    int contiguous = create();
+    for (int b = 0; b < 6; b++)
+        write(contiguous, data, BLOCK_SIZE, b * BLOCK_SIZE);
+    int first = create();
+    int second = create();
+    for (int b = 0; b < 4; b++) {
+        write(first, data, BLOCK_SIZE, b * BLOCK_SIZE);
+        write(second, data, BLOCK_SIZE, b * BLOCK_SIZE);
+    }
+    delete(contiguous);
+
+    // Its blocks are only freed once the reclaimer zeroed them
+    ssfs_sync();
+    pthread_mutex_lock(&fs_mutex);
+    reclaim_all();
+    pthread_mutex_unlock(&fs_mutex);
+
+    int kept = create();
+    write(kept, data, BLOCK_SIZE, 0);
+
+    ssfs_frag_file_t file;
+    if (ssfs_frag_file(kept, &file) != 0 || file.blocks != 1 || file.runs != 1 || file.ideal_runs != 1)
+        errors++;
+    if (ssfs_frag_file(first, &file) != 0 || file.blocks != 4 || file.runs != 4)
+        errors++;
+    if (ssfs_frag_file(second, &file) != 0 || file.runs <= file.ideal_runs)
+        errors++;
+
+    // The blocks freed by the first file leave a hole before the free end
+    ssfs_frag_report_t report;
+    ssfs_statfs_t stats;
+    uint32_t extents = 0;
+    if (ssfs_frag_report(&report) != 0 || ssfs_statfs(&stats) != 0)
+        errors++;
+    for (int bucket = 0; bucket < SSFS_FRAG_BUCKETS; bucket++)
+        extents += report.free_histogram[bucket];
+    if (report.files != 3 || report.fragmented_files != 2 || extents != report.free_extents ||
+        report.free_extents < 2 || report.largest_free_extent != stats.largest_free_extent)
+        errors++;
+    unmount();
+    vdisk_delete(disk_name);
+
+    if (errors == 0)
+        print_success("Fragmentation measured", "%u free runs", report.free_extents);
+    else
+        print_error("Wrong fragmentation", "%d errors", errors);
+}
+
+// Online defragmentation: files written in turn end up in single runs,
+// with the same data, and the old blocks free and zeroed
+void test24() {
+    print_warning("Starting test24...", NULL);
+
+    char *disk_name = VDISK_MEMORY_PREFIX "test24";
+    int len = 20 * BLOCK_SIZE + 100;
+    uint8_t *data[2] = {malloc(len), malloc(len)};
+    uint8_t *verify = malloc(len);
+    for (int i = 0; i < len; i++) {
+        data[0][i] = (uint8_t)(i % 251 + 1);
+        data[1][i] = (uint8_t)(i % 241 + 7);
+    }
+    int errors = 0;
+    int moved = 0;
+
+    // Block pointers, then extents with packed tails
+    ssfs_format_options_t versions[2] = {
+        {.inode_version = INODE_V1},
+        {.inode_version = INODE_V2, .features = SSFS_FEATURE_TAIL_PACKING},
+    };
+    for (int v = 0; v < 2; v++) {
+        vdisk_create(disk_name, 1024);
+        ssfs_format_opts(disk_name, 64, &versions[v]);
+        mount(disk_name);
+
+        // Two files written a block each in turn
+        int files[2] = {create(), create()};
+        for (int offset = 0; offset < len; offset += BLOCK_SIZE)
+            for (int f = 0; f < 2; f++)
+                write(files[f], data[f] + offset, len - offset < BLOCK_SIZE ? len - offset : BLOCK_SIZE, offset);
+
+        ssfs_frag_file_t file;
+        int ret = ssfs_defrag(files[0]);
+        moved += ret > 0 ? ret : 0;
+        if (ret < 20 || ssfs_frag_file(files[0], &file) != 0 || file.runs != 1 || ssfs_defrag(files[0]) != 0)
+            errors++;
+
+        ssfs_defrag_options_t options = {.bytes_per_second = 64 * 1024 * 1024};
+        ssfs_defrag_report_t report;
+        ssfs_frag_report_t layout;
+        if (ssfs_defrag_volume(&options, &report) != 0 || report.defragmented != 1 || report.skipped != 0 ||
+            ssfs_frag_report(&layout) != 0 || layout.fragmented_files != 0)
+            errors++;
+        moved += (int)report.blocks_moved;
+
+        for (int f = 0; f < 2; f++)
+            if (read(files[f], verify, len, 0) != len || memcmp(data[f], verify, len) != 0)
+                errors++;
+        unmount();
+
+        // The old blocks are free and zeroed, the new ones durable
+        ssfs_check_options_t check_options = {.threads = 2};
+        ssfs_check_report_t check;
+        if (ssfs_check(disk_name, &check_options, &check) != 0)
+            errors++;
+        for (int p = 0; p < SSFS_CHECK_NUM; p++)
+            errors += check.found[p] != 0;
+
+        mount(disk_name);
+        for (int f = 0; f < 2; f++)
+            if (read(files[f], verify, len, 0) != len || memcmp(data[f], verify, len) != 0)
+                errors++;
+        unmount();
+        vdisk_delete(disk_name);
+    }
+    free(data[0]);
+    free(data[1]);
+    free(verify);
+
+    if (errors == 0)
+        print_success("Files defragmented", "%d blocks moved", moved);
+    else
+        print_error("Wrong defragmentation", "%d errors", errors);
+}
+
+// Parallel read() and write(): large calls on fragmented files move the same
+// bytes as the sequential path, partial first and last blocks included
+void test25() {
+    print_warning("Starting test25...", NULL);
+
+    char *disk_name = VDISK_MEMORY_PREFIX "test25";
+    int offset = 333;
+    int len = 3 * 1024 * 1024 + 517;
+    int piece = 64 * 1024;
+    int size = offset + len;
+    uint8_t *data = malloc(size);
+    uint8_t *expected = malloc(size);
+    uint8_t *verify = malloc(size);
+    for (int i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i % 251 + 1);
+        expected[i] = (uint8_t)(i % 241 + 7);
+    }
+    memcpy(expected, data, offset);
+    int errors = 0;
+
+    vdisk_create(disk_name, 16384);
+    format(disk_name, 64);
+    mount(disk_name);
+
+    // Two files written a piece each in turn, on the caller's thread
+    ssfs_set_parallelism(1, 0);
+    int files[2] = {create(), create()};
+    for (int start = 0; start < size; start += piece)
+        for (int f = 0; f < 2; f++)
+            write(files[f], data + start, size - start < piece ? size - start : piece, start);
+
+    // One overwritten in parallel, the other sequentially
+    ssfs_set_parallelism(4, piece);
+    if (write(files[0], expected + offset, len, offset) != len)
+        errors++;
+    ssfs_set_parallelism(1, 0);
+    if (write(files[1], expected + offset, len, offset) != len)
+        errors++;
+
+    // Both read back in parallel and sequentially
+    for (int threads = 1; threads <= 4; threads += 3) {
+        ssfs_set_parallelism(threads, 0);
+        for (int f = 0; f < 2; f++) {
+            memset(verify, 0, size);
+            if (stat(files[f]) != size || read(files[f], verify, size, 0) != size ||
+                memcmp(expected, verify, size) != 0)
+                errors++;
+            memset(verify, 0, size);
+            if (read(files[f], verify, len, offset) != len || memcmp(expected + offset, verify, len) != 0)
+                errors++;
+        }
+    }
+
+    // A parallel write past the end of a new file leaves zeros before it
+    int gap = 5 * BLOCK_SIZE + 7;
+    int extended = create();
+    memset(verify, 0xFF, size);
+    if (write(extended, expected + offset, len, gap) != len || stat(extended) != gap + len ||
+        read(extended, verify, gap, 0) != gap)
+        errors++;
+    for (int i = 0; i < gap; i++)
+        errors += verify[i] != 0;
+    if (read(extended, verify, len, gap) != len || memcmp(expected + offset, verify, len) != 0)
+        errors++;
+    ssfs_set_parallelism(1, 1024 * 1024);
+
+    unmount();
+    vdisk_delete(disk_name);
+    free(data);
+    free(expected);
+    free(verify);
+
+    if (errors == 0)
+        print_success("Parallel transfers as the sequential ones", "%d bytes", len);
+    else
+        print_error("Parallel transfers differ", "%d errors", errors);
+}
+
+// Per-file sync: a file's dirty ranges are synced once, the scattered ones
+// merged into a single span, and its metadata committed only when needed
+void test26() {
+    print_warning("Starting test26...", NULL);
+
+    char *disk_name = VDISK_MEMORY_PREFIX "test26";
+    int blocks = 256;
+    int errors = 0;
+    vdisk_stats_t stats;
+
+    vdisk_create(disk_name, 4096);
+    format(disk_name, 64);
+    mount(disk_name);
+    ssfs_set_commit_batch(1000);
+
+    int len = blocks * BLOCK_SIZE;
+    uint8_t *data = malloc(len);
+    uint8_t *verify = malloc(len);
+    for (int i = 0; i < len; i++)
+        data[i] = (uint8_t)(i % 251 + 1);
+
+    // Data and block map of a new file: its range synced, then the journal committed
+    int file = create();
+    write(file, data, len, 0);
+    vdisk_reset_stats();
+    if (ssfs_fdatasync(file) != 0)
+        errors++;
+    vdisk_get_stats(&stats);
+    errors += stats.syncs < 2;
+    vdisk_reset_stats();
+    ssfs_fdatasync(file);
+    vdisk_get_stats(&stats);
+    errors += stats.syncs != 0;
+
+    // More scattered ranges than tracked: merged into one span, synced at once
+    for (int b = 0; b < blocks; b += 2) {
+        for (int i = b * BLOCK_SIZE; i < (b + 1) * BLOCK_SIZE; i++)
+            data[i] = (uint8_t)(data[i] + 1);
+        write(file, data + b * BLOCK_SIZE, BLOCK_SIZE, b * BLOCK_SIZE);
+    }
+    vdisk_reset_stats();
+    if (ssfs_fdatasync(file) != 0)
+        errors++;
+    vdisk_get_stats(&stats);
+    errors += stats.syncs != 1;
+
+    // The dirty ranges of a file are left alone by the sync of another
+    int other = create();
+    write(file, data, BLOCK_SIZE, 0);
+    vdisk_reset_stats();
+    ssfs_fdatasync(other);
+    vdisk_get_stats(&stats);
+    errors += stats.syncs != 0;
+    vdisk_reset_stats();
+    ssfs_fdatasync(file);
+    vdisk_get_stats(&stats);
+    errors += stats.syncs != 1;
+
+    // Only fsync() commits a creation
+    vdisk_reset_stats();
+    if (ssfs_fsync(other) != 0)
+        errors++;
+    vdisk_get_stats(&stats);
+    errors += stats.syncs == 0;
+    vdisk_reset_stats();
+    ssfs_fsync(other);
+    ssfs_fsync(file);
+    vdisk_get_stats(&stats);
+    errors += stats.syncs != 0;
+
+    ssfs_set_commit_batch(16);
+    unmount();
+    mount(disk_name);
+    if (stat(other) != 0 || stat(file) != len || read(file, verify, len, 0) != len || memcmp(data, verify, len) != 0)
+        errors++;
+    unmount();
+    vdisk_delete(disk_name);
+    free(data);
+    free(verify);
+
+    if (errors == 0)
+        print_success("Files synced by their own ranges", "%d blocks", blocks);
+    else
+        print_error("Wrong per-file sync", "%d errors", errors);
+}
+
+// Discards: a discarded range reads back as zeros, without data I/O when the
+// host can deallocate it, and format() leaves the data region zeroed
+void test27() {
+    print_warning("Starting test27...", NULL);
+
+    char *disk_name = "disk_img.27";
+    uint32_t sectors = 1024;
+    uint32_t first = 100, count = 200;
+    uint8_t buffer[VDISK_SECTOR_SIZE];
+    int errors = 0;
+    DISK disk;
+    vdisk_stats_t stats;
+
+    if (vdisk_create(disk_name, sectors) != 0 || vdisk_on(disk_name, &disk) != 0) {
+        print_error("Failed to create the image", "%s", disk_name);
+        return;
+    }
+    memset(buffer, 0xAB, VDISK_SECTOR_SIZE);
+    for (uint32_t s = 0; s < sectors; s++)
+        vdisk_write(&disk, s, buffer);
+    vdisk_sync(&disk);
+
+    // Deallocated, or else zeros written: either way counted once
+    vdisk_reset_stats();
+    if (vdisk_discard(&disk, first, count) != 0 || vdisk_discard(&disk, sectors, 1) == 0)
+        errors++;
+    vdisk_get_stats(&stats);
+    errors += stats.discards != 1 || stats.sectors_discarded != count;
+    if (disk.discarded_bytes == (uint64_t)count * VDISK_SECTOR_SIZE)
+        errors += stats.sectors_written != 0;
+    else
+        errors += disk.discarded_bytes != 0 || stats.sectors_written != count;
+    uint64_t discarded = disk.discarded_bytes;
+
+    // Only the range reads back as zeros, and the image keeps its size
+    for (uint32_t s = first - 1; s <= first + count; s++) {
+        vdisk_read(&disk, s, buffer);
+        uint8_t expected = s < first || s == first + count ? 0xAB : 0;
+        for (int i = 0; i < VDISK_SECTOR_SIZE; i++)
+            errors += buffer[i] != expected;
+    }
+    vdisk_off(&disk);
+    if (vdisk_on(disk_name, &disk) != 0 || disk.size_in_sectors != sectors)
+        errors++;
+    vdisk_off(&disk);
+
+    // The data region of a formatted image reads back as zeros
+    format(disk_name, 64);
+    vdisk_on(disk_name, &disk);
+    for (uint32_t s = sectors / 2; s < sectors; s++) {
+        vdisk_read(&disk, s, buffer);
+        for (int i = 0; i < VDISK_SECTOR_SIZE; i++)
+            errors += buffer[i] != 0;
+    }
+    vdisk_off(&disk);
+
+    if (errors == 0)
+        print_success("Discarded ranges zeroed", "%llu bytes without data I/O", (unsigned long long)discarded);
+    else
+        print_error("Wrong discards", "%d errors", errors);
+}
+
+// Sparse format: ssfs_format_new() replaces an image with one of the given
+// size, empty and usable, and a large one takes no longer than a small one
+void test28() {
+    print_warning("Starting test28...", NULL);
+
+    char *disk_name = "disk_img.28";
+    uint32_t sizes[2] = {2048, 1024 * 1024};
+    uint8_t buffer[VDISK_SECTOR_SIZE];
+    int errors = 0;
+    double elapsed_ms[2] = {0, 0};
+    DISK disk;
+
+    // A larger image, with data in it, to be replaced
+    memset(buffer, 0xCD, VDISK_SECTOR_SIZE);
+    vdisk_create(disk_name, 4096);
+    vdisk_on(disk_name, &disk);
+    for (uint32_t s = 0; s < 4096; s += 16)
+        vdisk_write(&disk, s, buffer);
+    vdisk_off(&disk);
+
+    for (int i = 0; i < 2; i++) {
+        clock_t start = clock();
+        if (ssfs_format_new(disk_name, sizes[i], 64) != 0 || mount(disk_name) != 0) {
+            print_error("Failed to format or mount", "%s", disk_name);
+            return;
+        }
+        elapsed_ms[i] = 1000.0 * (clock() - start) / CLOCKS_PER_SEC;
+
+        // Mounted: not replaced
+        if (ssfs_format_new(disk_name, sizes[i], 64) == 0)
+            errors++;
+
+        // Every data block free, in a single run
+        ssfs_statfs_t stats;
+        if (ssfs_statfs(&stats) != 0 || stats.total_blocks != sizes[i] || disk_handle->size_in_sectors != sizes[i] ||
+            stats.free_blocks == 0 || stats.largest_free_extent != stats.free_blocks || stats.total_inodes < 64 ||
+            stats.free_inodes != stats.total_inodes)
+            errors++;
+
+        // The free blocks read back as zeros, and hold a file
+        vdisk_read(disk_handle, (sizes[i] - 1) & ~15u, buffer);
+        for (int b = 0; b < VDISK_SECTOR_SIZE; b++)
+            errors += buffer[b] != 0;
+        int len = 100 * BLOCK_SIZE;
+        uint8_t *data = malloc(len);
+        uint8_t *verify = malloc(len);
+        for (int b = 0; b < len; b++)
+            data[b] = (uint8_t)(b % 251 + 1);
+        int file = create();
+        if (write(file, data, len, 0) != len)
+            errors++;
+        unmount();
+        mount(disk_name);
+        if (stat(file) != len || read(file, verify, len, 0) != len || memcmp(data, verify, len) != 0)
+            errors++;
+        unmount();
+        free(data);
+        free(verify);
+    }
+    vdisk_delete(disk_name);
+
+    if (errors == 0)
+        print_success("Images created and formatted", "%u blocks in %.3f ms, %u in %.3f ms",
+            sizes[0], elapsed_ms[0], sizes[1], elapsed_ms[1]);
+    else
+        print_error("Wrong sparse format", "%d errors", errors);
+}
+
+// Block sizes: volumes formatted with 4 KiB and 64 KiB blocks use them,
+// past the 1 KiB fan-out of the indirect blocks, and keep them once mounted again
+void test29() {
+    print_warning("Starting test29...", NULL);
+
+    char *disk_name = VDISK_MEMORY_PREFIX "test29";
+    uint32_t block_sizes[2] = {4096, 65536};
+    int errors = 0;
+
+    // Not a power of two
+    ssfs_format_options_t wrong = {.block_size = 3000};
+    vdisk_create(disk_name, 1024);
+    if (ssfs_format_opts(disk_name, 32, &wrong) == 0)
+        errors++;
+
+    for (int s = 0; s < 2; s++) {
+        int blocks = 300;
+        int unaligned = (int)block_sizes[s] - 10;
+        int len = blocks * (int)block_sizes[s];
+        uint32_t sectors = 2 * (uint32_t)len / VDISK_SECTOR_SIZE;
+        uint8_t *data = malloc(len);
+        uint8_t *verify = malloc(len);
+        for (int i = 0; i < len; i++)
+            data[i] = (uint8_t)(i % 251 + 1);
+
+        ssfs_format_options_t options = {.block_size = block_sizes[s]};
+        if (vdisk_create(disk_name, sectors) != 0 || ssfs_format_opts(disk_name, 32, &options) != 0 ||
+            mount(disk_name) != 0) {
+            print_error("Failed to format or mount", "%u bytes blocks", block_sizes[s]);
+            free(data);
+            free(verify);
+            return;
+        }
+
+        ssfs_statfs_t stats;
+        if (ssfs_statfs(&stats) != 0 || stats.block_size != block_sizes[s] ||
+            stats.total_blocks != sectors * VDISK_SECTOR_SIZE / block_sizes[s])
+            errors++;
+
+        // A file in more blocks than a 1 KiB indirect block maps, and one
+        // written across a block boundary
+        int files[2] = {create(), create()};
+        if (write(files[0], data, len, 0) != len || write(files[1], data, 20, unaligned) != 20)
+            errors++;
+
+        for (int mounted = 0; mounted < 2; mounted++) {
+            if (mounted) {
+                unmount();
+                mount(disk_name);
+                if (ssfs_statfs(&stats) != 0 || stats.block_size != block_sizes[s])
+                    errors++;
+            }
+            memset(verify, 0, len);
+            if (stat(files[0]) != len || read(files[0], verify, len, 0) != len || memcmp(data, verify, len) != 0)
+                errors++;
+            memset(verify, 0xFF, len);
+            if (stat(files[1]) != unaligned + 20 || read(files[1], verify, unaligned + 20, 0) != unaligned + 20 ||
+                memcmp(data, verify + unaligned, 20) != 0)
+                errors++;
+            for (int i = 0; i < unaligned; i++)
+                errors += verify[i] != 0;
+        }
+        unmount();
+        free(data);
+        free(verify);
+    }
+    vdisk_delete(disk_name);
+
+    if (errors == 0)
+        print_success("Volumes used with their block size", "%u and %u bytes", block_sizes[0], block_sizes[1]);
+    else
+        print_error("Wrong block size", "%d errors", errors);
+}
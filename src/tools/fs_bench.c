@@ -0,0 +1,720 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * fs_bench.c
+ * ==========
+ *
+ * Benchmark suite of the file system, built as `fs_bench`.
+ * Every workload runs against a freshly formatted image with a fixed seed,
+ * so that two runs of the same version do the same operations. Each
+ * operation is timed to report p50/p99 latencies along with the throughput,
+ * and the disk I/O of each measure gives its read and write amplification.
+ * The results can be written as JSON to compare versions. With --memory the
+ * image lives in memory, which leaves out the cost of the host file system
+ * to measure that of SSFS alone. With --device the disk I/O is also charged
+ * the time it would take on a simulated device, reported next to the wall
+ * time, and slept with --inject. --scheduler chooses how the vdisk layer
+ * orders and merges the batches of requests, whose merge ratio and queue
+ * latency are then reported.
+ *
+ * Usage: fs_bench [--quick] [--only WORKLOAD] [--json FILE] [--image FILE]
+ *                 [--memory] [--device hdd|ssd|nvme|network] [--inject]
+ *                 [--scheduler none|elevator|deadline]
+ *                 [--seed N] [--block-size N] [--extents]
+ *
+ */
+
+#include "ssfs_internal.h"
+#include "fs.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+
+#define MIB (1024 * 1024)
+
+// Options of the run
+typedef struct {
+    bool quick;               // Smaller workloads, for a quick check
+    const char *only;         // Single workload to run, NULL for all
+    const char *json_path;    // Where to write the results, "-" for stdout
+    char *image;              // Image used by the workloads, file or in memory
+    const char *device;       // Profile of the simulated device, NULL for none
+    bool inject;              // Sleep the time of the simulated device
+    const char *scheduler;    // Policy of vdisk_set_scheduler(), NULL for none
+    unsigned int seed;
+    ssfs_format_options_t format;
+} bench_config_t;
+
+// Latencies of the operations of a measure, in seconds
+typedef struct {
+    double *samples;
+    size_t num;
+    size_t capacity;
+} latencies_t;
+
+// One line of the results
+typedef struct {
+    char workload[32];
+    char params[64];
+    uint64_t ops;
+    uint64_t bytes;      // Bytes transferred, 0 if not relevant
+    double seconds;      // Total time, including the final sync
+    double device_seconds;  // Time of the disk I/O on the simulated device
+    double merge_ratio;     // Requests of batches per transfer, 0 without batches
+    double batch_wait_us;   // Average time a request of a batch waited
+    double p50_us;
+    double p99_us;
+    double max_us;
+    uint64_t user_bytes_read;       // From ssfs_get_stats(), over the measure
+    uint64_t user_bytes_written;
+    uint64_t device_bytes_read;
+    uint64_t device_bytes_written;
+    int errors;
+} bench_result_t;
+
+static bench_result_t *results = NULL;
+static size_t results_num = 0;
+static size_t results_capacity = 0;
+
+/**
+ * @brief Returns a monotonic timestamp in seconds.
+ */
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Starts a measure: the statistics of the file system are restarted,
+ * so that the result gets the disk I/O of the measure only.
+ * @return The start time of the measure.
+ */
+static double measure_start() {
+    ssfs_reset_stats();
+    return now_seconds();
+}
+
+/**
+ * @brief Records the latency of an operation. Samples are dropped when
+ * memory runs out, only the percentiles are affected.
+ */
+static void latency_add(latencies_t *lat, double seconds) {
+    if (lat->num == lat->capacity) {
+        size_t capacity = lat->capacity ? 2 * lat->capacity : 1024;
+        double *grown = realloc(lat->samples, capacity * sizeof(double));
+        if (grown == NULL)
+            return;
+        lat->samples = grown;
+        lat->capacity = capacity;
+    }
+    lat->samples[lat->num++] = seconds;
+}
+
+/**
+ * @brief Compares two latencies, for `qsort()`.
+ */
+static int compare_latencies(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Returns the `percent`-th percentile (nearest rank) of sorted samples,
+ * in microseconds.
+ */
+static double latency_percentile(const latencies_t *lat, double percent) {
+    if (lat->num == 0)
+        return 0;
+    size_t rank = (size_t)(percent / 100 * lat->num + 0.5);
+    if (rank == 0)
+        rank = 1;
+    if (rank > lat->num)
+        rank = lat->num;
+    return lat->samples[rank - 1] * 1e6;
+}
+
+/**
+ * @brief Returns device bytes per user byte, 0 without user bytes.
+ */
+static double amplification(uint64_t device_bytes, uint64_t user_bytes) {
+    return user_bytes > 0 ? (double)device_bytes / user_bytes : 0;
+}
+
+/**
+ * @brief Adds a result from the latencies of its operations, prints it and
+ * empties `lat` for the next measure.
+ */
+static void result_add(const char *workload, const char *params, latencies_t *lat,
+                       uint64_t bytes, double seconds, int errors) {
+    bench_result_t result = {0};
+    snprintf(result.workload, sizeof(result.workload), "%s", workload);
+    snprintf(result.params, sizeof(result.params), "%s", params);
+    result.ops = lat->num;
+    result.bytes = bytes;
+    result.seconds = seconds;
+    result.errors = errors;
+
+    qsort(lat->samples, lat->num, sizeof(double), compare_latencies);
+    result.p50_us = latency_percentile(lat, 50);
+    result.p99_us = latency_percentile(lat, 99);
+    result.max_us = latency_percentile(lat, 100);
+    lat->num = 0;
+
+    ssfs_stats_t stats;
+    ssfs_get_stats(&stats);
+    result.user_bytes_read = stats.user_bytes_read;
+    result.user_bytes_written = stats.user_bytes_written;
+    result.device_bytes_read = stats.device_bytes_read;
+    result.device_bytes_written = stats.device_bytes_written;
+    result.device_seconds = stats.device_simulated_ns / 1e9;
+    if (stats.device_batch_transfers > 0) {
+        result.merge_ratio = (double)stats.device_batched / stats.device_batch_transfers;
+        result.batch_wait_us = stats.device_batch_wait_ns / 1e3 / stats.device_batched;
+    }
+
+    if (bytes > 0)
+        print_info(workload, "%-24s %8.1f MiB/s  p50 %9.1f us  p99 %9.1f us  amplification r %.2f w %.2f",
+            params, bytes / seconds / MIB, result.p50_us, result.p99_us,
+            amplification(result.device_bytes_read, result.user_bytes_read),
+            amplification(result.device_bytes_written, result.user_bytes_written));
+    else
+        print_info(workload, "%-24s %8.0f op/s   p50 %9.1f us  p99 %9.1f us",
+            params, result.ops / seconds, result.p50_us, result.p99_us);
+    if (result.device_seconds > 0)
+        print_info(workload, "%-24s device %9.3f s  wall %9.3f s", params, result.device_seconds, seconds);
+    if (result.merge_ratio > 0)
+        print_info(workload, "%-24s %.2f requests per transfer, waited %.1f us in their batch",
+            params, result.merge_ratio, result.batch_wait_us);
+    if (errors != 0)
+        print_error(workload, "%s: %d failed operations", params, errors);
+
+    if (results_num == results_capacity) {
+        size_t capacity = results_capacity ? 2 * results_capacity : 32;
+        bench_result_t *grown = realloc(results, capacity * sizeof(bench_result_t));
+        if (grown == NULL)
+            return;
+        results = grown;
+        results_capacity = capacity;
+    }
+    results[results_num++] = result;
+}
+
+/**
+ * @brief Creates and formats a new image of `size_mib` MiB with the options
+ * of the run, then mounts it when `mount_it` is set.
+ * @return 0 on success, negative error code on failure.
+ */
+static int fresh_image(const bench_config_t *config, uint32_t size_mib, int inodes, bool mount_it) {
+    int ret = vdisk_create(config->image, size_mib * (MIB / VDISK_SECTOR_SIZE));
+    if (ret == 0)
+        ret = ssfs_format_opts(config->image, inodes, &config->format);
+    if (ret == 0 && mount_it)
+        ret = mount(config->image);
+    if (ret != 0)
+        print_error("Failed to create image", "%s, %u MiB (code %d)", config->image, size_mib, ret);
+    return ret;
+}
+
+/**
+ * @brief Fills `data` with a pattern, so that written blocks aren't zeros.
+ */
+static void fill_pattern(uint8_t *data, int len) {
+    for (int i = 0; i < len; i++)
+        data[i] = (uint8_t)(i % 251);
+}
+
+// format() time against the size of the image
+static void workload_format(const bench_config_t *config, latencies_t *lat) {
+    uint32_t sizes_mib[] = {16, 64, 256, 1024};
+    int num_sizes = config->quick ? 2 : 4;
+    int runs = config->quick ? 3 : 5;
+
+    for (int s = 0; s < num_sizes; s++) {
+        int errors = 0;
+        double total = 0;
+        measure_start();
+        for (int r = 0; r < runs; r++) {
+            if (vdisk_create(config->image, sizes_mib[s] * (MIB / VDISK_SECTOR_SIZE)) != 0) {
+                errors++;
+                continue;
+            }
+            double start = now_seconds();
+            if (ssfs_format_opts(config->image, 1024, &config->format) != 0)
+                errors++;
+            double elapsed = now_seconds() - start;
+            latency_add(lat, elapsed);
+            total += elapsed;
+        }
+
+        char params[64];
+        snprintf(params, sizeof(params), "size=%uMiB", sizes_mib[s]);
+        result_add("format", params, lat, 0, total, errors);
+    }
+}
+
+// mount() time against the fill level of the volume
+static void workload_mount(const bench_config_t *config, latencies_t *lat) {
+    uint32_t size_mib = config->quick ? 32 : 128;
+    int fill_percents[] = {0, 50, 90};
+    int file_size = 64 * 1024;
+    int runs = config->quick ? 3 : 5;
+
+    uint8_t *data = malloc(file_size);
+    if (data == NULL) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+    fill_pattern(data, file_size);
+
+    for (int f = 0; f < 3; f++) {
+        if (fresh_image(config, size_mib, 1024, true) != 0)
+            break;
+
+        int errors = 0;
+        int files_num = (int)((uint64_t)size_mib * MIB / 100 * fill_percents[f] / file_size);
+        for (int i = 0; i < files_num; i++) {
+            int inode = create();
+            if (inode < 0 || write(inode, data, file_size, 0) != file_size)
+                errors++;
+        }
+        unmount();
+
+        double total = 0;
+        measure_start();
+        for (int r = 0; r < runs; r++) {
+            double start = now_seconds();
+            if (mount(config->image) != 0)
+                errors++;
+            double elapsed = now_seconds() - start;
+            latency_add(lat, elapsed);
+            total += elapsed;
+            unmount();
+        }
+
+        char params[64];
+        snprintf(params, sizeof(params), "fill=%d%%,files=%d", fill_percents[f], files_num);
+        result_add("mount", params, lat, 0, total, errors);
+    }
+    free(data);
+}
+
+// create(), stat() and delete() of empty files
+static void workload_metadata(const bench_config_t *config, latencies_t *lat) {
+    int files_num = config->quick ? 2000 : 20000;
+    char params[64];
+    snprintf(params, sizeof(params), "files=%d", files_num);
+
+    int *inodes = malloc(files_num * sizeof(int));
+    if (inodes == NULL) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+    if (fresh_image(config, 64, files_num, true) != 0) {
+        free(inodes);
+        return;
+    }
+
+    int errors = 0;
+    double start = measure_start();
+    for (int i = 0; i < files_num; i++) {
+        double op_start = now_seconds();
+        inodes[i] = create();
+        latency_add(lat, now_seconds() - op_start);
+        if (inodes[i] < 0)
+            errors++;
+    }
+    ssfs_sync();
+    result_add("create", params, lat, 0, now_seconds() - start, errors);
+
+    // Random order, so the inode blocks read change from one call to the next
+    srand(config->seed);
+    errors = 0;
+    start = measure_start();
+    for (int i = 0; i < files_num; i++) {
+        int inode = inodes[rand() % files_num];
+        double op_start = now_seconds();
+        int ret = stat(inode);
+        latency_add(lat, now_seconds() - op_start);
+        if (ret < 0)
+            errors++;
+    }
+    result_add("stat", params, lat, 0, now_seconds() - start, errors);
+
+    errors = 0;
+    start = measure_start();
+    for (int i = 0; i < files_num; i++) {
+        double op_start = now_seconds();
+        int ret = delete(inodes[i]);
+        latency_add(lat, now_seconds() - op_start);
+        if (ret != 0)
+            errors++;
+    }
+    ssfs_sync();
+    result_add("delete", params, lat, 0, now_seconds() - start, errors);
+
+    unmount();
+    free(inodes);
+}
+
+// Sequential write then read of a file, for several I/O sizes
+static void workload_sequential(const bench_config_t *config, latencies_t *lat) {
+    int file_size = (config->quick ? 16 : 64) * MIB;
+    int io_sizes[] = {4096, 64 * 1024, MIB};
+    int num_sizes = sizeof(io_sizes) / sizeof(io_sizes[0]);
+
+    uint8_t *data = malloc(file_size);
+    if (data == NULL) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+    fill_pattern(data, file_size);
+
+    for (int s = 0; s < num_sizes; s++) {
+        if (fresh_image(config, 2 * file_size / MIB, 32, true) != 0)
+            break;
+        int io_size = io_sizes[s];
+        char params[64];
+        snprintf(params, sizeof(params), "io=%dKiB,file=%dMiB", io_size / 1024, file_size / MIB);
+
+        int inode = create();
+        int errors = 0;
+        double start = measure_start();
+        for (int offset = 0; offset < file_size; offset += io_size) {
+            double op_start = now_seconds();
+            int ret = write(inode, data + offset, io_size, offset);
+            latency_add(lat, now_seconds() - op_start);
+            if (ret != io_size)
+                errors++;
+        }
+        ssfs_sync();
+        result_add("seq_write", params, lat, file_size, now_seconds() - start, errors);
+
+        errors = 0;
+        start = measure_start();
+        for (int offset = 0; offset < file_size; offset += io_size) {
+            double op_start = now_seconds();
+            int ret = read(inode, data + offset, io_size, offset);
+            latency_add(lat, now_seconds() - op_start);
+            if (ret != io_size)
+                errors++;
+        }
+        result_add("seq_read", params, lat, file_size, now_seconds() - start, errors);
+        unmount();
+    }
+    free(data);
+}
+
+// Reads and overwrites at random aligned offsets of a file, for several I/O sizes
+static void workload_random(const bench_config_t *config, latencies_t *lat) {
+    int file_size = (config->quick ? 16 : 64) * MIB;
+    int ops = config->quick ? 1000 : 5000;
+    int io_sizes[] = {4096, 64 * 1024};
+    int num_sizes = sizeof(io_sizes) / sizeof(io_sizes[0]);
+
+    uint8_t *data = malloc(file_size);
+    if (data == NULL) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+    fill_pattern(data, file_size);
+
+    if (fresh_image(config, 2 * file_size / MIB, 32, true) != 0) {
+        free(data);
+        return;
+    }
+    int inode = create();
+    if (write(inode, data, file_size, 0) != file_size)
+        print_error("random", "failed to write the file");
+    ssfs_sync();
+
+    for (int s = 0; s < num_sizes; s++) {
+        int io_size = io_sizes[s];
+        int slots = file_size / io_size;
+        char params[64];
+        snprintf(params, sizeof(params), "io=%dKiB,file=%dMiB", io_size / 1024, file_size / MIB);
+
+        srand(config->seed);
+        int errors = 0;
+        double start = measure_start();
+        for (int op = 0; op < ops; op++) {
+            int offset = (rand() % slots) * io_size;
+            double op_start = now_seconds();
+            int ret = read(inode, data + offset, io_size, offset);
+            latency_add(lat, now_seconds() - op_start);
+            if (ret != io_size)
+                errors++;
+        }
+        result_add("rand_read", params, lat, (uint64_t)ops * io_size, now_seconds() - start, errors);
+
+        errors = 0;
+        start = measure_start();
+        for (int op = 0; op < ops; op++) {
+            int offset = (rand() % slots) * io_size;
+            double op_start = now_seconds();
+            int ret = write(inode, data + offset, io_size, offset);
+            latency_add(lat, now_seconds() - op_start);
+            if (ret != io_size)
+                errors++;
+        }
+        ssfs_sync();
+        result_add("rand_write", params, lat, (uint64_t)ops * io_size, now_seconds() - start, errors);
+    }
+
+    unmount();
+    free(data);
+}
+
+// A pool of small files constantly replaced, as a mail spool or a cache
+static void workload_churn(const bench_config_t *config, latencies_t *lat) {
+    int pool_size = 1000;
+    int max_file_size = 16 * 1024;
+    int ops = config->quick ? 5000 : 50000;
+    char params[64];
+    snprintf(params, sizeof(params), "pool=%d,max=%dKiB", pool_size, max_file_size / 1024);
+
+    uint8_t data[16 * 1024];
+    fill_pattern(data, max_file_size);
+    int *pool = malloc(pool_size * sizeof(int));
+    if (pool == NULL) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+    if (fresh_image(config, 64, pool_size, true) != 0) {
+        free(pool);
+        return;
+    }
+
+    srand(config->seed);
+    int errors = 0;
+    for (int i = 0; i < pool_size; i++) {
+        pool[i] = create();
+        int size = rand() % (max_file_size + 1);
+        if (pool[i] < 0 || write(pool[i], data, size, 0) != size)
+            errors++;
+    }
+
+    // One operation replaces a random file with a new one
+    double start = measure_start();
+    for (int op = 0; op < ops; op++) {
+        int slot = rand() % pool_size;
+        int size = rand() % (max_file_size + 1);
+        double op_start = now_seconds();
+        int ret = delete(pool[slot]);
+        pool[slot] = create();
+        if (ret != 0 || pool[slot] < 0 || write(pool[slot], data, size, 0) != size)
+            errors++;
+        latency_add(lat, now_seconds() - op_start);
+    }
+    ssfs_sync();
+    result_add("churn", params, lat, 0, now_seconds() - start, errors);
+
+    unmount();
+    free(pool);
+}
+
+// A single file growing by appends, as a log
+static void workload_growth(const bench_config_t *config, latencies_t *lat) {
+    int final_size = (config->quick ? 16 : 64) * MIB;  // Within the largest file of 1 KiB blocks
+    int append_size = 256 * 1024;
+    char params[64];
+    snprintf(params, sizeof(params), "append=%dKiB,final=%dMiB", append_size / 1024, final_size / MIB);
+
+    uint8_t *data = malloc(append_size);
+    if (data == NULL) {
+        print_error("Memory allocation failed", NULL);
+        return;
+    }
+    fill_pattern(data, append_size);
+    if (fresh_image(config, 2 * final_size / MIB, 32, true) != 0) {
+        free(data);
+        return;
+    }
+
+    int inode = create();
+    int errors = 0;
+    double start = measure_start();
+    for (int offset = 0; offset < final_size; offset += append_size) {
+        double op_start = now_seconds();
+        int ret = write(inode, data, append_size, offset);
+        latency_add(lat, now_seconds() - op_start);
+        if (ret != append_size)
+            errors++;
+    }
+    ssfs_sync();
+    result_add("growth", params, lat, final_size, now_seconds() - start, errors);
+
+    unmount();
+    free(data);
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(const bench_config_t *config, latencies_t *lat);
+} workload_t;
+
+static const workload_t workloads[] = {
+    {"format", workload_format},
+    {"mount", workload_mount},
+    {"metadata", workload_metadata},
+    {"sequential", workload_sequential},
+    {"random", workload_random},
+    {"churn", workload_churn},
+    {"growth", workload_growth},
+};
+
+/**
+ * @brief Writes the results of the run as JSON.
+ * @return 0 on success, -1 if the file can't be written.
+ */
+static int write_json(const bench_config_t *config) {
+    bool to_stdout = strcmp(config->json_path, "-") == 0;
+    FILE *out = to_stdout ? stdout : fopen(config->json_path, "w");
+    if (out == NULL)
+        return -1;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"tool\": \"fs_bench\",\n");
+    fprintf(out, "  \"schema\": 1,\n");
+    fprintf(out, "  \"timestamp\": %ld,\n", (long)time(NULL));
+    fprintf(out, "  \"config\": {\"quick\": %s, \"memory\": %s, \"device\": %s%s%s, \"inject\": %s, \"scheduler\": \"%s\", "
+        "\"seed\": %u, \"block_size\": %u, \"inode_version\": %u, \"features\": %u},\n",
+        config->quick ? "true" : "false",
+        strncmp(config->image, VDISK_MEMORY_PREFIX, strlen(VDISK_MEMORY_PREFIX)) == 0 ? "true" : "false",
+        config->device ? "\"" : "", config->device ? config->device : "null", config->device ? "\"" : "",
+        config->inject ? "true" : "false",
+        config->scheduler ? config->scheduler : "none",
+        config->seed,
+        config->format.block_size ? config->format.block_size : 1024,
+        config->format.inode_version ? config->format.inode_version : 1,
+        config->format.features);
+    fprintf(out, "  \"results\": [\n");
+    for (size_t r = 0; r < results_num; r++) {
+        bench_result_t *result = &results[r];
+        fprintf(out, "    {\"workload\": \"%s\", \"params\": \"%s\", \"ops\": %llu, \"seconds\": %.6f, "
+            "\"device_seconds\": %.6f, \"merge_ratio\": %.3f, \"batch_wait_us\": %.2f, "
+            "\"ops_per_sec\": %.1f, \"mib_per_sec\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f, "
+            "\"max_us\": %.2f, \"device_bytes_read\": %llu, \"device_bytes_written\": %llu, "
+            "\"read_amplification\": %.3f, \"write_amplification\": %.3f, \"errors\": %d}%s\n",
+            result->workload, result->params, (unsigned long long)result->ops, result->seconds,
+            result->device_seconds, result->merge_ratio, result->batch_wait_us,
+            result->seconds > 0 ? result->ops / result->seconds : 0,
+            result->seconds > 0 ? result->bytes / result->seconds / MIB : 0,
+            result->p50_us, result->p99_us, result->max_us,
+            (unsigned long long)result->device_bytes_read, (unsigned long long)result->device_bytes_written,
+            amplification(result->device_bytes_read, result->user_bytes_read),
+            amplification(result->device_bytes_written, result->user_bytes_written),
+            result->errors,
+            r + 1 < results_num ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (!to_stdout)
+        fclose(out);
+    return 0;
+}
+
+/**
+ * @brief Prints the options and the workloads.
+ */
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--quick] [--only WORKLOAD] [--json FILE] [--image FILE]\n"
+                    "          [--memory] [--device hdd|ssd|nvme|network] [--inject]\n"
+                    "          [--scheduler none|elevator|deadline]\n"
+                    "          [--seed N] [--block-size N] [--extents]\n"
+                    "Workloads:", program);
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+        fprintf(stderr, " %s", workloads[w].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+    bench_config_t config = {
+        .image = "fs_bench.img",
+        .seed = 42,
+    };
+
+    for (int a = 1; a < argc; a++) {
+        bool has_value = a + 1 < argc;
+        if (strcmp(argv[a], "--quick") == 0)
+            config.quick = true;
+        else if (strcmp(argv[a], "--memory") == 0)
+            config.image = VDISK_MEMORY_PREFIX "fs_bench";
+        else if (strcmp(argv[a], "--inject") == 0)
+            config.inject = true;
+        else if (strcmp(argv[a], "--scheduler") == 0 && has_value)
+            config.scheduler = argv[++a];
+        else if (strcmp(argv[a], "--device") == 0 && has_value)
+            config.device = argv[++a];
+        else if (strcmp(argv[a], "--extents") == 0)
+            config.format.inode_version = 2;
+        else if (strcmp(argv[a], "--only") == 0 && has_value)
+            config.only = argv[++a];
+        else if (strcmp(argv[a], "--json") == 0 && has_value)
+            config.json_path = argv[++a];
+        else if (strcmp(argv[a], "--image") == 0 && has_value)
+            config.image = argv[++a];
+        else if (strcmp(argv[a], "--seed") == 0 && has_value)
+            config.seed = (unsigned int)strtoul(argv[++a], NULL, 10);
+        else if (strcmp(argv[a], "--block-size") == 0 && has_value)
+            config.format.block_size = (uint32_t)strtoul(argv[++a], NULL, 10);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (config.device != NULL) {
+        vdisk_model_t model;
+        if (vdisk_model_profile(config.device, &model) != 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        model.inject = config.inject;
+        vdisk_set_model(&model);
+    }
+
+    if (config.scheduler != NULL) {
+        const char *policies[] = {"none", "elevator", "deadline"};
+        int p = 0;
+        while (p < 3 && strcmp(config.scheduler, policies[p]) != 0)
+            p++;
+        if (p == 3) {
+            usage(argv[0]);
+            return 1;
+        }
+        vdisk_set_scheduler((vdisk_scheduler_t)p);
+    }
+
+    latencies_t lat = {0};
+    bool found = false;
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        if (config.only != NULL && strcmp(config.only, workloads[w].name) != 0)
+            continue;
+        found = true;
+        print_warning("Workload", "%s", workloads[w].name);
+        workloads[w].run(&config, &lat);
+    }
+    free(lat.samples);
+    vdisk_delete(config.image);
+    vdisk_set_model(NULL);
+
+    if (!found) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int ret = 0;
+    if (config.json_path != NULL && write_json(&config) != 0) {
+        print_error("Failed to write results", "%s", config.json_path);
+        ret = 1;
+    }
+    for (size_t r = 0; r < results_num; r++)
+        if (results[r].errors != 0)
+            ret = 1;
+    free(results);
+    return ret;
+}
@@ -0,0 +1,168 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_frag.c
+ * ===========
+ *
+ * Reports the fragmentation of an image with `ssfs_frag_report()`, built as
+ * `ssfs_frag`: the runs of the files against the ideal, the runs of free
+ * blocks by length, and how far the indirect or extent blocks lie from the
+ * data they map. The files in the most runs past their ideal are listed.
+ * With --defrag, the files are first moved into single runs with
+ * `ssfs_defrag_volume()`, at most at the given rate.
+ *
+ * Usage: ssfs_frag IMAGE [--files N] [--defrag [--rate MB]]
+ *
+ */
+
+#include "ssfs_internal.h"
+#include "fs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// A file and its layout
+typedef struct {
+    int inode_num;
+    ssfs_frag_file_t layout;
+} frag_entry_t;
+
+/**
+ * @brief Orders files by extra runs, most first.
+ */
+static int compare_entries(const void *a, const void *b) {
+    const frag_entry_t *x = a;
+    const frag_entry_t *y = b;
+    uint32_t x_extra = x->layout.runs - x->layout.ideal_runs;
+    uint32_t y_extra = y->layout.runs - y->layout.ideal_runs;
+    if (x_extra != y_extra)
+        return x_extra > y_extra ? -1 : 1;
+    return (x->inode_num > y->inode_num) - (x->inode_num < y->inode_num);
+}
+
+/**
+ * @brief Lists the `count` most fragmented files.
+ * @return 0 on success, -1 on failure.
+ */
+static int print_worst_files(int count) {
+    size_t num = 0, capacity = 0;
+    frag_entry_t *entries = NULL;
+    ssfs_inode_iter_t iter;
+    ssfs_inode_info_t info;
+
+    if (ssfs_inode_iter_begin(&iter, 0) != 0)
+        return -1;
+    int ret;
+    while ((ret = ssfs_inode_iter_next(&iter, &info)) == 1) {
+        frag_entry_t entry = {.inode_num = info.inode_num};
+        if (ssfs_frag_file(info.inode_num, &entry.layout) != 0 || entry.layout.runs <= entry.layout.ideal_runs)
+            continue;
+        if (num == capacity) {
+            capacity = capacity ? 2 * capacity : 256;
+            frag_entry_t *grown = realloc(entries, capacity * sizeof(frag_entry_t));
+            if (grown == NULL) {
+                ret = -1;
+                break;
+            }
+            entries = grown;
+        }
+        entries[num++] = entry;
+    }
+    ssfs_inode_iter_end(&iter);
+    if (ret < 0) {
+        free(entries);
+        return -1;
+    }
+
+    if (num > 0) {
+        qsort(entries, num, sizeof(frag_entry_t), compare_entries);
+        printf("\n%-8s %10s %8s %8s %12s\n", "inode", "blocks", "runs", "ideal", "meta blocks");
+    }
+    for (size_t e = 0; e < num && e < (size_t)count; e++)
+        printf("%-8d %10u %8u %8u %12u\n", entries[e].inode_num, entries[e].layout.blocks,
+            entries[e].layout.runs, entries[e].layout.ideal_runs, entries[e].layout.meta_blocks);
+    free(entries);
+    return 0;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s IMAGE [--files N] [--defrag [--rate MB]]\n"
+                    "  --files N  Lists the N most fragmented files (10 by default, 0 for none)\n"
+                    "  --defrag   Defragments the image first\n"
+                    "  --rate MB  Copies at most MB MiB per second (no limit by default)\n", program);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    char *image = argv[1];
+    int files = 10;
+    int defrag = 0;
+    ssfs_defrag_options_t options = {.bytes_per_second = 0};
+    for (int a = 2; a < argc; a++) {
+        if (strcmp(argv[a], "--files") == 0 && a + 1 < argc)
+            files = atoi(argv[++a]);
+        else if (strcmp(argv[a], "--defrag") == 0)
+            defrag = 1;
+        else if (strcmp(argv[a], "--rate") == 0 && a + 1 < argc)
+            options.bytes_per_second = (uint64_t)(atof(argv[++a]) * 1024 * 1024);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (mount(image) != 0) {
+        print_error("Can't mount the image", "%s", image);
+        return 1;
+    }
+
+    if (defrag) {
+        ssfs_defrag_report_t moved;
+        if (ssfs_defrag_volume(&options, &moved) != 0) {
+            print_error("Can't defragment the image", "%s", image);
+            unmount();
+            return 1;
+        }
+        printf("%s: %u of %u fragmented files defragmented, %u left for lack of room, "
+               "%llu blocks moved, %llu runs to %llu, in %.1f ms\n\n", image, moved.defragmented, moved.files,
+            moved.skipped, (unsigned long long)moved.blocks_moved, (unsigned long long)moved.runs_before,
+            (unsigned long long)moved.runs_after, moved.elapsed_ns / 1e6);
+    }
+
+    ssfs_frag_report_t report;
+    if (ssfs_frag_report(&report) != 0) {
+        print_error("Can't measure the image", "%s", image);
+        unmount();
+        return 1;
+    }
+
+    printf("%s: %u files, %llu data blocks in %llu runs (ideal %llu), %u fragmented files\n", image,
+        report.files, (unsigned long long)report.data_blocks, (unsigned long long)report.data_runs,
+        (unsigned long long)report.ideal_runs, report.fragmented_files);
+    printf("  %.2f blocks per run, %.1f%% of the files fragmented\n",
+        report.data_runs ? (double)report.data_blocks / report.data_runs : 0.0,
+        report.files ? 100.0 * report.fragmented_files / report.files : 0.0);
+    printf("  %llu indirect or extent blocks, %.1f blocks away from their data on average\n",
+        (unsigned long long)report.meta_blocks,
+        report.meta_blocks ? (double)report.meta_distance / report.meta_blocks : 0.0);
+    printf("  inode table in %u runs\n", report.itable_runs);
+    printf("  %u free blocks in %u runs, the largest of %u blocks\n", report.free_blocks,
+        report.free_extents, report.largest_free_extent);
+
+    printf("\n%-24s %10s\n", "free run length", "runs");
+    for (int bucket = 0; bucket < SSFS_FRAG_BUCKETS; bucket++) {
+        if (report.free_histogram[bucket] == 0)
+            continue;
+        unsigned long long low = 1ull << bucket, high = (1ull << (bucket + 1)) - 1;
+        char range[32];
+        snprintf(range, sizeof(range), "%llu-%llu", low, high);
+        printf("%-24s %10u\n", range, report.free_histogram[bucket]);
+    }
+
+    int ret = files > 0 ? print_worst_files(files) : 0;
+    unmount();
+    return ret == 0 ? 0 : 1;
+}
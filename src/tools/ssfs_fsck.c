@@ -0,0 +1,90 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_fsck.c
+ * ===========
+ *
+ * Checks the consistency of an unmounted image with `ssfs_check()`, built
+ * as `ssfs_fsck`, and repairs it with --repair. The exit status follows
+ * e2fsck: 0 if the image is consistent, 1 if it was repaired, 4 if problems
+ * are left, 8 if the check couldn't run.
+ *
+ * Usage: ssfs_fsck IMAGE [--repair] [--threads N] [--verbose]
+ *
+ */
+
+#include "ssfs_internal.h"
+#include "fs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define EXIT_CLEAN 0
+#define EXIT_REPAIRED 1
+#define EXIT_PROBLEMS 4
+#define EXIT_FAILURE_CHECK 8
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s IMAGE [--repair] [--threads N] [--verbose]\n"
+                    "  --repair     Repairs the image, else only reads it\n"
+                    "  --threads N  Checks with N threads (8 by default)\n"
+                    "  --verbose    Prints every problem, not only the first ones of each kind\n", program);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE_CHECK;
+    }
+    char *image = argv[1];
+    ssfs_check_options_t options;
+    memset(&options, 0, sizeof(options));
+    for (int a = 2; a < argc; a++) {
+        if (strcmp(argv[a], "--repair") == 0)
+            options.repair = 1;
+        else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc)
+            options.threads = atoi(argv[++a]);
+        else if (strcmp(argv[a], "--verbose") == 0)
+            options.verbose = 1;
+        else {
+            usage(argv[0]);
+            return EXIT_FAILURE_CHECK;
+        }
+    }
+
+    ssfs_check_report_t report;
+    if (ssfs_check(image, &options, &report) != 0) {
+        print_error("Can't check the image", "%s", image);
+        return EXIT_FAILURE_CHECK;
+    }
+
+    uint64_t found = 0, remaining = 0;
+    for (int p = 0; p < SSFS_CHECK_NUM; p++) {
+        found += report.found[p];
+        remaining += report.remaining[p];
+    }
+
+    printf("%s: %u/%u inodes, %u/%u blocks, %u orphans, %u journal blocks, checked in %.1f ms\n", image,
+        report.used_inodes, report.inodes, report.used_blocks, report.blocks, report.orphans,
+        report.journal_blocks, report.elapsed_ns / 1e6);
+    for (int p = 0; p < SSFS_CHECK_NUM; p++) {
+        if (report.found[p] == 0)
+            continue;
+        if (options.repair)
+            printf("  %-26s %8llu found, %llu left\n", ssfs_check_problem_name(p),
+                (unsigned long long)report.found[p], (unsigned long long)report.remaining[p]);
+        else
+            printf("  %-26s %8llu\n", ssfs_check_problem_name(p), (unsigned long long)report.found[p]);
+    }
+
+    if (found == 0) {
+        printf("%s: clean\n", image);
+        return EXIT_CLEAN;
+    }
+    if (remaining > 0) {
+        printf("%s: %llu problems%s\n", image, (unsigned long long)remaining, options.repair ? " left" : "");
+        return EXIT_PROBLEMS;
+    }
+    printf("%s: repaired\n", image);
+    return EXIT_REPAIRED;
+}
@@ -0,0 +1,539 @@
+/*
+ * Author: Valérian Wislez
+ *
+ * ssfs_replay.c
+ * =============
+ *
+ * Replays a trace recorded by `ssfs_trace_start()` against an image, built
+ * as `ssfs_replay`. The image should be a copy of the one traced, as it was
+ * when the trace started; a trace starting with format() only needs an image
+ * of the right size.
+ *
+ * The calls are replayed on a single thread in the order they started, with
+ * their recorded arguments; written data is a pattern. Inode numbers returned
+ * by create(), ssfs_create_many(), lookup() and unlink() are mapped to those
+ * of the replay, so the trace stays meaningful if they differ. Calls this
+ * version doesn't know are skipped with a warning. For each operation, the
+ * recorded and replayed latencies are reported, to compare two versions on
+ * the same workload.
+ *
+ * Usage: ssfs_replay TRACE IMAGE [--speed X] [--json FILE]
+ *
+ */
+
+#include "ssfs_internal.h"
+#include "fs.h"
+#include "error.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+
+// A traced call and its name
+typedef struct {
+    trace_record_t record;
+    uint32_t index;  // Position in the trace, to keep the order of simultaneous calls
+    char name[SSFS_NAME_MAX + 1];
+    int32_t *inodes;  // Inode numbers of a batch operation, `record.arg2` of them
+} replay_call_t;
+
+// Latencies of one operation, in nanoseconds
+typedef struct {
+    double *recorded;
+    double *replayed;
+    size_t num;
+    size_t capacity;
+    int diverged;  // Calls whose result differs from the recorded one
+} op_latencies_t;
+
+// Replayed inode numbers, indexed by recorded inode number
+static int *inode_map = NULL;
+static size_t inode_map_size = 0;
+
+// Scan of the inode table being replayed
+static ssfs_inode_iter_t iter;
+static bool iter_open = false;
+
+/**
+ * @brief Returns a monotonic timestamp in nanoseconds.
+ */
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief Whether the record of an operation is followed by inode numbers.
+ */
+static bool lists_inodes(uint8_t op) {
+    return op == SSFS_OP_CREATE_MANY || op == SSFS_OP_DELETE_MANY || op == SSFS_OP_STAT_MANY;
+}
+
+/**
+ * @brief Frees the inode numbers of loaded calls.
+ */
+static void free_calls(replay_call_t *calls, size_t num) {
+    for (size_t c = 0; c < num; c++)
+        free(calls[c].inodes);
+    free(calls);
+}
+
+/**
+ * @brief Loads the calls of a trace, sorted by start time.
+ * @return The number of calls, or -1 on failure.
+ */
+static long load_trace(const char *path, replay_call_t **calls) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        print_error("Can't open the trace", "%s", path);
+        return -1;
+    }
+
+    trace_header_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC ||
+        header.version == 0 || header.version > TRACE_VERSION) {
+        print_error("Not a trace, or of another version", "%s", path);
+        fclose(file);
+        return -1;
+    }
+
+    size_t num = 0, capacity = 0;
+    replay_call_t call;
+    while (fread(&call.record, sizeof(trace_record_t), 1, file) == 1) {
+        uint16_t name_len = call.record.name_len;
+        if (name_len > SSFS_NAME_MAX || (name_len > 0 && fread(call.name, name_len, 1, file) != 1)) {
+            print_warning("Truncated trace", "%zu calls read", num);
+            break;
+        }
+        call.name[name_len] = '\0';
+        call.index = (uint32_t)num;
+
+        call.inodes = NULL;
+        int32_t listed = lists_inodes(call.record.op) ? call.record.arg2 : 0;
+        if (listed > 0) {
+            call.inodes = malloc((size_t)listed * sizeof(int32_t));
+            if (call.inodes == NULL || fread(call.inodes, sizeof(int32_t), listed, file) != (size_t)listed) {
+                free(call.inodes);
+                print_warning("Truncated trace", "%zu calls read", num);
+                break;
+            }
+        }
+
+        if (num == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            replay_call_t *grown = realloc(*calls, capacity * sizeof(replay_call_t));
+            if (grown == NULL) {
+                print_error("Memory allocation failed", NULL);
+                free(call.inodes);
+                free_calls(*calls, num);
+                *calls = NULL;
+                fclose(file);
+                return -1;
+            }
+            *calls = grown;
+        }
+        (*calls)[num++] = call;
+    }
+    fclose(file);
+    return (long)num;
+}
+
+/**
+ * @brief Orders calls by start time, then by position in the trace.
+ */
+static int compare_calls(const void *a, const void *b) {
+    const replay_call_t *x = a;
+    const replay_call_t *y = b;
+    if (x->record.start_ns != y->record.start_ns)
+        return x->record.start_ns < y->record.start_ns ? -1 : 1;
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/**
+ * @brief Returns the replayed inode number of a recorded one.
+ */
+static int map_inode(int recorded) {
+    if (recorded >= 0 && (size_t)recorded < inode_map_size && inode_map[recorded] >= 0)
+        return inode_map[recorded];
+    return recorded;
+}
+
+/**
+ * @brief Records that the inode `recorded` of the trace is `replayed`.
+ */
+static void map_set(int recorded, int replayed) {
+    if (recorded < 0 || replayed < 0)
+        return;
+    if ((size_t)recorded >= inode_map_size) {
+        size_t size = inode_map_size ? inode_map_size : 1024;
+        while (size <= (size_t)recorded)
+            size *= 2;
+        int *grown = realloc(inode_map, size * sizeof(int));
+        if (grown == NULL)
+            return;
+        for (size_t i = inode_map_size; i < size; i++)
+            grown[i] = -1;
+        inode_map = grown;
+        inode_map_size = size;
+    }
+    inode_map[recorded] = replayed;
+}
+
+/**
+ * @brief Warns once per operation that calls of it aren't replayed.
+ */
+static void warn_unknown(uint8_t op) {
+    static bool warned[256];
+    if (!warned[op])
+        print_warning("Unknown call, not replayed", "operation %d", op);
+    warned[op] = true;
+}
+
+/**
+ * @brief Replays a batch operation on the replayed inodes of its call.
+ * @return What the call returned.
+ */
+static int replay_batch(replay_call_t *call) {
+    trace_record_t *r = &call->record;
+    int count = r->arg1 > 0 ? r->arg1 : 0;
+    int listed = call->inodes != NULL ? r->arg2 : 0;
+    int ret;
+
+    int *inode_nums = malloc((size_t)(count > listed ? count : listed) * sizeof(int) + 1);
+    int *sizes = malloc((size_t)count * sizeof(int) + 1);
+    if (inode_nums == NULL || sizes == NULL) {
+        free(inode_nums);
+        free(sizes);
+        return ssfs_EALLOC;
+    }
+    for (int i = 0; i < listed; i++)
+        inode_nums[i] = map_inode(call->inodes[i]);
+
+    switch (r->op) {
+    case SSFS_OP_CREATE_MANY:
+        ret = ssfs_create_many(inode_nums, r->arg1);
+        for (int i = 0; i < listed && i < ret; i++)
+            map_set(call->inodes[i], inode_nums[i]);
+        break;
+    case SSFS_OP_DELETE_MANY:
+        ret = ssfs_delete_many(inode_nums, listed < r->arg1 ? listed : r->arg1);
+        break;
+    case SSFS_OP_STAT_MANY:
+        ret = ssfs_stat_many(inode_nums, listed < r->arg1 ? listed : r->arg1, sizes);
+        break;
+    default:
+        ret = ssfs_stat_range(map_inode(r->inode), r->arg1, sizes);
+        break;
+    }
+    free(inode_nums);
+    free(sizes);
+    return ret;
+}
+
+/**
+ * @brief Replays a call.
+ * @return What the call returned.
+ */
+static int replay_call(replay_call_t *call, char *image, uint8_t *data) {
+    trace_record_t *r = &call->record;
+    ssfs_statfs_t volume;
+    ssfs_inode_info_t info;
+    ssfs_dirent_t entry;
+    uint32_t cursor;
+    int ret;
+
+    switch (r->op) {
+    case SSFS_OP_FORMAT: {
+        ssfs_format_options_t options = {
+            .inode_version = (uint32_t)r->inode,
+            .block_size = (uint32_t)r->arg2,
+            .features = r->flags,
+        };
+        return ssfs_format_opts(image, r->arg1, &options);
+    }
+    case SSFS_OP_MOUNT:
+        return mount(image);
+    case SSFS_OP_UNMOUNT:
+        return unmount();
+    case SSFS_OP_CREATE:
+        ret = create();
+        map_set(r->result, ret);
+        return ret;
+    case SSFS_OP_DELETE:
+        return delete(map_inode(r->inode));
+    case SSFS_OP_STAT:
+        return stat(map_inode(r->inode));
+    case SSFS_OP_READ:
+        return read(map_inode(r->inode), data, r->arg2, r->arg1);
+    case SSFS_OP_WRITE:
+        return write(map_inode(r->inode), data, r->arg2, r->arg1);
+    case SSFS_OP_FSYNC:
+        return ssfs_fsync(map_inode(r->inode));
+    case SSFS_OP_FDATASYNC:
+        return ssfs_fdatasync(map_inode(r->inode));
+    case SSFS_OP_SYNC:
+        return ssfs_sync();
+    case SSFS_OP_LOOKUP:
+        ret = ssfs_lookup(map_inode(r->inode), call->name);
+        map_set(r->result, ret);
+        return ret;
+    case SSFS_OP_LINK:
+        return ssfs_link(map_inode(r->inode), call->name, map_inode(r->arg1));
+    case SSFS_OP_UNLINK:
+        ret = ssfs_unlink(map_inode(r->inode), call->name);
+        map_set(r->result, ret);
+        return ret;
+    case SSFS_OP_MKDIR:
+        ret = ssfs_mkdir();
+        map_set(r->result, ret);
+        return ret;
+    case SSFS_OP_CREATE_MANY:
+    case SSFS_OP_DELETE_MANY:
+    case SSFS_OP_STAT_MANY:
+    case SSFS_OP_STAT_RANGE:
+        return replay_batch(call);
+    case SSFS_OP_STATFS:
+        return ssfs_statfs(&volume);
+    case SSFS_OP_GROW:
+        return ssfs_grow((uint32_t)r->arg1);
+    case SSFS_OP_READDIR:
+        cursor = (uint32_t)r->arg1;
+        return ssfs_readdir(map_inode(r->inode), &cursor, &entry);
+    case SSFS_OP_ITER_BEGIN:
+        if (iter_open)
+            ssfs_inode_iter_end(&iter);
+        ret = ssfs_inode_iter_begin(&iter, map_inode(r->arg1));
+        iter_open = ret == 0;
+        return ret;
+    case SSFS_OP_ITER_NEXT:
+        return iter_open ? ssfs_inode_iter_next(&iter, &info) : ssfs_EINVAL;
+    case SSFS_OP_FORMAT_NEW:
+        return ssfs_format_new(image, (uint32_t)r->arg2, r->arg1);
+    default:
+        warn_unknown(r->op);
+        return r->result;
+    }
+}
+
+/**
+ * @brief Whether a replayed result matches the recorded one. Inode numbers
+ * may differ, only their validity is compared.
+ */
+static bool same_result(const trace_record_t *r, int ret) {
+    switch (r->op) {
+    case SSFS_OP_CREATE:
+    case SSFS_OP_LOOKUP:
+    case SSFS_OP_UNLINK:
+    case SSFS_OP_MKDIR:
+        return (r->result < 0) == (ret < 0);
+    default:
+        return r->result == ret;
+    }
+}
+
+/**
+ * @brief Records the latencies of a replayed call.
+ */
+static void latencies_add(op_latencies_t *lat, double recorded, double replayed) {
+    if (lat->num == lat->capacity) {
+        size_t capacity = lat->capacity ? 2 * lat->capacity : 256;
+        double *grown_recorded = realloc(lat->recorded, capacity * sizeof(double));
+        if (grown_recorded == NULL)
+            return;
+        lat->recorded = grown_recorded;
+        double *grown_replayed = realloc(lat->replayed, capacity * sizeof(double));
+        if (grown_replayed == NULL)
+            return;
+        lat->replayed = grown_replayed;
+        lat->capacity = capacity;
+    }
+    lat->recorded[lat->num] = recorded;
+    lat->replayed[lat->num] = replayed;
+    lat->num++;
+}
+
+/**
+ * @brief Compares two latencies, for `qsort()`.
+ */
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Returns the `percent`-th percentile (nearest rank) of sorted
+ * latencies, in microseconds.
+ */
+static double percentile_us(const double *sorted, size_t num, double percent) {
+    if (num == 0)
+        return 0;
+    size_t rank = (size_t)(percent / 100 * num + 0.5);
+    if (rank == 0)
+        rank = 1;
+    if (rank > num)
+        rank = num;
+    return sorted[rank - 1] / 1e3;
+}
+
+/**
+ * @brief Prints the latencies of every operation, and writes them as JSON
+ * to `json` if it isn't NULL.
+ */
+static void report(op_latencies_t *ops, double replay_seconds, long calls, FILE *json) {
+    // The JSON alone goes to stdout when it is written there
+    bool quiet = json == stdout;
+    if (!quiet)
+        print_info("Replayed", "%ld calls in %.3f s", calls, replay_seconds);
+    if (json != NULL)
+        fprintf(json, "{\n  \"tool\": \"ssfs_replay\",\n  \"calls\": %ld,\n  \"seconds\": %.6f,\n  \"ops\": [\n",
+            calls, replay_seconds);
+
+    bool first = true;
+    for (int op = 0; op < SSFS_OP_NUM; op++) {
+        op_latencies_t *lat = &ops[op];
+        if (lat->num == 0)
+            continue;
+        qsort(lat->recorded, lat->num, sizeof(double), compare_doubles);
+        qsort(lat->replayed, lat->num, sizeof(double), compare_doubles);
+        double recorded_p50 = percentile_us(lat->recorded, lat->num, 50);
+        double recorded_p99 = percentile_us(lat->recorded, lat->num, 99);
+        double replayed_p50 = percentile_us(lat->replayed, lat->num, 50);
+        double replayed_p99 = percentile_us(lat->replayed, lat->num, 99);
+
+        if (!quiet)
+            print_info(ssfs_op_name(op), "%8zu calls  recorded p50 %9.1f us p99 %9.1f us  "
+                "replayed p50 %9.1f us p99 %9.1f us", lat->num, recorded_p50, recorded_p99, replayed_p50, replayed_p99);
+        if (!quiet && lat->diverged != 0)
+            print_warning(ssfs_op_name(op), "%d calls returned another result than recorded", lat->diverged);
+
+        if (json != NULL) {
+            fprintf(json, "%s    {\"op\": \"%s\", \"calls\": %zu, \"diverged\": %d, "
+                "\"recorded_p50_us\": %.2f, \"recorded_p99_us\": %.2f, "
+                "\"replayed_p50_us\": %.2f, \"replayed_p99_us\": %.2f, \"replayed_max_us\": %.2f}",
+                first ? "" : ",\n", ssfs_op_name(op), lat->num, lat->diverged,
+                recorded_p50, recorded_p99, replayed_p50, replayed_p99,
+                percentile_us(lat->replayed, lat->num, 100));
+            first = false;
+        }
+    }
+    if (json != NULL)
+        fprintf(json, "\n  ]\n}\n");
+}
+
+/**
+ * @brief Prints the arguments and options.
+ */
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s TRACE IMAGE [--speed X] [--json FILE]\n"
+                    "  --speed X    Keeps the recorded pace, X times faster (as fast as possible by default)\n"
+                    "  --json FILE  Writes the latencies as JSON, \"-\" for stdout\n", program);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *trace_path = argv[1];
+    char *image = argv[2];
+    double speed = 0;  // 0 for as fast as possible
+    const char *json_path = NULL;
+    for (int a = 3; a < argc; a++) {
+        if (strcmp(argv[a], "--speed") == 0 && a + 1 < argc)
+            speed = strtod(argv[++a], NULL);
+        else if (strcmp(argv[a], "--json") == 0 && a + 1 < argc)
+            json_path = argv[++a];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    replay_call_t *calls = NULL;
+    long num = load_trace(trace_path, &calls);
+    if (num < 0)
+        return 1;
+    qsort(calls, num, sizeof(replay_call_t), compare_calls);
+
+    // Room for the largest transfer
+    int data_size = 1;
+    for (long c = 0; c < num; c++)
+        if ((calls[c].record.op == SSFS_OP_READ || calls[c].record.op == SSFS_OP_WRITE) &&
+            calls[c].record.arg2 > data_size)
+            data_size = calls[c].record.arg2;
+    uint8_t *data = malloc(data_size);
+    if (data == NULL) {
+        print_error("Memory allocation failed", NULL);
+        free_calls(calls, num);
+        return 1;
+    }
+    for (int i = 0; i < data_size; i++)
+        data[i] = (uint8_t)(i % 251);
+
+    // A trace started on a mounted volume goes on from the image as it is
+    if (num > 0 && calls[0].record.op != SSFS_OP_FORMAT && calls[0].record.op != SSFS_OP_FORMAT_NEW &&
+        calls[0].record.op != SSFS_OP_MOUNT && mount(image) != 0) {
+        print_error("Can't mount the image", "%s", image);
+        free(data);
+        free_calls(calls, num);
+        return 1;
+    }
+
+    op_latencies_t ops[SSFS_OP_NUM];
+    memset(ops, 0, sizeof(ops));
+    uint64_t replay_start = now_ns();
+    uint64_t trace_first = num > 0 ? calls[0].record.start_ns : 0;
+
+    for (long c = 0; c < num; c++) {
+        trace_record_t *r = &calls[c].record;
+        if (r->op >= SSFS_OP_NUM) {
+            warn_unknown(r->op);
+            continue;
+        }
+
+        if (speed > 0) {
+            uint64_t due = replay_start + (uint64_t)((r->start_ns - trace_first) / speed);
+            uint64_t now = now_ns();
+            if (due > now) {
+                struct timespec wait = {(time_t)((due - now) / 1000000000ull), (long)((due - now) % 1000000000ull)};
+                nanosleep(&wait, NULL);
+            }
+        }
+
+        uint64_t start = now_ns();
+        int ret = replay_call(&calls[c], image, data);
+        double elapsed = (double)(now_ns() - start);
+
+        latencies_add(&ops[r->op], r->duration_ns, elapsed);
+        if (!same_result(r, ret))
+            ops[r->op].diverged++;
+    }
+    double replay_seconds = (now_ns() - replay_start) / 1e9;
+
+    if (iter_open)
+        ssfs_inode_iter_end(&iter);
+    if (is_mounted())
+        unmount();
+
+    FILE *json = NULL;
+    if (json_path != NULL) {
+        json = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "w");
+        if (json == NULL)
+            print_error("Can't write the results", "%s", json_path);
+    }
+    report(ops, replay_seconds, num, json);
+    if (json != NULL && json != stdout)
+        fclose(json);
+
+    for (int op = 0; op < SSFS_OP_NUM; op++) {
+        free(ops[op].recorded);
+        free(ops[op].replayed);
+    }
+    free(inode_map);
+    free(data);
+    free_calls(calls, num);
+    return 0;
+}
@@ -1,8 +1,19 @@
+#ifdef __linux__
+#define _GNU_SOURCE  // sync_file_range, fallocate, mremap, SEEK_DATA, preadv
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 #include <bsd/string.h>
 
 #ifndef __APPLE__
@@ -15,7 +26,515 @@
 
 const int VDISK_SECTOR_SIZE = 1024;
 
+/*
+ * I/O statistics. Each thread counts in its own block, so counting takes no
+ * lock; vdisk_get_stats() sums the blocks. The block of an exited thread
+ * keeps its counts and is taken over by the next new thread.
+ */
+typedef struct thread_stats {
+    vdisk_stats_t counters;
+    uint64_t clock;  // Time of the thread on the simulated device
+    bool live;
+    struct thread_stats *next;
+} thread_stats_t;
+
+#define STATS_FIELDS (sizeof(vdisk_stats_t) / sizeof(uint64_t))
+
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static thread_stats_t *stats_threads = NULL;
+static vdisk_stats_t stats_baseline;  // Totals at the last vdisk_reset_stats()
+
+static void stats_thread_exit(void *block) {
+    pthread_mutex_lock(&stats_mutex);
+    ((thread_stats_t *)block)->live = false;
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+static void stats_init() {
+    pthread_key_create(&stats_key, stats_thread_exit);
+}
+
+/**
+ * Returns the block of the calling thread, NULL if it can't be allocated, in
+ * which case its I/O isn't counted.
+ */
+static thread_stats_t *local_block() {
+    pthread_once(&stats_once, stats_init);
+    thread_stats_t *local = pthread_getspecific(stats_key);
+    if (local != NULL) {
+        return local;
+    }
+
+    pthread_mutex_lock(&stats_mutex);
+    for (local = stats_threads; local != NULL; local = local->next) {
+        if (!local->live) {
+            break;
+        }
+    }
+    if (local == NULL) {
+        local = calloc(1, sizeof(thread_stats_t));
+        if (local != NULL) {
+            local->next = stats_threads;
+            stats_threads = local;
+        }
+    }
+    if (local != NULL) {
+        local->live = true;
+    }
+    pthread_mutex_unlock(&stats_mutex);
+
+    if (local == NULL || pthread_setspecific(stats_key, local) != 0) {
+        return NULL;
+    }
+    return local;
+}
+
+/**
+ * Returns the counters of the calling thread, see local_block().
+ */
+static vdisk_stats_t *local_stats() {
+    thread_stats_t *local = local_block();
+    return local != NULL ? &local->counters : NULL;
+}
+
+/**
+ * Sums the counters of every thread since the disk layer was first used.
+ */
+static void stats_totals(vdisk_stats_t *totals) {
+    uint64_t *sum = (uint64_t *)totals;
+    memset(totals, 0, sizeof(vdisk_stats_t));
+    pthread_mutex_lock(&stats_mutex);
+    for (thread_stats_t *block = stats_threads; block != NULL; block = block->next) {
+        uint64_t *counters = (uint64_t *)&block->counters;
+        for (size_t f = 0; f < STATS_FIELDS; f++) {
+            sum[f] += counters[f];
+        }
+    }
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+/**
+ * Fills `stats` with the I/O done by every thread since the last
+ * vdisk_reset_stats(). Counts of operations still running may be missed.
+ */
+void vdisk_get_stats(vdisk_stats_t *stats) {
+    stats_totals(stats);
+    uint64_t *counters = (uint64_t *)stats;
+    uint64_t *baseline = (uint64_t *)&stats_baseline;
+    for (size_t f = 0; f < STATS_FIELDS; f++) {
+        counters[f] -= baseline[f];
+    }
+}
+
+/**
+ * Restarts the counts of vdisk_get_stats() from zero. The threads' own
+ * counters are left alone, so that they never race with a reset.
+ */
+void vdisk_reset_stats() {
+    vdisk_stats_t totals;
+    stats_totals(&totals);
+    pthread_mutex_lock(&stats_mutex);
+    stats_baseline = totals;
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+/*
+ * Simulated device. Once a model is set, every request is charged the time
+ * it would take on the modelled device: its fixed cost, a seek from the end
+ * of the previous transfer, and the transfer at the modelled rate. Each
+ * thread has its own clock on the device, which a request moves to its
+ * completion. The device serves `queue_depth` requests at once, a request
+ * waits for the first slot free, and a sync for every slot. Only requests
+ * take time, not the CPU between them, so a thread doing the same requests
+ * gets the same time on every run. All the disks share the device, as
+ * images on one drive.
+ */
+static pthread_mutex_t model_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile bool model_on = false;  // Checked without the lock by every request
+static vdisk_model_t model;
+static uint64_t *model_slots = NULL;    // Time at which each slot of the queue is free
+static uint64_t model_head = 0;         // Byte after the last transfer
+
+typedef enum {
+    MODEL_READ,
+    MODEL_WRITE,     // Discards included
+    MODEL_SYNC,
+} model_request_t;
+
+// Typical devices, for vdisk_model_profile()
+static const struct {
+    const char *name;
+    vdisk_model_t model;
+} model_profiles[] = {
+    // 7200 rpm disk: 4.2 ms of rotation on average on top of 0.5 to 8 ms seeks
+    {"hdd", {.read_ns = 50000, .write_ns = 50000, .seek_min_ns = 4700000, .seek_max_ns = 12500000,
+             .bytes_per_second = 150000000, .sync_ns = 5000000, .queue_depth = 1}},
+    {"ssd", {.read_ns = 80000, .write_ns = 40000, .bytes_per_second = 500000000,
+             .sync_ns = 1000000, .queue_depth = 32}},
+    {"nvme", {.read_ns = 20000, .write_ns = 15000, .bytes_per_second = 3000000000ull,
+              .sync_ns = 200000, .queue_depth = 64}},
+    // Block volume of a cloud provider, behind a 1 Gb/s link
+    {"network", {.read_ns = 600000, .write_ns = 800000, .bytes_per_second = 125000000,
+                 .sync_ns = 1000000, .queue_depth = 16}},
+};
+
+/**
+ * Fills `model` with the costs of a typical device: "hdd", "ssd", "nvme" or
+ * "network".
+ */
+int vdisk_model_profile(const char *name, vdisk_model_t *model) {
+    for (size_t p = 0; p < sizeof(model_profiles) / sizeof(model_profiles[0]); p++) {
+        if (strcmp(model_profiles[p].name, name) == 0) {
+            *model = model_profiles[p].model;
+            return 0;
+        }
+    }
+    return vdisk_ENOEXIST;
+}
+
+/**
+ * Simulates a device with the costs of `new_model` under every disk, or
+ * stops the simulation if it is NULL. The simulated time is counted in
+ * `simulated_ns` of vdisk_get_stats(), and only slept with `inject`.
+ */
+int vdisk_set_model(const vdisk_model_t *new_model) {
+    uint64_t *slots = NULL;
+    if (new_model != NULL) {
+        slots = calloc(new_model->queue_depth ? new_model->queue_depth : 1, sizeof(uint64_t));
+        if (slots == NULL) {
+            return vdisk_ESECTOR;
+        }
+    }
+    pthread_mutex_lock(&model_mutex);
+    free(model_slots);
+    model_slots = slots;
+    model_head = 0;
+    if (new_model != NULL) {
+        model = *new_model;
+        if (model.queue_depth == 0) {
+            model.queue_depth = 1;
+        }
+    }
+    model_on = new_model != NULL;
+    pthread_mutex_unlock(&model_mutex);
+    return 0;
+}
+
+/**
+ * Integer square root, rounded down.
+ */
+static uint64_t square_root(uint64_t x) {
+    uint64_t root = 0;
+    for (uint64_t bit = 1ull << 62; bit != 0; bit >>= 2) {
+        if (x >= root + bit) {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+    }
+    return root;
+}
+
+/**
+ * Time to move from the end of the previous transfer to `position`. The
+ * caller holds model_mutex.
+ */
+static uint64_t model_seek(DISK *diskp, uint64_t position) {
+    if (position == model_head) {
+        return 0;
+    }
+    uint64_t distance = position > model_head ? position - model_head : model_head - position;
+    uint64_t size = (uint64_t)diskp->size_in_sectors * diskp->sector_size;
+    if (distance > size) {
+        distance = size;  // From another disk
+    }
+    // Fraction of the disk crossed, in 1 / 2^32, of which the root is in 1 / 2^16
+    uint64_t fraction = (uint64_t)((double)distance / size * 4294967296.0);
+    uint64_t spread = model.seek_max_ns > model.seek_min_ns ? model.seek_max_ns - model.seek_min_ns : 0;
+    return model.seek_min_ns + (uint64_t)((double)spread * square_root(fraction) / 65536);
+}
+
+/**
+ * Charges a request to the simulated device, if a model is set. `length`
+ * bytes are transferred from `position`, none for a sync or a discard. A
+ * sync waits for every request before it.
+ */
+static void model_request(DISK *diskp, model_request_t request, uint64_t position, uint64_t length) {
+    if (!model_on) {
+        return;
+    }
+    thread_stats_t *local = local_block();
+    if (local == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&model_mutex);
+    if (!model_on) {
+        pthread_mutex_unlock(&model_mutex);
+        return;
+    }
+    bool barrier = request == MODEL_SYNC;
+    uint64_t service = request == MODEL_SYNC ? model.sync_ns :
+                       request == MODEL_WRITE ? model.write_ns : model.read_ns;
+    if (length > 0) {
+        service += model_seek(diskp, position);
+        if (model.bytes_per_second != 0) {
+            service += (uint64_t)((double)length * 1e9 / model.bytes_per_second);
+        }
+        model_head = position + length;
+    }
+
+    // The request starts once the thread issued it and a slot is free
+    uint32_t slot = 0;
+    uint64_t begin = local->clock;
+    for (uint32_t s = 0; s < model.queue_depth; s++) {
+        if (model_slots[s] < model_slots[slot]) {
+            slot = s;
+        }
+        if (barrier && model_slots[s] > begin) {
+            begin = model_slots[s];
+        }
+    }
+    if (model_slots[slot] > begin) {
+        begin = model_slots[slot];
+    }
+    uint64_t end = begin + service;
+    for (uint32_t s = 0; s < model.queue_depth; s++) {
+        if (s == slot || barrier) {
+            model_slots[s] = end;
+        }
+    }
+    uint64_t waited = end - local->clock;
+    local->clock = end;
+    bool inject = model.inject;
+    pthread_mutex_unlock(&model_mutex);
+
+    local->counters.simulated_ns += waited;
+    if (inject) {
+        struct timespec delay = {.tv_sec = waited / 1000000000, .tv_nsec = waited % 1000000000};
+        while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+        }
+    }
+}
+
+/*
+ * In-memory images. An image named with VDISK_MEMORY_PREFIX is an anonymous
+ * mapping kept under its name until vdisk_delete(), so that vdisk_on() finds
+ * it like an image file and the file system runs on it unchanged, without
+ * the host file system and page cache. Large images ask for transparent huge
+ * pages, which saves TLB misses on random access.
+ */
+struct vdisk_memory {
+    char *name;
+    uint8_t *data;
+    size_t size;     // Bytes of the image
+    size_t mapped;   // Bytes of the mapping, whole pages
+    int users;       // Disks turned on, and saves running
+    struct vdisk_memory *next;
+};
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Unit in which vdisk_save() looks for zeros to leave as holes
+#define SAVE_CHUNK_SIZE (64 * 1024)
+
+static pthread_mutex_t memory_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct vdisk_memory *memory_images = NULL;
+
+static bool is_memory_name(const char *name) {
+    return strncmp(name, VDISK_MEMORY_PREFIX, strlen(VDISK_MEMORY_PREFIX)) == 0;
+}
+
+/**
+ * Returns the in-memory image named `name`, NULL if there is none. The
+ * caller holds memory_mutex.
+ */
+static struct vdisk_memory *memory_find(const char *name) {
+    struct vdisk_memory *image = memory_images;
+    while (image != NULL && strcmp(image->name, name) != 0) {
+        image = image->next;
+    }
+    return image;
+}
+
+static size_t page_round(size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+/**
+ * Maps `size` bytes of zeros, a multiple of the page size. The pages are
+ * only allocated when first written. Returns NULL on failure.
+ */
+static uint8_t *memory_map(size_t size) {
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (size >= HUGE_PAGE_SIZE) {
+        madvise(data, size, MADV_HUGEPAGE);
+    }
+#endif
+    return data;
+}
+
+/**
+ * Makes `data` the content of the in-memory image `name`, which is created
+ * if needed. The previous content is released. Fails if the image is turned
+ * on, in which case `data` is left to the caller.
+ */
+static int memory_install(const char *name, uint8_t *data, size_t size, size_t mapped) {
+    int err = 0;
+    pthread_mutex_lock(&memory_mutex);
+    struct vdisk_memory *image = memory_find(name);
+    if (image != NULL && image->users > 0) {
+        err = vdisk_EACCESS;
+    } else if (image != NULL) {
+        munmap(image->data, image->mapped);
+    } else {
+        image = calloc(1, sizeof(struct vdisk_memory));
+        int name_length = strlen(name) + 1;
+        char *image_name = malloc(name_length);
+        if (image == NULL || image_name == NULL) {
+            free(image);
+            free(image_name);
+            err = vdisk_ESECTOR;
+        } else {
+            strlcpy(image_name, name, name_length);
+            image->name = image_name;
+            image->next = memory_images;
+            memory_images = image;
+        }
+    }
+    if (!err) {
+        image->data = data;
+        image->size = size;
+        image->mapped = mapped;
+    }
+    pthread_mutex_unlock(&memory_mutex);
+    return err;
+}
+
+/**
+ * Extends an in-memory image to `size` bytes, the new bytes being zeros. The
+ * mapping may move, so no transfer may run on the image meanwhile.
+ */
+static int memory_grow(struct vdisk_memory *image, size_t size) {
+    if (size <= image->size) {
+        return 0;
+    }
+    size_t mapped = page_round(size);
+    if (mapped > image->mapped) {
+#ifdef __linux__
+        void *data = mremap(image->data, image->mapped, mapped, MREMAP_MAYMOVE);
+        if (data == MAP_FAILED) {
+            return vdisk_ESECTOR;
+        }
+#else
+        uint8_t *data = memory_map(mapped);
+        if (data == NULL) {
+            return vdisk_ESECTOR;
+        }
+        memcpy(data, image->data, image->size);
+        munmap(image->data, image->mapped);
+#endif
+        image->data = data;
+        image->mapped = mapped;
+    }
+    image->size = size;
+    return 0;
+}
+
+/**
+ * Zeroes `length` bytes of an in-memory image. On Linux the whole pages are
+ * given back to the system, and read back as zeros.
+ */
+static void memory_zero(struct vdisk_memory *image, size_t position, size_t length) {
+    uint8_t *start = image->data + position;
+    uint8_t *end = start + length;
+#ifdef __linux__
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uint8_t *first_page = (uint8_t *)(((uintptr_t)start + page - 1) / page * page);
+    uint8_t *last_page = (uint8_t *)((uintptr_t)end / page * page);
+    if (first_page < last_page && madvise(first_page, last_page - first_page, MADV_DONTNEED) == 0) {
+        memset(start, 0, first_page - start);
+        memset(last_page, 0, end - last_page);
+        return;
+    }
+#endif
+    memset(start, 0, length);
+}
+
+/**
+ * Turns on the in-memory image `name`, as vdisk_on() does for a file.
+ */
+static int memory_on(char *name, DISK *diskp) {
+    pthread_mutex_lock(&memory_mutex);
+    struct vdisk_memory *image = memory_find(name);
+    if (image != NULL) {
+        image->users++;
+    }
+    pthread_mutex_unlock(&memory_mutex);
+    if (image == NULL) {
+        return vdisk_ENOEXIST;
+    }
+
+    int name_length = strlen(name) + 1;
+    diskp->name = malloc(name_length);
+    strlcpy(diskp->name, name, name_length);
+    diskp->memory = image;
+    diskp->size_in_sectors = image->size / VDISK_SECTOR_SIZE;
+    diskp->sector_size = VDISK_SECTOR_SIZE;
+    diskp->discarded_bytes = 0;
+    return 0;
+}
+
+static bool is_on(DISK *diskp) {
+    return diskp->fp != NULL || diskp->memory != NULL;
+}
+
+/**
+ * Translates the errno of a failed open() of an image file.
+ */
+static int open_error() {
+    if (errno == EACCES) {
+        return vdisk_EACCESS;
+    }
+    return errno == ENOENT ? vdisk_ENOEXIST : -1;
+}
+
+/**
+ * Transfers `total` bytes at `position` of a file, whatever the number of
+ * calls pread/pwrite take.
+ */
+static int file_transfer(int fd, uint8_t *buffer, size_t total, off_t position, int is_write) {
+    size_t done = 0;
+    while (done < total) {
+        ssize_t n = is_write ?
+            pwrite(fd, buffer + done, total - done, position + done) :
+            pread(fd, buffer + done, total - done, position + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return vdisk_ESECTOR;
+        }
+        done += n;
+    }
+    return 0;
+}
+
 int vdisk_on(char *filename, DISK *diskp) {
+    diskp->memory = NULL;
+    if (is_memory_name(filename)) {
+        diskp->fp = NULL;
+        return memory_on(filename, diskp);
+    }
+
     FILE *vdisk = fopen(filename, "r+b");
     diskp->fp = vdisk;
     if (vdisk == NULL) {
@@ -28,6 +547,9 @@ int vdisk_on(char *filename, DISK *diskp) {
             return -1; // unknown error
         }
     }
+    // All transfers use positional I/O on the descriptor, stdio must not buffer.
+    setvbuf(vdisk, NULL, _IONBF, 0);
+
     int filename_length = strlen(filename) + 1;
     diskp->name = malloc(filename_length);
     strlcpy(diskp->name, filename, filename_length);
@@ -39,54 +561,582 @@ int vdisk_on(char *filename, DISK *diskp) {
         return vdisk_ENODISK;
     }
     diskp->sector_size = VDISK_SECTOR_SIZE;
+    diskp->discarded_bytes = 0;
     return 0;
 }
 
-int seek_sector(DISK *diskp, uint32_t sector) {
-    FILE *vdisk = diskp->fp;
-    if (vdisk == NULL) {
+/**
+ * Changes the unit in which the disk is addressed, so that one sector is one
+ * file system block. The trailing bytes that don't fill a sector are unused.
+ */
+int vdisk_set_sector_size(DISK *diskp, uint32_t sector_size) {
+    if (!is_on(diskp)) {
+        return vdisk_ENODISK;
+    }
+    if (sector_size == 0) {
+        return vdisk_ESECTOR;
+    }
+    uint64_t size_in_bytes = (uint64_t)diskp->size_in_sectors * diskp->sector_size;
+    if (size_in_bytes / sector_size == 0) {
+        return vdisk_ENODISK;
+    }
+    diskp->size_in_sectors = size_in_bytes / sector_size;
+    diskp->sector_size = sector_size;
+    return 0;
+}
+
+/**
+ * Creates an image of `size_in_sectors` zeroed sectors, or resizes and
+ * zeroes an existing one. The file is truncated, so the zeros are holes and
+ * nothing is written. A name starting with VDISK_MEMORY_PREFIX creates an
+ * in-memory image instead, which can't be replaced while turned on.
+ */
+int vdisk_create(char *filename, uint32_t size_in_sectors) {
+    if (size_in_sectors == 0) {
         return vdisk_ENODISK;
     }
-    if (sector >= diskp->size_in_sectors) {
+    if (is_memory_name(filename)) {
+        size_t size = (size_t)size_in_sectors * VDISK_SECTOR_SIZE;
+        uint8_t *data = memory_map(page_round(size));
+        if (data == NULL) {
+            return vdisk_ESECTOR;
+        }
+        int err = memory_install(filename, data, size, page_round(size));
+        if (err) {
+            munmap(data, page_round(size));
+        }
+        return err;
+    }
+    int fd = open(filename, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return errno == EACCES ? vdisk_EACCESS : -1;
+    }
+    off_t size = (off_t)size_in_sectors * VDISK_SECTOR_SIZE;
+    int err = 0;
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0) {
+        err = vdisk_ESECTOR;
+    }
+    close(fd);
+    return err;
+}
+
+/**
+ * Extends an open disk to `size_in_sectors` sectors. The new sectors read as
+ * zeros, even where the file already had bytes past the old end. A disk
+ * can't shrink.
+ */
+int vdisk_resize(DISK *diskp, uint32_t size_in_sectors) {
+    if (!is_on(diskp)) {
+        return vdisk_ENODISK;
+    }
+    if (size_in_sectors < diskp->size_in_sectors) {
+        return vdisk_EEXCEED;
+    }
+    off_t size = (off_t)size_in_sectors * diskp->sector_size;
+    if (diskp->memory != NULL) {
+        if (memory_grow(diskp->memory, size) != 0) {
+            return vdisk_ESECTOR;
+        }
+    } else {
+        int fd = fileno(diskp->fp);
+        off_t current = lseek(fd, 0, SEEK_END);
+        if (current < 0 || (current < size && ftruncate(fd, size) != 0)) {
+            return vdisk_ESECTOR;
+        }
+    }
+    uint32_t old_size = diskp->size_in_sectors;
+    diskp->size_in_sectors = size_in_sectors;
+    int err = vdisk_discard(diskp, old_size, size_in_sectors - old_size);
+    if (err) {
+        diskp->size_in_sectors = old_size;
+    }
+    return err;
+}
+
+/**
+ * Hints that the sectors [sector, sector + count) will be read soon, so that
+ * they are read ahead while the caller does something else. Never fails.
+ */
+void vdisk_prefetch(DISK *diskp, uint32_t sector, uint32_t count) {
+    // An in-memory image has nothing to read ahead
+    if (diskp->fp == NULL || sector >= diskp->size_in_sectors) {
+        return;
+    }
+    if (count > diskp->size_in_sectors - sector) {
+        count = diskp->size_in_sectors - sector;
+    }
+    off_t position = (off_t)sector * diskp->sector_size;
+    off_t length = (off_t)count * diskp->sector_size;
+    posix_fadvise(fileno(diskp->fp), position, length, POSIX_FADV_WILLNEED);
+
+    vdisk_stats_t *stats = local_stats();
+    if (stats != NULL) {
+        stats->prefetches++;
+    }
+}
+
+/**
+ * Checks that the range [sector, sector + count) lies on the disk.
+ */
+static int check_range(DISK *diskp, uint32_t sector, uint32_t count) {
+    if (!is_on(diskp)) {
+        return vdisk_ENODISK;
+    }
+    if (sector >= diskp->size_in_sectors || count > diskp->size_in_sectors - sector) {
         return vdisk_EEXCEED;
     }
-    fseek(vdisk, sector * diskp->sector_size, SEEK_SET);
     return 0;
 }
 
-inline int vdisk_read(DISK *diskp, uint32_t sector, uint8_t *buffer) {
-    int err = seek_sector(diskp, sector);
+/**
+ * Counts a transfer of `count` sectors, `total` bytes, in the statistics.
+ */
+static void count_transfer(uint64_t count, uint64_t total, int is_write) {
+    vdisk_stats_t *stats = local_stats();
+    if (stats != NULL && is_write) {
+        stats->writes++;
+        stats->sectors_written += count;
+        stats->bytes_written += total;
+    } else if (stats != NULL) {
+        stats->reads++;
+        stats->sectors_read += count;
+        stats->bytes_read += total;
+    }
+}
+
+/**
+ * Positional transfer of `count` whole sectors. pread/pwrite don't move a
+ * shared file offset, so several threads can transfer at once on one DISK.
+ */
+static int transfer_range(DISK *diskp, uint32_t sector, uint32_t count, uint8_t *buffer, int is_write) {
+    int err = check_range(diskp, sector, count);
     if (err) {
         return err;
     }
-    if (fread(buffer, 1, diskp->sector_size, diskp->fp) != diskp->sector_size) {
-        return vdisk_ESECTOR;
+    size_t total = (size_t)count * diskp->sector_size;
+    off_t position = (off_t)sector * diskp->sector_size;
+    model_request(diskp, is_write ? MODEL_WRITE : MODEL_READ, position, total);
+    if (diskp->memory != NULL && is_write) {
+        memcpy(diskp->memory->data + position, buffer, total);
+    } else if (diskp->memory != NULL) {
+        memcpy(buffer, diskp->memory->data + position, total);
+    } else {
+        err = file_transfer(fileno(diskp->fp), buffer, total, position, is_write);
+        if (err) {
+            return err;
+        }
     }
+
+    count_transfer(count, total, is_write);
     return 0;
 }
 
-inline int vdisk_write(DISK *diskp, uint32_t sector, uint8_t *buffer) {
-    int err = seek_sector(diskp, sector);
+/*
+ * Scheduler of the batches of vdisk_submit(). Sorted batches are swept from
+ * where the previous one stopped, as C-LOOK, and adjacent requests of the
+ * same kind are merged into one vectored transfer. With the deadline policy,
+ * the reads that don't come from a background batch are counted, and a
+ * background batch waits before each transfer while some are running, until
+ * its deadline. Batches are served by their caller's thread.
+ */
+#define MERGE_MAX_REQUESTS 256
+#define MERGE_MAX_BYTES (1024 * 1024)
+#define BACKGROUND_DEADLINE_NS (50 * 1000000ll)
+
+static volatile vdisk_scheduler_t scheduler = VDISK_SCHED_NONE;
+static volatile uint32_t sweep_position = 0;  // Sector after the last sorted transfer, a hint
+static pthread_mutex_t foreground_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t foreground_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t foreground_reads = 0;  // Running, under the deadline policy
+
+/**
+ * Chooses how vdisk_submit() serves the batches. VDISK_SCHED_NONE, the
+ * default, transfers them as given.
+ */
+void vdisk_set_scheduler(vdisk_scheduler_t policy) {
+    scheduler = policy;
+}
+
+/**
+ * Counts a foreground read that starts, if background batches wait for
+ * them. Returns whether it is counted, to give to foreground_end().
+ */
+static bool foreground_begin() {
+    if (scheduler != VDISK_SCHED_DEADLINE) {
+        return false;
+    }
+    pthread_mutex_lock(&foreground_mutex);
+    foreground_reads++;
+    pthread_mutex_unlock(&foreground_mutex);
+    return true;
+}
+
+static void foreground_end(bool counted) {
+    if (!counted) {
+        return;
+    }
+    pthread_mutex_lock(&foreground_mutex);
+    if (--foreground_reads == 0) {
+        pthread_cond_broadcast(&foreground_cond);
+    }
+    pthread_mutex_unlock(&foreground_mutex);
+}
+
+/**
+ * Waits while foreground reads run, at most until `deadline`.
+ */
+static void background_yield(const struct timespec *deadline) {
+    pthread_mutex_lock(&foreground_mutex);
+    while (foreground_reads > 0) {
+        if (pthread_cond_timedwait(&foreground_cond, &foreground_mutex, deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&foreground_mutex);
+}
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Positional vectored transfer of a file, whatever the number of calls
+ * preadv/pwritev take. `iov` is consumed.
+ */
+static int file_transfer_vector(int fd, struct iovec *iov, int iovcnt, off_t position, int is_write) {
+    while (iovcnt > 0) {
+        ssize_t n = is_write ? pwritev(fd, iov, iovcnt, position) : preadv(fd, iov, iovcnt, position);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return vdisk_ESECTOR;
+        }
+        position += n;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Transfers the merged requests run[0..length) of a batch, which follow
+ * each other on the disk, as one transfer.
+ */
+static int transfer_run(DISK *diskp, vdisk_request_t **run, uint32_t length, uint32_t sectors) {
+    vdisk_request_t *first = run[0];
+    if (first->op == VDISK_DISCARD) {
+        return vdisk_discard(diskp, first->sector, sectors);
+    }
+    int err = check_range(diskp, first->sector, sectors);
     if (err) {
         return err;
     }
-    if (fwrite(buffer, 1, diskp->sector_size, diskp->fp) != diskp->sector_size) {
-        return vdisk_ESECTOR;
+
+    int is_write = first->op == VDISK_WRITE;
+    size_t total = (size_t)sectors * diskp->sector_size;
+    off_t position = (off_t)first->sector * diskp->sector_size;
+    model_request(diskp, is_write ? MODEL_WRITE : MODEL_READ, position, total);
+    if (diskp->memory != NULL) {
+        uint8_t *image = diskp->memory->data + position;
+        for (uint32_t r = 0; r < length; r++) {
+            size_t bytes = (size_t)run[r]->count * diskp->sector_size;
+            if (is_write) {
+                memcpy(image, run[r]->buffer, bytes);
+            } else {
+                memcpy(run[r]->buffer, image, bytes);
+            }
+            image += bytes;
+        }
+    } else {
+        struct iovec iov[MERGE_MAX_REQUESTS];
+        for (uint32_t r = 0; r < length; r++) {
+            iov[r].iov_base = run[r]->buffer;
+            iov[r].iov_len = (size_t)run[r]->count * diskp->sector_size;
+        }
+        err = file_transfer_vector(fileno(diskp->fp), iov, length, position, is_write);
+        if (err) {
+            return err;
+        }
     }
+    count_transfer(sectors, total, is_write);
     return 0;
 }
 
+static int compare_by_sector(const void *a, const void *b) {
+    const vdisk_request_t *x = *(vdisk_request_t *const *)a;
+    const vdisk_request_t *y = *(vdisk_request_t *const *)b;
+    if (x->sector != y->sector) {
+        return x->sector < y->sector ? -1 : 1;
+    }
+    return (x > y) - (x < y);  // In the order given
+}
+
+static int compare_reads_first(const void *a, const void *b) {
+    bool x_read = (*(vdisk_request_t *const *)a)->op == VDISK_READ;
+    bool y_read = (*(vdisk_request_t *const *)b)->op == VDISK_READ;
+    if (x_read != y_read) {
+        return x_read ? -1 : 1;
+    }
+    return compare_by_sector(a, b);
+}
+
+static void reverse(vdisk_request_t **order, uint32_t count) {
+    for (uint32_t i = 0; i < count / 2; i++) {
+        vdisk_request_t *swap = order[i];
+        order[i] = order[count - 1 - i];
+        order[count - 1 - i] = swap;
+    }
+}
+
+/**
+ * Rotates sorted requests so that the sweep starts at `position` and wraps
+ * around to the lowest sectors.
+ */
+static void sweep_from(vdisk_request_t **order, uint32_t count, uint32_t position) {
+    uint32_t start = 0;
+    while (start < count && order[start]->sector < position) {
+        start++;
+    }
+    if (start == 0 || start == count) {
+        return;
+    }
+    reverse(order, start);
+    reverse(order + start, count - start);
+    reverse(order, count);
+}
+
+/**
+ * Serves a batch of requests, in the order chosen by vdisk_set_scheduler().
+ * Once sorted, requests that follow each other on the disk are merged into
+ * one transfer. The requests of a batch must not overlap, since their order
+ * isn't kept. A background batch, as write-back or zeroing, gives way to the
+ * reads of other threads under the deadline policy.
+ *
+ * Returns 0 once every request is served, or the error of the first that
+ * failed, the following ones being left.
+ */
+int vdisk_submit(DISK *diskp, vdisk_request_t *requests, uint32_t count, bool background) {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t submitted = monotonic_ns();
+    vdisk_scheduler_t policy = scheduler;
+    vdisk_request_t **order = malloc(count * sizeof(vdisk_request_t *));
+    if (order == NULL) {
+        return vdisk_ESECTOR;
+    }
+
+    uint32_t reads = 0;
+    for (uint32_t r = 0; r < count; r++) {
+        order[r] = &requests[r];
+        reads += requests[r].op == VDISK_READ;
+    }
+    if (policy == VDISK_SCHED_ELEVATOR) {
+        qsort(order, count, sizeof(vdisk_request_t *), compare_by_sector);
+        sweep_from(order, count, sweep_position);
+    } else if (policy == VDISK_SCHED_DEADLINE) {
+        qsort(order, count, sizeof(vdisk_request_t *), compare_reads_first);
+        sweep_from(order, reads, sweep_position);
+        sweep_from(order + reads, count - reads, sweep_position);
+    }
+
+    bool yields = background && policy == VDISK_SCHED_DEADLINE;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (deadline.tv_nsec + BACKGROUND_DEADLINE_NS) / 1000000000;
+    deadline.tv_nsec = (deadline.tv_nsec + BACKGROUND_DEADLINE_NS) % 1000000000;
+    bool counted = !background && reads > 0 && foreground_begin();
+
+    int err = 0;
+    uint64_t transfers = 0;
+    uint64_t wait_ns = 0;
+    for (uint32_t i = 0; i < count && !err;) {
+        vdisk_request_t *first = order[i];
+        uint32_t length = 1;
+        uint64_t sectors = first->count;
+        while (policy != VDISK_SCHED_NONE && i + length < count && length < MERGE_MAX_REQUESTS &&
+               order[i + length]->op == first->op && order[i + length]->sector == first->sector + sectors &&
+               (sectors + order[i + length]->count) * diskp->sector_size <= MERGE_MAX_BYTES) {
+            sectors += order[i + length]->count;
+            length++;
+        }
+
+        if (yields) {
+            background_yield(&deadline);
+        }
+        wait_ns += (monotonic_ns() - submitted) * length;
+        err = transfer_run(diskp, order + i, length, (uint32_t)sectors);
+        if (policy != VDISK_SCHED_NONE) {
+            sweep_position = first->sector + (uint32_t)sectors;
+        }
+        transfers++;
+        i += length;
+    }
+    foreground_end(counted);
+    free(order);
+
+    vdisk_stats_t *stats = local_stats();
+    if (stats != NULL) {
+        stats->batched_requests += count;
+        stats->batched_transfers += transfers;
+        stats->batch_wait_ns += wait_ns;
+    }
+    return err;
+}
+
+inline int vdisk_read(DISK *diskp, uint32_t sector, uint8_t *buffer) {
+    bool counted = foreground_begin();
+    int err = transfer_range(diskp, sector, 1, buffer, 0);
+    foreground_end(counted);
+    return err;
+}
+
+inline int vdisk_write(DISK *diskp, uint32_t sector, uint8_t *buffer) {
+    return transfer_range(diskp, sector, 1, buffer, 1);
+}
+
+int vdisk_read_range(DISK *diskp, uint32_t sector, uint32_t count, uint8_t *buffer) {
+    bool counted = foreground_begin();
+    int err = transfer_range(diskp, sector, count, buffer, 0);
+    foreground_end(counted);
+    return err;
+}
+
+int vdisk_write_range(DISK *diskp, uint32_t sector, uint32_t count, uint8_t *buffer) {
+    return transfer_range(diskp, sector, count, buffer, 1);
+}
+
+/**
+ * Translates the errno of a failed sync of an image file.
+ */
+static int sync_error() {
+    return errno == EACCES || errno == EPERM ? vdisk_EACCESS : vdisk_ESECTOR;
+}
+
 int vdisk_sync(DISK *diskp) {
-    FILE *vdisk = diskp->fp;
-    if (vdisk == NULL){
+    if (!is_on(diskp)) {
         return vdisk_ENODISK;
     }
-    fflush(vdisk);
-    fsync(fileno(vdisk));
+    model_request(diskp, MODEL_SYNC, 0, 0);
+
+    vdisk_stats_t *stats = local_stats();
+    if (stats != NULL) {
+        stats->syncs++;
+    }
+
+    // An in-memory image has nothing to write back
+    FILE *vdisk = diskp->fp;
+    if (vdisk != NULL && (fflush(vdisk) != 0 || fsync(fileno(vdisk)) != 0)) {
+        return sync_error();
+    }
+    return 0;
+}
+
+/**
+ * Makes the sectors [sector, sector + count) durable. On Linux they are
+ * written back first with sync_file_range(), which doesn't flush the device
+ * cache nor the file metadata, so fdatasync() follows in any case: blocks
+ * written after a hole was punched need their new allocation in the image
+ * file to be durable too. The other dirty sectors of the image are written
+ * back with them.
+ */
+int vdisk_sync_range(DISK *diskp, uint32_t sector, uint32_t count) {
+    int err = check_range(diskp, sector, count);
+    if (err) {
+        return err;
+    }
+    vdisk_stats_t *stats = local_stats();
+    if (stats != NULL) {
+        stats->syncs++;
+    }
+    model_request(diskp, MODEL_SYNC, 0, 0);
+    if (diskp->memory != NULL) {
+        return 0;
+    }
+    int fd = fileno(diskp->fp);
+#ifdef __linux__
+    off_t position = (off_t)sector * diskp->sector_size;
+    off_t length = (off_t)count * diskp->sector_size;
+    unsigned int flags = SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER;
+    if (sync_file_range(fd, position, length, flags) != 0 && errno != ENOSYS && errno != EINVAL) {
+        return sync_error();
+    }
+#endif
+    if (fdatasync(fd) != 0) {
+        return sync_error();
+    }
     return 0;
 }
 
+/**
+ * Zeroes the sectors [sector, sector + count) without writing them. On Linux
+ * the range is deallocated from the image with fallocate(), as a hole if the
+ * host filesystem supports it, else as unwritten extents. Elsewhere, or if
+ * neither is supported, zeros are written. Only the bytes zeroed without data
+ * I/O are added to `discarded_bytes`.
+ */
+int vdisk_discard(DISK *diskp, uint32_t sector, uint32_t count) {
+    int err = check_range(diskp, sector, count);
+    if (err) {
+        return err;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    vdisk_stats_t *stats = local_stats();
+    if (stats != NULL) {
+        stats->discards++;
+        stats->sectors_discarded += count;
+    }
+    model_request(diskp, MODEL_WRITE, 0, 0);
+    if (diskp->memory != NULL) {
+        size_t length = (size_t)count * diskp->sector_size;
+        memory_zero(diskp->memory, (size_t)sector * diskp->sector_size, length);
+        diskp->discarded_bytes += length;
+        return 0;
+    }
+#ifdef __linux__
+    int fd = fileno(diskp->fp);
+    off_t position = (off_t)sector * diskp->sector_size;
+    off_t length = (off_t)count * diskp->sector_size;
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, position, length) == 0 ||
+        fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, position, length) == 0) {
+        diskp->discarded_bytes += length;
+        return 0;
+    }
+#endif
+    uint32_t chunk = count < 256 ? count : 256;
+    uint8_t *zeros = calloc(chunk, diskp->sector_size);
+    if (zeros == NULL) {
+        return vdisk_ESECTOR;
+    }
+    for (uint32_t done = 0; done < count && !err; done += chunk) {
+        uint32_t n = count - done < chunk ? count - done : chunk;
+        err = transfer_range(diskp, sector + done, n, zeros, 1);
+    }
+    free(zeros);
+    return err;
+}
+
 void vdisk_off(DISK *diskp) {
+    if (diskp->memory != NULL) {
+        pthread_mutex_lock(&memory_mutex);
+        diskp->memory->users--;
+        pthread_mutex_unlock(&memory_mutex);
+        diskp->memory = NULL;
+        free(diskp->name);
+        return;
+    }
     FILE *vdisk = diskp->fp;
     if (vdisk == NULL) {
         return;
@@ -96,3 +1146,270 @@ void vdisk_off(DISK *diskp) {
     free(diskp->name);
     diskp->fp = NULL;
 }
+
+/**
+ * Reads `size` bytes of an image file into `data`, which holds zeros. On
+ * Linux the holes of a sparse image are skipped, so they take no memory.
+ */
+static int memory_read_file(int fd, uint8_t *data, size_t size) {
+    off_t position = 0;
+    while ((size_t)position < size) {
+        off_t end = size;
+#ifdef SEEK_DATA
+        off_t data_start = lseek(fd, position, SEEK_DATA);
+        if (data_start < 0 && errno == ENXIO) {
+            break;  // Only a hole is left
+        }
+        if (data_start >= 0) {
+            if ((size_t)data_start >= size) {
+                break;
+            }
+            position = data_start;
+            off_t hole = lseek(fd, position, SEEK_HOLE);
+            if (hole > position && hole < end) {
+                end = hole;
+            }
+        }
+#endif
+        int err = file_transfer(fd, data + position, end - position, position, 0);
+        if (err) {
+            return err;
+        }
+        position = end;
+    }
+    return 0;
+}
+
+/**
+ * Copies the image file `filename` into the in-memory image `name`, created
+ * or replaced. Fails if the in-memory image is turned on.
+ */
+int vdisk_load(char *name, char *filename) {
+    if (!is_memory_name(name)) {
+        return vdisk_ENODISK;
+    }
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return open_error();
+    }
+
+    int err = 0;
+    struct stat st;
+    uint8_t *data = NULL;
+    size_t size = 0;
+    if (fstat(fd, &st) != 0 || st.st_size < VDISK_SECTOR_SIZE) {
+        err = vdisk_ENODISK;
+    } else {
+        size = st.st_size;
+        data = memory_map(page_round(size));
+        err = data == NULL ? vdisk_ESECTOR : memory_read_file(fd, data, size);
+    }
+    close(fd);
+
+    if (!err) {
+        err = memory_install(name, data, size, page_round(size));
+    }
+    if (err && data != NULL) {
+        munmap(data, page_round(size));
+    }
+    return err;
+}
+
+static bool is_zero(const uint8_t *data, size_t length) {
+    return data[0] == 0 && memcmp(data, data + 1, length - 1) == 0;
+}
+
+/**
+ * Writes the in-memory image `name` into the image file `filename`, replaced
+ * if it exists. Runs of zeros are left as holes. The file is only a
+ * consistent copy if no disk writes to the image meanwhile, as after
+ * unmount().
+ */
+int vdisk_save(char *name, char *filename) {
+    pthread_mutex_lock(&memory_mutex);
+    struct vdisk_memory *image = is_memory_name(name) ? memory_find(name) : NULL;
+    if (image != NULL) {
+        image->users++;  // Not released by vdisk_delete() meanwhile
+    }
+    pthread_mutex_unlock(&memory_mutex);
+    if (image == NULL) {
+        return vdisk_ENOEXIST;
+    }
+
+    int err = 0;
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        err = open_error();
+    } else {
+        if (ftruncate(fd, image->size) != 0) {
+            err = vdisk_ESECTOR;
+        }
+        for (size_t position = 0; position < image->size && !err; position += SAVE_CHUNK_SIZE) {
+            size_t length = image->size - position < SAVE_CHUNK_SIZE ? image->size - position : SAVE_CHUNK_SIZE;
+            if (!is_zero(image->data + position, length)) {
+                err = file_transfer(fd, image->data + position, length, position, 1);
+            }
+        }
+        if (!err && fsync(fd) != 0) {
+            err = vdisk_ESECTOR;
+        }
+        close(fd);
+    }
+
+    pthread_mutex_lock(&memory_mutex);
+    image->users--;
+    pthread_mutex_unlock(&memory_mutex);
+    return err;
+}
+
+/**
+ * Removes an image: an in-memory image is released, an image file deleted.
+ * An in-memory image can't be removed while turned on.
+ */
+int vdisk_delete(char *name) {
+    if (!is_memory_name(name)) {
+        return unlink(name) == 0 ? 0 : open_error();
+    }
+
+    int err = 0;
+    pthread_mutex_lock(&memory_mutex);
+    struct vdisk_memory **link = &memory_images;
+    while (*link != NULL && strcmp((*link)->name, name) != 0) {
+        link = &(*link)->next;
+    }
+    struct vdisk_memory *image = *link;
+    if (image == NULL) {
+        err = vdisk_ENOEXIST;
+    } else if (image->users > 0) {
+        err = vdisk_EACCESS;
+    } else {
+        *link = image->next;
+    }
+    pthread_mutex_unlock(&memory_mutex);
+
+    if (!err) {
+        munmap(image->data, image->mapped);
+        free(image->name);
+        free(image);
+    }
+    return err;
+}
+
+/*
+ * Mapped images. An image is mapped whole, so that a tool such as ssfs_fsck
+ * reads its blocks in place, from as many threads as it wants, without a
+ * copy or a system call per block. The mapping of an image file is shared:
+ * what is written to it goes to the file. Transfers aren't counted in the
+ * statistics.
+ */
+
+/**
+ * Maps the image `filename`, a file or an in-memory image, for reading, and
+ * for writing if `writable`. An in-memory image can't be removed while
+ * mapped.
+ */
+int vdisk_map(char *filename, bool writable, vdisk_mapping_t *mapping) {
+    memset(mapping, 0, sizeof(vdisk_mapping_t));
+    mapping->fd = -1;
+    if (is_memory_name(filename)) {
+        pthread_mutex_lock(&memory_mutex);
+        struct vdisk_memory *image = memory_find(filename);
+        if (image != NULL) {
+            image->users++;
+        }
+        pthread_mutex_unlock(&memory_mutex);
+        if (image == NULL) {
+            return vdisk_ENOEXIST;
+        }
+        mapping->memory = image;
+        mapping->data = image->data;
+        mapping->size = image->size;
+        return 0;
+    }
+
+    int fd = open(filename, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        return open_error();
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < VDISK_SECTOR_SIZE) {
+        close(fd);
+        return vdisk_ENODISK;
+    }
+    void *data = mmap(NULL, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return vdisk_ESECTOR;
+    }
+    mapping->fd = fd;
+    mapping->data = data;
+    mapping->size = st.st_size;
+    return 0;
+}
+
+/**
+ * Returns the first position from `position` that may hold data, skipping
+ * the holes of a sparse image file, or the size of the image if there is
+ * none. Holes read as zeros.
+ */
+uint64_t vdisk_map_next_data(vdisk_mapping_t *mapping, uint64_t position) {
+#ifdef SEEK_DATA
+    if (mapping->fd >= 0 && position < mapping->size) {
+        off_t data_start = lseek(mapping->fd, position, SEEK_DATA);
+        if (data_start < 0 && errno == ENXIO) {
+            return mapping->size;
+        }
+        if (data_start >= 0) {
+            return (uint64_t)data_start < mapping->size ? (uint64_t)data_start : mapping->size;
+        }
+    }
+#endif
+    return position;
+}
+
+/**
+ * Zeroes `length` bytes of a writable mapping. The range is punched out of
+ * an image file when possible, and given back to the system for an
+ * in-memory image.
+ */
+void vdisk_map_zero(vdisk_mapping_t *mapping, uint64_t position, uint64_t length) {
+    if (mapping->memory != NULL) {
+        memory_zero(mapping->memory, position, length);
+        return;
+    }
+#ifdef __linux__
+    if (fallocate(mapping->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, position, length) == 0) {
+        return;
+    }
+#endif
+    memset(mapping->data + position, 0, length);
+}
+
+/**
+ * Makes what was written to the mapping of an image file durable.
+ */
+int vdisk_map_sync(vdisk_mapping_t *mapping) {
+    if (mapping->memory != NULL) {
+        return 0;
+    }
+    if (msync(mapping->data, mapping->size, MS_SYNC) != 0 || fsync(mapping->fd) != 0) {
+        return vdisk_ESECTOR;
+    }
+    return 0;
+}
+
+/**
+ * Releases a mapping. What was written to it is kept, durable or not.
+ */
+void vdisk_unmap(vdisk_mapping_t *mapping) {
+    if (mapping->memory != NULL) {
+        pthread_mutex_lock(&memory_mutex);
+        mapping->memory->users--;
+        pthread_mutex_unlock(&memory_mutex);
+    } else if (mapping->data != NULL) {
+        munmap(mapping->data, mapping->size);
+        close(mapping->fd);
+    }
+    memset(mapping, 0, sizeof(vdisk_mapping_t));
+    mapping->fd = -1;
+}